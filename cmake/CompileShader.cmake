@@ -2,12 +2,18 @@ include(FindGLSLangValidator)
 
 find_program(GLSLangValidator REQUIRED)
 
+# compile_shader(TARGET GLSL_FILE SPIRV_FILE [DEFINE...]) compiles GLSL_FILE
+# after TARGET is built, with each DEFINE passed to the preprocessor
 macro (compile_shader TARGET GLSL_FILE SPIRV_FILE)
-  if (NOT ${ARGC} EQUAL 3)
-    message(SEND_ERROR "COMPILE_SHADER takes 3 arguments")
-  endif (NOT ${ARGC} EQUAL 3)
+  if (${ARGC} LESS 3)
+    message(SEND_ERROR "COMPILE_SHADER takes at least 3 arguments")
+  endif (${ARGC} LESS 3)
+  set(SHADER_DEFINES "")
+  foreach (SHADER_DEFINE ${ARGN})
+    list(APPEND SHADER_DEFINES "-D${SHADER_DEFINE}")
+  endforeach (SHADER_DEFINE)
   add_custom_command(
     TARGET ${TARGET} POST_BUILD
-    COMMAND ${GLSLANGVALIDATOR_EXECUTABLE} -V -o "${CMAKE_CURRENT_BINARY_DIR}/${SPIRV_FILE}" "${CMAKE_CURRENT_SOURCE_DIR}/${GLSL_FILE}"
+    COMMAND ${GLSLANGVALIDATOR_EXECUTABLE} -V ${SHADER_DEFINES} -o "${CMAKE_CURRENT_BINARY_DIR}/${SPIRV_FILE}" "${CMAKE_CURRENT_SOURCE_DIR}/${GLSL_FILE}"
   )
 endmacro (compile_shader TARGET GLSL_FILE SPIRV_FILE)
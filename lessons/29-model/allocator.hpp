@@ -0,0 +1,872 @@
+#ifndef __ALLOCATOR_HPP__
+#define __ALLOCATOR_HPP__
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include "base-includes.hpp"
+#include "deleter.hpp"
+#include "common.hpp"
+#include "memory.hpp"
+#include "telemetry.hpp"
+
+// Device memory sub-allocation. Resources are placed at offsets within a
+// few large vkAllocateMemory blocks per memory type instead of getting an
+// allocation each, which is slow and limited to maxMemoryAllocationCount.
+
+// Two-level segregated fit allocator over the offsets of one block. Free
+// ranges are kept in lists by size class, found through two bitmaps in
+// constant time and merged with their free neighbours when released.
+class TlsfSuballocator
+{
+public:
+  static const uint32_t INVALID = ~0u;
+
+  TlsfSuballocator( VkDeviceSize size )
+    : capacity { size }
+  {
+    for ( uint32_t fl = 0; fl < FL_COUNT; fl++ )
+    {
+      for ( uint32_t sl = 0; sl < SL_COUNT; sl++ )
+      {
+        this->heads[fl][sl] = INVALID;
+      }
+    }
+
+    uint32_t range = this->newRange();
+    this->ranges[range].size = size;
+    this->insertFree( range );
+  }
+
+  // Returns a handle for free(), or INVALID if no free range fits
+  uint32_t allocate( VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset )
+  {
+    size      = std::max<VkDeviceSize>( size, 1 );
+    alignment = std::max<VkDeviceSize>( alignment, 1 );
+
+    // Any range in the list found is large enough for the worst alignment.
+    // Failing that, a range of the request's own size class may still fit.
+    uint32_t range = this->findFree( size + alignment - 1 );
+    if ( range == INVALID )
+    {
+      range = this->findFitInClass( size, alignment );
+    }
+    if ( range == INVALID )
+    {
+      return INVALID;
+    }
+    this->removeFree( range );
+
+    // Hand the alignment padding and the tail back as free ranges
+    VkDeviceSize aligned = alignUp( this->ranges[range].offset, alignment );
+    if ( aligned > this->ranges[range].offset )
+    {
+      uint32_t placed = this->split( range, aligned - this->ranges[range].offset );
+      this->insertFree( range );
+      range = placed;
+    }
+    if ( this->ranges[range].size > size )
+    {
+      this->insertFree( this->split( range, size ) );
+    }
+
+    this->ranges[range].free = false;
+    this->used              += this->ranges[range].size;
+    this->allocations++;
+    offset = this->ranges[range].offset;
+    return range;
+  }
+
+  void free( uint32_t range )
+  {
+    this->used -= this->ranges[range].size;
+    this->allocations--;
+
+    // Merge with free neighbours
+    uint32_t next = this->ranges[range].next;
+    if ( next != INVALID && this->ranges[next].free )
+    {
+      this->removeFree( next );
+      this->merge( range, next );
+    }
+    uint32_t prev = this->ranges[range].prev;
+    if ( prev != INVALID && this->ranges[prev].free )
+    {
+      this->removeFree( prev );
+      this->merge( prev, range );
+      range = prev;
+    }
+
+    this->insertFree( range );
+  }
+
+  VkDeviceSize size() const            { return this->capacity; }
+  VkDeviceSize usedBytes() const       { return this->used; }
+  uint32_t     allocationCount() const { return this->allocations; }
+
+  // Free bytes, the largest free range and the number of free ranges
+  void freeStats( VkDeviceSize& freeBytes, VkDeviceSize& largest, uint32_t& rangeCount ) const
+  {
+    freeBytes  = 0;
+    largest    = 0;
+    rangeCount = 0;
+    for ( const auto& range : this->ranges )
+    {
+      if ( range.free && range.size > 0 )
+      {
+        freeBytes += range.size;
+        largest    = std::max( largest, range.size );
+        rangeCount++;
+      }
+    }
+  }
+
+private:
+  static const uint32_t SL_BITS  = 4;
+  static const uint32_t SL_COUNT = 1 << SL_BITS;
+  static const uint32_t FL_COUNT = 64 - SL_BITS + 1;
+
+  struct Range
+  {
+    VkDeviceSize offset   = 0;
+    VkDeviceSize size     = 0;
+    uint32_t     prev     = INVALID; // Neighbours by offset
+    uint32_t     next     = INVALID;
+    uint32_t     prevFree = INVALID; // Within the size class list
+    uint32_t     nextFree = INVALID;
+    bool         free     = true;
+  };
+
+  VkDeviceSize          capacity;
+  VkDeviceSize          used        = 0;
+  uint32_t              allocations = 0;
+  std::vector<Range>    ranges;
+  std::vector<uint32_t> unusedRanges;
+  uint64_t              flBitmap = 0;
+  uint32_t              slBitmap[ FL_COUNT ] = {};
+  uint32_t              heads[ FL_COUNT ][ SL_COUNT ];
+
+  static uint32_t log2( VkDeviceSize value )
+  {
+    uint32_t bit = 0;
+    while ( value >>= 1 )
+    {
+      bit++;
+    }
+    return bit;
+  }
+
+  // Size class: sizes below SL_COUNT map exactly, larger ones into
+  // SL_COUNT linear steps per power of two
+  static void mapping( VkDeviceSize size, uint32_t& fl, uint32_t& sl )
+  {
+    if ( size < SL_COUNT )
+    {
+      fl = 0;
+      sl = size;
+      return;
+    }
+
+    uint32_t bit = log2( size );
+    fl = bit - SL_BITS + 1;
+    sl = ( size >> ( bit - SL_BITS ) ) ^ SL_COUNT;
+  }
+
+  uint32_t newRange()
+  {
+    if ( !this->unusedRanges.empty() )
+    {
+      uint32_t range = this->unusedRanges.back();
+      this->unusedRanges.pop_back();
+      this->ranges[range] = Range();
+      return range;
+    }
+
+    this->ranges.push_back( Range() );
+    return this->ranges.size() - 1;
+  }
+
+  void insertFree( uint32_t range )
+  {
+    uint32_t fl, sl;
+    mapping( this->ranges[range].size, fl, sl );
+
+    Range& entry = this->ranges[range];
+    entry.free     = true;
+    entry.prevFree = INVALID;
+    entry.nextFree = this->heads[fl][sl];
+    if ( entry.nextFree != INVALID )
+    {
+      this->ranges[ entry.nextFree ].prevFree = range;
+    }
+    this->heads[fl][sl] = range;
+    this->flBitmap     |= 1ull << fl;
+    this->slBitmap[fl] |= 1u << sl;
+  }
+
+  void removeFree( uint32_t range )
+  {
+    uint32_t fl, sl;
+    mapping( this->ranges[range].size, fl, sl );
+
+    Range& entry = this->ranges[range];
+    if ( entry.prevFree != INVALID )
+    {
+      this->ranges[ entry.prevFree ].nextFree = entry.nextFree;
+    }
+    else
+    {
+      this->heads[fl][sl] = entry.nextFree;
+    }
+    if ( entry.nextFree != INVALID )
+    {
+      this->ranges[ entry.nextFree ].prevFree = entry.prevFree;
+    }
+
+    if ( this->heads[fl][sl] == INVALID )
+    {
+      this->slBitmap[fl] &= ~( 1u << sl );
+      if ( this->slBitmap[fl] == 0 )
+      {
+        this->flBitmap &= ~( 1ull << fl );
+      }
+    }
+    entry.free = false;
+  }
+
+  // A free range of at least size, not yet removed from its list
+  uint32_t findFree( VkDeviceSize size ) const
+  {
+    // Round up to the next size class so every range in it fits
+    if ( size >= SL_COUNT )
+    {
+      VkDeviceSize step = (VkDeviceSize)1 << ( log2( size ) - SL_BITS );
+      if ( size > std::numeric_limits<VkDeviceSize>::max() - step )
+      {
+        return INVALID;
+      }
+      size += step - 1;
+    }
+
+    uint32_t fl, sl;
+    mapping( size, fl, sl );
+    if ( fl >= FL_COUNT )
+    {
+      return INVALID;
+    }
+
+    uint32_t slMap = this->slBitmap[fl] & ( ~0u << sl );
+    if ( slMap == 0 )
+    {
+      uint64_t flMap = fl + 1 < FL_COUNT ? this->flBitmap & ( ~0ull << ( fl + 1 ) ) : 0;
+      if ( flMap == 0 )
+      {
+        return INVALID;
+      }
+      fl    = lowestBit( flMap );
+      slMap = this->slBitmap[fl];
+    }
+
+    return this->heads[fl][ lowestBit( slMap ) ];
+  }
+
+  // Walk the list of size's own class for a range that fits once aligned
+  uint32_t findFitInClass( VkDeviceSize size, VkDeviceSize alignment ) const
+  {
+    uint32_t fl, sl;
+    mapping( size, fl, sl );
+    for ( uint32_t range = this->heads[fl][sl]; range != INVALID; range = this->ranges[range].nextFree )
+    {
+      const Range& entry = this->ranges[range];
+      if ( alignUp( entry.offset, alignment ) + size <= entry.offset + entry.size )
+      {
+        return range;
+      }
+    }
+    return INVALID;
+  }
+
+  static VkDeviceSize alignUp( VkDeviceSize value, VkDeviceSize alignment )
+  {
+    return ( value + alignment - 1 ) / alignment * alignment;
+  }
+
+  static uint32_t lowestBit( uint64_t value )
+  {
+    uint32_t bit = 0;
+    while ( ( value & 1 ) == 0 )
+    {
+      value >>= 1;
+      bit++;
+    }
+    return bit;
+  }
+
+  // Cut range after size bytes, returning the new range holding the rest
+  uint32_t split( uint32_t range, VkDeviceSize size )
+  {
+    uint32_t rest = this->newRange();
+    Range&   head = this->ranges[range];
+    Range&   tail = this->ranges[rest];
+
+    tail.offset = head.offset + size;
+    tail.size   = head.size - size;
+    tail.prev   = range;
+    tail.next   = head.next;
+    if ( tail.next != INVALID )
+    {
+      this->ranges[ tail.next ].prev = rest;
+    }
+    head.size = size;
+    head.next = rest;
+    return rest;
+  }
+
+  // Absorb next, which directly follows range, into range
+  void merge( uint32_t range, uint32_t next )
+  {
+    Range& head = this->ranges[range];
+    Range& tail = this->ranges[next];
+
+    head.size += tail.size;
+    head.next  = tail.next;
+    if ( head.next != INVALID )
+    {
+      this->ranges[ head.next ].prev = range;
+    }
+    tail = Range();
+    tail.free = false;
+    this->unusedRanges.push_back( next );
+  }
+};
+
+struct AllocatorStats
+{
+  uint32_t     blocks           = 0; // vkAllocateMemory calls currently alive
+  uint32_t     dedicated        = 0; // Of those, holding a single large resource
+  uint32_t     allocations      = 0; // Resources placed in memory
+  VkDeviceSize reservedBytes    = 0;
+  VkDeviceSize usedBytes        = 0;
+  VkDeviceSize largestFreeRange = 0;
+  uint32_t     freeRanges       = 0;
+  float        fragmentation    = 0.0f; // 1 - largest free range / free bytes
+  uint32_t     fallbacks        = 0;    // Placed in a slower memory type than the usage prefers
+};
+
+// Hands out ranges of large per memory type blocks. Buffers and linear
+// images never share a block with optimal images, so bufferImageGranularity
+// cannot be violated. Resources larger than half a block get a dedicated
+// allocation. The memory type follows the resource's MemoryUsage: the best
+// ranked type whose heap still has room for a new block under the budget.
+// Safe to use from several threads.
+class DeviceMemoryAllocator
+{
+public:
+  DeviceMemoryAllocator( const VDeleter<VkDevice>& device )
+    : device { device }
+  {
+  }
+
+  // Every resource should have released its memory by now
+  ~DeviceMemoryAllocator()
+  {
+    size_t leaks = this->telemetry.reportLeaks( std::cerr );
+    if ( leaks > 0 )
+    {
+      std::cerr << "Device memory: " << leaks << " allocations leaked" << std::endl;
+    }
+    this->releaseAll();
+  }
+
+  const VDeleter<VkDevice>& device;
+
+  struct Block
+  {
+    Block( VkDeviceSize size ) : ranges { size } {}
+
+    VkDeviceMemory   memory    = VK_NULL_HANDLE;
+    uint32_t         typeIndex = 0;
+    bool             linear    = false;
+    bool             dedicated = false;
+    void*            mapped    = nullptr;
+    TlsfSuballocator ranges;
+  };
+
+  // Where a resource lives; range is the handle within the block
+  struct Placement
+  {
+    Block*       block  = nullptr;
+    uint32_t     range  = TlsfSuballocator::INVALID;
+    VkDeviceSize offset = 0;
+    uint64_t     id     = 0; // Telemetry record
+  };
+
+  // Cache the memory properties and choose the block size for each memory
+  // type: blockSize, or an eighth of smaller heaps. Until setBudget is
+  // called each heap's budget is its size.
+  void init( VkPhysicalDevice physical, VkDeviceSize blockSize )
+  {
+    vkGetPhysicalDeviceMemoryProperties( physical, &this->memprops );
+
+    for ( uint32_t i = 0; i < this->memprops.memoryTypeCount; i++ )
+    {
+      VkDeviceSize heapSize = this->memprops.memoryHeaps[ this->memprops.memoryTypes[i].heapIndex ].size;
+      this->blockSizes[i]   = std::min( blockSize, std::max<VkDeviceSize>( heapSize / 8, 1 ) );
+    }
+    for ( uint32_t i = 0; i < this->memprops.memoryHeapCount; i++ )
+    {
+      this->heapBudget[i] = this->memprops.memoryHeaps[i].size;
+    }
+    this->telemetry.init( this->memprops );
+  }
+
+  // Budget and usage per heap, e.g. from queryHeapBudgets. Usage already
+  // counts the blocks alive now; blocks allocated later are added to it.
+  void setBudget( const VkDeviceSize* heapBudget, const VkDeviceSize* heapUsage )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+
+    for ( uint32_t i = 0; i < this->memprops.memoryHeapCount; i++ )
+    {
+      this->heapBudget[i]          = heapBudget[i];
+      this->heapUsage[i]           = heapUsage[i];
+      this->heapReservedAtQuery[i] = this->telemetry.heapReserved[i].bytes;
+    }
+  }
+
+  const VkPhysicalDeviceMemoryProperties& properties() const
+  {
+    return this->memprops;
+  }
+
+  // Place a resource in the fastest memory type usage allows that still
+  // fits, going over the budget only when no type does. Returns false if
+  // vkAllocateMemory fails for every type.
+  bool allocate( const VkMemoryRequirements& requirements,
+                 MemoryUsage                 usage,
+                 bool                        linear,
+                 MemoryCategory              category,
+                 const std::string&          name,
+                 Placement&                  placement )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+
+    std::vector<uint32_t> types = rankMemoryTypes( this->memprops, requirements.memoryTypeBits,
+                                                   memoryPolicy( usage ) );
+    bool placed = false;
+    for ( size_t i = 0; i < types.size() && !placed; i++ )
+    {
+      if ( this->placeInBlocks( requirements, types[i], linear, placement ) ||
+           ( this->fitsBudget( requirements, types[i] ) &&
+             this->placeInNewBlock( requirements, types[i], linear, placement ) ) )
+      {
+        this->fallbacks += i > 0 ? 1 : 0;
+        placed = true;
+      }
+    }
+
+    for ( size_t i = 0; i < types.size() && !placed; i++ )
+    {
+      if ( this->placeInNewBlock( requirements, types[i], linear, placement ) )
+      {
+        this->fallbacks += i > 0 ? 1 : 0;
+        placed = true;
+      }
+    }
+
+    if ( placed )
+    {
+      placement.id = this->telemetry.allocated( placement.block->typeIndex, requirements.size,
+                                                category, name );
+    }
+    return placed;
+  }
+
+  void free( const Placement& placement )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+
+    this->telemetry.freed( placement.id );
+
+    Block* block = placement.block;
+    block->ranges.free( placement.range );
+    if ( block->ranges.allocationCount() > 0 )
+    {
+      return;
+    }
+
+    // Keep one empty block per memory type and kind for the next staging
+    // buffer rather than going back to the driver
+    if ( !block->dedicated )
+    {
+      for ( const auto& other : this->blocks )
+      {
+        if ( other.get() != block && !other->dedicated && other->typeIndex == block->typeIndex &&
+             other->linear == block->linear && other->ranges.allocationCount() == 0 )
+        {
+          this->releaseBlock( block );
+          return;
+        }
+      }
+      return;
+    }
+
+    this->releaseBlock( block );
+  }
+
+  // Host pointer to a placement in host visible memory. Blocks are mapped
+  // once and stay mapped, since a VkDeviceMemory can only be mapped once.
+  void* map( const Placement& placement )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+
+    Block* block = placement.block;
+    if ( !block->mapped &&
+         vkMapMemory( this->device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped ) != VK_SUCCESS )
+    {
+      throw std::runtime_error( "Failed to map device memory!" );
+    }
+    return (char*)block->mapped + placement.offset;
+  }
+
+  AllocatorStats stats()
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+
+    AllocatorStats stats;
+    VkDeviceSize   freeBytes = 0;
+    for ( const auto& block : this->blocks )
+    {
+      VkDeviceSize blockFree, largest;
+      uint32_t     freeRanges;
+      block->ranges.freeStats( blockFree, largest, freeRanges );
+
+      stats.blocks++;
+      stats.dedicated        += block->dedicated ? 1 : 0;
+      stats.allocations      += block->ranges.allocationCount();
+      stats.reservedBytes    += block->ranges.size();
+      stats.usedBytes        += block->ranges.usedBytes();
+      stats.largestFreeRange  = std::max( stats.largestFreeRange, largest );
+      stats.freeRanges       += freeRanges;
+      freeBytes              += blockFree;
+    }
+    stats.fragmentation = freeBytes > 0 ? 1.0f - (float)stats.largestFreeRange / freeBytes : 0.0f;
+    stats.fallbacks     = this->fallbacks;
+    return stats;
+  }
+
+  // Snapshot of the telemetry and of every block as JSON
+  void writeJson( std::ostream& out )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    this->telemetry.writeJson( out, this->heapBudget, this->collectBlockInfos() );
+  }
+
+  std::vector<MemoryBlockInfo> blockInfos()
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    return this->collectBlockInfos();
+  }
+
+  // Place a copy of source in another non-empty block of the same memory
+  // type and kind, the fullest that has room, for the defragmenter.
+  // Returns false if none has.
+  bool relocate( const VkMemoryRequirements& requirements,
+                 const Placement&            source,
+                 MemoryCategory              category,
+                 const std::string&          name,
+                 Placement&                  target )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+
+    const Block* from = source.block;
+    if ( !( requirements.memoryTypeBits & ( 1u << from->typeIndex ) ) )
+    {
+      return false;
+    }
+
+    std::vector<Block*> candidates;
+    for ( const auto& block : this->blocks )
+    {
+      if ( block.get() != from && !block->dedicated && block->typeIndex == from->typeIndex &&
+           block->linear == from->linear && block->ranges.allocationCount() > 0 )
+      {
+        candidates.push_back( block.get() );
+      }
+    }
+    std::sort( candidates.begin(), candidates.end(), []( const Block* a, const Block* b )
+    {
+      return a->ranges.usedBytes() > b->ranges.usedBytes();
+    } );
+
+    for ( Block* block : candidates )
+    {
+      target.range = block->ranges.allocate( requirements.size, requirements.alignment, target.offset );
+      if ( target.range != TlsfSuballocator::INVALID )
+      {
+        target.block = block;
+        target.id    = this->telemetry.allocated( block->typeIndex, requirements.size, category, name );
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Give back every shared block nothing is placed in, including the ones
+  // kept for reuse. Returns how many were released.
+  uint32_t releaseEmptyBlocks()
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+
+    std::vector<Block*> empty;
+    for ( const auto& block : this->blocks )
+    {
+      if ( !block->dedicated && block->ranges.allocationCount() == 0 )
+      {
+        empty.push_back( block.get() );
+      }
+    }
+    for ( Block* block : empty )
+    {
+      this->releaseBlock( block );
+    }
+    return empty.size();
+  }
+
+private:
+  std::mutex                          mutex;
+  std::vector<std::unique_ptr<Block>> blocks;
+  VkPhysicalDeviceMemoryProperties    memprops = {};
+  VkDeviceSize                        blockSizes[ VK_MAX_MEMORY_TYPES ]          = {};
+  VkDeviceSize                        heapBudget[ VK_MAX_MEMORY_HEAPS ]          = {};
+  VkDeviceSize                        heapUsage[ VK_MAX_MEMORY_HEAPS ]           = {};
+  VkDeviceSize                        heapReservedAtQuery[ VK_MAX_MEMORY_HEAPS ] = {};
+  uint32_t                            fallbacks = 0;
+  MemoryTelemetry                     telemetry;
+
+  std::vector<MemoryBlockInfo> collectBlockInfos() const
+  {
+    std::vector<MemoryBlockInfo> infos;
+    for ( const auto& block : this->blocks )
+    {
+      VkDeviceSize    freeBytes;
+      MemoryBlockInfo info;
+      info.block       = block.get();
+      info.typeIndex   = block->typeIndex;
+      info.linear      = block->linear;
+      info.dedicated   = block->dedicated;
+      info.size        = block->ranges.size();
+      info.usedBytes   = block->ranges.usedBytes();
+      info.allocations = block->ranges.allocationCount();
+      block->ranges.freeStats( freeBytes, info.largestFreeRange, info.freeRanges );
+      infos.push_back( info );
+    }
+    return infos;
+  }
+
+  bool dedicatedSize( const VkMemoryRequirements& requirements, uint32_t typeIndex ) const
+  {
+    return requirements.size > this->blockSizes[ typeIndex ] / 2;
+  }
+
+  bool placeInBlocks( const VkMemoryRequirements& requirements,
+                      uint32_t                    typeIndex,
+                      bool                        linear,
+                      Placement&                  placement )
+  {
+    if ( this->dedicatedSize( requirements, typeIndex ) )
+    {
+      return false;
+    }
+
+    for ( const auto& block : this->blocks )
+    {
+      if ( !block->dedicated && block->typeIndex == typeIndex && block->linear == linear )
+      {
+        placement.range = block->ranges.allocate( requirements.size, requirements.alignment,
+                                                  placement.offset );
+        if ( placement.range != TlsfSuballocator::INVALID )
+        {
+          placement.block = block.get();
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  bool placeInNewBlock( const VkMemoryRequirements& requirements,
+                        uint32_t                    typeIndex,
+                        bool                        linear,
+                        Placement&                  placement )
+  {
+    bool   dedicated = this->dedicatedSize( requirements, typeIndex );
+    Block* block     = this->newBlock( dedicated ? requirements.size : this->blockSizes[ typeIndex ],
+                                       typeIndex, linear );
+    if ( !block )
+    {
+      return false;
+    }
+    block->dedicated = dedicated;
+    placement.block  = block;
+    placement.range  = block->ranges.allocate( requirements.size,
+                                               dedicated ? 1 : requirements.alignment,
+                                               placement.offset );
+    return true;
+  }
+
+  // Whether the heap behind typeIndex has room for the block a new
+  // placement would need
+  bool fitsBudget( const VkMemoryRequirements& requirements, uint32_t typeIndex ) const
+  {
+    uint32_t     heap  = this->memprops.memoryTypes[ typeIndex ].heapIndex;
+    VkDeviceSize size  = this->dedicatedSize( requirements, typeIndex ) ?
+                           requirements.size : this->blockSizes[ typeIndex ];
+    VkDeviceSize usage = this->heapUsage[heap] + this->telemetry.heapReserved[heap].bytes;
+    usage = usage > this->heapReservedAtQuery[heap] ? usage - this->heapReservedAtQuery[heap] : 0;
+    return usage + size <= this->heapBudget[heap];
+  }
+
+  Block* newBlock( VkDeviceSize size, uint32_t typeIndex, bool linear )
+  {
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize  = size;
+    allocInfo.memoryTypeIndex = typeIndex;
+
+    VkDeviceMemory memory;
+    if ( vkAllocateMemory( this->device, &allocInfo, nullptr, &memory ) != VK_SUCCESS )
+    {
+      return nullptr;
+    }
+
+    this->telemetry.blockAllocated( typeIndex, size );
+
+    std::unique_ptr<Block> block( new Block( size ) );
+    block->memory    = memory;
+    block->typeIndex = typeIndex;
+    block->linear    = linear;
+    this->blocks.push_back( std::move( block ) );
+    return this->blocks.back().get();
+  }
+
+  void releaseBlock( Block* block )
+  {
+    for ( size_t i = 0; i < this->blocks.size(); i++ )
+    {
+      if ( this->blocks[i].get() == block )
+      {
+        this->telemetry.blockFreed( block->typeIndex, block->ranges.size() );
+        vkFreeMemory( this->device, block->memory, nullptr );
+        this->blocks.erase( this->blocks.begin() + i );
+        return;
+      }
+    }
+  }
+
+  void releaseAll()
+  {
+    for ( const auto& block : this->blocks )
+    {
+      vkFreeMemory( this->device, block->memory, nullptr );
+    }
+    this->blocks.clear();
+  }
+};
+
+// Memory of one resource, returned to its allocator when destroyed or
+// replaced, in the manner of VDeleter<VkDeviceMemory>
+class MemoryAllocation
+{
+public:
+  // category and name describe the resource in telemetry
+  MemoryAllocation( DeviceMemoryAllocator& allocator, MemoryCategory category, const std::string& name )
+    : allocator { &allocator },
+      category  { category },
+      name      { name }
+  {
+  }
+
+  // Copies are empty but keep the category and name, so an empty
+  // allocation can serve as a prototype for containers
+  MemoryAllocation( const MemoryAllocation& other )
+    : allocator { other.allocator },
+      category  { other.category },
+      name      { other.name }
+  {
+  }
+
+  MemoryAllocation& operator=( const MemoryAllocation& ) = delete;
+
+  ~MemoryAllocation()
+  {
+    this->free();
+  }
+
+  // Place a resource with requirements in memory suited to usage,
+  // releasing any previous placement first. Returns false if no memory is
+  // left.
+  bool allocate( const VkMemoryRequirements& requirements, MemoryUsage usage, bool linear )
+  {
+    this->free();
+    return this->allocator->allocate( requirements, usage, linear, this->category, this->name,
+                                      this->placement );
+  }
+
+  void free()
+  {
+    if ( this->placement.block )
+    {
+      this->allocator->free( this->placement );
+      this->placement = DeviceMemoryAllocator::Placement();
+    }
+  }
+
+  // Place this empty allocation in another block than source's, with
+  // requirements of the resource that will replace source's
+  bool relocate( const MemoryAllocation& source, const VkMemoryRequirements& requirements )
+  {
+    this->free();
+    return this->allocator->relocate( requirements, source.placement, this->category, this->name,
+                                      this->placement );
+  }
+
+  // Identifies the block the allocation lives in
+  const void* block() const
+  {
+    return this->placement.block;
+  }
+
+  // Take over other's placement, giving it this one
+  void swap( MemoryAllocation& other )
+  {
+    std::swap( this->allocator, other.allocator );
+    std::swap( this->placement, other.placement );
+  }
+
+  VkDeviceMemory memory() const
+  {
+    return this->placement.block ? this->placement.block->memory : VK_NULL_HANDLE;
+  }
+
+  VkDeviceSize offset() const
+  {
+    return this->placement.offset;
+  }
+
+  // Host pointer to the start of the resource, for host visible memory
+  void* map()
+  {
+    return this->allocator->map( this->placement );
+  }
+
+private:
+  DeviceMemoryAllocator*           allocator;
+  MemoryCategory                   category;
+  std::string                      name;
+  DeviceMemoryAllocator::Placement placement;
+};
+
+#endif
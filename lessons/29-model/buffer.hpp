@@ -3,14 +3,17 @@
 
 #include "base-includes.hpp"
 #include "memory.hpp"
-
-void createBuffer( VkDevice                  device,
-                   VkPhysicalDevice          physical,
-                   VkDeviceSize              size,
-                   VkBufferUsageFlags        usage,
-                   VkMemoryPropertyFlags     props,
-                   VDeleter<VkBuffer>&       buffer,
-                   VDeleter<VkDeviceMemory>& bufferMemory )
+#include "allocator.hpp"
+
+// Returns false when no memory type suits memoryUsage or the allocation
+// fails, so callers can retry with another usage
+bool tryCreateBuffer( VkDevice                  device,
+                      VkPhysicalDevice          physical,
+                      VkDeviceSize              size,
+                      VkBufferUsageFlags        usage,
+                      MemoryUsage               memoryUsage,
+                      VDeleter<VkBuffer>&       buffer,
+                      MemoryAllocation&         bufferMemory )
 {
   VkBufferCreateInfo bufferInfo = {};
   bufferInfo.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -27,20 +30,27 @@ void createBuffer( VkDevice                  device,
   VkMemoryRequirements memreqs;
   vkGetBufferMemoryRequirements( device, buffer, &memreqs );
 
-  VkMemoryAllocateInfo allocInfo = {};
-  allocInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize  = memreqs.size;
-  allocInfo.memoryTypeIndex = findMemoryType( physical,
-                                              memreqs.memoryTypeBits,
-                                              props );
+  if ( !bufferMemory.allocate( memreqs, memoryUsage, true ) )
+  {
+    return false;
+  }
 
-  if ( vkAllocateMemory( device, &allocInfo,
-                         nullptr, &bufferMemory ) != VK_SUCCESS )
+  vkBindBufferMemory( device, buffer, bufferMemory.memory(), bufferMemory.offset() );
+  return true;
+}
+
+void createBuffer( VkDevice                  device,
+                   VkPhysicalDevice          physical,
+                   VkDeviceSize              size,
+                   VkBufferUsageFlags        usage,
+                   MemoryUsage               memoryUsage,
+                   VDeleter<VkBuffer>&       buffer,
+                   MemoryAllocation&         bufferMemory )
+{
+  if ( !tryCreateBuffer( device, physical, size, usage, memoryUsage, buffer, bufferMemory ) )
   {
     throw std::runtime_error( "Failed to allocate buffer memory!" );
   }
-
-  vkBindBufferMemory( device, buffer, bufferMemory, 0 );
 }
 
 VkCommandBuffer beginSingleTimeCommands( VkDevice        device,
@@ -17,6 +17,113 @@ const std::vector<const char*> validationLayers = {
 const std::string MODEL_PATH   = "chalet.obj";
 const std::string TEXTURE_PATH = "chalet.jpg";
 
+// Block compressed copy of TEXTURE_PATH, cooked on first load. Textures
+// that use alpha are always cooked to BC3.
+const std::string COOKED_TEXTURE_PATH = "chalet.vtex";
+
+enum TextureQuality
+{
+  TEXTURE_QUALITY_FAST, // BC1 for opaque textures
+  TEXTURE_QUALITY_HIGH  // BC7 for opaque textures, with more endpoint refinement
+};
+
+const TextureQuality TEXTURE_COOK_QUALITY = TEXTURE_QUALITY_HIGH;
+
+// Levels of a cooked texture up to this size are loaded before the first
+// frame; finer levels stream in from disk while rendering
+const uint32_t TEXTURE_STREAM_RESIDENT_SIZE = 256;
+
+// Models with several material textures get them packed into one texture
+// array; textures smaller than a layer are padded by this many texels
+const uint32_t MATERIAL_TEXTURE_GUTTER = 4;
+
+// Textures may claim this share of the available device local memory; the
+// finest mip levels of the least important ones are left out to fit
+const float TEXTURE_BUDGET_SHARE = 0.5f;
+
+// Frames between queries of the texture budget while rendering, so textures
+// give up levels when other applications claim device local memory
+const uint64_t TEXTURE_BUDGET_INTERVAL = 120;
+
+// Drive texture residency from mip levels the fragment shader reports,
+// one pixel per tile of this size. Every TEXTURE_FEEDBACK_WINDOW frames the
+// texture keeps the finest level all but TEXTURE_FEEDBACK_IGNORE_SHARE of
+// the samples asked for. Needs fragmentStoresAndAtomics.
+const bool     TEXTURE_FEEDBACK              = false;
+const uint32_t TEXTURE_FEEDBACK_TILE         = 16;
+const uint64_t TEXTURE_FEEDBACK_WINDOW       = 60;
+const float    TEXTURE_FEEDBACK_IGNORE_SHARE = 0.02f;
+
+// Material textures are decoded on a pool of worker threads into a shared
+// staging region of at most this many bytes (grown to fit the largest one)
+const uint64_t DECODE_STAGING_SIZE = 64 * 1024 * 1024;
+
+// Baseline JPEGs are only entropy decoded on the CPU; dequantization, IDCT
+// and color conversion run in jpegidct.comp, straight into the texture when
+// it is uploaded as decoded and read back for the cook otherwise
+const bool JPEG_GPU_RECONSTRUCT = true;
+
+// Bypass the cooked file and check what the path above reconstructs
+// against stb_image. Chroma is upsampled differently, so only the mean
+// error per channel is held to JPEG_GPU_VALIDATE_MEAN_ERROR.
+const bool  JPEG_GPU_VALIDATE            = false;
+const float JPEG_GPU_VALIDATE_MEAN_ERROR = 1.0f;
+
+// Cooked files are imported with VK_EXT_external_memory_host and copied
+// from directly where it is available. The benchmark uploads the cooked
+// texture both ways at startup and prints the timings.
+const bool     HOST_IMPORT                       = true;
+const bool     HOST_IMPORT_BENCHMARK             = false;
+const uint32_t HOST_IMPORT_BENCHMARK_REPETITIONS = 5;
+
+// Frames the CPU may record ahead of the GPU, whatever the number of
+// swapchain images. Each has its own fence and pair of semaphores.
+const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+
+// Bytes of uniforms and other transient data each frame may allocate
+const uint64_t FRAME_RING_REGION_SIZE = 256 * 1024;
+
+// Mapped memory every staged upload is copied from; larger uploads go
+// through it in pieces
+const uint64_t STAGING_RING_SIZE = 64 * 1024 * 1024;
+
+// Device memory is allocated in blocks of this size per memory type and
+// sub-allocated; tests/allocator.cpp stress tests the sub-allocator
+const uint64_t ALLOCATOR_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// Sparsely used memory blocks are emptied by moving geometry and the
+// impostor atlas into denser ones, at most this many bytes per frame;
+// tests/defrag.cpp fragments memory on a headless device and checks that
+// it is reclaimed
+const bool     DEFRAGMENT                 = true;
+const uint64_t DEFRAGMENT_BYTES_PER_FRAME = 8 * 1024 * 1024;
+
+// Device memory telemetry is written as JSON to MEMORY_SNAPSHOT_PATH at
+// exit, and to a file named after the frame whenever MEMORY_SNAPSHOT_KEY
+// is pressed
+const std::string MEMORY_SNAPSHOT_PATH    = "memory.json";
+const bool        MEMORY_SNAPSHOT_AT_EXIT = true;
+const int         MEMORY_SNAPSHOT_KEY     = GLFW_KEY_M;
+
+// Share of the host visible device local heap (resizable BAR) that buffers
+// may claim to be written in place instead of staged
+const float DIRECT_WRITE_HEAP_SHARE = 0.5f;
+
+// Upper bound on a single vertex or index buffer; meshes larger than this
+// are split across several pages
+const uint64_t GEOMETRY_PAGE_SIZE = 256 * 1024 * 1024;
+
+// Copies of the model are laid out on a square grid. Copies whose projected
+// radius drops below the threshold are drawn as impostors, cross-fading over
+// a band of IMPOSTOR_FADE_BAND * threshold pixels.
+const uint32_t INSTANCE_GRID_SIZE        = 1;
+const float    INSTANCE_SPACING          = 2.5f;
+const uint32_t INSTANCE_COUNT            = INSTANCE_GRID_SIZE * INSTANCE_GRID_SIZE;
+const uint32_t IMPOSTOR_VIEWS_PER_SIDE   = 8;
+const uint32_t IMPOSTOR_TILE_SIZE        = 256;
+const float    IMPOSTOR_THRESHOLD_PIXELS = 48.0f;
+const float    IMPOSTOR_FADE_BAND        = 0.25f;
+
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
 #else
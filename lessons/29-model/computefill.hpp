@@ -0,0 +1,201 @@
+#ifndef __COMPUTEFILL_HPP__
+#define __COMPUTEFILL_HPP__
+
+#include <array>
+#include "base-includes.hpp"
+#include "mipmap.hpp"
+#include "shader.hpp"
+#include "upload.hpp"
+
+// Record a compute shader that reads a storage buffer (binding 0) and
+// writes level 0 of an RGBA8 image (binding 1, which needs STORAGE usage).
+// pushConstants are handed to the shader as they are. Leaves all mipLevels
+// levels in TRANSFER_DST_OPTIMAL, the same as copyBufferToImage, so
+// generateMipmaps can follow.
+void fillLevelZeroCompute( UploadContext&     upload,
+                           const std::string& shaderFile,
+                           VkBuffer           buffer,
+                           VkImage            image,
+                           const void*        pushConstants,
+                           uint32_t           pushConstantSize,
+                           uint32_t           groupCountX,
+                           uint32_t           groupCountY,
+                           uint32_t           mipLevels )
+{
+  const VDeleter<VkDevice>& device = upload.device;
+
+  // Everything the recorded dispatch uses is owned by the upload context
+
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+  bindings[0].binding         = 0;
+  bindings[0].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+  bindings[1].binding         = 1;
+  bindings[1].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  bindings[1].descriptorCount = 1;
+  bindings[1].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = bindings.size();
+  layoutInfo.pBindings    = bindings.data();
+
+  VDeleter<VkDescriptorSetLayout>& setLayout = upload.own<VkDescriptorSetLayout>( vkDestroyDescriptorSetLayout );
+  if ( vkCreateDescriptorSetLayout( device, &layoutInfo, nullptr, &setLayout ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create " + shaderFile + " descriptor set layout!" );
+  }
+
+  VkPushConstantRange pushConstant = {};
+  pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstant.offset     = 0;
+  pushConstant.size       = pushConstantSize;
+
+  VkDescriptorSetLayout setLayouts[] = { setLayout };
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+  pipelineLayoutInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount         = 1;
+  pipelineLayoutInfo.pSetLayouts            = setLayouts;
+  pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+  pipelineLayoutInfo.pPushConstantRanges    = &pushConstant;
+
+  VDeleter<VkPipelineLayout>& pipelineLayout = upload.own<VkPipelineLayout>( vkDestroyPipelineLayout );
+  if ( vkCreatePipelineLayout( device, &pipelineLayoutInfo, nullptr, &pipelineLayout ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create " + shaderFile + " pipeline layout!" );
+  }
+
+  auto shaderCode = readFile( shaderFile );
+  VDeleter<VkShaderModule> shader { device, vkDestroyShaderModule };
+  createShaderModule( device, shaderCode, shader );
+
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType        = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shader;
+  pipelineInfo.stage.pName  = "main";
+  pipelineInfo.layout       = pipelineLayout;
+
+  VDeleter<VkPipeline>& pipeline = upload.own<VkPipeline>( vkDestroyPipeline );
+  if ( vkCreateComputePipelines( device, VK_NULL_HANDLE, 1,
+                                 &pipelineInfo, nullptr, &pipeline ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create " + shaderFile + " pipeline!" );
+  }
+
+  std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+  poolSizes[0].type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[0].descriptorCount = 1;
+  poolSizes[1].type            = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSizes[1].descriptorCount = 1;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = poolSizes.size();
+  poolInfo.pPoolSizes    = poolSizes.data();
+  poolInfo.maxSets       = 1;
+
+  VDeleter<VkDescriptorPool>& descriptorPool = upload.own<VkDescriptorPool>( vkDestroyDescriptorPool );
+  if ( vkCreateDescriptorPool( device, &poolInfo, nullptr, &descriptorPool ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create " + shaderFile + " descriptor pool!" );
+  }
+
+  VDeleter<VkImageView>& levelView = upload.own<VkImageView>( vkDestroyImageView );
+
+  VkImageViewCreateInfo viewInfo = {};
+  viewInfo.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image                           = image;
+  viewInfo.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format                          = VK_FORMAT_R8G8B8A8_UNORM;
+  viewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel   = 0;
+  viewInfo.subresourceRange.levelCount     = 1;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount     = 1;
+
+  if ( vkCreateImageView( device, &viewInfo, nullptr, &levelView ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create " + shaderFile + " level view!" );
+  }
+
+  VkDescriptorSetLayout       stepLayout = setLayout;
+  VkDescriptorSetAllocateInfo allocInfo  = {};
+  allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool     = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts        = &stepLayout;
+
+  VkDescriptorSet set;
+  if ( vkAllocateDescriptorSets( device, &allocInfo, &set ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to allocate " + shaderFile + " descriptor set!" );
+  }
+
+  VkDescriptorBufferInfo bufferInfo = {};
+  bufferInfo.buffer = buffer;
+  bufferInfo.offset = 0;
+  bufferInfo.range  = VK_WHOLE_SIZE;
+
+  VkDescriptorImageInfo imageInfo = {};
+  imageInfo.imageView   = levelView;
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  std::array<VkWriteDescriptorSet, 2> writes = {};
+  for ( uint32_t b = 0; b < writes.size(); b++ )
+  {
+    writes[b].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[b].dstSet          = set;
+    writes[b].dstBinding      = b;
+    writes[b].descriptorType  = bindings[b].descriptorType;
+    writes[b].descriptorCount = 1;
+  }
+  writes[0].pBufferInfo = &bufferInfo;
+  writes[1].pImageInfo  = &imageInfo;
+
+  vkUpdateDescriptorSets( device, writes.size(), writes.data(), 0, nullptr );
+
+  VkCommandBuffer commandBuffer = upload.commandBuffer;
+
+  auto toGeneral = mipBarrier( image, 0, 1,
+                               VK_IMAGE_LAYOUT_UNDEFINED,
+                               VK_IMAGE_LAYOUT_GENERAL,
+                               0,
+                               VK_ACCESS_SHADER_WRITE_BIT );
+  vkCmdPipelineBarrier( commandBuffer,
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        0, 0, nullptr, 0, nullptr, 1, &toGeneral );
+
+  vkCmdBindPipeline( commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline );
+  vkCmdBindDescriptorSets( commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                           pipelineLayout, 0, 1, &set, 0, nullptr );
+  if ( pushConstantSize > 0 )
+  {
+    vkCmdPushConstants( commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                        0, pushConstantSize, pushConstants );
+  }
+  vkCmdDispatch( commandBuffer, groupCountX, groupCountY, 1 );
+
+  // Level 0 keeps its contents, the rest are filled by the mip chain
+  std::array<VkImageMemoryBarrier, 2> toTransfer = {};
+  toTransfer[0] = mipBarrier( image, 0, 1,
+                              VK_IMAGE_LAYOUT_GENERAL,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              VK_ACCESS_SHADER_WRITE_BIT,
+                              VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT );
+  toTransfer[1] = mipBarrier( image, 1, mipLevels - 1,
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              0,
+                              VK_ACCESS_TRANSFER_WRITE_BIT );
+  vkCmdPipelineBarrier( commandBuffer,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        0, 0, nullptr, 0, nullptr,
+                        mipLevels > 1 ? 2 : 1, toTransfer.data() );
+}
+
+#endif
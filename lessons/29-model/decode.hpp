@@ -0,0 +1,520 @@
+#ifndef __DECODE_HPP__
+#define __DECODE_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include "base-includes.hpp"
+#include "shader.hpp"
+#include "jpeg.hpp"
+
+// Background image decoding for scenes with many textures. A fixed pool of
+// workers takes requests highest importance first and decodes them to
+// tightly packed RGBA8 in a capped staging region. Nothing here touches the
+// device, so the service runs the same with or without a window.
+
+// First-fit allocator over a caller owned region, usually a persistently
+// mapped staging buffer. allocate() blocks while the region is full.
+class DecodeStagingPool
+{
+public:
+  DecodeStagingPool( uint8_t* base, uint64_t size )
+    : base { base },
+      size { size }
+  {
+    this->freeBlocks[0] = size;
+  }
+
+  uint8_t* data( uint64_t offset ) const
+  {
+    return this->base + offset;
+  }
+
+  uint64_t capacity() const
+  {
+    return this->size;
+  }
+
+  // Wait for a block of the given size. Returns false if it can never fit
+  // or abort() turned true while waiting. abort() runs under the pool lock,
+  // so it must not take other locks; pair it with interrupt().
+  bool allocate( uint64_t                     size,
+                 const std::function<bool()>& abort,
+                 uint64_t&                    offset )
+  {
+    size = ( size + 15 ) & ~(uint64_t)15;
+    if ( size > this->size )
+    {
+      return false;
+    }
+
+    std::unique_lock<std::mutex> lock( this->mutex );
+    while ( true )
+    {
+      if ( abort() )
+      {
+        return false;
+      }
+
+      for ( auto block = this->freeBlocks.begin(); block != this->freeBlocks.end(); ++block )
+      {
+        if ( block->second >= size )
+        {
+          offset = block->first;
+          if ( block->second > size )
+          {
+            this->freeBlocks[ offset + size ] = block->second - size;
+          }
+          this->freeBlocks.erase( block );
+          this->usedBlocks[offset] = size;
+
+          this->used    += size;
+          this->peak     = std::max( this->peak, this->used );
+          return true;
+        }
+      }
+
+      this->released.wait( lock );
+    }
+  }
+
+  void free( uint64_t offset )
+  {
+    {
+      std::lock_guard<std::mutex> lock( this->mutex );
+      auto     used = this->usedBlocks.find( offset );
+      uint64_t size = used->second;
+      this->usedBlocks.erase( used );
+      this->used -= size;
+
+      // Merge with the neighbouring free blocks
+      auto next = this->freeBlocks.lower_bound( offset );
+      if ( next != this->freeBlocks.end() && next->first == offset + size )
+      {
+        size += next->second;
+        next  = this->freeBlocks.erase( next );
+      }
+      if ( next != this->freeBlocks.begin() )
+      {
+        auto previous = std::prev( next );
+        if ( previous->first + previous->second == offset )
+        {
+          previous->second += size;
+          size = 0;
+        }
+      }
+      if ( size > 0 )
+      {
+        this->freeBlocks[offset] = size;
+      }
+    }
+
+    this->released.notify_all();
+  }
+
+  // Wake every waiting allocate() so it can re-check its abort condition
+  void interrupt()
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    this->released.notify_all();
+  }
+
+  void usage( uint64_t& used, uint64_t& peak )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    used = this->used;
+    peak = this->peak;
+  }
+
+private:
+  uint8_t*                     base;
+  uint64_t                     size;
+  uint64_t                     used = 0;
+  uint64_t                     peak = 0;
+  std::map<uint64_t, uint64_t> freeBlocks; // Offset to size
+  std::map<uint64_t, uint64_t> usedBlocks;
+  std::mutex                   mutex;
+  std::condition_variable      released;
+};
+
+enum DecodeState
+{
+  DECODE_STATE_QUEUED,
+  DECODE_STATE_DECODING,
+  DECODE_STATE_DONE,
+  DECODE_STATE_FAILED,
+  DECODE_STATE_CANCELLED
+};
+
+struct DecodeJob
+{
+  std::string path;
+  float       importance; // Larger decodes sooner, e.g. projected screen area
+  uint64_t    generation = 0;
+  DecodeState state      = DECODE_STATE_QUEUED;
+  std::atomic<bool> cancelled { false };
+  std::string error;
+
+  // Valid once DONE, until the job is released back to the service
+  uint32_t    width         = 0;
+  uint32_t    height        = 0;
+  uint64_t    stagingOffset = 0;
+  uint8_t*    pixels        = nullptr;
+
+  std::chrono::high_resolution_clock::time_point submitted;
+  float       latencyMs = 0.0f; // Submission to completion
+  float       decodeMs  = 0.0f;
+};
+
+struct DecodeMetrics
+{
+  size_t   queued    = 0; // Queue depth, excluding cancelled entries
+  size_t   decoding  = 0;
+  size_t   completed = 0;
+  size_t   failed    = 0;
+  size_t   cancelled = 0;
+  float    averageLatencyMs = 0.0f;
+  float    maxLatencyMs     = 0.0f;
+  float    averageDecodeMs  = 0.0f;
+  uint64_t stagingUsed      = 0;
+  uint64_t stagingPeak      = 0;
+};
+
+class DecodeService
+{
+public:
+  DecodeService( uint32_t threadCount, DecodeStagingPool& staging )
+    : staging { staging }
+  {
+    threadCount = std::max( threadCount, 1u );
+    for ( uint32_t i = 0; i < threadCount; i++ )
+    {
+      this->workers.push_back( std::thread( [this]() { this->work(); } ) );
+    }
+  }
+
+  ~DecodeService()
+  {
+    {
+      std::lock_guard<std::mutex> lock( this->mutex );
+      this->stopping = true;
+    }
+    this->wake.notify_all();
+    this->staging.interrupt();
+
+    for ( auto& worker : this->workers )
+    {
+      worker.join();
+    }
+  }
+
+  std::shared_ptr<DecodeJob> submit( const std::string& path, float importance )
+  {
+    auto job = std::make_shared<DecodeJob>();
+    job->path       = path;
+    job->importance = importance;
+    job->submitted  = std::chrono::high_resolution_clock::now();
+
+    {
+      std::lock_guard<std::mutex> lock( this->mutex );
+      this->queue.push( QueueEntry { importance, this->sequence++, 0, job } );
+      this->queued++;
+    }
+    this->wake.notify_one();
+    return job;
+  }
+
+  // Re-rank a queued job as its screen-space importance changes
+  void reprioritize( const std::shared_ptr<DecodeJob>& job, float importance )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    if ( job->state == DECODE_STATE_QUEUED )
+    {
+      job->importance = importance;
+      this->queue.push( QueueEntry { importance, this->sequence++, ++job->generation, job } );
+    }
+  }
+
+  // Drop a job that is no longer needed. Queued jobs never start; a job
+  // waiting for staging memory gives up; a finished one is released.
+  void cancel( const std::shared_ptr<DecodeJob>& job )
+  {
+    {
+      std::lock_guard<std::mutex> lock( this->mutex );
+      if ( job->state == DECODE_STATE_CANCELLED )
+      {
+        return;
+      }
+      if ( job->state == DECODE_STATE_QUEUED )
+      {
+        this->queued--;
+      }
+      else if ( job->state == DECODE_STATE_DONE || job->state == DECODE_STATE_FAILED )
+      {
+        this->finished.erase( std::remove( this->finished.begin(), this->finished.end(), job ),
+                              this->finished.end() );
+      }
+
+      if ( job->state != DECODE_STATE_DECODING )
+      {
+        this->releaseLocked( job );
+      }
+      job->state     = DECODE_STATE_CANCELLED;
+      job->cancelled = true;
+      this->cancelled++;
+    }
+    this->staging.interrupt();
+  }
+
+  // Block until any job finishes and hand it to the caller, or return null
+  // once nothing is queued or decoding
+  std::shared_ptr<DecodeJob> next()
+  {
+    std::unique_lock<std::mutex> lock( this->mutex );
+    this->done.wait( lock, [this]()
+    {
+      return !this->finished.empty() || ( this->queued == 0 && this->decoding == 0 );
+    } );
+
+    if ( this->finished.empty() )
+    {
+      return nullptr;
+    }
+
+    auto job = this->finished.front();
+    this->finished.pop_front();
+    return job;
+  }
+
+  // As next(), but return null straight away when no job has finished yet
+  std::shared_ptr<DecodeJob> tryNext()
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    if ( this->finished.empty() )
+    {
+      return nullptr;
+    }
+
+    auto job = this->finished.front();
+    this->finished.pop_front();
+    return job;
+  }
+
+  // Return a finished job's staging memory to the pool
+  void release( const std::shared_ptr<DecodeJob>& job )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    this->releaseLocked( job );
+  }
+
+  DecodeMetrics metrics()
+  {
+    DecodeMetrics metrics;
+    {
+      std::lock_guard<std::mutex> lock( this->mutex );
+      metrics.queued           = this->queued;
+      metrics.decoding         = this->decoding;
+      metrics.completed        = this->completed;
+      metrics.failed           = this->failed;
+      metrics.cancelled        = this->cancelled;
+      metrics.averageLatencyMs = this->completed ? this->totalLatencyMs / this->completed : 0.0f;
+      metrics.maxLatencyMs     = this->maxLatencyMs;
+      metrics.averageDecodeMs  = this->completed ? this->totalDecodeMs / this->completed : 0.0f;
+    }
+    this->staging.usage( metrics.stagingUsed, metrics.stagingPeak );
+    return metrics;
+  }
+
+private:
+  struct QueueEntry
+  {
+    float                      importance;
+    uint64_t                   sequence;
+    uint64_t                   generation;
+    std::shared_ptr<DecodeJob> job;
+
+    // Most important first, then first submitted
+    bool operator<( const QueueEntry& other ) const
+    {
+      if ( this->importance != other.importance )
+      {
+        return this->importance < other.importance;
+      }
+      return this->sequence > other.sequence;
+    }
+  };
+
+  DecodeStagingPool&                      staging;
+  std::vector<std::thread>                workers;
+  std::mutex                              mutex;
+  std::condition_variable                 wake;
+  std::condition_variable                 done;
+  std::priority_queue<QueueEntry>         queue;
+  std::deque<std::shared_ptr<DecodeJob>>  finished;
+  std::atomic<bool>                       stopping { false };
+  uint64_t                                sequence = 0;
+
+  size_t                                  queued    = 0;
+  size_t                                  decoding  = 0;
+  size_t                                  completed = 0;
+  size_t                                  failed    = 0;
+  size_t                                  cancelled = 0;
+  float                                   totalLatencyMs = 0.0f;
+  float                                   maxLatencyMs   = 0.0f;
+  float                                   totalDecodeMs  = 0.0f;
+
+  void releaseLocked( const std::shared_ptr<DecodeJob>& job )
+  {
+    if ( job->pixels )
+    {
+      this->staging.free( job->stagingOffset );
+      job->pixels = nullptr;
+    }
+  }
+
+  void work()
+  {
+    while ( true )
+    {
+      std::shared_ptr<DecodeJob> job;
+      {
+        std::unique_lock<std::mutex> lock( this->mutex );
+        while ( !job )
+        {
+          this->wake.wait( lock, [this]() { return this->stopping || !this->queue.empty(); } );
+          if ( this->stopping )
+          {
+            return;
+          }
+
+          // Skip cancelled jobs and entries superseded by reprioritize()
+          QueueEntry entry = this->queue.top();
+          this->queue.pop();
+          if ( entry.job->state == DECODE_STATE_QUEUED &&
+               entry.generation == entry.job->generation )
+          {
+            job = entry.job;
+          }
+        }
+
+        job->state = DECODE_STATE_DECODING;
+        this->queued--;
+        this->decoding++;
+      }
+
+      auto        start = std::chrono::high_resolution_clock::now();
+      DecodeState state = this->decode( *job );
+      auto        end   = std::chrono::high_resolution_clock::now();
+
+      {
+        std::lock_guard<std::mutex> lock( this->mutex );
+        this->decoding--;
+
+        if ( job->state == DECODE_STATE_CANCELLED )
+        {
+          // Cancelled while decoding; nobody wants the pixels
+          this->releaseLocked( job );
+        }
+        else
+        {
+          job->state     = state;
+          job->decodeMs  = std::chrono::duration<float, std::milli>( end - start ).count();
+          job->latencyMs = std::chrono::duration<float, std::milli>( end - job->submitted ).count();
+
+          if ( state == DECODE_STATE_DONE )
+          {
+            this->completed++;
+            this->totalLatencyMs += job->latencyMs;
+            this->totalDecodeMs  += job->decodeMs;
+            this->maxLatencyMs    = std::max( this->maxLatencyMs, job->latencyMs );
+          }
+          else
+          {
+            this->failed++;
+          }
+          this->finished.push_back( job );
+        }
+      }
+      this->done.notify_all();
+    }
+  }
+
+  DecodeState decode( DecodeJob& job )
+  {
+    std::vector<char> file;
+    try
+    {
+      file = readFile( job.path );
+    }
+    catch ( const std::exception& e )
+    {
+      job.error = e.what();
+      return DECODE_STATE_FAILED;
+    }
+
+    // Size the staging block from the header before decoding anything
+    JpegImage jpeg;
+    bool      isJpeg = readJpegHeader( file, jpeg );
+    int       width, height, channels;
+    if ( isJpeg )
+    {
+      width  = jpeg.width;
+      height = jpeg.height;
+    }
+    else if ( !stbi_info_from_memory( (const stbi_uc*)file.data(), file.size(),
+                                      &width, &height, &channels ) )
+    {
+      job.error = "Unsupported image format";
+      return DECODE_STATE_FAILED;
+    }
+
+    auto aborted = [this, &job]() -> bool { return this->stopping || job.cancelled; };
+
+    uint64_t offset;
+    uint64_t size = (uint64_t)width * height * 4;
+    if ( !this->staging.allocate( size, aborted, offset ) )
+    {
+      job.error = size > this->staging.capacity() ? "Image is larger than the staging pool" :
+                                                     "Cancelled";
+      return DECODE_STATE_FAILED;
+    }
+
+    uint8_t* pixels = this->staging.data( offset );
+    if ( isJpeg )
+    {
+      // Parallelism comes from decoding several images at once
+      decodeJpeg( jpeg, pixels, width * 4, 4, 1 );
+    }
+    else
+    {
+      stbi_uc* decoded = stbi_load_from_memory( (const stbi_uc*)file.data(), file.size(),
+                                                &width, &height, &channels, STBI_rgb_alpha );
+      if ( !decoded )
+      {
+        this->staging.free( offset );
+        job.error = stbi_failure_reason();
+        return DECODE_STATE_FAILED;
+      }
+      std::memcpy( pixels, decoded, size );
+      stbi_image_free( decoded );
+    }
+
+    std::lock_guard<std::mutex> lock( this->mutex );
+    job.width         = width;
+    job.height        = height;
+    job.stagingOffset = offset;
+    job.pixels        = pixels;
+    return DECODE_STATE_DONE;
+  }
+};
+
+#endif
@@ -0,0 +1,442 @@
+#ifndef __DEFRAG_HPP__
+#define __DEFRAG_HPP__
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "base-includes.hpp"
+#include "deleter.hpp"
+#include "allocator.hpp"
+#include "buffer.hpp"
+#include "imgview.hpp"
+#include "upload.hpp"
+#include "frames.hpp"
+
+// What is needed to create a registered image again elsewhere
+struct MovableImageInfo
+{
+  uint32_t           width     = 0;
+  uint32_t           height    = 0;
+  uint32_t           mipLevels = 1;
+  uint32_t           layers    = 1;
+  VkFormat           format    = VK_FORMAT_UNDEFINED;
+  VkImageUsageFlags  usage     = 0;
+  VkImageLayout      layout    = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // Between frames
+  VkImageAspectFlags aspect    = VK_IMAGE_ASPECT_COLOR_BIT;
+  VkImageViewType    viewType  = VK_IMAGE_VIEW_TYPE_2D;
+};
+
+struct DefragmentStats
+{
+  uint32_t     moves          = 0;
+  VkDeviceSize bytesMoved     = 0;
+  uint32_t     blocksReleased = 0;
+};
+
+// Empties sparsely used allocator blocks by moving their resources into
+// denser blocks of the same memory type, a few megabytes per frame.
+//
+// Only registered resources move. They must be immutable once created and
+// created with TRANSFER_SRC usage. Their owners keep them in the VDeleter
+// and MemoryAllocation slots passed to addBuffer and addImage; a move
+// copies the contents on the GPU into a new resource and, once the copy
+// has finished, swaps it into those slots. update then returns true and
+// the caller must rewrite descriptors and command buffers that held the
+// old handles. The old resources are destroyed once the frames that may
+// still use them have completed.
+class Defragmenter
+{
+public:
+  Defragmenter( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : device    { device },
+      allocator { allocator },
+      upload    { device, allocator }
+  {
+  }
+
+  // size and usage are the buffer's own
+  void addBuffer( VDeleter<VkBuffer>& buffer,
+                  MemoryAllocation&   memory,
+                  VkDeviceSize        size,
+                  VkBufferUsageFlags  usage )
+  {
+    Movable movable;
+    movable.buffer      = std::addressof( buffer );
+    movable.memory      = &memory;
+    movable.size        = size;
+    movable.bufferUsage = usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    this->movables.push_back( movable );
+  }
+
+  // view is recreated along with the image
+  void addImage( VDeleter<VkImage>&      image,
+                 MemoryAllocation&       memory,
+                 VDeleter<VkImageView>&  view,
+                 const MovableImageInfo& info )
+  {
+    VkMemoryRequirements memreqs;
+    vkGetImageMemoryRequirements( this->device, image, &memreqs );
+
+    Movable movable;
+    movable.image           = std::addressof( image );
+    movable.view            = std::addressof( view );
+    movable.memory          = &memory;
+    movable.size            = memreqs.size;
+    movable.imageInfo       = info;
+    movable.imageInfo.usage = info.usage | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    this->movables.push_back( movable );
+  }
+
+  // Call once per frame. Returns true when moved resources replaced the
+  // old ones in their slots.
+  bool update( VkQueue       queue,
+               VkCommandPool commandPool,
+               uint64_t      frame,
+               uint64_t      completedFrame,
+               VkDeviceSize  byteBudget )
+  {
+    this->retired.collect( completedFrame );
+
+    if ( !this->pending.empty() )
+    {
+      if ( !this->upload.poll() )
+      {
+        return false;
+      }
+      this->apply( frame );
+      return true;
+    }
+
+    const void* source = this->chooseSourceBlock();
+    if ( !source )
+    {
+      // Everything that can move has; once the old resources are gone,
+      // give back the blocks left empty
+      if ( this->moved && this->retired.pendingBytes == 0 )
+      {
+        this->stats.blocksReleased += this->allocator.releaseEmptyBlocks();
+        this->exhausted.clear();
+        this->moved = false;
+      }
+      return false;
+    }
+
+    VkDeviceSize bytes = 0;
+    for ( size_t i = 0; i < this->movables.size() && bytes < byteBudget; i++ )
+    {
+      if ( this->movables[i].memory->block() != source )
+      {
+        continue;
+      }
+
+      if ( !this->beginMove( i ) )
+      {
+        // Too fragmented elsewhere for this one; leave the block be
+        this->exhausted.insert( source );
+        break;
+      }
+      bytes += this->movables[i].size;
+    }
+
+    if ( this->pending.empty() )
+    {
+      return false;
+    }
+
+    this->upload.begin( commandPool );
+    for ( const auto& move : this->pending )
+    {
+      this->recordCopy( move );
+    }
+
+    // Make the copies visible to whatever reads the new resources
+    VkMemoryBarrier barrier = {};
+    barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier( this->upload.commandBuffer,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                          0, 1, &barrier, 0, nullptr, 0, nullptr );
+    this->upload.submit( queue );
+    return false;
+  }
+
+  // Wait for the copies in flight, e.g. before stepping again without
+  // frames
+  void finish()
+  {
+    this->upload.wait();
+  }
+
+  bool busy() const
+  {
+    return !this->pending.empty();
+  }
+
+  const DefragmentStats& statistics() const
+  {
+    return this->stats;
+  }
+
+private:
+  struct Movable
+  {
+    VDeleter<VkBuffer>*    buffer      = nullptr; // Either buffer or image is set
+    VDeleter<VkImage>*     image       = nullptr;
+    VDeleter<VkImageView>* view        = nullptr;
+    MemoryAllocation*      memory      = nullptr;
+    VkDeviceSize           size        = 0;
+    VkBufferUsageFlags     bufferUsage = 0;
+    MovableImageInfo       imageInfo;
+  };
+
+  // A copy in flight into resources not yet visible to the owner
+  struct Move
+  {
+    size_t                                 movable;
+    std::shared_ptr<VDeleter<VkBuffer>>    buffer;
+    std::shared_ptr<VDeleter<VkImage>>     image;
+    std::shared_ptr<MemoryAllocation>      memory;
+  };
+
+  const VDeleter<VkDevice>& device;
+  DeviceMemoryAllocator&    allocator;
+  std::vector<Movable>      movables;
+  std::set<const void*>     exhausted; // Blocks whose resources found no room elsewhere
+  bool                      moved = false;
+  DefragmentStats           stats;
+  DeferredDestroyQueue      retired;
+  std::vector<Move>         pending;
+  UploadContext             upload; // Last, so pending copies finish before anything else goes
+
+  // The least used block whose every resource is registered and whose
+  // resources the other non-empty blocks of its memory type have room for
+  const void* chooseSourceBlock()
+  {
+    std::unordered_map<const void*, uint32_t> registered;
+    for ( const auto& movable : this->movables )
+    {
+      registered[ movable.memory->block() ]++;
+    }
+
+    std::vector<MemoryBlockInfo> blocks = this->allocator.blockInfos();
+    const MemoryBlockInfo*       chosen = nullptr;
+    for ( const auto& block : blocks )
+    {
+      if ( block.dedicated || block.allocations == 0 || registered[ block.block ] != block.allocations ||
+           this->exhausted.count( block.block ) )
+      {
+        continue;
+      }
+
+      VkDeviceSize room = 0;
+      for ( const auto& other : blocks )
+      {
+        if ( &other != &block && !other.dedicated && other.allocations > 0 &&
+             other.typeIndex == block.typeIndex && other.linear == block.linear )
+        {
+          room += other.size - other.usedBytes;
+        }
+      }
+
+      if ( room >= block.usedBytes && ( !chosen || block.usedBytes < chosen->usedBytes ) )
+      {
+        chosen = &block;
+      }
+    }
+    return chosen ? chosen->block : nullptr;
+  }
+
+  // Create the replacement of a movable in another block. Returns false if
+  // no other block has room for it.
+  bool beginMove( size_t index )
+  {
+    const Movable& movable = this->movables[ index ];
+
+    Move move;
+    move.movable = index;
+    move.memory  = std::make_shared<MemoryAllocation>( *movable.memory );
+
+    VkMemoryRequirements memreqs;
+    if ( movable.buffer )
+    {
+      VkBufferCreateInfo bufferInfo = {};
+      bufferInfo.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+      bufferInfo.size        = movable.size;
+      bufferInfo.usage       = movable.bufferUsage;
+      bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+      move.buffer = std::make_shared<VDeleter<VkBuffer>>( this->device, vkDestroyBuffer );
+      if ( vkCreateBuffer( this->device, &bufferInfo, nullptr, &*move.buffer ) != VK_SUCCESS )
+      {
+        throw std::runtime_error( "Failed to create defragmentation buffer!" );
+      }
+      vkGetBufferMemoryRequirements( this->device, *move.buffer, &memreqs );
+    }
+    else
+    {
+      const MovableImageInfo& info = movable.imageInfo;
+
+      VkImageCreateInfo imageInfo = {};
+      imageInfo.sType         = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      imageInfo.imageType     = VK_IMAGE_TYPE_2D;
+      imageInfo.extent.width  = info.width;
+      imageInfo.extent.height = info.height;
+      imageInfo.extent.depth  = 1;
+      imageInfo.mipLevels     = info.mipLevels;
+      imageInfo.arrayLayers   = info.layers;
+      imageInfo.format        = info.format;
+      imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
+      imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      imageInfo.usage         = info.usage;
+      imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
+      imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+
+      move.image = std::make_shared<VDeleter<VkImage>>( this->device, vkDestroyImage );
+      if ( vkCreateImage( this->device, &imageInfo, nullptr, &*move.image ) != VK_SUCCESS )
+      {
+        throw std::runtime_error( "Failed to create defragmentation image!" );
+      }
+      vkGetImageMemoryRequirements( this->device, *move.image, &memreqs );
+    }
+
+    if ( !move.memory->relocate( *movable.memory, memreqs ) )
+    {
+      return false;
+    }
+
+    if ( movable.buffer )
+    {
+      vkBindBufferMemory( this->device, *move.buffer, move.memory->memory(), move.memory->offset() );
+    }
+    else
+    {
+      vkBindImageMemory( this->device, *move.image, move.memory->memory(), move.memory->offset() );
+    }
+    this->pending.push_back( move );
+    return true;
+  }
+
+  void recordCopy( const Move& move )
+  {
+    const Movable&  movable       = this->movables[ move.movable ];
+    VkCommandBuffer commandBuffer = this->upload.commandBuffer;
+
+    if ( movable.buffer )
+    {
+      VkBufferCopy region = {};
+      region.size = movable.size;
+      vkCmdCopyBuffer( commandBuffer, *movable.buffer, *move.buffer, 1, &region );
+      return;
+    }
+
+    // Frames submitted before and after still sample the old image in its
+    // usual layout; queue order keeps them apart from the copy
+    const MovableImageInfo& info = movable.imageInfo;
+
+    VkImageMemoryBarrier barriers[2] = {};
+    for ( auto& barrier : barriers )
+    {
+      barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+      barrier.subresourceRange.aspectMask     = info.aspect;
+      barrier.subresourceRange.baseMipLevel   = 0;
+      barrier.subresourceRange.levelCount     = info.mipLevels;
+      barrier.subresourceRange.baseArrayLayer = 0;
+      barrier.subresourceRange.layerCount     = info.layers;
+    }
+    barriers[0].image         = *movable.image;
+    barriers[0].oldLayout     = info.layout;
+    barriers[0].newLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[1].image         = *move.image;
+    barriers[1].oldLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier( commandBuffer,
+                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          0, 0, nullptr, 0, nullptr, 2, barriers );
+
+    std::vector<VkImageCopy> regions( info.mipLevels );
+    for ( uint32_t level = 0; level < info.mipLevels; level++ )
+    {
+      VkImageCopy& region = regions[ level ];
+      region.srcSubresource.aspectMask     = info.aspect;
+      region.srcSubresource.mipLevel       = level;
+      region.srcSubresource.baseArrayLayer = 0;
+      region.srcSubresource.layerCount     = info.layers;
+      region.dstSubresource                = region.srcSubresource;
+      region.extent.width                  = std::max( info.width >> level, 1u );
+      region.extent.height                 = std::max( info.height >> level, 1u );
+      region.extent.depth                  = 1;
+    }
+    vkCmdCopyImage( commandBuffer,
+                    *movable.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    *move.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    regions.size(), regions.data() );
+
+    barriers[0].oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].newLayout     = info.layout;
+    barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barriers[1].oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].newLayout     = info.layout;
+    barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier( commandBuffer,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                          0, 0, nullptr, 0, nullptr, 2, barriers );
+  }
+
+  // Swap the finished copies into their owners' slots and retire the old
+  // resources past the last frame recorded with them
+  void apply( uint64_t frame )
+  {
+    VkDevice device = this->device;
+    for ( auto& move : this->pending )
+    {
+      Movable& movable = this->movables[ move.movable ];
+      move.memory->swap( *movable.memory );
+      std::shared_ptr<MemoryAllocation> memory = move.memory;
+
+      if ( movable.buffer )
+      {
+        VkBuffer buffer = movable.buffer->release();
+        *&*movable.buffer = move.buffer->release();
+        this->retired.retire( frame - 1, movable.size,
+                              std::shared_ptr<void>( nullptr, [=]( void* )
+        {
+          vkDestroyBuffer( device, buffer, nullptr );
+          memory->free();
+        } ) );
+      }
+      else
+      {
+        const MovableImageInfo& info = movable.imageInfo;
+        VkImage     image = movable.image->release();
+        VkImageView view  = movable.view->release();
+        *&*movable.image = move.image->release();
+        createImageView( device, *movable.image, info.viewType, info.format, info.aspect,
+                         0, info.mipLevels, info.layers, *movable.view );
+        this->retired.retire( frame - 1, movable.size,
+                              std::shared_ptr<void>( nullptr, [=]( void* )
+        {
+          vkDestroyImageView( device, view, nullptr );
+          vkDestroyImage( device, image, nullptr );
+          memory->free();
+        } ) );
+      }
+
+      this->stats.moves++;
+      this->stats.bytesMoved += movable.size;
+    }
+
+    this->pending.clear();
+    this->moved = true;
+  }
+};
+
+#endif
@@ -38,6 +38,13 @@ public:
     return object;
   }
 
+  // Give up the object without destroying it
+  T release() {
+    T released = object;
+    object = VK_NULL_HANDLE;
+    return released;
+  }
+
 private:
   T object{ VK_NULL_HANDLE };
   std::function<void( T )> deleter;
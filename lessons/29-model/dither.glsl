@@ -0,0 +1,14 @@
+// 4x4 ordered dither for the mesh to impostor cross-fade, included by every
+// shader that takes part. The mesh discards the pixels whose threshold is
+// above its visibility and the impostor the others, so the two draws cover
+// complementary pixels. Discards depending on it are not uniform within a
+// quad, so implicit derivatives must be used before them.
+float ditherThreshold(vec2 fragCoord)
+{
+  const float bayer[16] = float[](  0.0,  8.0,  2.0, 10.0,
+                                   12.0,  4.0, 14.0,  6.0,
+                                    3.0, 11.0,  1.0,  9.0,
+                                   15.0,  7.0, 13.0,  5.0 );
+  ivec2 p = ivec2(fragCoord) & 3;
+  return (bayer[p.y * 4 + p.x] + 0.5) / 16.0;
+}
@@ -0,0 +1,248 @@
+#ifndef __FEEDBACK_HPP__
+#define __FEEDBACK_HPP__
+
+#include <algorithm>
+#include <chrono>
+#include "base-includes.hpp"
+#include "deleter.hpp"
+#include "buffer.hpp"
+
+// Mip level feedback written by shader.frag built with TEXTURE_FEEDBACK
+// (feedback-frag.spv). The framebuffer is split into tiles and one pixel
+// per tile, moved every frame, records which texture layer it sampled and
+// the level of detail textureQueryLod computed, so the shader writes at
+// most one word per tile. Every
+// swapchain image has its own slot, read back once that image's frame fence
+// has signalled; collecting never waits for the GPU.
+
+const uint32_t FEEDBACK_MAX_LEVELS = 16;
+const uint32_t FEEDBACK_ALL_LAYERS = ~0u;
+
+struct FeedbackMetrics
+{
+  uint64_t     frames        = 0; // Slots read back
+  uint64_t     samples       = 0;
+  VkDeviceSize bytesPerFrame = 0;
+  float        averageCollectMs = 0.0f;
+  float        maxCollectMs     = 0.0f;
+};
+
+class TextureFeedback
+{
+public:
+  TextureFeedback( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : buffer { device, vkDestroyBuffer },
+      memory { allocator, MEMORY_CATEGORY_READBACK, "texture feedback" },
+      device { device }
+  {
+  }
+
+  VDeleter<VkBuffer> buffer;
+  MemoryAllocation   memory;
+
+  // One slot per swapchain image for a framebuffer of extent; the device
+  // must be idle
+  void create( VkPhysicalDevice physical, VkExtent2D extent, uint32_t tileSize, uint32_t slotCount )
+  {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties( physical, &properties );
+    VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+
+    this->tileSize  = tileSize;
+    this->columns   = ( extent.width + tileSize - 1 ) / tileSize;
+    this->rows      = ( extent.height + tileSize - 1 ) / tileSize;
+    this->slotRange = ( 4 + this->columns * this->rows ) * sizeof( uint32_t );
+    this->slotSize  = ( this->slotRange + alignment - 1 ) / alignment * alignment;
+    this->slots.assign( slotCount, Slot() );
+
+    createBuffer( this->device,
+                  physical,
+                  this->slotSize * slotCount,
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  MEMORY_USAGE_READBACK,
+                  this->buffer,
+                  this->memory );
+    this->data = (uint8_t*)this->memory.map();
+
+    for ( uint32_t s = 0; s < slotCount; s++ )
+    {
+      this->writeParams( s );
+    }
+  }
+
+  // Range of one slot, for the dynamic storage buffer descriptor
+  VkDeviceSize range() const
+  {
+    return this->slotRange;
+  }
+
+  uint32_t dynamicOffset( uint32_t slot ) const
+  {
+    return slot * this->slotSize;
+  }
+
+  // Record clearing the slot before the frame's fragments write it
+  void recordClear( VkCommandBuffer commandBuffer, uint32_t slot ) const
+  {
+    vkCmdFillBuffer( commandBuffer, this->buffer, this->dynamicOffset( slot ) + 4 * sizeof( uint32_t ),
+                     this->columns * this->rows * sizeof( uint32_t ), 0 );
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask       = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer              = this->buffer;
+    barrier.offset              = this->dynamicOffset( slot );
+    barrier.size                = this->slotRange;
+    vkCmdPipelineBarrier( commandBuffer,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                          0, 0, nullptr, 1, &barrier, 0, nullptr );
+  }
+
+  // The slot's frame has been submitted; levelOffset turns the levels it
+  // records, which are relative to the texture view, into absolute ones
+  void submitted( uint32_t slot, uint32_t levelOffset )
+  {
+    this->slots[slot].pending     = true;
+    this->slots[slot].levelOffset = levelOffset;
+  }
+
+  // Fold a slot into the demand histograms. Its frame fence must have
+  // signalled. Also moves the slot's sample pixel for its next frame.
+  void collect( uint32_t slot )
+  {
+    if ( !this->slots[slot].pending )
+    {
+      return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    const uint32_t* tiles = this->slotData( slot ) + 4;
+    for ( uint32_t t = 0; t < this->columns * this->rows; t++ )
+    {
+      if ( tiles[t] == 0 )
+      {
+        continue;
+      }
+
+      uint32_t layer = tiles[t] >> 8;
+      uint32_t level = std::min( ( tiles[t] & 0xFF ) - 1 + this->slots[slot].levelOffset,
+                                 FEEDBACK_MAX_LEVELS - 1 );
+      if ( layer >= this->histograms.size() )
+      {
+        this->histograms.resize( layer + 1, Histogram() );
+      }
+      this->histograms[layer].counts[level]++;
+      this->counters.samples++;
+    }
+
+    this->slots[slot].pending = false;
+    this->writeParams( slot );
+
+    float ms = std::chrono::duration<float, std::milli>(
+                 std::chrono::high_resolution_clock::now() - start ).count();
+    this->collectMs              += ms;
+    this->counters.maxCollectMs   = std::max( this->counters.maxCollectMs, ms );
+    this->counters.frames++;
+  }
+
+  // Finest level that all but ignoreShare of the samples of layer (or of
+  // every layer) are satisfied with. Returns false if there were none.
+  bool demandedLevel( uint32_t layer, float ignoreShare, uint32_t& level ) const
+  {
+    uint32_t counts[ FEEDBACK_MAX_LEVELS ] = {};
+    uint64_t total = 0;
+    for ( uint32_t l = 0; l < this->histograms.size(); l++ )
+    {
+      if ( layer != FEEDBACK_ALL_LAYERS && l != layer )
+      {
+        continue;
+      }
+      for ( uint32_t i = 0; i < FEEDBACK_MAX_LEVELS; i++ )
+      {
+        counts[i] += this->histograms[l].counts[i];
+        total     += this->histograms[l].counts[i];
+      }
+    }
+
+    if ( total == 0 )
+    {
+      return false;
+    }
+
+    uint64_t ignored = 0;
+    for ( level = 0; level + 1 < FEEDBACK_MAX_LEVELS; level++ )
+    {
+      ignored += counts[level];
+      if ( ignored > total * ignoreShare )
+      {
+        break;
+      }
+    }
+    return true;
+  }
+
+  // Start a new demand window
+  void resetDemand()
+  {
+    this->histograms.clear();
+  }
+
+  FeedbackMetrics metrics() const
+  {
+    FeedbackMetrics metrics  = this->counters;
+    metrics.bytesPerFrame    = this->slotRange;
+    metrics.averageCollectMs = metrics.frames > 0 ? this->collectMs / metrics.frames : 0.0f;
+    return metrics;
+  }
+
+private:
+  struct Slot
+  {
+    bool     pending     = false;
+    uint32_t levelOffset = 0;
+    uint32_t frame       = 0; // Moves the sample pixel
+  };
+
+  struct Histogram
+  {
+    uint32_t counts[ FEEDBACK_MAX_LEVELS ] = {};
+  };
+
+  const VDeleter<VkDevice>& device;
+  uint8_t*                  data      = nullptr;
+  uint32_t                  tileSize  = 1;
+  uint32_t                  columns   = 0;
+  uint32_t                  rows      = 0;
+  VkDeviceSize              slotRange = 0;
+  VkDeviceSize              slotSize  = 0;
+  std::vector<Slot>         slots;
+  std::vector<Histogram>    histograms;
+  FeedbackMetrics           counters;
+  float                     collectMs = 0.0f;
+
+  uint32_t* slotData( uint32_t slot )
+  {
+    return (uint32_t*)( this->data + this->dynamicOffset( slot ) );
+  }
+
+  // Sample pixel within each tile, the tile column count and the tile size,
+  // read by feedback-frag.spv. The pixel walks the tile in a scrambled
+  // order so small objects are eventually seen.
+  void writeParams( uint32_t slot )
+  {
+    uint32_t pixel = ( this->slots[slot].frame++ * 7919u ) % ( this->tileSize * this->tileSize );
+
+    uint32_t* params = this->slotData( slot );
+    params[0] = pixel % this->tileSize;
+    params[1] = pixel / this->tileSize;
+    params[2] = this->columns;
+    params[3] = this->tileSize;
+  }
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef __FRAMES_HPP__
+#define __FRAMES_HPP__
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include "base-includes.hpp"
+#include "deleter.hpp"
+
+// Numbers every submitted frame and learns which have finished through a
+// fence per frame in flight. At most a fixed number of frames are in flight;
+// each of them has its own fence and its own pair of semaphores for image
+// acquisition and presentation, so no semaphore is signalled again before
+// its previous wait has been consumed. Swapchain images may be handed out
+// in any order, so the fence of the frame that last drew to an image is
+// remembered too: each image has its own prerecorded command buffer and
+// per frame data, which must not be reused while that frame is pending.
+class FrameFences
+{
+public:
+  FrameFences( const VDeleter<VkDevice>& device )
+    : device { device }
+  {
+  }
+
+  // Number of the frame being recorded; frames start at 1
+  uint64_t frame = 1;
+
+  // Recreate the per frame objects for framesInFlight frames drawing to
+  // imageCount images; the device must be idle
+  void resize( uint32_t framesInFlight, uint32_t imageCount )
+  {
+    this->fences.clear();
+    this->fences.resize( framesInFlight, VDeleter<VkFence>( this->device, vkDestroyFence ) );
+    this->imageAvailable.clear();
+    this->imageAvailable.resize( framesInFlight,
+                                 VDeleter<VkSemaphore>( this->device, vkDestroySemaphore ) );
+    this->renderFinished.clear();
+    this->renderFinished.resize( framesInFlight,
+                                 VDeleter<VkSemaphore>( this->device, vkDestroySemaphore ) );
+    this->frames.assign( framesInFlight, 0 );
+    this->imageSlots.assign( imageCount, uint32_t( NO_SLOT ) );
+    this->slot = 0;
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for ( uint32_t i = 0; i < framesInFlight; i++ )
+    {
+      if ( vkCreateFence( this->device, &fenceInfo, nullptr, &this->fences[i] ) != VK_SUCCESS )
+      {
+        throw std::runtime_error( "Failed to create frame fence!" );
+      }
+      if ( vkCreateSemaphore( this->device, &semaphoreInfo, nullptr,
+                              &this->imageAvailable[i] ) != VK_SUCCESS ||
+           vkCreateSemaphore( this->device, &semaphoreInfo, nullptr,
+                              &this->renderFinished[i] ) != VK_SUCCESS )
+      {
+        throw std::runtime_error( "Failed to create semaphore!" );
+      }
+    }
+  }
+
+  // Wait until the frame that last used this frame's slot has finished,
+  // which caps the frames in flight. Returns the semaphore the image
+  // acquisition signals and the submission waits on.
+  VkSemaphore begin()
+  {
+    this->wait( this->slot );
+    return this->imageAvailable[this->slot];
+  }
+
+  // Semaphore the submission signals and presentation waits on
+  VkSemaphore renderFinishedSemaphore() const
+  {
+    return this->renderFinished[this->slot];
+  }
+
+  // Wait for the previous frame drawn to image, which may have used another
+  // slot, then hand out this frame's fence for its submission. Call after
+  // begin once the image is known; the fence is only reset here, so a frame
+  // abandoned before acquiring an image leaves it signalled.
+  VkFence acquire( uint32_t image )
+  {
+    if ( this->imageSlots[image] != NO_SLOT )
+    {
+      this->wait( this->imageSlots[image] );
+    }
+    this->imageSlots[image] = this->slot;
+
+    VkFence fence[] = { this->fences[this->slot] };
+    vkResetFences( this->device, 1, fence );
+    this->frames[this->slot] = this->frame;
+    return fence[0];
+  }
+
+  // Call once the frame's submission has been made
+  void advance()
+  {
+    this->frame++;
+    this->slot = ( this->slot + 1 ) % this->fences.size();
+  }
+
+  // Latest frame the GPU has finished. Queue submissions complete in order,
+  // so every earlier frame has finished too.
+  uint64_t completedFrame()
+  {
+    for ( size_t i = 0; i < this->fences.size(); i++ )
+    {
+      if ( this->frames[i] > this->completed &&
+           vkGetFenceStatus( this->device, this->fences[i] ) == VK_SUCCESS )
+      {
+        this->completed = this->frames[i];
+      }
+    }
+
+    return this->completed;
+  }
+
+  // Everything submitted so far has finished, e.g. after vkDeviceWaitIdle
+  void idle()
+  {
+    this->completed = this->frame - 1;
+  }
+
+private:
+  static const uint32_t NO_SLOT = std::numeric_limits<uint32_t>::max();
+
+  const VDeleter<VkDevice>&          device;
+  std::vector<VDeleter<VkFence>>     fences;
+  std::vector<VDeleter<VkSemaphore>> imageAvailable;
+  std::vector<VDeleter<VkSemaphore>> renderFinished;
+  std::vector<uint64_t>              frames;     // Frame last submitted with each fence
+  std::vector<uint32_t>              imageSlots; // Slot of the frame last drawn to each image
+  uint32_t                           slot      = 0;
+  uint64_t                           completed = 0;
+
+  void wait( uint32_t slot )
+  {
+    VkFence fence[] = { this->fences[slot] };
+    vkWaitForFences( this->device, 1, fence, VK_TRUE, std::numeric_limits<uint64_t>::max() );
+    this->completed = std::max( this->completed, this->frames[slot] );
+  }
+};
+
+// Objects replaced while frames that may still use them are in flight.
+// Each is released once the last frame that could reference it completes.
+class DeferredDestroyQueue
+{
+public:
+  VkDeviceSize pendingBytes = 0;
+
+  void retire( uint64_t frame, VkDeviceSize bytes, std::shared_ptr<void> object )
+  {
+    this->retired.push_back( Retired { frame, bytes, object } );
+    this->pendingBytes += bytes;
+  }
+
+  // Release everything retired up to completedFrame; returns how many
+  size_t collect( uint64_t completedFrame )
+  {
+    size_t count = 0;
+    while ( !this->retired.empty() && this->retired.front().frame <= completedFrame )
+    {
+      this->pendingBytes -= this->retired.front().bytes;
+      this->retired.pop_front();
+      count++;
+    }
+    return count;
+  }
+
+private:
+  struct Retired
+  {
+    uint64_t              frame;
+    VkDeviceSize          bytes;
+    std::shared_ptr<void> object;
+  };
+
+  std::deque<Retired> retired;
+};
+
+#endif
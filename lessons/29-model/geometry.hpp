@@ -0,0 +1,293 @@
+#ifndef __GEOMETRY_HPP__
+#define __GEOMETRY_HPP__
+
+#include <cstring>
+#include <iostream>
+#include "base-includes.hpp"
+#include "buffer.hpp"
+#include "upload.hpp"
+#include "vertex.hpp"
+#include "strip.hpp"
+
+// Part of a mesh small enough to be addressed with 32 bit indices
+// and to fit in a single geometry page
+struct MeshChunk
+{
+  std::vector<Vertex>   vertices;
+  std::vector<uint32_t> indices;
+  IndexEncoding         encoding = INDEX_ENCODING_TRIANGLE_LIST;
+};
+
+// A draw of one chunk, located by page and element offsets into that page
+struct GeometryDraw
+{
+  uint32_t      page;
+  uint32_t      firstIndex;
+  uint32_t      indexCount;
+  int32_t       vertexOffset;
+  IndexEncoding encoding;
+};
+
+// Vertex and index buffer pair holding one or more chunks
+struct GeometryPage
+{
+  GeometryPage( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : vertexBuffer       { device, vkDestroyBuffer },
+      vertexBufferMemory { allocator, MEMORY_CATEGORY_GEOMETRY, "geometry page vertices" },
+      indexBuffer        { device, vkDestroyBuffer },
+      indexBufferMemory  { allocator, MEMORY_CATEGORY_GEOMETRY, "geometry page indices" }
+  {
+  }
+
+  VDeleter<VkBuffer>       vertexBuffer;
+  MemoryAllocation         vertexBufferMemory;
+  VDeleter<VkBuffer>       indexBuffer;
+  MemoryAllocation         indexBufferMemory;
+
+  VkDeviceSize             vertexBytes = 0;
+  VkDeviceSize             indexBytes  = 0;
+};
+
+struct GeometryLimits
+{
+  VkDeviceSize pageSize;
+  uint64_t     maxChunkVertices;
+  uint64_t     maxChunkIndices;
+};
+
+// Clamp the requested page size to what a single buffer and allocation can
+// hold on this device, and derive the largest chunk that fits in a page
+GeometryLimits queryGeometryLimits( VkPhysicalDevice physical,
+                                    VkDeviceSize     requestedPageSize )
+{
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties( physical, &props );
+
+  VkPhysicalDeviceMemoryProperties memprops;
+  vkGetPhysicalDeviceMemoryProperties( physical, &memprops );
+
+  GeometryLimits limits;
+  limits.pageSize = std::min<VkDeviceSize>( requestedPageSize,
+                                            props.limits.maxStorageBufferRange );
+
+  // A page should never claim more than a quarter of the device local heap
+  for ( uint32_t i = 0; i < memprops.memoryHeapCount; i++ )
+  {
+    if ( memprops.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT )
+    {
+      limits.pageSize = std::min<VkDeviceSize>( limits.pageSize,
+                                                memprops.memoryHeaps[i].size / 4 );
+    }
+  }
+
+  // Index values must stay below both the draw limit and the restart index
+  limits.maxChunkVertices = std::min<uint64_t>( limits.pageSize / sizeof( Vertex ),
+                                                props.limits.maxDrawIndexedIndexValue );
+  limits.maxChunkVertices = std::min<uint64_t>( limits.maxChunkVertices,
+                                                PRIMITIVE_RESTART_INDEX );
+  limits.maxChunkIndices  = ( limits.pageSize / sizeof( uint32_t ) ) / 3 * 3;
+
+  return limits;
+}
+
+// Split a triangle list of indexCount 64 bit indices into chunks of at most
+// maxVertices vertices and maxIndices indices, rebasing each chunk's
+// indices to 32 bit. Vertices shared across a chunk boundary are duplicated.
+// Indices and vertices are read through indexAt( i ) and vertexAt( index ),
+// and each chunk is handed to emit( MeshChunk&& ) once it is full, so
+// streams larger than memory can be split. At least one chunk is emitted.
+template < typename IndexAt, typename VertexAt, typename Emit >
+void splitMeshStream( uint64_t indexCount,
+                      IndexAt  indexAt,
+                      VertexAt vertexAt,
+                      uint64_t maxVertices,
+                      uint64_t maxIndices,
+                      Emit     emit )
+{
+  MeshChunk                              chunk;
+  std::unordered_map<uint64_t, uint32_t> localIndex;
+  const uint64_t                         NOT_FOUND = ~0ull;
+
+  // Neighbouring triangles mostly share an edge, so the previous triangle
+  // answers most lookups without hashing
+  uint64_t previous[3]      = { NOT_FOUND, NOT_FOUND, NOT_FOUND };
+  uint64_t previousLocal[3] = { 0, 0, 0 };
+
+  if ( maxVertices < 3 || maxIndices < 3 )
+  {
+    throw std::runtime_error( "Geometry page is too small to hold a triangle!" );
+  }
+
+  for ( uint64_t i = 0; i + 2 < indexCount; i += 3 )
+  {
+    uint64_t triangle[3] = { indexAt( i ), indexAt( i + 1 ), indexAt( i + 2 ) };
+
+    // Count how many new vertices this triangle would add to the chunk,
+    // keeping what was found for when it fits
+    uint64_t local[3];
+    uint64_t newVertices = 0;
+    for ( uint64_t k = 0; k < 3; k++ )
+    {
+      local[k] = triangle[k] == previous[0] ? previousLocal[0] :
+                 triangle[k] == previous[1] ? previousLocal[1] :
+                 triangle[k] == previous[2] ? previousLocal[2] : NOT_FOUND;
+      if ( local[k] == NOT_FOUND )
+      {
+        auto it  = localIndex.find( triangle[k] );
+        local[k] = it != localIndex.end() ? it->second : NOT_FOUND;
+      }
+      if ( local[k] == NOT_FOUND )
+      {
+        newVertices++;
+      }
+    }
+
+    if ( chunk.vertices.size() + newVertices > maxVertices ||
+         chunk.indices.size() + 3 > maxIndices )
+    {
+      emit( std::move( chunk ) );
+      chunk = MeshChunk();
+      localIndex.clear();
+      local[0] = local[1] = local[2] = NOT_FOUND;
+    }
+
+    for ( uint64_t k = 0; k < 3; k++ )
+    {
+      if ( local[k] == NOT_FOUND )
+      {
+        // Looked up again in case it repeats an earlier vertex of the triangle
+        auto inserted = localIndex.insert( std::make_pair( triangle[k], (uint32_t)chunk.vertices.size() ) );
+        if ( inserted.second )
+        {
+          chunk.vertices.push_back( vertexAt( triangle[k] ) );
+        }
+        local[k] = inserted.first->second;
+      }
+      chunk.indices.push_back( (uint32_t)local[k] );
+      previous[k]      = triangle[k];
+      previousLocal[k] = local[k];
+    }
+  }
+
+  emit( std::move( chunk ) );
+}
+
+std::vector<MeshChunk> splitMesh( const std::vector<Vertex>&   vertices,
+                                  const std::vector<uint64_t>& indices,
+                                  uint64_t                     maxVertices,
+                                  uint64_t                     maxIndices )
+{
+  std::vector<MeshChunk> chunks;
+  splitMeshStream( indices.size(),
+                   [&indices]( uint64_t i ) { return indices[i]; },
+                   [&vertices]( uint64_t index ) -> const Vertex& { return vertices[index]; },
+                   maxVertices,
+                   maxIndices,
+                   [&chunks]( MeshChunk&& chunk ) { chunks.push_back( std::move( chunk ) ); } );
+  return chunks;
+}
+
+// Pack chunks into pages of at most pageSize bytes each, record their
+// upload, and return one draw per chunk
+void createGeometryPages( VkPhysicalDevice               physical,
+                          const VDeleter<VkDevice>&      device,
+                          UploadContext&                 upload,
+                          const std::vector<MeshChunk>&  chunks,
+                          VkDeviceSize                   pageSize,
+                          std::vector<GeometryPage>&     pages,
+                          std::vector<GeometryDraw>&     draws )
+{
+  // Assign chunks to pages first so the page list never reallocates
+  // while it owns live buffers
+  std::vector<VkDeviceSize> vertexBytes( 1, 0 );
+  std::vector<VkDeviceSize> indexBytes( 1, 0 );
+
+  draws.clear();
+  for ( const auto& chunk : chunks )
+  {
+    VkDeviceSize chunkVertexBytes = chunk.vertices.size() * sizeof( Vertex );
+    VkDeviceSize chunkIndexBytes  = chunk.indices.size() * sizeof( uint32_t );
+
+    if ( vertexBytes.back() + chunkVertexBytes > pageSize ||
+         indexBytes.back() + chunkIndexBytes > pageSize )
+    {
+      vertexBytes.push_back( 0 );
+      indexBytes.push_back( 0 );
+    }
+
+    GeometryDraw draw;
+    draw.page         = vertexBytes.size() - 1;
+    draw.firstIndex   = indexBytes.back() / sizeof( uint32_t );
+    draw.indexCount   = chunk.indices.size();
+    draw.vertexOffset = vertexBytes.back() / sizeof( Vertex );
+    draw.encoding     = chunk.encoding;
+    draws.push_back( draw );
+
+    vertexBytes.back() += chunkVertexBytes;
+    indexBytes.back()  += chunkIndexBytes;
+  }
+
+  pages.clear();
+  pages.resize( vertexBytes.size(), GeometryPage( device, upload.allocator ) );
+
+  for ( uint32_t p = 0; p < pages.size(); p++ )
+  {
+    GeometryPage& page = pages[p];
+    page.vertexBytes = vertexBytes[p];
+    page.indexBytes  = indexBytes[p];
+
+    if ( page.vertexBytes == 0 )
+    {
+      continue;
+    }
+
+    // Write the page's chunks back to back, in place when the device
+    // allows it and through staging otherwise
+    BufferWrite vertices = upload.beginBufferWrite( physical,
+                                                    "geometry page vertices",
+                                                    page.vertexBytes,
+                                                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                                                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                    page.vertexBuffer,
+                                                    page.vertexBufferMemory );
+    BufferWrite indices  = upload.beginBufferWrite( physical,
+                                                    "geometry page indices",
+                                                    page.indexBytes,
+                                                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                                                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                    page.indexBuffer,
+                                                    page.indexBufferMemory );
+    for ( uint32_t c = 0; c < chunks.size(); c++ )
+    {
+      if ( draws[c].page != p )
+      {
+        continue;
+      }
+
+      std::memcpy( (char*)vertices.data + draws[c].vertexOffset * sizeof( Vertex ),
+                   chunks[c].vertices.data(),
+                   chunks[c].vertices.size() * sizeof( Vertex ) );
+      std::memcpy( (char*)indices.data + draws[c].firstIndex * sizeof( uint32_t ),
+                   chunks[c].indices.data(),
+                   chunks[c].indices.size() * sizeof( uint32_t ) );
+    }
+
+    upload.finishBufferWrite( physical, vertices );
+    upload.finishBufferWrite( physical, indices );
+  }
+
+  // Later commands in the same submission may already draw from the pages
+  VkMemoryBarrier barrier = {};
+  barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+  vkCmdPipelineBarrier( upload.commandBuffer,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                        0, 1, &barrier, 0, nullptr, 0, nullptr );
+
+  std::cout << "Geometry: " << chunks.size() << " chunks in "
+            << pages.size() << " pages of up to " << pageSize << " bytes" << std::endl;
+}
+
+#endif
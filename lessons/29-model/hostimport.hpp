@@ -0,0 +1,358 @@
+#ifndef __HOSTIMPORT_HPP__
+#define __HOSTIMPORT_HPP__
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include "base-includes.hpp"
+#include "deleter.hpp"
+#include "buffer.hpp"
+#include "texcook.hpp"
+#include "upload.hpp"
+#include "vkextensions.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Zero-copy uploads from cooked files. With VK_EXT_external_memory_host a
+// file mapping is imported as device memory and the GPU copies straight
+// out of the page cache, skipping the read into staging memory. Anything
+// that cannot be imported goes through staging as before.
+
+// A whole file mapped at an address aligned for importing. Pages past the
+// end of the file are not backed, so only ranges within the file may be
+// imported; cooked files are padded to COOKED_FILE_ALIGNMENT for that.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  MappedFile( const MappedFile& ) = delete;
+  MappedFile& operator=( const MappedFile& ) = delete;
+
+  ~MappedFile()
+  {
+#ifndef _WIN32
+    if ( this->data != nullptr )
+    {
+      munmap( this->data, this->size );
+    }
+#endif
+  }
+
+  char*    data = nullptr;
+  uint64_t size = 0; // Of the file
+
+  // Returns false if the file cannot be mapped
+  bool map( const std::string& path, VkDeviceSize alignment )
+  {
+#ifdef _WIN32
+    return false;
+#else
+    int fd = open( path.c_str(), O_RDONLY );
+    if ( fd < 0 )
+    {
+      return false;
+    }
+
+    struct stat info;
+    if ( fstat( fd, &info ) != 0 || info.st_size == 0 )
+    {
+      close( fd );
+      return false;
+    }
+    this->size = info.st_size;
+
+    // Reserve enough address space to place the file at an aligned address.
+    // The mapping is private and writable because some drivers pin
+    // imported pages for writing; the file itself is never changed.
+    char* reserved = (char*)mmap( nullptr, this->size + alignment, PROT_NONE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( reserved == MAP_FAILED )
+    {
+      close( fd );
+      return false;
+    }
+
+    char* aligned = (char*)( ( (uintptr_t)reserved + alignment - 1 ) & ~(uintptr_t)( alignment - 1 ) );
+    void* mapped  = mmap( aligned, this->size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_FIXED, fd, 0 );
+    close( fd );
+
+    if ( mapped == MAP_FAILED )
+    {
+      munmap( reserved, this->size + alignment );
+      return false;
+    }
+
+    // Give back the reservation around the file
+    if ( aligned > reserved )
+    {
+      munmap( reserved, aligned - reserved );
+    }
+    char* tail = aligned + this->size;
+    char* end  = reserved + this->size + alignment;
+    if ( end > tail )
+    {
+      munmap( tail, end - tail );
+    }
+
+    this->data = aligned;
+    return true;
+#endif
+  }
+};
+
+// A range of a file imported as a transfer source. Members are destroyed
+// in reverse order, so the memory is freed before the file is unmapped.
+struct HostImportedRange
+{
+  HostImportedRange( const VDeleter<VkDevice>& device )
+    : memory { device, vkFreeMemory },
+      buffer { device, vkDestroyBuffer }
+  {
+  }
+
+  MappedFile               file;
+  VDeleter<VkDeviceMemory> memory;
+  VDeleter<VkBuffer>       buffer;
+  VkDeviceSize             offset = 0; // Of the requested range within buffer
+};
+
+class HostImporter
+{
+public:
+  HostImporter( const VDeleter<VkDevice>& device )
+    : device { device }
+  {
+  }
+
+  // Whether the instance and device extensions import needs are available;
+  // the caller enables them
+  static bool available( VkPhysicalDevice physical, bool instanceSupport )
+  {
+#ifdef VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME
+    return instanceSupport &&
+           deviceExtensionSupported( physical, VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME ) &&
+           deviceExtensionSupported( physical, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME );
+#else
+    return false;
+#endif
+  }
+
+  // After the device was created with the extensions enabled
+  void init( VkInstance instance, VkPhysicalDevice physical )
+  {
+#ifdef VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME
+    auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)
+      vkGetInstanceProcAddr( instance, "vkGetPhysicalDeviceProperties2KHR" );
+    this->getHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT)
+      vkGetDeviceProcAddr( this->device, "vkGetMemoryHostPointerPropertiesEXT" );
+    if ( getProperties2 == nullptr || this->getHostPointerProperties == nullptr )
+    {
+      return;
+    }
+
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+    hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2KHR properties2 = {};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties2.pNext = &hostProperties;
+    getProperties2( physical, &properties2 );
+
+    this->physical  = physical;
+    this->alignment = std::max<VkDeviceSize>( hostProperties.minImportedHostPointerAlignment, 1 );
+    this->enabled   = true;
+#endif
+  }
+
+  bool supported() const
+  {
+    return this->enabled;
+  }
+
+  // Import [offset, offset + size) of the file at path as a buffer the GPU
+  // can copy from. Returns null, and the caller stages instead, when
+  // importing is unsupported or fails. Safe to call from any thread.
+  std::shared_ptr<HostImportedRange> import( const std::string& path, uint64_t offset, uint64_t size ) const
+  {
+#ifdef VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME
+    if ( !this->enabled )
+    {
+      return nullptr;
+    }
+
+    std::shared_ptr<HostImportedRange> range = std::make_shared<HostImportedRange>( this->device );
+    if ( !range->file.map( path, this->alignment ) )
+    {
+      return nullptr;
+    }
+
+    // Both ends of the imported range are aligned and must stay in the file
+    VkDeviceSize begin = offset / this->alignment * this->alignment;
+    VkDeviceSize end   = ( offset + size + this->alignment - 1 ) / this->alignment * this->alignment;
+    if ( end > range->file.size )
+    {
+      return nullptr;
+    }
+    range->offset = offset - begin;
+
+    VkMemoryHostPointerPropertiesEXT pointerProperties = {};
+    pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    if ( this->getHostPointerProperties( this->device,
+                                         VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+                                         range->file.data + begin,
+                                         &pointerProperties ) != VK_SUCCESS )
+    {
+      return nullptr;
+    }
+
+    VkExternalMemoryBufferCreateInfoKHR externalInfo = {};
+    externalInfo.sType       = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO_KHR;
+    externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.pNext       = &externalInfo;
+    bufferInfo.size        = end - begin;
+    bufferInfo.usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if ( vkCreateBuffer( this->device, &bufferInfo, nullptr, &range->buffer ) != VK_SUCCESS )
+    {
+      return nullptr;
+    }
+
+    VkMemoryRequirements memreqs;
+    vkGetBufferMemoryRequirements( this->device, range->buffer, &memreqs );
+
+    VkImportMemoryHostPointerInfoEXT importInfo = {};
+    importInfo.sType        = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType   = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    importInfo.pHostPointer = range->file.data + begin;
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType          = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext          = &importInfo;
+    allocInfo.allocationSize = end - begin;
+
+    if ( memreqs.size > end - begin ||
+         !findMemoryTypeIndex( this->physical, memreqs.memoryTypeBits & pointerProperties.memoryTypeBits,
+                               0, allocInfo.memoryTypeIndex ) ||
+         vkAllocateMemory( this->device, &allocInfo, nullptr, &range->memory ) != VK_SUCCESS )
+    {
+      return nullptr;
+    }
+
+    vkBindBufferMemory( this->device, range->buffer, range->memory, 0 );
+    return range;
+#else
+    return nullptr;
+#endif
+  }
+
+private:
+  const VDeleter<VkDevice>& device;
+  VkPhysicalDevice          physical  = VK_NULL_HANDLE;
+  VkDeviceSize              alignment = 1;
+  bool                      enabled   = false;
+#ifdef VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME
+  PFN_vkGetMemoryHostPointerPropertiesEXT getHostPointerProperties = nullptr;
+#endif
+};
+
+// Upload every level of a cooked file repetitions times through each path,
+// copying into a scratch device local buffer and waiting for every copy,
+// and print the averages. The file is read through the page cache both
+// ways, so after the first pass this measures the copies themselves.
+void benchmarkHostImport( const VDeleter<VkDevice>& device,
+                          DeviceMemoryAllocator&    allocator,
+                          VkQueue                   queue,
+                          VkCommandPool             commandPool,
+                          VkPhysicalDevice          physical,
+                          const HostImporter&       importer,
+                          const std::string&        path,
+                          const CookedTexture&      cooked,
+                          uint32_t                  repetitions )
+{
+  uint64_t offset, size;
+  cookedLevelRange( cooked, 0, cooked.levels.size(), offset, size );
+
+  // A context of its own keeps the benchmark out of the upload statistics
+  UploadContext upload { device, allocator };
+
+  VDeleter<VkBuffer>       scratch       { device, vkDestroyBuffer };
+  MemoryAllocation         scratchMemory { allocator, MEMORY_CATEGORY_TEXTURE, "host import benchmark" };
+  createBuffer( device,
+                physical,
+                size,
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                MEMORY_USAGE_GPU_ONLY,
+                scratch,
+                scratchMemory );
+
+  const char* names[] = { "staged", "imported" };
+  for ( uint32_t imported = 0; imported < 2; imported++ )
+  {
+    if ( imported && !importer.supported() )
+    {
+      std::cout << "Host import benchmark: VK_EXT_external_memory_host unavailable" << std::endl;
+      break;
+    }
+
+    float prepareMs = 0.0f;
+    float totalMs   = 0.0f;
+    for ( uint32_t r = 0; r < repetitions; r++ )
+    {
+      auto start = std::chrono::high_resolution_clock::now();
+      upload.begin( commandPool );
+
+      VkBuffer     source;
+      VkDeviceSize sourceOffset = 0;
+      if ( imported )
+      {
+        std::shared_ptr<HostImportedRange> range = importer.import( path, cooked.dataOffset + offset, size );
+        if ( !range )
+        {
+          throw std::runtime_error( "Failed to import " + path + "!" );
+        }
+        upload.owned.push_back( range );
+        source       = range->buffer;
+        sourceOffset = range->offset;
+      }
+      else
+      {
+        StagingRange staging = upload.createStagingBuffer( physical, size );
+        source       = staging.buffer;
+        sourceOffset = staging.offset;
+        if ( !readCookedLevels( path, cooked, 0, cooked.levels.size(), (char*)staging.data ) )
+        {
+          throw std::runtime_error( "Failed to read " + path + "!" );
+        }
+      }
+      auto prepared = std::chrono::high_resolution_clock::now();
+
+      VkBufferCopy region = {};
+      region.srcOffset = sourceOffset;
+      region.dstOffset = 0;
+      region.size      = size;
+      vkCmdCopyBuffer( upload.commandBuffer, source, scratch, 1, &region );
+      upload.flush( queue );
+
+      auto end = std::chrono::high_resolution_clock::now();
+      prepareMs += std::chrono::duration<float, std::milli>( prepared - start ).count();
+      totalMs   += std::chrono::duration<float, std::milli>( end - start ).count();
+    }
+
+    std::cout << "Host import benchmark: " << size << " bytes " << names[imported] << " in "
+              << totalMs / repetitions << " ms ("
+              << prepareMs / repetitions << " ms preparing the source, "
+              << size / ( totalMs / repetitions * 1e6f ) << " GB/s)" << std::endl;
+  }
+}
+
+#endif
@@ -5,20 +5,24 @@
 
 void createImageView( VkDevice               device,
                       VkImage                image,
+                      VkImageViewType        viewType,
                       VkFormat               format,
                       VkImageAspectFlags     aspectFlags,
+                      uint32_t               baseMipLevel,
+                      uint32_t               mipLevels,
+                      uint32_t               arrayLayers,
                       VDeleter<VkImageView>& imageView )
 {
   VkImageViewCreateInfo viewInfo = {};
   viewInfo.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
   viewInfo.image                           = image;
-  viewInfo.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.viewType                        = viewType;
   viewInfo.format                          = format;
   viewInfo.subresourceRange.aspectMask     = aspectFlags;
-  viewInfo.subresourceRange.baseMipLevel   = 0;
-  viewInfo.subresourceRange.levelCount     = 1;
+  viewInfo.subresourceRange.baseMipLevel   = baseMipLevel;
+  viewInfo.subresourceRange.levelCount     = mipLevels;
   viewInfo.subresourceRange.baseArrayLayer = 0;
-  viewInfo.subresourceRange.layerCount     = 1;
+  viewInfo.subresourceRange.layerCount     = arrayLayers;
 
   if ( vkCreateImageView( device, &viewInfo,
                           nullptr, &imageView ) != VK_SUCCESS )
@@ -0,0 +1,21 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 1) uniform sampler2DArray texSampler;
+
+layout(location = 0) in vec3 fragViewPos;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in float fragTextureLayer;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec4 outNormalDepth;
+
+void main() {
+  // The model has no normals, so derive a facet normal from the view
+  // position. Window y points down, which puts dFdy first for the normal to
+  // face the eye.
+  vec3 normal = normalize(cross(dFdy(fragViewPos), dFdx(fragViewPos)));
+
+  outColor       = vec4(texture(texSampler, vec3(fragTexCoord, fragTextureLayer)).rgb, 1.0);
+  outNormalDepth = vec4(normal * 0.5 + 0.5, gl_FragCoord.z);
+}
@@ -0,0 +1,32 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+layout(push_constant) uniform BakeConstants
+{
+  mat4 view;
+  mat4 proj;
+} bake;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in float inTextureLayer;
+
+layout(location = 0) out vec3 fragViewPos;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out float fragTextureLayer;
+
+void main()
+{
+  vec4 viewPos = bake.view * vec4(inPosition, 1.0);
+
+  gl_Position      = bake.proj * viewPos;
+  fragViewPos      = viewPos.xyz;
+  fragTexCoord     = inTexCoord;
+  fragTextureLayer = inTextureLayer;
+}
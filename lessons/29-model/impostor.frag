@@ -0,0 +1,41 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+layout(binding = 0) uniform UniformBufferObject
+{
+  mat4 model;
+  mat4 view;
+  mat4 proj;
+} ubo;
+
+layout(binding = 1) uniform sampler2D atlasColor;
+layout(binding = 2) uniform sampler2D atlasNormalDepth;
+
+layout(location = 0) in vec2 fragAtlasCoord;
+layout(location = 1) in vec3 fragWorldPos;
+layout(location = 2) flat in vec3 fragDepthAxis;
+layout(location = 3) flat in float fragVisibility;
+
+layout(location = 0) out vec4 outColor;
+
+#include "dither.glsl"
+
+void main() {
+  vec4  color = texture(atlasColor, fragAtlasCoord);
+  float depth = texture(atlasNormalDepth, fragAtlasCoord).a;
+
+  // Draw only the pixels the mesh leaves out while cross-fading, and only
+  // where the bake covered the tile
+  if (fragVisibility >= ditherThreshold(gl_FragCoord.xy) || color.a < 0.5)
+  {
+    discard;
+  }
+
+  // The baked depth spans [-radius, radius] around the quad plane
+  vec3  surface = fragWorldPos + fragDepthAxis * (2.0 - 4.0 * depth);
+  vec4  clip    = ubo.proj * ubo.view * vec4(surface, 1.0);
+
+  gl_FragDepth = clip.z / clip.w;
+  outColor     = vec4(color.rgb, 1.0);
+}
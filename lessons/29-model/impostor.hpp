@@ -0,0 +1,745 @@
+#ifndef __IMPOSTOR_HPP__
+#define __IMPOSTOR_HPP__
+
+#include <cmath>
+#include <iostream>
+#include "base-includes.hpp"
+#include "buffer.hpp"
+#include "texture.hpp"
+#include "imgview.hpp"
+#include "sampler.hpp"
+#include "depth.hpp"
+#include "shader.hpp"
+#include "vertex.hpp"
+#include "geometry.hpp"
+#include "ubo.hpp"
+
+// Per-instance data shared by the mesh and impostor pipelines
+struct InstanceData
+{
+  glm::vec4 offsetScale; // xyz: world offset, w: uniform scale
+  glm::vec4 params;      // x: mesh visibility used for the cross-fade
+
+  static VkVertexInputBindingDescription getBindingDescription( uint32_t binding )
+  {
+    VkVertexInputBindingDescription bindingDescription = {};
+    bindingDescription.binding   = binding;
+    bindingDescription.stride    = sizeof( InstanceData );
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    return bindingDescription;
+  }
+
+  static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions( uint32_t binding,
+                                                                                    uint32_t firstLocation )
+  {
+    std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions = {};
+
+    attributeDescriptions[0].binding  = binding;
+    attributeDescriptions[0].location = firstLocation;
+    attributeDescriptions[0].format   = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescriptions[0].offset   = offsetof( InstanceData, offsetScale );
+
+    attributeDescriptions[1].binding  = binding;
+    attributeDescriptions[1].location = firstLocation + 1;
+    attributeDescriptions[1].format   = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescriptions[1].offset   = offsetof( InstanceData, params );
+
+    return attributeDescriptions;
+  }
+};
+
+struct ImpostorBakeConstants
+{
+  glm::mat4 view;
+  glm::mat4 proj;
+};
+
+struct ImpostorConstants
+{
+  glm::vec4 centerRadius;
+  glm::vec4 grid;
+};
+
+// Color and normal/depth atlas holding viewsPerSide x viewsPerSide views
+// of a mesh, laid out by octahedral encoding of the view direction
+struct ImpostorAtlas
+{
+  ImpostorAtlas( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : colorImage            { device, vkDestroyImage },
+      colorImageMemory      { allocator, MEMORY_CATEGORY_TEXTURE, "impostor atlas color" },
+      colorImageView        { device, vkDestroyImageView },
+      normalDepthImage      { device, vkDestroyImage },
+      normalDepthImageMemory{ allocator, MEMORY_CATEGORY_TEXTURE, "impostor atlas normal depth" },
+      normalDepthImageView  { device, vkDestroyImageView }
+  {
+  }
+
+  VDeleter<VkImage>        colorImage;
+  MemoryAllocation         colorImageMemory;
+  VDeleter<VkImageView>    colorImageView;
+  VDeleter<VkImage>        normalDepthImage;
+  MemoryAllocation         normalDepthImageMemory;
+  VDeleter<VkImageView>    normalDepthImageView;
+  SamplerHandle            sampler;
+
+  uint32_t                 viewsPerSide = 0;
+  uint32_t                 tileSize     = 0;
+  glm::vec3                center;
+  float                    radius       = 0.0f;
+};
+
+// Shared by both atlas images and baked into the impostor descriptor set
+// layout as an immutable sampler
+VkSamplerCreateInfo impostorSamplerInfo(  )
+{
+  VkSamplerCreateInfo samplerInfo = {};
+  samplerInfo.sType                   = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter               = VK_FILTER_LINEAR;
+  samplerInfo.minFilter               = VK_FILTER_LINEAR;
+  samplerInfo.addressModeU            = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV            = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW            = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.anisotropyEnable        = VK_FALSE;
+  samplerInfo.maxAnisotropy           = 1;
+  samplerInfo.borderColor             = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+  samplerInfo.unnormalizedCoordinates = VK_FALSE;
+  samplerInfo.compareEnable           = VK_FALSE;
+  samplerInfo.compareOp               = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.mipmapMode              = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.minLod                  = 0.0f;
+  samplerInfo.maxLod                  = 0.0f;
+
+  return samplerInfo;
+}
+
+static float impostorSign( float v )
+{
+  return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Inverse of the octahedral mapping in impostor.vert
+glm::vec3 impostorOctDecode( glm::vec2 e )
+{
+  glm::vec3 d( e.x, e.y, 1.0f - std::fabs( e.x ) - std::fabs( e.y ) );
+  if ( d.z < 0.0f )
+  {
+    float x = ( 1.0f - std::fabs( d.y ) ) * impostorSign( d.x );
+    float y = ( 1.0f - std::fabs( d.x ) ) * impostorSign( d.y );
+    d.x = x;
+    d.y = y;
+  }
+
+  return glm::normalize( d );
+}
+
+// Octahedral mapping of a direction into [-1, 1]^2, as in impostor.vert
+glm::vec2 impostorOctEncode( glm::vec3 d )
+{
+  d /= std::fabs( d.x ) + std::fabs( d.y ) + std::fabs( d.z );
+  glm::vec2 e( d.x, d.y );
+  if ( d.z < 0.0f )
+  {
+    e = glm::vec2( ( 1.0f - std::fabs( d.y ) ) * impostorSign( d.x ),
+                   ( 1.0f - std::fabs( d.x ) ) * impostorSign( d.y ) );
+  }
+
+  return e;
+}
+
+// Direction the view in an atlas tile is baked from
+glm::vec3 impostorTileDirection( uint32_t tx, uint32_t ty, uint32_t viewsPerSide )
+{
+  return impostorOctDecode( glm::vec2( ( tx + 0.5f ) / viewsPerSide * 2.0f - 1.0f,
+                                       ( ty + 0.5f ) / viewsPerSide * 2.0f - 1.0f ) );
+}
+
+// Tile impostor.vert draws for a model space direction towards the eye
+glm::uvec2 impostorViewTile( glm::vec3 toEye, uint32_t viewsPerSide )
+{
+  glm::vec2 e = impostorOctEncode( glm::normalize( toEye ) );
+  glm::vec2 t = glm::floor( ( e * 0.5f + 0.5f ) * (float)viewsPerSide );
+  return glm::uvec2( glm::clamp( t, glm::vec2( 0.0f ), glm::vec2( viewsPerSide - 1.0f ) ) );
+}
+
+// Camera a tile is baked with: an orthographic view of the bounding sphere
+// from impostorTileDirection, depth spanning twice its diameter
+ImpostorBakeConstants impostorTileConstants( const ImpostorAtlas& atlas, uint32_t tx, uint32_t ty )
+{
+  glm::vec3 dir = impostorTileDirection( tx, ty, atlas.viewsPerSide );
+  glm::vec3 up  = std::fabs( dir.z ) > 0.99f ? glm::vec3( 0.0f, 1.0f, 0.0f ) :
+                                               glm::vec3( 0.0f, 0.0f, 1.0f );
+
+  float r = atlas.radius;
+  ImpostorBakeConstants constants;
+  constants.view     = glm::lookAt( atlas.center + dir * 2.0f * r, atlas.center, up );
+  constants.proj     = glm::ortho( -r, r, -r, r, 0.0f, 4.0f * r );
+  constants.proj[1][1] *= -1; // Match the y flip used for the main camera
+
+  return constants;
+}
+
+static void createImpostorRenderPass( VkPhysicalDevice        physical,
+                                      VkDevice                device,
+                                      VDeleter<VkRenderPass>& renderPass )
+{
+  std::array<VkAttachmentDescription, 3> attachments = {};
+  for ( uint32_t i = 0; i < 2; i++ )
+  {
+    attachments[i].format         = VK_FORMAT_R8G8B8A8_UNORM;
+    attachments[i].samples        = VK_SAMPLE_COUNT_1_BIT;
+    attachments[i].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[i].storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[i].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[i].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[i].finalLayout    = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+
+  attachments[2].format         = findDepthFormat( physical );
+  attachments[2].samples        = VK_SAMPLE_COUNT_1_BIT;
+  attachments[2].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[2].storeOp        = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[2].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[2].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachments[2].finalLayout    = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  std::array<VkAttachmentReference, 2> colorRefs = {};
+  colorRefs[0].attachment = 0;
+  colorRefs[0].layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  colorRefs[1].attachment = 1;
+  colorRefs[1].layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference depthRef = {};
+  depthRef.attachment = 2;
+  depthRef.layout     = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpassDesc = {};
+  subpassDesc.pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpassDesc.colorAttachmentCount    = colorRefs.size();
+  subpassDesc.pColorAttachments       = colorRefs.data();
+  subpassDesc.pDepthStencilAttachment = &depthRef;
+
+  // Make the atlas visible to the fragment shaders that sample it
+  VkSubpassDependency dependency = {};
+  dependency.srcSubpass    = 0;
+  dependency.dstSubpass    = VK_SUBPASS_EXTERNAL;
+  dependency.srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependency.dstStageMask  = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  VkRenderPassCreateInfo renderPassCreateInfo = {};
+  renderPassCreateInfo.sType           = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassCreateInfo.attachmentCount = attachments.size();
+  renderPassCreateInfo.pAttachments    = attachments.data();
+  renderPassCreateInfo.subpassCount    = 1;
+  renderPassCreateInfo.pSubpasses      = &subpassDesc;
+  renderPassCreateInfo.dependencyCount = 1;
+  renderPassCreateInfo.pDependencies   = &dependency;
+
+  if ( vkCreateRenderPass( device, &renderPassCreateInfo,
+                           nullptr, &renderPass ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create impostor render pass!" );
+  }
+}
+
+static void createImpostorBakePipeline( const VDeleter<VkDevice>&   device,
+                                        VkRenderPass                renderPass,
+                                        VkDescriptorSetLayout       descriptorSetLayout,
+                                        VkPrimitiveTopology         topology,
+                                        VDeleter<VkPipelineLayout>& pipelineLayout,
+                                        VDeleter<VkPipeline>&       pipeline )
+{
+  auto vertexShaderCode   = readFile( "impostor-bake-vert.spv" );
+  auto fragmentShaderCode = readFile( "impostor-bake-frag.spv" );
+
+  VDeleter<VkShaderModule> vertexShader{ device, vkDestroyShaderModule };
+  VDeleter<VkShaderModule> fragmentShader{ device, vkDestroyShaderModule };
+  createShaderModule( device, vertexShaderCode, vertexShader );
+  createShaderModule( device, fragmentShaderCode, fragmentShader );
+
+  std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {};
+  shaderStages[0].sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[0].stage  = VK_SHADER_STAGE_VERTEX_BIT;
+  shaderStages[0].module = vertexShader;
+  shaderStages[0].pName  = "main";
+  shaderStages[1].sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[1].stage  = VK_SHADER_STAGE_FRAGMENT_BIT;
+  shaderStages[1].module = fragmentShader;
+  shaderStages[1].pName  = "main";
+
+  auto bindingDescription    = Vertex::getBindingDescription();
+  auto attributeDescriptions = Vertex::getAttributeDescriptions();
+
+  VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
+  vertexInputCreateInfo.sType                           = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInputCreateInfo.vertexBindingDescriptionCount   = 1;
+  vertexInputCreateInfo.pVertexBindingDescriptions      = &bindingDescription;
+  vertexInputCreateInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+  vertexInputCreateInfo.pVertexAttributeDescriptions    = attributeDescriptions.data();
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo = {};
+  inputAssemblyCreateInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssemblyCreateInfo.topology               = topology;
+  inputAssemblyCreateInfo.primitiveRestartEnable = topology == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP ?
+                                                     VK_TRUE : VK_FALSE;
+
+  // Each view renders into its own tile, so viewport and scissor are dynamic
+  VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
+  viewportStateCreateInfo.sType         = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewportStateCreateInfo.viewportCount = 1;
+  viewportStateCreateInfo.scissorCount  = 1;
+
+  std::array<VkDynamicState, 2> dynamicStates = {
+    VK_DYNAMIC_STATE_VIEWPORT,
+    VK_DYNAMIC_STATE_SCISSOR
+  };
+  VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
+  dynamicStateCreateInfo.sType             = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicStateCreateInfo.dynamicStateCount = dynamicStates.size();
+  dynamicStateCreateInfo.pDynamicStates    = dynamicStates.data();
+
+  VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = {};
+  rasterizerCreateInfo.sType       = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizerCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizerCreateInfo.lineWidth   = 1.0f;
+  rasterizerCreateInfo.cullMode    = VK_CULL_MODE_BACK_BIT;
+  rasterizerCreateInfo.frontFace   = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+  VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+  depthStencil.sType            = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencil.depthTestEnable  = VK_TRUE;
+  depthStencil.depthWriteEnable = VK_TRUE;
+  depthStencil.depthCompareOp   = VK_COMPARE_OP_LESS;
+  depthStencil.maxDepthBounds   = 1.0f;
+
+  VkPipelineMultisampleStateCreateInfo multisamplingCreateInfo = {};
+  multisamplingCreateInfo.sType                = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  multisamplingCreateInfo.minSampleShading     = 1.0f;
+
+  std::array<VkPipelineColorBlendAttachmentState, 2> colorBlendAttachments = {};
+  for ( auto& attachment : colorBlendAttachments )
+  {
+    attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    attachment.blendEnable    = VK_FALSE;
+  }
+
+  VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo = {};
+  colorBlendCreateInfo.sType           = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlendCreateInfo.logicOpEnable   = VK_FALSE;
+  colorBlendCreateInfo.attachmentCount = colorBlendAttachments.size();
+  colorBlendCreateInfo.pAttachments    = colorBlendAttachments.data();
+
+  VkPushConstantRange pushConstantRange = {};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushConstantRange.offset     = 0;
+  pushConstantRange.size       = sizeof( ImpostorBakeConstants );
+
+  VkDescriptorSetLayout setLayouts[] = { descriptorSetLayout };
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+  pipelineLayoutCreateInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutCreateInfo.setLayoutCount         = 1;
+  pipelineLayoutCreateInfo.pSetLayouts            = setLayouts;
+  pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+  pipelineLayoutCreateInfo.pPushConstantRanges    = &pushConstantRange;
+
+  if ( vkCreatePipelineLayout( device, &pipelineLayoutCreateInfo, nullptr,
+                               &pipelineLayout ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create impostor bake pipeline layout!" );
+  }
+
+  VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
+  pipelineCreateInfo.sType               = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineCreateInfo.stageCount          = shaderStages.size();
+  pipelineCreateInfo.pStages             = shaderStages.data();
+  pipelineCreateInfo.pVertexInputState   = &vertexInputCreateInfo;
+  pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
+  pipelineCreateInfo.pViewportState      = &viewportStateCreateInfo;
+  pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
+  pipelineCreateInfo.pMultisampleState   = &multisamplingCreateInfo;
+  pipelineCreateInfo.pDepthStencilState  = &depthStencil;
+  pipelineCreateInfo.pColorBlendState    = &colorBlendCreateInfo;
+  pipelineCreateInfo.pDynamicState       = &dynamicStateCreateInfo;
+  pipelineCreateInfo.layout              = pipelineLayout;
+  pipelineCreateInfo.renderPass          = renderPass;
+  pipelineCreateInfo.subpass             = 0;
+  pipelineCreateInfo.basePipelineHandle  = VK_NULL_HANDLE;
+  pipelineCreateInfo.basePipelineIndex   = -1;
+
+  if ( vkCreateGraphicsPipelines( device, VK_NULL_HANDLE, 1,
+                                  &pipelineCreateInfo, nullptr,
+                                  &pipeline ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create impostor bake pipeline!" );
+  }
+}
+
+// Record rendering the mesh from viewsPerSide^2 directions into the atlas.
+// Needs no swapchain or surface, so it can run headlessly. descriptorSet
+// must bind the mesh texture at binding 1 of descriptorSetLayout, and the
+// bake's temporary targets and pipelines are owned by upload.
+void bakeImpostorAtlas( VkPhysicalDevice                 physical,
+                        const VDeleter<VkDevice>&        device,
+                        UploadContext&                   upload,
+                        VkDescriptorSetLayout            descriptorSetLayout,
+                        VkDescriptorSet                  descriptorSet,
+                        const std::vector<Vertex>&       vertices,
+                        const std::vector<GeometryPage>& pages,
+                        const std::vector<GeometryDraw>& draws,
+                        uint32_t                         viewsPerSide,
+                        uint32_t                         tileSize,
+                        ImpostorAtlas&                   atlas )
+{
+  // Fit a bounding sphere around the mesh
+  glm::vec3 minPos = vertices[0].pos;
+  glm::vec3 maxPos = vertices[0].pos;
+  for ( const auto& vertex : vertices )
+  {
+    minPos = glm::min( minPos, vertex.pos );
+    maxPos = glm::max( maxPos, vertex.pos );
+  }
+  atlas.center = ( minPos + maxPos ) * 0.5f;
+  atlas.radius = 0.0f;
+  for ( const auto& vertex : vertices )
+  {
+    atlas.radius = std::max( atlas.radius, glm::length( vertex.pos - atlas.center ) );
+  }
+  atlas.viewsPerSide = viewsPerSide;
+  atlas.tileSize     = tileSize;
+
+  uint32_t atlasSize = viewsPerSide * tileSize;
+
+  // Create atlas attachments; the atlas may later be moved by copying it
+  VkFormat depthFormat = findDepthFormat( physical );
+  VDeleter<VkImage>&        depthImage       = upload.own<VkImage>( vkDestroyImage );
+  MemoryAllocation&         depthImageMemory = upload.ownMemory( MEMORY_CATEGORY_ATTACHMENT, "impostor bake depth" );
+  VDeleter<VkImageView>&    depthImageView   = upload.own<VkImageView>( vkDestroyImageView );
+
+  createImage( physical, device, atlasSize, atlasSize, 1, 1,
+               VK_FORMAT_R8G8B8A8_UNORM,
+               VK_IMAGE_TILING_OPTIMAL,
+               VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+               MEMORY_USAGE_GPU_ONLY,
+               atlas.colorImage,
+               atlas.colorImageMemory );
+  createImage( physical, device, atlasSize, atlasSize, 1, 1,
+               VK_FORMAT_R8G8B8A8_UNORM,
+               VK_IMAGE_TILING_OPTIMAL,
+               VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+               MEMORY_USAGE_GPU_ONLY,
+               atlas.normalDepthImage,
+               atlas.normalDepthImageMemory );
+  createImage( physical, device, atlasSize, atlasSize, 1, 1,
+               depthFormat,
+               VK_IMAGE_TILING_OPTIMAL,
+               VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+               MEMORY_USAGE_GPU_ONLY,
+               depthImage,
+               depthImageMemory );
+
+  createImageView( device, atlas.colorImage, VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM,
+                   VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 1, atlas.colorImageView );
+  createImageView( device, atlas.normalDepthImage, VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM,
+                   VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 1, atlas.normalDepthImageView );
+  createImageView( device, depthImage, VK_IMAGE_VIEW_TYPE_2D, depthFormat,
+                   VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 1, depthImageView );
+
+  // Create bake pass
+  VDeleter<VkRenderPass>&     renderPass     = upload.own<VkRenderPass>( vkDestroyRenderPass );
+  VDeleter<VkFramebuffer>&    framebuffer    = upload.own<VkFramebuffer>( vkDestroyFramebuffer );
+  VDeleter<VkPipelineLayout>& pipelineLayout = upload.own<VkPipelineLayout>( vkDestroyPipelineLayout );
+  VDeleter<VkPipeline>&       pipeline       = upload.own<VkPipeline>( vkDestroyPipeline );
+  VDeleter<VkPipelineLayout>& stripLayout    = upload.own<VkPipelineLayout>( vkDestroyPipelineLayout );
+  VDeleter<VkPipeline>&       stripPipeline  = upload.own<VkPipeline>( vkDestroyPipeline );
+
+  createImpostorRenderPass( physical, device, renderPass );
+  createImpostorBakePipeline( device, renderPass, descriptorSetLayout,
+                              VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, pipelineLayout, pipeline );
+  createImpostorBakePipeline( device, renderPass, descriptorSetLayout,
+                              VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP, stripLayout, stripPipeline );
+
+  std::array<VkImageView, 3> attachments = {
+    atlas.colorImageView,
+    atlas.normalDepthImageView,
+    depthImageView
+  };
+
+  VkFramebufferCreateInfo framebufferCreateInfo = {};
+  framebufferCreateInfo.sType           = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferCreateInfo.renderPass      = renderPass;
+  framebufferCreateInfo.attachmentCount = attachments.size();
+  framebufferCreateInfo.pAttachments    = attachments.data();
+  framebufferCreateInfo.width           = atlasSize;
+  framebufferCreateInfo.height          = atlasSize;
+  framebufferCreateInfo.layers          = 1;
+
+  if ( vkCreateFramebuffer( device, &framebufferCreateInfo,
+                            nullptr, &framebuffer ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create impostor framebuffer!" );
+  }
+
+  // Record every view into the upload command buffer
+  VkCommandBuffer commandBuffer = upload.commandBuffer;
+
+  std::array<VkClearValue, 3> clearValues = {};
+  clearValues[0].color        = { 0.0f, 0.0f, 0.0f, 0.0f };
+  clearValues[1].color        = { 0.5f, 0.5f, 1.0f, 1.0f };
+  clearValues[2].depthStencil = { 1.0f, 0 };
+
+  VkRenderPassBeginInfo renderPassBeginInfo = {};
+  renderPassBeginInfo.sType                    = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderPassBeginInfo.renderPass               = renderPass;
+  renderPassBeginInfo.framebuffer              = framebuffer;
+  renderPassBeginInfo.renderArea.offset        = { 0, 0 };
+  renderPassBeginInfo.renderArea.extent.width  = atlasSize;
+  renderPassBeginInfo.renderArea.extent.height = atlasSize;
+  renderPassBeginInfo.clearValueCount          = clearValues.size();
+  renderPassBeginInfo.pClearValues             = clearValues.data();
+
+  vkCmdBeginRenderPass( commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE );
+
+  // Both bake layouts are identical, so the set stays bound across pipelines
+  vkCmdBindDescriptorSets( commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                           pipelineLayout, 0, 1, &descriptorSet, 0, nullptr );
+
+  for ( uint32_t ty = 0; ty < viewsPerSide; ty++ )
+  {
+    for ( uint32_t tx = 0; tx < viewsPerSide; tx++ )
+    {
+      ImpostorBakeConstants constants = impostorTileConstants( atlas, tx, ty );
+
+      VkViewport viewport = {};
+      viewport.x        = (float)( tx * tileSize );
+      viewport.y        = (float)( ty * tileSize );
+      viewport.width    = (float)tileSize;
+      viewport.height   = (float)tileSize;
+      viewport.minDepth = 0.0f;
+      viewport.maxDepth = 1.0f;
+
+      VkRect2D scissor = {};
+      scissor.offset = { (int32_t)( tx * tileSize ), (int32_t)( ty * tileSize ) };
+      scissor.extent = { tileSize, tileSize };
+
+      vkCmdSetViewport( commandBuffer, 0, 1, &viewport );
+      vkCmdSetScissor( commandBuffer, 0, 1, &scissor );
+      vkCmdPushConstants( commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                          0, sizeof( constants ), &constants );
+
+      for ( const auto& draw : draws )
+      {
+        VkDeviceSize offsets[] = { 0 };
+        VkBuffer     buffers[] = { pages[draw.page].vertexBuffer };
+
+        vkCmdBindPipeline( commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                           draw.encoding == INDEX_ENCODING_TRIANGLE_STRIP ?
+                             stripPipeline : pipeline );
+        vkCmdBindVertexBuffers( commandBuffer, 0, 1, buffers, offsets );
+        vkCmdBindIndexBuffer( commandBuffer, pages[draw.page].indexBuffer,
+                              0, VK_INDEX_TYPE_UINT32 );
+        vkCmdDrawIndexed( commandBuffer, draw.indexCount, 1,
+                          draw.firstIndex, draw.vertexOffset, 0 );
+      }
+    }
+  }
+
+  vkCmdEndRenderPass( commandBuffer );
+
+  std::cout << "Baked " << viewsPerSide * viewsPerSide << " impostor views into a "
+            << atlasSize << "x" << atlasSize << " atlas" << std::endl;
+}
+
+// Pipeline drawing camera-facing impostor quads, 4 strip vertices per instance
+void createImpostorPipeline( const VDeleter<VkDevice>&   device,
+                             VkRenderPass                renderPass,
+                             VkExtent2D                  extent,
+                             VkDescriptorSetLayout       descriptorSetLayout,
+                             VDeleter<VkPipelineLayout>& pipelineLayout,
+                             VDeleter<VkPipeline>&       pipeline )
+{
+  auto vertexShaderCode   = readFile( "impostor-vert.spv" );
+  auto fragmentShaderCode = readFile( "impostor-frag.spv" );
+
+  VDeleter<VkShaderModule> vertexShader{ device, vkDestroyShaderModule };
+  VDeleter<VkShaderModule> fragmentShader{ device, vkDestroyShaderModule };
+  createShaderModule( device, vertexShaderCode, vertexShader );
+  createShaderModule( device, fragmentShaderCode, fragmentShader );
+
+  std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {};
+  shaderStages[0].sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[0].stage  = VK_SHADER_STAGE_VERTEX_BIT;
+  shaderStages[0].module = vertexShader;
+  shaderStages[0].pName  = "main";
+  shaderStages[1].sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[1].stage  = VK_SHADER_STAGE_FRAGMENT_BIT;
+  shaderStages[1].module = fragmentShader;
+  shaderStages[1].pName  = "main";
+
+  auto bindingDescription    = InstanceData::getBindingDescription( 0 );
+  auto attributeDescriptions = InstanceData::getAttributeDescriptions( 0, 0 );
+
+  VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
+  vertexInputCreateInfo.sType                           = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInputCreateInfo.vertexBindingDescriptionCount   = 1;
+  vertexInputCreateInfo.pVertexBindingDescriptions      = &bindingDescription;
+  vertexInputCreateInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+  vertexInputCreateInfo.pVertexAttributeDescriptions    = attributeDescriptions.data();
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo = {};
+  inputAssemblyCreateInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssemblyCreateInfo.topology               = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+  inputAssemblyCreateInfo.primitiveRestartEnable = VK_FALSE;
+
+  VkViewport viewport = {};
+  viewport.x        = 0.0f;
+  viewport.y        = 0.0f;
+  viewport.width    = (float) extent.width;
+  viewport.height   = (float) extent.height;
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+
+  VkRect2D scissor = {};
+  scissor.offset = {0, 0};
+  scissor.extent = extent;
+
+  VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
+  viewportStateCreateInfo.sType         = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewportStateCreateInfo.viewportCount = 1;
+  viewportStateCreateInfo.pViewports    = &viewport;
+  viewportStateCreateInfo.scissorCount  = 1;
+  viewportStateCreateInfo.pScissors     = &scissor;
+
+  // Quads always face the camera, so there is nothing to cull
+  VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = {};
+  rasterizerCreateInfo.sType       = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizerCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizerCreateInfo.lineWidth   = 1.0f;
+  rasterizerCreateInfo.cullMode    = VK_CULL_MODE_NONE;
+  rasterizerCreateInfo.frontFace   = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+  VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+  depthStencil.sType            = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencil.depthTestEnable  = VK_TRUE;
+  depthStencil.depthWriteEnable = VK_TRUE;
+  depthStencil.depthCompareOp   = VK_COMPARE_OP_LESS;
+  depthStencil.maxDepthBounds   = 1.0f;
+
+  VkPipelineMultisampleStateCreateInfo multisamplingCreateInfo = {};
+  multisamplingCreateInfo.sType                = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  multisamplingCreateInfo.minSampleShading     = 1.0f;
+
+  VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+  colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  colorBlendAttachment.blendEnable    = VK_FALSE;
+
+  VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo = {};
+  colorBlendCreateInfo.sType           = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlendCreateInfo.logicOpEnable   = VK_FALSE;
+  colorBlendCreateInfo.attachmentCount = 1;
+  colorBlendCreateInfo.pAttachments    = &colorBlendAttachment;
+
+  VkPushConstantRange pushConstantRange = {};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushConstantRange.offset     = 0;
+  pushConstantRange.size       = sizeof( ImpostorConstants );
+
+  VkDescriptorSetLayout setLayouts[] = { descriptorSetLayout };
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+  pipelineLayoutCreateInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutCreateInfo.setLayoutCount         = 1;
+  pipelineLayoutCreateInfo.pSetLayouts            = setLayouts;
+  pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+  pipelineLayoutCreateInfo.pPushConstantRanges    = &pushConstantRange;
+
+  if ( vkCreatePipelineLayout( device, &pipelineLayoutCreateInfo, nullptr,
+                               &pipelineLayout ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create impostor pipeline layout!" );
+  }
+
+  VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
+  pipelineCreateInfo.sType               = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineCreateInfo.stageCount          = shaderStages.size();
+  pipelineCreateInfo.pStages             = shaderStages.data();
+  pipelineCreateInfo.pVertexInputState   = &vertexInputCreateInfo;
+  pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
+  pipelineCreateInfo.pViewportState      = &viewportStateCreateInfo;
+  pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
+  pipelineCreateInfo.pMultisampleState   = &multisamplingCreateInfo;
+  pipelineCreateInfo.pDepthStencilState  = &depthStencil;
+  pipelineCreateInfo.pColorBlendState    = &colorBlendCreateInfo;
+  pipelineCreateInfo.pDynamicState       = nullptr;
+  pipelineCreateInfo.layout              = pipelineLayout;
+  pipelineCreateInfo.renderPass          = renderPass;
+  pipelineCreateInfo.subpass             = 0;
+  pipelineCreateInfo.basePipelineHandle  = VK_NULL_HANDLE;
+  pipelineCreateInfo.basePipelineIndex   = -1;
+
+  if ( vkCreateGraphicsPipelines( device, VK_NULL_HANDLE, 1,
+                                  &pipelineCreateInfo, nullptr,
+                                  &pipeline ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create impostor pipeline!" );
+  }
+}
+
+// Split instances into full meshes and impostors by projected radius in
+// pixels. Instances inside the fade band are emitted to both lists with the
+// same visibility so the two dithered draws cover complementary pixels.
+void selectImpostorInstances( const std::vector<glm::vec4>& instances,
+                              const ImpostorAtlas&          atlas,
+                              const UniformBufferObject&    ubo,
+                              float                         viewportHeight,
+                              float                         thresholdPixels,
+                              float                         fadeBand,
+                              std::vector<InstanceData>&    meshInstances,
+                              std::vector<InstanceData>&    impostorInstances )
+{
+  meshInstances.clear();
+  impostorInstances.clear();
+
+  glm::vec3 eye        = glm::vec3( glm::inverse( ubo.view )[3] );
+  float     focalScale = std::fabs( ubo.proj[1][1] ) * viewportHeight * 0.5f;
+
+  for ( const auto& instance : instances )
+  {
+    float     scale  = instance.w;
+    glm::vec3 center = glm::vec3( ubo.model * glm::vec4( atlas.center * scale, 1.0f ) ) +
+                       glm::vec3( instance );
+    float     radius = atlas.radius * scale;
+    float     dist   = glm::length( center - eye );
+
+    float visibility = 1.0f;
+    if ( dist > radius )
+    {
+      float screenRadius = radius * focalScale / dist;
+      visibility = glm::clamp( ( screenRadius - thresholdPixels ) /
+                               ( thresholdPixels * fadeBand ), 0.0f, 1.0f );
+    }
+
+    InstanceData data;
+    data.offsetScale = instance;
+    data.params      = glm::vec4( visibility, 0.0f, 0.0f, 0.0f );
+
+    if ( visibility > 0.0f )
+    {
+      meshInstances.push_back( data );
+    }
+    if ( visibility < 1.0f )
+    {
+      impostorInstances.push_back( data );
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,81 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+layout(binding = 0) uniform UniformBufferObject
+{
+  mat4 model;
+  mat4 view;
+  mat4 proj;
+} ubo;
+
+layout(push_constant) uniform ImpostorConstants
+{
+  vec4 centerRadius; // Bounding sphere of the baked mesh in model space
+  vec4 grid;         // x: views per atlas side
+} impostor;
+
+layout(location = 0) in vec4 instOffsetScale;
+layout(location = 1) in vec4 instParams;
+
+layout(location = 0) out vec2 fragAtlasCoord;
+layout(location = 1) out vec3 fragWorldPos;
+layout(location = 2) flat out vec3 fragDepthAxis;
+layout(location = 3) flat out float fragVisibility;
+
+vec2 octEncode(vec3 d)
+{
+  d /= abs(d.x) + abs(d.y) + abs(d.z);
+  vec2 e = d.xy;
+  if (d.z < 0.0)
+  {
+    e = (1.0 - abs(d.yx)) * vec2(d.x >= 0.0 ? 1.0 : -1.0, d.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return e;
+}
+
+vec3 octDecode(vec2 e)
+{
+  vec3 d = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (d.z < 0.0)
+  {
+    d.xy = (1.0 - abs(d.yx)) * vec2(d.x >= 0.0 ? 1.0 : -1.0, d.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return normalize(d);
+}
+
+void main()
+{
+  // Quad corners for a 4 vertex triangle strip
+  vec2  corner = vec2((gl_VertexIndex & 1) != 0 ? 1.0 : -1.0,
+                      (gl_VertexIndex & 2) != 0 ? 1.0 : -1.0);
+  float scale  = instOffsetScale.w;
+  float radius = impostor.centerRadius.w * scale;
+  float views  = impostor.grid.x;
+
+  mat3 rotation = mat3(ubo.model);
+  vec3 center   = rotation * (impostor.centerRadius.xyz * scale) + instOffsetScale.xyz;
+  vec3 eye      = inverse(ubo.view)[3].xyz;
+
+  // Select the baked view closest to the current view direction
+  vec3 toEye = transpose(rotation) * normalize(eye - center);
+  vec2 tile  = clamp(floor((octEncode(toEye) * 0.5 + 0.5) * views), vec2(0.0), vec2(views - 1.0));
+  vec3 dir   = octDecode((tile + 0.5) / views * 2.0 - 1.0);
+
+  // Rebuild the basis the baker used for that view
+  vec3 up    = abs(dir.z) > 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0);
+  vec3 side  = normalize(cross(-dir, up));
+  vec3 upDir = cross(side, -dir);
+
+  vec3 worldPos = center + rotation * (radius * (corner.x * side + corner.y * upDir));
+
+  gl_Position    = ubo.proj * ubo.view * vec4(worldPos, 1.0);
+  fragAtlasCoord = (tile + vec2(corner.x * 0.5 + 0.5, 0.5 - corner.y * 0.5)) / views;
+  fragWorldPos   = worldPos;
+  fragDepthAxis  = rotation * dir * radius;
+  fragVisibility = instParams.x;
+}
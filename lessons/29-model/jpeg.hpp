@@ -0,0 +1,1134 @@
+#ifndef __JPEG_HPP__
+#define __JPEG_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include "base-includes.hpp"
+
+// SSE2 is part of x86-64, so the vector IDCT and color conversion below need
+// no extra compiler flags. They produce exactly what the scalar code does;
+// define JPEG_SCALAR to build the scalar code anyway.
+#if defined( __SSE2__ ) && !defined( JPEG_SCALAR )
+#define JPEG_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Multithreaded decoder for baseline (sequential Huffman, 8 bit) JPEGs that
+// writes RGBA8 straight into caller memory such as a mapped staging buffer.
+// Images with restart markers are decoded one restart interval per task;
+// otherwise one thread does entropy decoding while the others run IDCT and
+// color conversion one MCU row behind. Progressive, arithmetic coded,
+// 12 bit and CMYK files are rejected by readJpegHeader so callers can fall
+// back to stb_image. Chroma is upsampled by replication.
+// decodeJpegCoefficients stops after entropy decoding, leaving the rest to
+// jpegidct.comp.
+
+const uint32_t JPEG_FAST_BITS = 9;
+
+struct JpegHuffmanTable
+{
+  uint16_t fast[1 << JPEG_FAST_BITS]; // (length << 8) | symbol, 0 if longer
+  int32_t  maxCode[18];               // One past the last code of each length
+  int32_t  valOffset[17];
+  uint8_t  symbols[256];
+  bool     defined = false;
+};
+
+struct JpegComponent
+{
+  uint32_t id;
+  uint32_t h;
+  uint32_t v;
+  uint32_t quantTable;
+  uint32_t dcTable;
+  uint32_t acTable;
+};
+
+struct JpegImage
+{
+  uint32_t                   width  = 0;
+  uint32_t                   height = 0;
+  std::vector<JpegComponent> components;
+  bool                       transformYCbCr = true;
+
+  // Dequantization tables in natural order, prescaled for the AAN IDCT
+  float                      quant[4][64];
+  JpegHuffmanTable           dcTables[4];
+  JpegHuffmanTable           acTables[4];
+
+  uint32_t                   restartInterval = 0;
+  uint32_t                   hmax = 1;
+  uint32_t                   vmax = 1;
+  uint32_t                   mcusX = 0;
+  uint32_t                   mcusY = 0;
+  uint32_t                   blocksPerMcu = 0;
+
+  // Entropy coded data of the single scan; points into the caller's file
+  const uint8_t*             scanBegin = nullptr;
+  const uint8_t*             scanEnd   = nullptr;
+};
+
+static const uint8_t jpegZigzag[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10,
+  17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34,
+  27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36,
+  29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46,
+  53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static void buildJpegHuffmanTable( const uint8_t    counts[16],
+                                   const uint8_t*   symbols,
+                                   JpegHuffmanTable& table )
+{
+  std::memset( table.fast, 0, sizeof( table.fast ) );
+
+  int32_t code = 0;
+  int32_t k    = 0;
+  for ( uint32_t length = 1; length <= 16; length++ )
+  {
+    table.valOffset[length] = k - code;
+    for ( uint32_t i = 0; i < counts[length - 1]; i++, code++, k++ )
+    {
+      table.symbols[k] = symbols[k];
+      if ( length <= JPEG_FAST_BITS )
+      {
+        uint32_t shift = JPEG_FAST_BITS - length;
+        for ( uint32_t fill = 0; fill < ( 1u << shift ); fill++ )
+        {
+          table.fast[ ( code << shift ) | fill ] = (uint16_t)( ( length << 8 ) | symbols[k] );
+        }
+      }
+    }
+    table.maxCode[length] = code;
+    code <<= 1;
+  }
+  table.maxCode[17] = INT_MAX;
+  table.defined     = true;
+}
+
+// Reads one entropy coded segment, removing stuffed zero bytes and
+// feeding zeros once a marker is reached
+struct JpegBitReader
+{
+  const uint8_t* pos;
+  const uint8_t* end;
+  uint64_t       bits  = 0;
+  uint32_t       count = 0;
+
+  JpegBitReader( const uint8_t* begin, const uint8_t* end ) : pos( begin ), end( end ) {}
+
+  void fill()
+  {
+    while ( count <= 56 )
+    {
+      uint64_t byte = 0;
+      if ( pos < end )
+      {
+        if ( pos[0] != 0xFF )
+        {
+          byte = *pos++;
+        }
+        else if ( pos + 1 < end && pos[1] == 0x00 )
+        {
+          byte = 0xFF;
+          pos += 2;
+        }
+        else
+        {
+          end = pos; // Marker
+        }
+      }
+      bits  |= byte << ( 56 - count );
+      count += 8;
+    }
+  }
+
+  uint32_t peek( uint32_t n )
+  {
+    return (uint32_t)( bits >> ( 64 - n ) );
+  }
+
+  void consume( uint32_t n )
+  {
+    bits  <<= n;
+    count  -= n;
+  }
+
+  int32_t receiveExtend( uint32_t n )
+  {
+    if ( n == 0 )
+    {
+      return 0;
+    }
+    fill();
+    int32_t value = (int32_t)peek( n );
+    consume( n );
+    return value < ( 1 << ( n - 1 ) ) ? value - ( 1 << n ) + 1 : value;
+  }
+
+  uint32_t decode( const JpegHuffmanTable& table )
+  {
+    fill();
+    uint16_t entry = table.fast[ peek( JPEG_FAST_BITS ) ];
+    if ( entry )
+    {
+      consume( entry >> 8 );
+      return entry & 0xFF;
+    }
+
+    for ( uint32_t length = JPEG_FAST_BITS + 1; length <= 16; length++ )
+    {
+      int32_t code = (int32_t)peek( length );
+      if ( code < table.maxCode[length] )
+      {
+        consume( length );
+        return table.symbols[ code + table.valOffset[length] ];
+      }
+    }
+
+    consume( 16 ); // Corrupt data, decode as zero
+    return 0;
+  }
+};
+
+static uint32_t readJpegU16( const uint8_t* p )
+{
+  return ( p[0] << 8 ) | p[1];
+}
+
+// Parse markers up to the start of the scan. Returns false for anything
+// this decoder does not handle; the image must then be decoded elsewhere.
+bool readJpegHeader( const std::vector<char>& file, JpegImage& jpeg )
+{
+  static const float aanScale[8] = {
+    1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+    1.0f, 0.785694958f, 0.541196100f, 0.275899379f
+  };
+
+  const uint8_t* data = (const uint8_t*)file.data();
+  const uint8_t* end  = data + file.size();
+  if ( file.size() < 4 || data[0] != 0xFF || data[1] != 0xD8 )
+  {
+    return false;
+  }
+
+  bool           haveFrame = false;
+  const uint8_t* p         = data + 2;
+  while ( p + 4 <= end )
+  {
+    if ( p[0] != 0xFF )
+    {
+      return false;
+    }
+
+    uint8_t marker = p[1];
+    if ( marker == 0xFF )
+    {
+      p++; // Fill byte
+      continue;
+    }
+
+    uint32_t       length  = readJpegU16( p + 2 );
+    const uint8_t* segment = p + 4;
+    const uint8_t* next    = p + 2 + length;
+    if ( length < 2 || next > end )
+    {
+      return false;
+    }
+
+    switch ( marker )
+    {
+      case 0xC0: // Baseline
+      case 0xC1: // Extended sequential, Huffman
+      {
+        if ( length < 8 || segment[0] != 8 )
+        {
+          return false;
+        }
+        jpeg.height = readJpegU16( segment + 1 );
+        jpeg.width  = readJpegU16( segment + 3 );
+        uint32_t count = segment[5];
+        if ( jpeg.width == 0 || jpeg.height == 0 ||
+             ( count != 1 && count != 3 ) || length != 8 + 3 * count )
+        {
+          return false;
+        }
+
+        jpeg.components.resize( count );
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+          const uint8_t* c = segment + 6 + 3 * i;
+          jpeg.components[i].id         = c[0];
+          jpeg.components[i].h          = c[1] >> 4;
+          jpeg.components[i].v          = c[1] & 15;
+          jpeg.components[i].quantTable = c[2] & 3;
+          if ( jpeg.components[i].h == 0 || jpeg.components[i].v == 0 )
+          {
+            return false;
+          }
+        }
+        haveFrame = true;
+        break;
+      }
+
+      case 0xC4: // Huffman tables
+      {
+        const uint8_t* t = segment;
+        while ( t < next )
+        {
+          if ( t + 17 > next )
+          {
+            return false;
+          }
+          uint32_t tableClass = t[0] >> 4;
+          uint32_t tableId    = t[0] & 3;
+          uint32_t total      = 0;
+          for ( uint32_t i = 0; i < 16; i++ )
+          {
+            total += t[1 + i];
+          }
+          if ( tableClass > 1 || total > 256 || t + 17 + total > next )
+          {
+            return false;
+          }
+          buildJpegHuffmanTable( t + 1, t + 17,
+                                 tableClass == 0 ? jpeg.dcTables[tableId] : jpeg.acTables[tableId] );
+          t += 17 + total;
+        }
+        break;
+      }
+
+      case 0xDB: // Quantization tables, stored zigzagged
+      {
+        const uint8_t* t = segment;
+        while ( t < next )
+        {
+          uint32_t precision = t[0] >> 4;
+          uint32_t tableId   = t[0] & 3;
+          if ( precision > 1 || t + 1 + 64 * ( precision + 1 ) > next )
+          {
+            return false;
+          }
+          for ( uint32_t k = 0; k < 64; k++ )
+          {
+            uint32_t value   = precision ? readJpegU16( t + 1 + 2 * k ) : t[1 + k];
+            uint32_t natural = jpegZigzag[k];
+            jpeg.quant[tableId][natural] = value * aanScale[natural / 8] *
+                                           aanScale[natural % 8] / 8.0f;
+          }
+          t += 1 + 64 * ( precision + 1 );
+        }
+        break;
+      }
+
+      case 0xDD: // Restart interval
+        jpeg.restartInterval = readJpegU16( segment );
+        break;
+
+      case 0xEE: // Adobe; transform 0 means the components are plain RGB
+        if ( length >= 14 && std::memcmp( segment, "Adobe", 5 ) == 0 )
+        {
+          jpeg.transformYCbCr = segment[11] != 0;
+        }
+        break;
+
+      case 0xDA: // Start of scan
+      {
+        if ( !haveFrame || segment[0] != jpeg.components.size() )
+        {
+          return false; // Multi-scan images are not handled
+        }
+
+        for ( uint32_t i = 0; i < segment[0]; i++ )
+        {
+          const uint8_t* s = segment + 1 + 2 * i;
+          if ( s[0] != jpeg.components[i].id )
+          {
+            return false;
+          }
+          jpeg.components[i].dcTable = s[1] >> 4 & 3;
+          jpeg.components[i].acTable = s[1] & 3;
+          if ( !jpeg.dcTables[ jpeg.components[i].dcTable ].defined ||
+               !jpeg.acTables[ jpeg.components[i].acTable ].defined )
+          {
+            return false;
+          }
+        }
+
+        // A single component scan is never interleaved
+        if ( jpeg.components.size() == 1 )
+        {
+          jpeg.components[0].h = 1;
+          jpeg.components[0].v = 1;
+        }
+
+        jpeg.hmax         = 1;
+        jpeg.vmax         = 1;
+        jpeg.blocksPerMcu = 0;
+        for ( const auto& c : jpeg.components )
+        {
+          jpeg.hmax          = std::max( jpeg.hmax, c.h );
+          jpeg.vmax          = std::max( jpeg.vmax, c.v );
+          jpeg.blocksPerMcu += c.h * c.v;
+        }
+        for ( const auto& c : jpeg.components )
+        {
+          if ( jpeg.hmax % c.h != 0 || jpeg.vmax % c.v != 0 )
+          {
+            return false;
+          }
+        }
+        if ( jpeg.blocksPerMcu > 10 )
+        {
+          return false;
+        }
+
+        jpeg.mcusX     = ( jpeg.width + 8 * jpeg.hmax - 1 ) / ( 8 * jpeg.hmax );
+        jpeg.mcusY     = ( jpeg.height + 8 * jpeg.vmax - 1 ) / ( 8 * jpeg.vmax );
+        jpeg.scanBegin = next;
+        jpeg.scanEnd   = end;
+        return true;
+      }
+
+      default:
+        // Progressive, lossless, hierarchical and arithmetic coded frames
+        if ( marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC )
+        {
+          return false;
+        }
+        break;
+    }
+
+    p = next;
+  }
+
+  return false;
+}
+
+// Decode one MCU into coefficient blocks, natural order and not yet
+// dequantized. Returns a bit per block that has nonzero AC coefficients.
+static uint32_t decodeJpegMcu( const JpegImage& jpeg,
+                               JpegBitReader&   reader,
+                               int32_t          dcPred[3],
+                               int16_t*         coefficients )
+{
+  uint32_t acMask = 0;
+  uint32_t block  = 0;
+
+  std::memset( coefficients, 0, jpeg.blocksPerMcu * 64 * sizeof( int16_t ) );
+
+  for ( uint32_t c = 0; c < jpeg.components.size(); c++ )
+  {
+    const JpegComponent&    comp = jpeg.components[c];
+    const JpegHuffmanTable& dc   = jpeg.dcTables[ comp.dcTable ];
+    const JpegHuffmanTable& ac   = jpeg.acTables[ comp.acTable ];
+
+    for ( uint32_t b = 0; b < comp.h * comp.v; b++, block++ )
+    {
+      int16_t* coef = coefficients + block * 64;
+
+      dcPred[c] += reader.receiveExtend( reader.decode( dc ) & 15 );
+      coef[0]    = (int16_t)dcPred[c];
+
+      for ( uint32_t k = 1; k < 64; )
+      {
+        uint32_t rs  = reader.decode( ac );
+        uint32_t run = rs >> 4;
+        uint32_t s   = rs & 15;
+        if ( s == 0 )
+        {
+          if ( run != 15 )
+          {
+            break; // End of block
+          }
+          k += 16;
+          continue;
+        }
+
+        k += run;
+        if ( k > 63 )
+        {
+          break;
+        }
+        coef[ jpegZigzag[k] ] = (int16_t)reader.receiveExtend( s );
+        acMask |= 1u << block;
+        k++;
+      }
+    }
+  }
+
+  return acMask;
+}
+
+static uint8_t clampJpegSample( float value )
+{
+  int32_t sample = (int32_t)( value + 128.5f );
+  return (uint8_t)std::min( std::max( sample, 0 ), 255 );
+}
+
+#if JPEG_SSE2
+
+// One dimension of the float AAN inverse DCT on four lines at once, v[i]
+// holding value i of each line. The operations and their order are those of
+// the scalar code, so the results are identical.
+static inline void inverseDct8( __m128* v )
+{
+  const __m128 c1414 = _mm_set1_ps( 1.414213562f );
+  const __m128 c1847 = _mm_set1_ps( 1.847759065f );
+  const __m128 c1082 = _mm_set1_ps( 1.082392200f );
+  const __m128 c2613 = _mm_set1_ps( 2.613125930f );
+
+  __m128 tmp10 = _mm_add_ps( v[0], v[4] );
+  __m128 tmp11 = _mm_sub_ps( v[0], v[4] );
+  __m128 tmp13 = _mm_add_ps( v[2], v[6] );
+  __m128 tmp12 = _mm_sub_ps( _mm_mul_ps( _mm_sub_ps( v[2], v[6] ), c1414 ), tmp13 );
+
+  __m128 tmp0 = _mm_add_ps( tmp10, tmp13 );
+  __m128 tmp3 = _mm_sub_ps( tmp10, tmp13 );
+  __m128 tmp1 = _mm_add_ps( tmp11, tmp12 );
+  __m128 tmp2 = _mm_sub_ps( tmp11, tmp12 );
+
+  __m128 z13 = _mm_add_ps( v[5], v[3] );
+  __m128 z10 = _mm_sub_ps( v[5], v[3] );
+  __m128 z11 = _mm_add_ps( v[1], v[7] );
+  __m128 z12 = _mm_sub_ps( v[1], v[7] );
+
+  __m128 tmp7 = _mm_add_ps( z11, z13 );
+  __m128 z5   = _mm_mul_ps( _mm_add_ps( z10, z12 ), c1847 );
+  tmp11       = _mm_mul_ps( _mm_sub_ps( z11, z13 ), c1414 );
+  tmp10       = _mm_sub_ps( z5, _mm_mul_ps( z12, c1082 ) );
+  tmp12       = _mm_sub_ps( z5, _mm_mul_ps( z10, c2613 ) );
+
+  __m128 tmp6 = _mm_sub_ps( tmp12, tmp7 );
+  __m128 tmp5 = _mm_sub_ps( tmp11, tmp6 );
+  __m128 tmp4 = _mm_sub_ps( tmp10, tmp5 );
+
+  v[0] = _mm_add_ps( tmp0, tmp7 );
+  v[7] = _mm_sub_ps( tmp0, tmp7 );
+  v[1] = _mm_add_ps( tmp1, tmp6 );
+  v[6] = _mm_sub_ps( tmp1, tmp6 );
+  v[2] = _mm_add_ps( tmp2, tmp5 );
+  v[5] = _mm_sub_ps( tmp2, tmp5 );
+  v[3] = _mm_add_ps( tmp3, tmp4 );
+  v[4] = _mm_sub_ps( tmp3, tmp4 );
+}
+
+// Transpose an 8x8 block held as columns 0-3 (lo) and 4-7 (hi) of each row
+static inline void transposeJpegBlock( __m128* lo, __m128* hi )
+{
+  _MM_TRANSPOSE4_PS( lo[0], lo[1], lo[2], lo[3] );
+  _MM_TRANSPOSE4_PS( lo[4], lo[5], lo[6], lo[7] );
+  _MM_TRANSPOSE4_PS( hi[0], hi[1], hi[2], hi[3] );
+  _MM_TRANSPOSE4_PS( hi[4], hi[5], hi[6], hi[7] );
+  for ( uint32_t i = 0; i < 4; i++ )
+  {
+    std::swap( lo[4 + i], hi[i] );
+  }
+}
+
+// Float AAN inverse DCT of one dequantized block, columns then rows like the
+// scalar version, four lines per vector
+static void inverseDctBlock( const int16_t* coef, const float* quant, uint8_t* out )
+{
+  __m128 lo[8], hi[8];
+  for ( uint32_t y = 0; y < 8; y++ )
+  {
+    __m128i row = _mm_loadu_si128( (const __m128i*)( coef + y * 8 ) );
+    lo[y] = _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpacklo_epi16( row, row ), 16 ) ),
+                        _mm_loadu_ps( quant + y * 8 ) );
+    hi[y] = _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpackhi_epi16( row, row ), 16 ) ),
+                        _mm_loadu_ps( quant + y * 8 + 4 ) );
+  }
+
+  inverseDct8( lo );
+  inverseDct8( hi );
+  transposeJpegBlock( lo, hi );
+  inverseDct8( lo );
+  inverseDct8( hi );
+  transposeJpegBlock( lo, hi );
+
+  // Truncate and saturate like clampJpegSample, two rows per store
+  const __m128 bias = _mm_set1_ps( 128.5f );
+  for ( uint32_t y = 0; y < 8; y += 2 )
+  {
+    __m128i first  = _mm_packs_epi32( _mm_cvttps_epi32( _mm_add_ps( lo[y], bias ) ),
+                                      _mm_cvttps_epi32( _mm_add_ps( hi[y], bias ) ) );
+    __m128i second = _mm_packs_epi32( _mm_cvttps_epi32( _mm_add_ps( lo[y + 1], bias ) ),
+                                      _mm_cvttps_epi32( _mm_add_ps( hi[y + 1], bias ) ) );
+    _mm_storeu_si128( (__m128i*)( out + y * 8 ), _mm_packus_epi16( first, second ) );
+  }
+}
+
+#else
+
+// Float AAN inverse DCT of one dequantized block
+static void inverseDctBlock( const int16_t* coef, const float* quant, uint8_t* out )
+{
+  float workspace[64];
+
+  for ( uint32_t x = 0; x < 8; x++ )
+  {
+    float in[8];
+    for ( uint32_t y = 0; y < 8; y++ )
+    {
+      in[y] = coef[ y * 8 + x ] * quant[ y * 8 + x ];
+    }
+
+    float tmp10 = in[0] + in[4];
+    float tmp11 = in[0] - in[4];
+    float tmp13 = in[2] + in[6];
+    float tmp12 = ( in[2] - in[6] ) * 1.414213562f - tmp13;
+
+    float tmp0 = tmp10 + tmp13;
+    float tmp3 = tmp10 - tmp13;
+    float tmp1 = tmp11 + tmp12;
+    float tmp2 = tmp11 - tmp12;
+
+    float z13 = in[5] + in[3];
+    float z10 = in[5] - in[3];
+    float z11 = in[1] + in[7];
+    float z12 = in[1] - in[7];
+
+    float tmp7 = z11 + z13;
+    float z5   = ( z10 + z12 ) * 1.847759065f;
+    tmp11      = ( z11 - z13 ) * 1.414213562f;
+    tmp10      = z5 - z12 * 1.082392200f;
+    tmp12      = z5 - z10 * 2.613125930f;
+
+    float tmp6 = tmp12 - tmp7;
+    float tmp5 = tmp11 - tmp6;
+    float tmp4 = tmp10 - tmp5;
+
+    workspace[ 0 * 8 + x ] = tmp0 + tmp7;
+    workspace[ 7 * 8 + x ] = tmp0 - tmp7;
+    workspace[ 1 * 8 + x ] = tmp1 + tmp6;
+    workspace[ 6 * 8 + x ] = tmp1 - tmp6;
+    workspace[ 2 * 8 + x ] = tmp2 + tmp5;
+    workspace[ 5 * 8 + x ] = tmp2 - tmp5;
+    workspace[ 3 * 8 + x ] = tmp3 + tmp4;
+    workspace[ 4 * 8 + x ] = tmp3 - tmp4;
+  }
+
+  for ( uint32_t y = 0; y < 8; y++ )
+  {
+    const float* in = workspace + y * 8;
+
+    float tmp10 = in[0] + in[4];
+    float tmp11 = in[0] - in[4];
+    float tmp13 = in[2] + in[6];
+    float tmp12 = ( in[2] - in[6] ) * 1.414213562f - tmp13;
+
+    float tmp0 = tmp10 + tmp13;
+    float tmp3 = tmp10 - tmp13;
+    float tmp1 = tmp11 + tmp12;
+    float tmp2 = tmp11 - tmp12;
+
+    float z13 = in[5] + in[3];
+    float z10 = in[5] - in[3];
+    float z11 = in[1] + in[7];
+    float z12 = in[1] - in[7];
+
+    float tmp7 = z11 + z13;
+    float z5   = ( z10 + z12 ) * 1.847759065f;
+    tmp11      = ( z11 - z13 ) * 1.414213562f;
+    tmp10      = z5 - z12 * 1.082392200f;
+    tmp12      = z5 - z10 * 2.613125930f;
+
+    float tmp6 = tmp12 - tmp7;
+    float tmp5 = tmp11 - tmp6;
+    float tmp4 = tmp10 - tmp5;
+
+    uint8_t* row = out + y * 8;
+    row[0] = clampJpegSample( tmp0 + tmp7 );
+    row[7] = clampJpegSample( tmp0 - tmp7 );
+    row[1] = clampJpegSample( tmp1 + tmp6 );
+    row[6] = clampJpegSample( tmp1 - tmp6 );
+    row[2] = clampJpegSample( tmp2 + tmp5 );
+    row[5] = clampJpegSample( tmp2 - tmp5 );
+    row[3] = clampJpegSample( tmp3 + tmp4 );
+    row[4] = clampJpegSample( tmp3 - tmp4 );
+  }
+}
+
+#endif
+
+// JFIF YCbCr to RGB lookup tables in the style of libjpeg
+struct JpegColorTables
+{
+  int32_t crToR[256];
+  int32_t cbToB[256];
+  int32_t crToG[256]; // 16.16 fixed point
+  int32_t cbToG[256];
+  uint8_t clamp[1024];
+
+  JpegColorTables()
+  {
+    for ( int32_t i = 0; i < 256; i++ )
+    {
+      int32_t c = i - 128;
+      crToR[i]  = ( 91881 * c + ( 1 << 15 ) ) >> 16;
+      cbToB[i]  = ( 116130 * c + ( 1 << 15 ) ) >> 16;
+      crToG[i]  = -46802 * c;
+      cbToG[i]  = -22554 * c + ( 1 << 15 );
+    }
+    for ( int32_t i = 0; i < 1024; i++ )
+    {
+      clamp[i] = (uint8_t)std::min( std::max( i - 384, 0 ), 255 );
+    }
+  }
+};
+
+static const JpegColorTables& jpegColorTables()
+{
+  static const JpegColorTables tables;
+  return tables;
+}
+
+#if JPEG_SSE2
+
+// YCbCr rows to opaque RGBA8, eight pixels at a time, with the arithmetic of
+// JpegColorTables. The 16.16 factors that do not fit 16 bits are split into
+// a whole part added separately and a remainder for _mm_madd_epi16, which
+// rounds the same. Returns how many pixels were converted.
+static uint32_t convertJpegRowRGBA( const uint8_t* c0,
+                                    const uint8_t* c1,
+                                    const uint8_t* c2,
+                                    uint32_t       width,
+                                    uint8_t*       out )
+{
+  // Factors of interleaved (cb, cr) pairs
+  auto factors = []( int16_t cb, int16_t cr ) { return _mm_set_epi16( cr, cb, cr, cb, cr, cb, cr, cb ); };
+  const __m128i toR   = factors( 0, 26345 );       // 91881 = 65536 + 26345
+  const __m128i toG   = factors( -22554, 18734 );  // -46802 = -65536 + 18734
+  const __m128i toB   = factors( -14942, 0 );      // 116130 = 131072 - 14942
+  const __m128i round = _mm_set1_epi32( 1 << 15 );
+  const __m128i bias  = _mm_set1_epi16( 128 );
+  const __m128i zero  = _mm_setzero_si128();
+  const __m128i alpha = _mm_set1_epi8( (char)0xFF );
+
+  auto scaled = [&]( __m128i lo, __m128i hi, __m128i k )
+  {
+    return _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( lo, k ), round ), 16 ),
+                            _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( hi, k ), round ), 16 ) );
+  };
+
+  uint32_t x = 0;
+  for ( ; x + 8 <= width; x += 8, out += 32 )
+  {
+    __m128i yy = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( c0 + x ) ), zero );
+    __m128i cb = _mm_sub_epi16( _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( c1 + x ) ), zero ), bias );
+    __m128i cr = _mm_sub_epi16( _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( c2 + x ) ), zero ), bias );
+    __m128i lo = _mm_unpacklo_epi16( cb, cr );
+    __m128i hi = _mm_unpackhi_epi16( cb, cr );
+
+    __m128i r = _mm_add_epi16( _mm_add_epi16( yy, cr ), scaled( lo, hi, toR ) );
+    __m128i g = _mm_sub_epi16( _mm_add_epi16( yy, scaled( lo, hi, toG ) ), cr );
+    __m128i b = _mm_add_epi16( _mm_add_epi16( yy, _mm_add_epi16( cb, cb ) ), scaled( lo, hi, toB ) );
+
+    __m128i rg = _mm_unpacklo_epi8( _mm_packus_epi16( r, r ), _mm_packus_epi16( g, g ) );
+    __m128i ba = _mm_unpacklo_epi8( _mm_packus_epi16( b, b ), alpha );
+    _mm_storeu_si128( (__m128i*)out, _mm_unpacklo_epi16( rg, ba ) );
+    _mm_storeu_si128( (__m128i*)( out + 16 ), _mm_unpackhi_epi16( rg, ba ) );
+  }
+  return x;
+}
+
+#endif
+
+// IDCT, upsample and color convert one MCU into the RGB or RGBA output
+static void reconstructJpegMcu( const JpegImage& jpeg,
+                                const int16_t*   coefficients,
+                                uint32_t         acMask,
+                                uint32_t         mcuX,
+                                uint32_t         mcuY,
+                                uint8_t*         pixels,
+                                size_t           rowPitch,
+                                uint32_t         channels )
+{
+  uint8_t samples[10][64];
+
+  uint32_t block = 0;
+  for ( const auto& comp : jpeg.components )
+  {
+    const float* quant = jpeg.quant[ comp.quantTable ];
+    for ( uint32_t b = 0; b < comp.h * comp.v; b++, block++ )
+    {
+      const int16_t* coef = coefficients + block * 64;
+      if ( acMask & ( 1u << block ) )
+      {
+        inverseDctBlock( coef, quant, samples[block] );
+      }
+      else
+      {
+        std::memset( samples[block], clampJpegSample( coef[0] * quant[0] ), 64 );
+      }
+    }
+  }
+
+  uint32_t mcuWidth  = 8 * jpeg.hmax;
+  uint32_t mcuHeight = 8 * jpeg.vmax;
+  uint32_t x0        = mcuX * mcuWidth;
+  uint32_t y0        = mcuY * mcuHeight;
+  uint32_t width     = std::min( mcuWidth, jpeg.width - x0 );
+  uint32_t height    = std::min( mcuHeight, jpeg.height - y0 );
+
+  // Upsample every component to full MCU resolution
+  uint8_t planes[3][32 * 32];
+  block = 0;
+  for ( uint32_t c = 0; c < jpeg.components.size(); c++ )
+  {
+    const JpegComponent& comp = jpeg.components[c];
+    uint32_t             rx   = jpeg.hmax / comp.h;
+    uint32_t             ry   = jpeg.vmax / comp.v;
+
+    for ( uint32_t by = 0; by < comp.v; by++ )
+    {
+      for ( uint32_t bx = 0; bx < comp.h; bx++, block++ )
+      {
+        for ( uint32_t y = 0; y < 8; y++ )
+        {
+          const uint8_t* src = samples[block] + y * 8;
+          uint8_t*       dst = planes[c] + ( ( by * 8 + y ) * ry ) * mcuWidth + bx * 8 * rx;
+          if ( rx == 1 )
+          {
+            std::memcpy( dst, src, 8 );
+          }
+          else if ( rx == 2 )
+          {
+            for ( uint32_t x = 0; x < 8; x++ )
+            {
+              dst[2 * x] = dst[2 * x + 1] = src[x];
+            }
+          }
+          else
+          {
+            for ( uint32_t x = 0; x < 8; x++ )
+            {
+              std::memset( dst + x * rx, src[x], rx );
+            }
+          }
+          for ( uint32_t dy = 1; dy < ry; dy++ )
+          {
+            std::memcpy( dst + dy * mcuWidth, dst, 8 * rx );
+          }
+        }
+      }
+    }
+  }
+
+  for ( uint32_t y = 0; y < height; y++ )
+  {
+    uint8_t*       out = pixels + ( y0 + y ) * rowPitch + x0 * channels;
+    const uint8_t* c0  = planes[0] + y * mcuWidth;
+    const uint8_t* c1  = planes[1] + y * mcuWidth;
+    const uint8_t* c2  = planes[2] + y * mcuWidth;
+
+    if ( jpeg.components.size() == 1 )
+    {
+      for ( uint32_t x = 0; x < width; x++, out += channels )
+      {
+        out[0] = out[1] = out[2] = c0[x];
+      }
+    }
+    else if ( !jpeg.transformYCbCr )
+    {
+      for ( uint32_t x = 0; x < width; x++, out += channels )
+      {
+        out[0] = c0[x];
+        out[1] = c1[x];
+        out[2] = c2[x];
+      }
+    }
+    else
+    {
+      const JpegColorTables& tables = jpegColorTables();
+      const uint8_t*         clamp  = tables.clamp + 384;
+      uint32_t               x      = 0;
+#if JPEG_SSE2
+      if ( channels == 4 )
+      {
+        x    = convertJpegRowRGBA( c0, c1, c2, width, out );
+        out += x * 4;
+      }
+#endif
+      for ( ; x < width; x++, out += channels )
+      {
+        int32_t yy = c0[x];
+        out[0] = clamp[ yy + tables.crToR[ c2[x] ] ];
+        out[1] = clamp[ yy + ( ( tables.cbToG[ c1[x] ] + tables.crToG[ c2[x] ] ) >> 16 ) ];
+        out[2] = clamp[ yy + tables.cbToB[ c1[x] ] ];
+      }
+    }
+
+    if ( channels == 4 )
+    {
+      out = pixels + ( y0 + y ) * rowPitch + x0 * 4;
+      for ( uint32_t x = 0; x < width; x++ )
+      {
+        out[ x * 4 + 3 ] = 255;
+      }
+    }
+  }
+}
+
+// Split the scan at its restart markers
+static std::vector<std::pair<const uint8_t*, const uint8_t*>> findJpegRestartSegments( const JpegImage& jpeg )
+{
+  std::vector<std::pair<const uint8_t*, const uint8_t*>> segments;
+
+  const uint8_t* begin = jpeg.scanBegin;
+  const uint8_t* p     = jpeg.scanBegin;
+  while ( p + 1 < jpeg.scanEnd )
+  {
+    if ( p[0] == 0xFF && p[1] != 0x00 && p[1] != 0xFF )
+    {
+      segments.push_back( std::make_pair( begin, p ) );
+      if ( p[1] < 0xD0 || p[1] > 0xD7 )
+      {
+        return segments; // EOI or another marker ends the scan
+      }
+      p    += 2;
+      begin = p;
+      continue;
+    }
+    p++;
+  }
+
+  segments.push_back( std::make_pair( begin, jpeg.scanEnd ) );
+  return segments;
+}
+
+// Decode a parsed baseline JPEG into width * height RGB8 (channels 3) or
+// opaque RGBA8 (channels 4) texels at pixels, with rows rowPitch bytes
+// apart. jpeg must have come from readJpegHeader and the file it was read
+// from must still be alive.
+void decodeJpeg( const JpegImage& jpeg,
+                 uint8_t*         pixels,
+                 size_t           rowPitch,
+                 uint32_t         channels,
+                 uint32_t         threadCount )
+{
+  const uint32_t coefficientsPerMcu = jpeg.blocksPerMcu * 64;
+  const uint32_t totalMcus          = jpeg.mcusX * jpeg.mcusY;
+
+  threadCount = std::max( threadCount, 1u );
+
+  // Restart intervals are independent, so hand them out as tasks
+  if ( jpeg.restartInterval > 0 )
+  {
+    auto segments = findJpegRestartSegments( jpeg );
+
+    std::atomic<uint32_t> nextSegment( 0 );
+    auto worker = [&]()
+    {
+      std::vector<int16_t> coefficients( coefficientsPerMcu );
+      for ( uint32_t s = nextSegment++; s < segments.size(); s = nextSegment++ )
+      {
+        JpegBitReader reader( segments[s].first, segments[s].second );
+        int32_t       dcPred[3] = { 0, 0, 0 };
+
+        uint32_t first = s * jpeg.restartInterval;
+        uint32_t last  = std::min( first + jpeg.restartInterval, totalMcus );
+        for ( uint32_t m = first; m < last; m++ )
+        {
+          uint32_t acMask = decodeJpegMcu( jpeg, reader, dcPred, coefficients.data() );
+          reconstructJpegMcu( jpeg, coefficients.data(), acMask,
+                              m % jpeg.mcusX, m / jpeg.mcusX, pixels, rowPitch, channels );
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for ( uint32_t t = 1; t < threadCount; t++ )
+    {
+      threads.push_back( std::thread( worker ) );
+    }
+    worker();
+    for ( auto& thread : threads )
+    {
+      thread.join();
+    }
+    return;
+  }
+
+  JpegBitReader reader( jpeg.scanBegin, jpeg.scanEnd );
+  int32_t       dcPred[3] = { 0, 0, 0 };
+
+  if ( threadCount == 1 )
+  {
+    std::vector<int16_t> coefficients( coefficientsPerMcu );
+    for ( uint32_t m = 0; m < totalMcus; m++ )
+    {
+      uint32_t acMask = decodeJpegMcu( jpeg, reader, dcPred, coefficients.data() );
+      reconstructJpegMcu( jpeg, coefficients.data(), acMask,
+                          m % jpeg.mcusX, m / jpeg.mcusX, pixels, rowPitch, channels );
+    }
+    return;
+  }
+
+  // This thread entropy decodes MCU rows into a ring of slots while the
+  // workers reconstruct finished rows
+  const uint32_t workerCount = threadCount - 1;
+  const uint32_t slotCount   = 2 * workerCount + 2;
+
+  std::vector<int16_t>  coefficients( (size_t)slotCount * jpeg.mcusX * coefficientsPerMcu );
+  std::vector<uint32_t> acMasks( (size_t)slotCount * jpeg.mcusX );
+  std::vector<bool>     slotFree( slotCount, true );
+  uint32_t              decodedRows = 0;
+  std::atomic<uint32_t> nextRow( 0 );
+  std::mutex              mutex;
+  std::condition_variable changed;
+
+  auto worker = [&]()
+  {
+    for ( uint32_t row = nextRow++; row < jpeg.mcusY; row = nextRow++ )
+    {
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        changed.wait( lock, [&]() { return decodedRows > row; } );
+      }
+
+      uint32_t slot = row % slotCount;
+      for ( uint32_t x = 0; x < jpeg.mcusX; x++ )
+      {
+        size_t mcu = (size_t)slot * jpeg.mcusX + x;
+        reconstructJpegMcu( jpeg, &coefficients[ mcu * coefficientsPerMcu ], acMasks[mcu],
+                            x, row, pixels, rowPitch, channels );
+      }
+
+      std::lock_guard<std::mutex> lock( mutex );
+      slotFree[slot] = true;
+      changed.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for ( uint32_t t = 0; t < workerCount; t++ )
+  {
+    threads.push_back( std::thread( worker ) );
+  }
+
+  for ( uint32_t row = 0; row < jpeg.mcusY; row++ )
+  {
+    uint32_t slot = row % slotCount;
+    {
+      std::unique_lock<std::mutex> lock( mutex );
+      changed.wait( lock, [&]() { return slotFree[slot]; } );
+      slotFree[slot] = false;
+    }
+
+    for ( uint32_t x = 0; x < jpeg.mcusX; x++ )
+    {
+      size_t mcu = (size_t)slot * jpeg.mcusX + x;
+      acMasks[mcu] = decodeJpegMcu( jpeg, reader, dcPred, &coefficients[ mcu * coefficientsPerMcu ] );
+    }
+
+    std::lock_guard<std::mutex> lock( mutex );
+    decodedRows = row + 1;
+    changed.notify_all();
+  }
+
+  for ( auto& thread : threads )
+  {
+    thread.join();
+  }
+}
+
+// Nonzero coefficients of every block, for reconstruction on the device
+// by jpegidct.comp. Blocks are in MCU order and block b owns
+// words[ blockOffsets[b], blockOffsets[b + 1] ), each packed as
+// ( value << 16 ) | natural index and not yet dequantized.
+struct JpegCoefficients
+{
+  std::vector<uint32_t> blockOffsets { 0 };
+  std::vector<uint32_t> words;
+};
+
+static void packJpegMcu( const int16_t* coefficients, uint32_t blockCount, JpegCoefficients& out )
+{
+  for ( uint32_t block = 0; block < blockCount; block++ )
+  {
+    const int16_t* coef = coefficients + block * 64;
+    for ( uint32_t k = 0; k < 64; k++ )
+    {
+      if ( coef[k] != 0 )
+      {
+        out.words.push_back( (uint32_t)(uint16_t)coef[k] << 16 | k );
+      }
+    }
+    out.blockOffsets.push_back( out.words.size() );
+  }
+}
+
+// Entropy decode only; restart intervals are decoded in parallel
+void decodeJpegCoefficients( const JpegImage&  jpeg,
+                             JpegCoefficients& coefficients,
+                             uint32_t          threadCount )
+{
+  const uint32_t totalMcus = jpeg.mcusX * jpeg.mcusY;
+
+  std::vector<std::pair<const uint8_t*, const uint8_t*>> segments;
+  uint32_t                                               mcusPerSegment = totalMcus;
+  if ( jpeg.restartInterval > 0 )
+  {
+    segments       = findJpegRestartSegments( jpeg );
+    mcusPerSegment = jpeg.restartInterval;
+  }
+  else
+  {
+    segments.push_back( std::make_pair( jpeg.scanBegin, jpeg.scanEnd ) );
+  }
+
+  std::vector<JpegCoefficients> decoded( segments.size() );
+  std::atomic<uint32_t>         nextSegment( 0 );
+  auto worker = [&]()
+  {
+    std::vector<int16_t> mcu( jpeg.blocksPerMcu * 64 );
+    for ( uint32_t s = nextSegment++; s < segments.size(); s = nextSegment++ )
+    {
+      JpegBitReader reader( segments[s].first, segments[s].second );
+      int32_t       dcPred[3] = { 0, 0, 0 };
+
+      uint32_t first = s * mcusPerSegment;
+      uint32_t last  = std::min( first + mcusPerSegment, totalMcus );
+      for ( uint32_t m = first; m < last; m++ )
+      {
+        decodeJpegMcu( jpeg, reader, dcPred, mcu.data() );
+        packJpegMcu( mcu.data(), jpeg.blocksPerMcu, decoded[s] );
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for ( uint32_t t = 1; t < std::min<size_t>( threadCount, segments.size() ); t++ )
+  {
+    threads.push_back( std::thread( worker ) );
+  }
+  worker();
+  for ( auto& thread : threads )
+  {
+    thread.join();
+  }
+
+  // Stitch the segments together
+  coefficients = JpegCoefficients();
+  for ( const auto& segment : decoded )
+  {
+    uint32_t base = coefficients.words.size();
+    for ( size_t b = 1; b < segment.blockOffsets.size(); b++ )
+    {
+      coefficients.blockOffsets.push_back( base + segment.blockOffsets[b] );
+    }
+    coefficients.words.insert( coefficients.words.end(), segment.words.begin(), segment.words.end() );
+  }
+}
+
+#endif
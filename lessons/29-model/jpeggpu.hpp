@@ -0,0 +1,194 @@
+#ifndef __JPEGGPU_HPP__
+#define __JPEGGPU_HPP__
+
+#include "base-includes.hpp"
+#include "buffer.hpp"
+#include "computefill.hpp"
+#include "jpeg.hpp"
+#include "texture.hpp"
+#include "upload.hpp"
+
+// Hybrid JPEG decoding: the CPU only entropy decodes (decodeJpegCoefficients)
+// and jpegidct.comp reconstructs the pixels straight into the texture. Only
+// the nonzero coefficients cross the bus, which is usually far less than
+// the decoded texels.
+
+// Leading words of the buffer read by jpegidct.comp, followed by the
+// prescaled quantization tables, the block offsets and the coefficients
+struct JpegGpuHeader
+{
+  uint32_t width;
+  uint32_t height;
+  uint32_t mcusX;
+  uint32_t blocksPerMcu;
+  uint32_t componentCount;
+  uint32_t hmax;
+  uint32_t vmax;
+  uint32_t transformYCbCr;
+  uint32_t components[3][4]; // h, v, quantTable, first block within the MCU
+  uint32_t offsetsBase;      // Word index of the block offsets
+  uint32_t dataBase;         // Word index of the coefficients
+  uint32_t padding[2];
+};
+
+const uint32_t JPEG_GPU_QUANT_WORDS = 4 * 64;
+
+// Words of the buffer read by jpegidct.comp; never empty, so the buffer is
+// valid even for a blank image
+size_t jpegGpuWordCount( const JpegCoefficients& coefficients )
+{
+  return sizeof( JpegGpuHeader ) / 4 + JPEG_GPU_QUANT_WORDS +
+         coefficients.blockOffsets.size() + std::max<size_t>( coefficients.words.size(), 1 );
+}
+
+// Lay out everything jpegidct.comp reads at words
+void writeJpegGpuWords( const JpegImage&        jpeg,
+                        const JpegCoefficients& coefficients,
+                        uint32_t*               words )
+{
+  JpegGpuHeader header = {};
+  header.width          = jpeg.width;
+  header.height         = jpeg.height;
+  header.mcusX          = jpeg.mcusX;
+  header.blocksPerMcu   = jpeg.blocksPerMcu;
+  header.componentCount = jpeg.components.size();
+  header.hmax           = jpeg.hmax;
+  header.vmax           = jpeg.vmax;
+  header.transformYCbCr = jpeg.transformYCbCr;
+
+  uint32_t firstBlock = 0;
+  for ( uint32_t c = 0; c < jpeg.components.size(); c++ )
+  {
+    header.components[c][0] = jpeg.components[c].h;
+    header.components[c][1] = jpeg.components[c].v;
+    header.components[c][2] = jpeg.components[c].quantTable;
+    header.components[c][3] = firstBlock;
+    firstBlock += jpeg.components[c].h * jpeg.components[c].v;
+  }
+
+  header.offsetsBase = sizeof( header ) / 4 + JPEG_GPU_QUANT_WORDS;
+  header.dataBase    = header.offsetsBase + coefficients.blockOffsets.size();
+
+  std::memcpy( words, &header, sizeof( header ) );
+  std::memcpy( words + sizeof( header ) / 4, jpeg.quant, sizeof( jpeg.quant ) );
+  std::memcpy( words + header.offsetsBase, coefficients.blockOffsets.data(),
+               coefficients.blockOffsets.size() * 4 );
+  std::memcpy( words + header.dataBase, coefficients.words.data(),
+               coefficients.words.size() * 4 );
+}
+
+// Host visible buffer with everything jpegidct.comp reads
+VkBuffer createJpegCoefficientBuffer( VkPhysicalDevice        physical,
+                                      UploadContext&          upload,
+                                      const JpegImage&        jpeg,
+                                      const JpegCoefficients& coefficients )
+{
+  VkDeviceSize size = jpegGpuWordCount( coefficients ) * 4;
+
+  VDeleter<VkBuffer>& buffer = upload.own<VkBuffer>( vkDestroyBuffer );
+  MemoryAllocation&   memory = upload.ownMemory( MEMORY_CATEGORY_STAGING, "JPEG coefficients" );
+  createBuffer( upload.device,
+                physical,
+                size,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                MEMORY_USAGE_UPLOAD,
+                buffer,
+                memory );
+
+  void* data = memory.map();
+  writeJpegGpuWords( jpeg, coefficients, (uint32_t*)data );
+
+  upload.stagedBytes += size;
+  return buffer;
+}
+
+// Record reconstructing jpeg from buffer into level 0 of image, which needs
+// STORAGE usage. Leaves all mipLevels levels in TRANSFER_DST_OPTIMAL so
+// generateMipmaps can follow.
+void reconstructJpeg( UploadContext&   upload,
+                      VkBuffer         buffer,
+                      VkImage          image,
+                      const JpegImage& jpeg,
+                      uint32_t         mipLevels )
+{
+  fillLevelZeroCompute( upload, "jpegidct-comp.spv", buffer, image,
+                        nullptr, 0, jpeg.mcusX, jpeg.mcusY, mipLevels );
+}
+
+// Reconstruct jpeg on the device and read it back as tightly packed RGBA8
+// rows into pixels, for textures cooked to a block compressed format rather
+// than sampled as decoded. Submits its own commands and waits for them.
+void decodeJpegOnDevice( VkPhysicalDevice          physical,
+                         const VDeleter<VkDevice>& device,
+                         DeviceMemoryAllocator&    allocator,
+                         VkQueue                   queue,
+                         VkCommandPool             commandPool,
+                         const JpegImage&          jpeg,
+                         const JpegCoefficients&   coefficients,
+                         uint8_t*                  pixels )
+{
+  VkDeviceSize       size = (VkDeviceSize)jpeg.width * jpeg.height * 4;
+  VDeleter<VkBuffer> readbackBuffer       { device, vkDestroyBuffer };
+  MemoryAllocation   readbackBufferMemory { allocator, MEMORY_CATEGORY_READBACK, "JPEG reconstruction readback" };
+  createBuffer( device,
+                physical,
+                size,
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                MEMORY_USAGE_READBACK,
+                readbackBuffer,
+                readbackBufferMemory );
+
+  UploadContext upload( device, allocator );
+  upload.begin( commandPool );
+
+  VDeleter<VkImage>& image       = upload.own<VkImage>( vkDestroyImage );
+  MemoryAllocation&  imageMemory = upload.ownMemory( MEMORY_CATEGORY_TEXTURE, "JPEG reconstruction" );
+  createImage( physical,
+               device,
+               jpeg.width,
+               jpeg.height,
+               1,
+               1,
+               VK_FORMAT_R8G8B8A8_UNORM,
+               VK_IMAGE_TILING_OPTIMAL,
+               VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+               MEMORY_USAGE_GPU_ONLY,
+               image,
+               imageMemory );
+
+  VkBuffer buffer = createJpegCoefficientBuffer( physical, upload, jpeg, coefficients );
+  reconstructJpeg( upload, buffer, image, jpeg, 1 );
+
+  auto toSrc = mipBarrier( image, 0, 1,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                           VK_ACCESS_TRANSFER_READ_BIT );
+  vkCmdPipelineBarrier( upload.commandBuffer,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        0, 0, nullptr, 0, nullptr, 1, &toSrc );
+
+  VkBufferImageCopy region = {};
+  region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel       = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount     = 1;
+  region.imageExtent                     = { jpeg.width, jpeg.height, 1 };
+  vkCmdCopyImageToBuffer( upload.commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                          readbackBuffer, 1, &region );
+
+  VkMemoryBarrier toHost = {};
+  toHost.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier( upload.commandBuffer,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_HOST_BIT,
+                        0, 1, &toHost, 0, nullptr, 0, nullptr );
+
+  upload.flush( queue );
+  std::memcpy( pixels, readbackBufferMemory.map(), size );
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <vector>
 #include <stdexcept>
@@ -9,11 +10,33 @@
 #include "swapchain.hpp"
 #include "shader.hpp"
 #include "buffer.hpp"
+#include "allocator.hpp"
+#include "staging.hpp"
 #include "vertex.hpp"
 #include "ubo.hpp"
 #include "texture.hpp"
 #include "imgview.hpp"
+#include "sampler.hpp"
 #include "depth.hpp"
+#include "mipmap.hpp"
+#include "rgbexpand.hpp"
+#include "texcook.hpp"
+#include "hostimport.hpp"
+#include "streaming.hpp"
+#include "texarray.hpp"
+#include "texbudget.hpp"
+#include "jpeg.hpp"
+#include "jpeggpu.hpp"
+#include "decode.hpp"
+#include "frames.hpp"
+#include "transient.hpp"
+#include "residency.hpp"
+#include "feedback.hpp"
+#include "strip.hpp"
+#include "geometry.hpp"
+#include "impostor.hpp"
+#include "meshpipeline.hpp"
+#include "defrag.hpp"
 
 class HelloTriangleApplication
 {
@@ -34,6 +57,12 @@ private:
 
   VkPhysicalDevice                     physical = VK_NULL_HANDLE;
   VDeleter<VkDevice>                   device   { vkDestroyDevice };
+  DeviceMemoryAllocator                allocator { this->device };
+  bool                                 properties2Supported  = false;
+  bool                                 memoryBudgetSupported = false;
+  bool                                 externalMemorySupported = false;
+  SamplerCache                         samplerCache { this->device };
+  HostImporter                         hostImporter { this->device };
 
   int                                  graphicsQueueIdx;
   int                                  presentQueueIdx;
@@ -51,38 +80,73 @@ private:
   VDeleter<VkDescriptorSetLayout>      descriptorSetLayout        { this->device, vkDestroyDescriptorSetLayout };
   VDeleter<VkPipelineLayout>           pipelineLayout             { this->device, vkDestroyPipelineLayout };
   VDeleter<VkPipeline>                 graphicsPipeline           { this->device, vkDestroyPipeline };
+  VDeleter<VkPipeline>                 stripPipeline              { this->device, vkDestroyPipeline };
+
+  VDeleter<VkDescriptorSetLayout>      impostorDescriptorSetLayout { this->device, vkDestroyDescriptorSetLayout };
+  VDeleter<VkPipelineLayout>           impostorPipelineLayout      { this->device, vkDestroyPipelineLayout };
+  VDeleter<VkPipeline>                 impostorPipeline            { this->device, vkDestroyPipeline };
+  ImpostorAtlas                        impostorAtlas               { this->device, this->allocator };
 
   VDeleter<VkCommandPool>              commandPool                { this->device, vkDestroyCommandPool };
+  StagingRing                          stagingRing                { this->device, this->allocator };
+  UploadContext                        upload                     { this->device, this->allocator };
+  UploadContext                        reloadUpload               { this->device, this->allocator }; // Submitted without waiting
 
   VDeleter<VkImage>                    depthImage                 { this->device, vkDestroyImage };
-  VDeleter<VkDeviceMemory>             depthImageMemory           { this->device, vkFreeMemory };
+  MemoryAllocation                     depthImageMemory           { this->allocator, MEMORY_CATEGORY_ATTACHMENT, "depth image" };
   VDeleter<VkImageView>                depthImageView             { this->device, vkDestroyImageView };
 
   VDeleter<VkImage>                    textureImage               { this->device, vkDestroyImage };
-  VDeleter<VkDeviceMemory>             textureImageMemory         { this->device, vkFreeMemory };
+  MemoryAllocation                     textureImageMemory         { this->allocator, MEMORY_CATEGORY_TEXTURE, "material texture" };
   VDeleter<VkImageView>                textureImageView           { this->device, vkDestroyImageView };
-  VDeleter<VkSampler>                  textureSampler             { this->device, vkDestroySampler };
+  SamplerHandle                        textureSampler;
+  VDeleter<VkImage>                    reloadImage                { this->device, vkDestroyImage }; // Replaces textureImage once uploaded
+  MemoryAllocation                     reloadImageMemory          { this->allocator, MEMORY_CATEGORY_TEXTURE, "material texture" };
+  uint32_t                             textureMipLevels           = 1;
+  VkFormat                             textureFormat              = VK_FORMAT_R8G8B8A8_UNORM;
+  bool                                 textureReconstructedOnGpu  = false;
+  uint32_t                             textureArrayLayers         = 1;
+  std::vector<std::string>             materialTextures;
+  std::vector<VkExtent2D>              materialTextureExtents;
+  TextureArrayPacking                  materialTexturePacking;
+  TextureStreamer                      textureStreamer            { this->device, this->allocator };
+  TextureResidency                     textureResidency;
+  uint32_t                             textureResidencyId         = 0;
+  CookedTexture                        textureCooked;             // Header of the reloadable cooked texture
+  uint32_t                             textureBaseLevel           = 0; // Full chain level the image starts at
+  VkDeviceSize                         textureBudget              = 0;
+  DeferredDestroyQueue                 retiredTextures;
+  bool                                 reloadRequested            = false;
+  uint32_t                             reloadBaseLevel            = 0;
+  uint32_t                             reloadResidentLevel        = 0;
+  TextureFeedback                      textureFeedback            { this->device, this->allocator };
+  bool                                 textureFeedbackEnabled     = false;
 
   std::vector<Vertex>                  vertices;
-  std::unordered_map<Vertex, int>      uniqueVertices = {};
-  std::vector<uint32_t>                indices;
-  VDeleter<VkBuffer>                   vertexBuffer               { this->device, vkDestroyBuffer };
-  VDeleter<VkDeviceMemory>             vertexBufferMemory         { this->device, vkFreeMemory };
-  VDeleter<VkBuffer>                   indexBuffer                { this->device, vkDestroyBuffer };
-  VDeleter<VkDeviceMemory>             indexBufferMemory          { this->device, vkFreeMemory };
-
-  VDeleter<VkBuffer>                   uniformStagingBuffer       { this->device, vkDestroyBuffer };
-  VDeleter<VkDeviceMemory>             uniformStagingBufferMemory { this->device, vkFreeMemory };
-  VDeleter<VkBuffer>                   uniformBuffer              { this->device, vkDestroyBuffer };
-  VDeleter<VkDeviceMemory>             uniformBufferMemory        { this->device, vkFreeMemory };
+  std::unordered_map<Vertex, uint64_t> uniqueVertices = {};
+  std::vector<uint64_t>                indices;
+  std::vector<MeshChunk>               meshChunks;
+  GeometryLimits                       geometryLimits;
+  std::vector<GeometryPage>            geometryPages;
+  std::vector<GeometryDraw>            geometryDraws;
+  Defragmenter                         defragmenter               { this->device, this->allocator }; // After what it moves
+
+  std::vector<glm::vec4>               instances;
+  std::vector<InstanceData>            meshInstances;
+  std::vector<InstanceData>            impostorInstances;
+
+  TransientRing                        frameRing                  { this->device, this->allocator }; // Uniforms, instances and indirect draws
+  UniformBufferObject                  frameUniforms;             // Copied into the ring once the frame's image is acquired
 
   VDeleter<VkDescriptorPool>           descriptorPool             { this->device, vkDestroyDescriptorPool };
-  VkDescriptorSet                      descriptorSet; // Freed when descriptorPool is destroyed
+  std::vector<VkDescriptorSet>         descriptorSets;            // One per swapchain image, freed when descriptorPool is destroyed
+  std::vector<VkDescriptorSet>         impostorDescriptorSets;
 
   std::vector<VkCommandBuffer>         commandBuffers;
+  uint64_t                             bindingsVersion            = 1; // Bumped whenever a resource the frame commands use is replaced
+  std::vector<uint64_t>                recordedVersions;          // Version each image's descriptor sets and commands were written at
 
-  VDeleter<VkSemaphore>                imageAvailableSemaphore { this->device, vkDestroySemaphore };
-  VDeleter<VkSemaphore>                renderFinishSemaphore   { this->device, vkDestroySemaphore };
+  FrameFences                          frameFences             { this->device }; // Fences and semaphores per frame in flight
   
   void initWindow()
   {
@@ -96,6 +160,7 @@ private:
 
     glfwSetWindowUserPointer( this->window, this );
     glfwSetWindowSizeCallback( this->window, HelloTriangleApplication::onWindowResized );
+    glfwSetKeyCallback( this->window, HelloTriangleApplication::onKey );
   }
 
   static void onWindowResized( GLFWwindow* window, int width, int height )
@@ -110,6 +175,19 @@ private:
     );
     app->recreateSwapChain();
   }
+
+  static void onKey( GLFWwindow* window, int key, int scancode, int action, int mods )
+  {
+    if ( key != MEMORY_SNAPSHOT_KEY || action != GLFW_PRESS )
+    {
+      return;
+    }
+
+    HelloTriangleApplication* app = reinterpret_cast<HelloTriangleApplication*>(
+      glfwGetWindowUserPointer( window )
+    );
+    app->writeMemorySnapshot( "memory-" + std::to_string( app->frameFences.frame ) + ".json" );
+  }
     
   void initVulkan()
   {
@@ -124,19 +202,95 @@ private:
     this->createDescriptorSetLayout();
     this->createGraphicsPipeline();
     this->createCommandPool();
+
+    // Every one-time upload, mip generation and bake below is recorded
+    // into one command buffer and submitted once
+    this->upload.begin( this->commandPool );
     this->createDepthResources();
     this->createFramebuffers();
+    this->loadModel();
     this->createTextureImage();
     this->createTextureImageView();
-    this->createTextureSampler();
-    this->loadModel();
-    this->createVertexBuffer();
-    this->createIndexBuffer();
+    this->createGeometryBuffers();
+    this->createInstances();
     this->createUniformBuffer();
+    this->createTextureFeedback();
     this->createDescriptorPool();
-    this->createDescriptorSet();
+    this->createDescriptorSets();
+    this->createImpostorAtlas();
+    this->upload.submit( this->graphicsQueue );
+    std::cout << "Upload: " << this->upload.stats.stagedBytes << " bytes staged in "
+              << this->upload.stats.submissions << " submissions, "
+              << this->upload.stats.directBytes << " bytes written directly" << std::endl;
+
     this->createCommandBuffers();
-    this->createSemaphores();
+    this->frameFences.resize( MAX_FRAMES_IN_FLIGHT, this->swapchainImages.size() );
+    this->upload.wait();
+
+    if ( JPEG_GPU_VALIDATE && this->textureReconstructedOnGpu )
+    {
+      this->validateJpegTexture();
+    }
+
+    if ( HOST_IMPORT_BENCHMARK && !this->textureCooked.levels.empty() )
+    {
+      benchmarkHostImport( this->device, this->allocator, this->graphicsQueue, this->commandPool,
+                           this->physical, this->hostImporter, COOKED_TEXTURE_PATH,
+                           this->textureCooked, HOST_IMPORT_BENCHMARK_REPETITIONS );
+    }
+
+    this->registerMovableResources();
+
+    this->printAllocatorStats();
+  }
+
+  // Resources the defragmenter may move. The texture image is left out as
+  // residency changes already place it anew.
+  void registerMovableResources(  )
+  {
+    for ( auto& page : this->geometryPages )
+    {
+      if ( page.vertexBytes == 0 )
+      {
+        continue;
+      }
+      this->defragmenter.addBuffer( page.vertexBuffer, page.vertexBufferMemory, page.vertexBytes,
+                                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT );
+      this->defragmenter.addBuffer( page.indexBuffer, page.indexBufferMemory, page.indexBytes,
+                                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT );
+    }
+
+    MovableImageInfo atlas;
+    atlas.width  = this->impostorAtlas.viewsPerSide * this->impostorAtlas.tileSize;
+    atlas.height = atlas.width;
+    atlas.format = VK_FORMAT_R8G8B8A8_UNORM;
+    atlas.usage  = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    this->defragmenter.addImage( this->impostorAtlas.colorImage, this->impostorAtlas.colorImageMemory,
+                                 this->impostorAtlas.colorImageView, atlas );
+    this->defragmenter.addImage( this->impostorAtlas.normalDepthImage,
+                                 this->impostorAtlas.normalDepthImageMemory,
+                                 this->impostorAtlas.normalDepthImageView, atlas );
+  }
+
+  void printAllocatorStats(  )
+  {
+    AllocatorStats stats = this->allocator.stats();
+    std::cout << "Device memory: " << stats.allocations << " allocations in "
+              << stats.blocks << " blocks (" << stats.dedicated << " dedicated), "
+              << stats.usedBytes << " of " << stats.reservedBytes << " bytes used, "
+              << stats.freeRanges << " free ranges, largest " << stats.largestFreeRange
+              << " bytes, fragmentation " << stats.fragmentation << ", "
+              << stats.fallbacks << " placed in a slower memory type" << std::endl;
+  }
+
+  // Heap budgets the allocator checks new blocks against
+  void updateAllocatorBudget(  )
+  {
+    VkDeviceSize heapBudget[ VK_MAX_MEMORY_HEAPS ];
+    VkDeviceSize heapUsage[ VK_MAX_MEMORY_HEAPS ];
+    queryHeapBudgets( this->instance, this->physical, this->memoryBudgetSupported,
+                      heapBudget, heapUsage );
+    this->allocator.setBudget( heapBudget, heapUsage );
   }
 
   void mainLoop()
@@ -146,11 +300,72 @@ private:
       glfwPollEvents();
 
       this->updateUniformBuffer();
+      this->updateTextureStreaming();
+      this->updateTextureReload();
+      this->updateTextureResidency();
+      this->updateDefragmentation();
       this->drawFrame();
     }
 
     // Wait for logical device to finish
     vkDeviceWaitIdle( this->device );
+    this->retiredTextures.collect( this->frameFences.frame );
+
+    ResidencyMetrics residency = this->textureResidency.metrics();
+    std::cout << "Texture residency: " << residency.residentBytes << " bytes resident, "
+              << residency.downgrades << " downgrades, "
+              << residency.evictions << " evictions, "
+              << residency.reuploads << " re-uploads, "
+              << residency.trims << " trims" << std::endl;
+
+    if ( this->textureFeedbackEnabled )
+    {
+      FeedbackMetrics feedback = this->textureFeedback.metrics();
+      std::cout << "Texture feedback: " << feedback.samples << " samples in "
+                << feedback.frames << " frames, " << feedback.bytesPerFrame
+                << " bytes per frame, collected in " << feedback.averageCollectMs
+                << " ms on average, " << feedback.maxCollectMs << " ms at most" << std::endl;
+    }
+
+    const UploadStats& stats = this->upload.stats;
+    std::cout << "Upload: " << stats.directBytes << " bytes written directly, "
+              << stats.stagedBytes << " bytes copied and "
+              << stats.importedBytes << " bytes imported in "
+              << stats.submissions << " submissions" << std::endl;
+
+    const UploadStats& streamed = this->textureStreamer.uploadStats();
+    std::cout << "Texture streaming: " << streamed.stagedBytes << " bytes copied and "
+              << streamed.importedBytes << " bytes imported" << std::endl;
+    std::cout << "Staging ring: " << this->stagingRing.peakBytes() << " of "
+              << this->stagingRing.capacity() << " bytes used at most, "
+              << stats.splits + streamed.splits << " submissions split, "
+              << stats.ringMisses + streamed.ringMisses << " uploads too large for it" << std::endl;
+    std::cout << "Frame ring: " << this->frameRing.peakBytes() << " of "
+              << this->frameRing.capacity() << " bytes per frame used at most" << std::endl;
+
+    const DefragmentStats& defragmented = this->defragmenter.statistics();
+    std::cout << "Defragmentation: " << defragmented.moves << " moves, "
+              << defragmented.bytesMoved << " bytes moved, "
+              << defragmented.blocksReleased << " blocks released" << std::endl;
+
+    this->printAllocatorStats();
+    if ( MEMORY_SNAPSHOT_AT_EXIT )
+    {
+      this->writeMemorySnapshot( MEMORY_SNAPSHOT_PATH );
+    }
+  }
+
+  void writeMemorySnapshot( const std::string& path )
+  {
+    std::ofstream file( path );
+    if ( !file )
+    {
+      std::cerr << "Device memory: failed to write snapshot to " << path << std::endl;
+      return;
+    }
+
+    this->allocator.writeJson( file );
+    std::cout << "Device memory: snapshot written to " << path << std::endl;
   }
 
   void recreateSwapChain(  )
@@ -161,9 +376,23 @@ private:
     this->createImageViews();
     this->createRenderPass();
     this->createGraphicsPipeline();
+    this->upload.begin( this->commandPool );
     this->createDepthResources();
+    this->upload.flush( this->graphicsQueue );
     this->createFramebuffers();
+    this->createTextureFeedback();
+    if ( this->frameRing.regions() != this->swapchainImages.size() )
+    {
+      this->createUniformBuffer();
+    }
+    if ( this->descriptorSets.size() != this->swapchainImages.size() )
+    {
+      this->createDescriptorPool();
+      this->createDescriptorSets();
+    }
     this->createCommandBuffers();
+    this->frameFences.resize( MAX_FRAMES_IN_FLIGHT, this->swapchainImages.size() );
+    this->frameFences.idle();
   }
 
   void updateUniformBuffer(  )
@@ -188,39 +417,285 @@ private:
                                         0.1f, 10.0f );
     ubo.proj[1][1] *= -1; // Flip y coord to deal with vulkan's coordinate system
 
-    void* data;
-    vkMapMemory( this->device, this->uniformStagingBufferMemory,
-                 0, sizeof(ubo), 0, &data );
-    std::memcpy( data, &ubo, sizeof(ubo) );
-    vkUnmapMemory( this->device, this->uniformStagingBufferMemory );
+    this->frameUniforms = ubo;
+    this->updateInstances( ubo );
+  }
+
+  // Pick which instances are drawn as meshes and which as impostors; they
+  // are written into the ring by writeFrameData once the frame's image is
+  // known
+  void updateInstances( const UniformBufferObject& ubo )
+  {
+    selectImpostorInstances( this->instances,
+                             this->impostorAtlas,
+                             ubo,
+                             (float)this->swapchainExtent.height,
+                             IMPOSTOR_THRESHOLD_PIXELS,
+                             IMPOSTOR_FADE_BAND,
+                             this->meshInstances,
+                             this->impostorInstances );
+
+    // Only mesh draws sample the texture
+    if ( !this->meshInstances.empty() )
+    {
+      this->textureResidency.use( this->textureResidencyId, this->frameFences.frame );
+    }
+  }
+
+  // Fill the image's ring region with everything its frame reads. The
+  // previous frame drawn to the image has completed, so nothing in flight
+  // reads the region. The allocations are made in the order the prerecorded
+  // command buffer expects: uniforms, instances, then indirect draws.
+  void writeFrameData( uint32_t imageIdx )
+  {
+    this->frameRing.begin( imageIdx );
+    TransientAllocation uniforms = this->frameRing.allocate( sizeof( UniformBufferObject ) );
+    std::memcpy( uniforms.data, &this->frameUniforms, sizeof( UniformBufferObject ) );
+
+    // Mesh instances go first, impostor instances start at INSTANCE_COUNT
+    TransientAllocation instanceData = this->frameRing.allocate( this->instanceDataSize() );
+    InstanceData*       instances    = (InstanceData*)instanceData.data;
+    std::memcpy( instances, this->meshInstances.data(),
+                 this->meshInstances.size() * sizeof( InstanceData ) );
+    std::memcpy( instances + INSTANCE_COUNT, this->impostorInstances.data(),
+                 this->impostorInstances.size() * sizeof( InstanceData ) );
+
+    // Instance counts are fed to the prerecorded command buffers indirectly,
+    // one indexed draw per geometry chunk followed by the impostor draw
+    std::vector<VkDrawIndexedIndirectCommand> meshDraws( this->geometryDraws.size() );
+    for ( size_t d = 0; d < meshDraws.size(); d++ )
+    {
+      meshDraws[d].indexCount    = this->geometryDraws[d].indexCount;
+      meshDraws[d].instanceCount = this->meshInstances.size();
+      meshDraws[d].firstIndex    = this->geometryDraws[d].firstIndex;
+      meshDraws[d].vertexOffset  = this->geometryDraws[d].vertexOffset;
+      meshDraws[d].firstInstance = 0;
+    }
+
+    VkDrawIndirectCommand impostorDraw = {};
+    impostorDraw.vertexCount   = 4;
+    impostorDraw.instanceCount = this->impostorInstances.size();
+
+    VkDeviceSize        meshDrawsSize = meshDraws.size() * sizeof( VkDrawIndexedIndirectCommand );
+    TransientAllocation indirect      = this->frameRing.allocate( this->indirectDataSize() );
+    char*               data          = (char*)indirect.data;
+    std::memcpy( data, meshDraws.data(), meshDrawsSize );
+    std::memcpy( data + meshDrawsSize, &impostorDraw, sizeof( impostorDraw ) );
+  }
+
+  void updateTextureStreaming(  )
+  {
+    if ( !this->textureStreamer.update( this->graphicsQueue, this->commandPool ) )
+    {
+      return;
+    }
+
+    // Widen the texture view to the new level. Frames in flight still
+    // sample through the old view, so it is destroyed once they have
+    // completed; each image binds the new one the next time it is drawn.
+    VkDevice    device = this->device;
+    VkImageView view   = this->textureImageView.release();
+    this->retiredTextures.retire( this->frameFences.frame - 1, 0,
+                                  std::shared_ptr<void>( nullptr, [=]( void* )
+    {
+      vkDestroyImageView( device, view, nullptr );
+    } ) );
+    this->createTextureImageView();
+    this->bindingsVersion++;
+
+    std::cout << "Texture: level " << this->textureStreamer.residentLevel
+              << " resident" << std::endl;
+  }
+
+  // Keep textures within the budget, least recently drawn first. With
+  // VK_EXT_memory_budget the budget follows what the driver reports, so
+  // memory claimed by other applications pushes textures down.
+  void updateTextureResidency(  )
+  {
+    if ( this->memoryBudgetSupported && this->frameFences.frame % TEXTURE_BUDGET_INTERVAL == 0 )
+    {
+      this->updateAllocatorBudget();
+
+      // Reported usage includes the textures themselves
+      VkDeviceSize available = queryDeviceLocalBudget( this->instance,
+                                                       this->physical,
+                                                       this->memoryBudgetSupported );
+      available += this->textureResidency.residentBytes() + this->retiredTextures.pendingBytes;
+      this->textureBudget = (VkDeviceSize)( available * TEXTURE_BUDGET_SHARE );
+    }
+
+    // Every layer of the array feeds the one texture entry
+    if ( this->textureFeedbackEnabled && this->frameFences.frame % TEXTURE_FEEDBACK_WINDOW == 0 )
+    {
+      uint32_t level;
+      if ( this->textureFeedback.demandedLevel( FEEDBACK_ALL_LAYERS,
+                                                TEXTURE_FEEDBACK_IGNORE_SHARE, level ) )
+      {
+        this->textureResidency.demand( this->textureResidencyId, level );
+      }
+      this->textureFeedback.resetDemand();
+    }
+
+    if ( this->textureResidency.update( this->frameFences.frame, this->textureBudget ) )
+    {
+      ResidencyMetrics metrics = this->textureResidency.metrics();
+      std::cout << "Texture residency: " << metrics.residentBytes << " of "
+                << this->textureBudget << " bytes resident" << std::endl;
+    }
+  }
+
+  // Move a few megabytes out of sparsely used memory blocks. Once moved
+  // resources replace the old ones, the old handles stay alive until the
+  // frames submitted with them complete, and each swapchain image rewrites
+  // its descriptor sets and vertex buffer bindings the next time it is
+  // drawn.
+  void updateDefragmentation(  )
+  {
+    if ( DEFRAGMENT &&
+         this->defragmenter.update( this->graphicsQueue, this->commandPool, this->frameFences.frame,
+                                    this->frameFences.completedFrame(), DEFRAGMENT_BYTES_PER_FRAME ) )
+    {
+      this->bindingsVersion++;
+    }
+  }
+
+  // Rebuild the texture from its cooked file with baseLevel as the finest
+  // level. Called by the residency manager; the streamer is asked to stop
+  // and updateTextureReload does the rest over the following frames.
+  void reloadCookedTexture( uint32_t baseLevel )
+  {
+    this->reloadRequested = true;
+    this->reloadBaseLevel = baseLevel;
+    this->textureStreamer.cancel();
+  }
+
+  // Upload the coarse levels of a requested reload into a new image once
+  // the streamer has let go of the old one, then swap the new image in when
+  // its upload has finished. Nothing here waits on the device: frames in
+  // flight keep sampling the old image, which is destroyed once they have
+  // completed, and each swapchain image binds the new one the next time it
+  // is drawn.
+  void updateTextureReload(  )
+  {
+    if ( this->reloadUpload.pending )
+    {
+      if ( !this->reloadUpload.poll() )
+      {
+        return;
+      }
+
+      this->retireTexture();
+      *&this->textureImage = this->reloadImage.release();
+      this->textureImageMemory.swap( this->reloadImageMemory );
+      this->textureMipLevels = this->textureCooked.levels.size() - this->reloadBaseLevel;
+      this->textureBaseLevel = this->reloadBaseLevel;
+
+      // The rest streams in as usual, unless another reload has already
+      // been asked for
+      CookedTexture cooked = this->textureCooked;
+      skipCookedLevels( cooked, this->textureBaseLevel );
+      this->textureStreamer.start( this->physical,
+                                   this->hostImporter,
+                                   COOKED_TEXTURE_PATH,
+                                   cooked,
+                                   this->textureImage,
+                                   this->reloadResidentLevel );
+      if ( this->reloadRequested )
+      {
+        this->textureStreamer.cancel();
+      }
+      this->createTextureImageView();
+      this->bindingsVersion++;
+      return;
+    }
+
+    if ( !this->reloadRequested || !this->textureStreamer.idle() )
+    {
+      return;
+    }
+    this->reloadRequested = false;
+
+    // Coarse levels now, into an image of their own
+    CookedTexture cooked = this->textureCooked;
+    skipCookedLevels( cooked, this->reloadBaseLevel );
+    this->reloadUpload.begin( this->commandPool );
+    this->reloadResidentLevel = this->streamCookedTexture( cooked,
+                                                           this->reloadUpload,
+                                                           this->reloadImage,
+                                                           this->reloadImageMemory );
+    this->reloadUpload.submit( this->graphicsQueue );
+  }
+
+  // Hand the texture image, its memory and view over to retiredTextures
+  // until the frames submitted so far have completed
+  void retireTexture(  )
+  {
+    VkDeviceSize bytes = 0;
+    for ( size_t i = this->textureBaseLevel; i < this->textureCooked.levels.size(); i++ )
+    {
+      bytes += this->textureCooked.levels[i].size;
+    }
 
-    copyBuffer( this->device, this->graphicsQueue, this->commandPool,
-                this->uniformStagingBuffer, this->uniformBuffer, sizeof(ubo) );
+    VkDevice    device = this->device;
+    VkImage     image  = this->textureImage.release();
+    VkImageView view   = this->textureImageView.release();
+    auto        memory = std::make_shared<MemoryAllocation>( this->textureImageMemory );
+    memory->swap( this->textureImageMemory );
+    this->retiredTextures.retire( this->frameFences.frame - 1, bytes,
+                                  std::shared_ptr<void>( nullptr, [=]( void* )
+    {
+      vkDestroyImageView( device, view, nullptr );
+      vkDestroyImage( device, image, nullptr );
+      memory->free();
+    } ) );
+  }
+
+  // Register the texture with the residency manager. A texture cooked to
+  // disk can be reloaded at any level; anything else stays pinned.
+  void trackTextureResidency( const std::vector<VkDeviceSize>& levelSizes,
+                              uint32_t                         baseLevel,
+                              uint64_t                         cookedSourceSize )
+  {
+    std::function<void( uint32_t )> setBaseLevel;
+    if ( cookedSourceSize > 0 &&
+         readCookedTextureHeader( COOKED_TEXTURE_PATH, cookedSourceSize, this->textureCooked ) )
+    {
+      setBaseLevel = [this]( uint32_t level ) { this->reloadCookedTexture( level ); };
+    }
+    this->textureBaseLevel = baseLevel;
+
+    this->textureResidencyId = this->textureResidency.add( TEXTURE_PATH, levelSizes,
+                                                           baseLevel, setBaseLevel );
   }
 
   void drawFrame(  )
   {
+    // Blocks while MAX_FRAMES_IN_FLIGHT frames are still running
+    VkSemaphore imageAvailable = this->frameFences.begin();
+
     uint32_t imageIdx;
     auto result = vkAcquireNextImageKHR( this->device,
                                          this->swapchain,
                                          std::numeric_limits<uint64_t>::max(), // Disable timeout for image to become available
-                                         this->imageAvailableSemaphore,
+                                         imageAvailable,
                                          VK_NULL_HANDLE,
                                          &imageIdx );
-    if ( result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR )
+    if ( result == VK_ERROR_OUT_OF_DATE_KHR )
     {
       this->recreateSwapChain();
       return;
     }
-    else if ( result != VK_SUCCESS )
+    // A suboptimal image has been acquired and its semaphore will signal,
+    // so it is drawn and the swapchain recreated after presenting it
+    else if ( result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR )
     {
       throw std::runtime_error( "Failed to present swap chain image!" );
     }
 
     // Submit command buffer
-    VkSemaphore waitSemaphores[]      = { this->imageAvailableSemaphore };
+    VkSemaphore waitSemaphores[]      = { imageAvailable };
     VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    VkSemaphore signalSemaphores[]    = { this->renderFinishSemaphore };
+    VkSemaphore signalSemaphores[]    = { this->frameFences.renderFinishedSemaphore() };
     
 
     VkSubmitInfo submitInfo = {};
@@ -233,13 +708,39 @@ private:
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores    = signalSemaphores;
 
+    // Waits until the image's command buffer and per frame data are no
+    // longer used by the frame that last drew to it
+    VkFence frameFence = this->frameFences.acquire( imageIdx );
+    if ( this->textureFeedbackEnabled )
+    {
+      this->textureFeedback.collect( imageIdx );
+    }
+
+    // Resources replaced since the image was last drawn are bound now that
+    // no frame in flight uses its descriptor sets or command buffer
+    if ( this->recordedVersions[imageIdx] != this->bindingsVersion )
+    {
+      this->updateDescriptorSets( imageIdx );
+      this->recordCommandBuffer( imageIdx );
+      this->recordedVersions[imageIdx] = this->bindingsVersion;
+    }
+    this->writeFrameData( imageIdx );
+
     if ( vkQueueSubmit( this->graphicsQueue,
                         1,
                         &submitInfo,
-                        VK_NULL_HANDLE ) != VK_SUCCESS )
+                        frameFence ) != VK_SUCCESS )
     {
       throw std::runtime_error( "Failed to submit draw command buffer!" );
     }
+    if ( this->textureFeedbackEnabled )
+    {
+      // Levels are relative to the texture view
+      this->textureFeedback.submitted( imageIdx, this->textureBaseLevel +
+                                                 this->textureStreamer.residentLevel );
+    }
+    this->frameFences.advance();
+    this->retiredTextures.collect( this->frameFences.completedFrame() );
 
     // Submit result to swap chain
     VkSwapchainKHR swapchains[] = { this->swapchain };
@@ -253,7 +754,15 @@ private:
     presentInfo.pImageIndices      = &imageIdx;
     presentInfo.pResults           = nullptr;
 
-    vkQueuePresentKHR( this->presentQueue, &presentInfo );
+    result = vkQueuePresentKHR( this->presentQueue, &presentInfo );
+    if ( result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR )
+    {
+      this->recreateSwapChain();
+    }
+    else if ( result != VK_SUCCESS )
+    {
+      throw std::runtime_error( "Failed to present swap chain image!" );
+    }
   }
 
   void createInstance(  )
@@ -365,7 +874,22 @@ private:
       queueCreateInfos.push_back( queueCreateInfo );
     }
 
+    // Block compressed textures are used whenever the device has them
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures( this->physical, &supportedFeatures );
+
     VkPhysicalDeviceFeatures devFeatures = {};
+    devFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
+    // Mip feedback stores from the fragment shader
+    this->textureFeedbackEnabled         = TEXTURE_FEEDBACK && supportedFeatures.fragmentStoresAndAtomics;
+    devFeatures.fragmentStoresAndAtomics = this->textureFeedbackEnabled;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties( this->physical, &properties );
+    this->samplerCache.maxSamplers = properties.limits.maxSamplerAllocationCount;
+    this->upload.directBudget      = (VkDeviceSize)( directWriteHeapSize( this->physical ) *
+                                                     DIRECT_WRITE_HEAP_SHARE );
 
     // Create struct used to create a logical device
     VkDeviceCreateInfo devCreateInfo = {};
@@ -373,8 +897,27 @@ private:
     devCreateInfo.pQueueCreateInfos       = queueCreateInfos.data();
     devCreateInfo.queueCreateInfoCount    = (uint32_t)queueCreateInfos.size();
     devCreateInfo.pEnabledFeatures        = &devFeatures;
-    devCreateInfo.enabledExtensionCount   = requiredDeviceExtensions.size();
-    devCreateInfo.ppEnabledExtensionNames = requiredDeviceExtensions.data();
+    std::vector<const char*> deviceExtensions = requiredDeviceExtensions;
+#ifdef VK_EXT_MEMORY_BUDGET_EXTENSION_NAME
+    this->memoryBudgetSupported = this->properties2Supported &&
+                                  deviceExtensionSupported( this->physical,
+                                                            VK_EXT_MEMORY_BUDGET_EXTENSION_NAME );
+    if ( this->memoryBudgetSupported )
+    {
+      deviceExtensions.push_back( VK_EXT_MEMORY_BUDGET_EXTENSION_NAME );
+    }
+#endif
+    bool hostImportSupported = HostImporter::available( this->physical, this->externalMemorySupported );
+#ifdef VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME
+    if ( hostImportSupported )
+    {
+      deviceExtensions.push_back( VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME );
+      deviceExtensions.push_back( VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME );
+    }
+#endif
+
+    devCreateInfo.enabledExtensionCount   = deviceExtensions.size();
+    devCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
     if ( enableValidationLayers )
     {
       devCreateInfo.enabledLayerCount   = validationLayers.size(  );
@@ -390,9 +933,23 @@ private:
       throw std::runtime_error( "Failed to create logical device!" );
     }
 
+    this->allocator.init( this->physical, ALLOCATOR_BLOCK_SIZE );
+    this->updateAllocatorBudget();
+
+    if ( hostImportSupported )
+    {
+      this->hostImporter.init( this->instance, this->physical );
+    }
+
     // Retrieve handles for graphics and presentation queues
     vkGetDeviceQueue( this->device, indices.graphicsFamily, 0, &this->graphicsQueue);
     vkGetDeviceQueue( this->device, indices.presentFamily,  0, &this->presentQueue );
+
+    // Every staged upload takes its source memory from one mapped ring
+    this->stagingRing.create( this->physical, STAGING_RING_SIZE );
+    this->upload.useStagingRing( this->stagingRing, this->graphicsQueue );
+    this->textureStreamer.useStagingRing( this->stagingRing );
+    this->reloadUpload.useStagingRing( this->stagingRing, VK_NULL_HANDLE );
   }
 
   void createSwapChain( )
@@ -483,8 +1040,12 @@ private:
     {
       createImageView( this->device,
                        this->swapchainImages[i],
+                       VK_IMAGE_VIEW_TYPE_2D,
                        this->swapchainImageFormat,
                        VK_IMAGE_ASPECT_COLOR_BIT,
+                       0,
+                       1,
+                       1,
                        this->swapchainImageViews[i] );
     }
   }
@@ -563,23 +1124,38 @@ private:
     // Creatout layout for uniform buffer
     VkDescriptorSetLayoutBinding uboLayoutBinding = {};
     uboLayoutBinding.binding            = 0;
-    uboLayoutBinding.descriptorType     = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.descriptorType     = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     uboLayoutBinding.descriptorCount    = 1;
     uboLayoutBinding.stageFlags         = VK_SHADER_STAGE_VERTEX_BIT;
     uboLayoutBinding.pImmutableSamplers = nullptr;
 
-    // Create layout for texture sampler
+    // Create layout for texture sampler. Samplers never change, so they are
+    // baked into the layouts as immutable samplers.
+    this->textureSampler        = this->samplerCache.get( this->textureSamplerInfo() );
+    this->impostorAtlas.sampler = this->samplerCache.get( impostorSamplerInfo() );
+
     VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
     samplerLayoutBinding.binding            = 1;
     samplerLayoutBinding.descriptorCount    = 1;
     samplerLayoutBinding.descriptorType     = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerLayoutBinding.pImmutableSamplers = nullptr;
+    samplerLayoutBinding.pImmutableSamplers = this->textureSampler.get();
     samplerLayoutBinding.stageFlags         = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {
+    std::vector<VkDescriptorSetLayoutBinding> bindings = {
       uboLayoutBinding,
       samplerLayoutBinding
     };
+
+    // Mip feedback, one slot per swapchain image selected by dynamic offset
+    if ( this->textureFeedbackEnabled )
+    {
+      VkDescriptorSetLayoutBinding feedbackLayoutBinding = {};
+      feedbackLayoutBinding.binding         = 2;
+      feedbackLayoutBinding.descriptorCount = 1;
+      feedbackLayoutBinding.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+      feedbackLayoutBinding.stageFlags      = VK_SHADER_STAGE_FRAGMENT_BIT;
+      bindings.push_back( feedbackLayoutBinding );
+    }
     
     VkDescriptorSetLayoutCreateInfo layoutInfo = {};
     layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -593,186 +1169,58 @@ private:
     {
       throw std::runtime_error( "Failed to create descriptor set layout!" );
     }
-  }
 
-  void createGraphicsPipeline(  )
-  {
-    auto vertexShaderCode   = readFile( "vert.spv" );
-    auto fragmentShaderCode = readFile( "frag.spv" );
-
-    // Create shader modules
-    VDeleter<VkShaderModule> vertexShader{this->device, vkDestroyShaderModule};
-    VDeleter<VkShaderModule> fragmentShader{this->device, vkDestroyShaderModule};
-    createShaderModule( this->device, vertexShaderCode, vertexShader );
-    createShaderModule( this->device, fragmentShaderCode, fragmentShader );
-
-    // Add to graphics pipeline
-    VkPipelineShaderStageCreateInfo vertexShaderStageInfo = {};
-    vertexShaderStageInfo.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertexShaderStageInfo.stage  = VK_SHADER_STAGE_VERTEX_BIT;
-    vertexShaderStageInfo.module = vertexShader;
-    vertexShaderStageInfo.pName  = "main";
-    VkPipelineShaderStageCreateInfo fragmentShaderStageInfo = {};
-    fragmentShaderStageInfo.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragmentShaderStageInfo.stage  = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragmentShaderStageInfo.module = fragmentShader;
-    fragmentShaderStageInfo.pName  = "main";
-
-    VkPipelineShaderStageCreateInfo shaderStages[] = {
-      vertexShaderStageInfo,
-      fragmentShaderStageInfo
+    // Impostors read the uniform buffer in both stages, plus the
+    // color and normal/depth atlases
+    VkDescriptorSetLayoutBinding atlasColorBinding = samplerLayoutBinding;
+    atlasColorBinding.pImmutableSamplers = this->impostorAtlas.sampler.get();
+    VkDescriptorSetLayoutBinding atlasNormalDepthBinding = atlasColorBinding;
+    atlasNormalDepthBinding.binding = 2;
+    uboLayoutBinding.stageFlags     = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    std::array<VkDescriptorSetLayoutBinding, 3> impostorBindings = {
+      uboLayoutBinding,
+      atlasColorBinding,
+      atlasNormalDepthBinding
     };
 
-    // Describe the format of the input vertex data
-    auto bindingDescription    = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
-    
-    VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
-    vertexInputCreateInfo.sType                           = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputCreateInfo.vertexBindingDescriptionCount   = 1;
-    vertexInputCreateInfo.pVertexBindingDescriptions      = &bindingDescription;
-    vertexInputCreateInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
-    vertexInputCreateInfo.pVertexAttributeDescriptions    = attributeDescriptions.data();
-
-    // Specify topology of input vertices
-    VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo = {};
-    inputAssemblyCreateInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssemblyCreateInfo.topology               = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    inputAssemblyCreateInfo.primitiveRestartEnable = VK_FALSE;
-
-    // Create Viewport
-    VkViewport viewport = {};
-    viewport.x        = 0.0f;
-    viewport.y        = 0.0f;
-    viewport.width    = (float) this->swapchainExtent.width;
-    viewport.height   = (float) this->swapchainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    // Create Scissor Rectangle
-    VkRect2D scissor = {};
-    scissor.offset = {0, 0};
-    scissor.extent = this->swapchainExtent;
-
-    // Combine Viewport and Scissor Rectangle into Viewport State
-    VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
-    viewportStateCreateInfo.sType         = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportStateCreateInfo.viewportCount = 1;
-    viewportStateCreateInfo.pViewports    = &viewport;
-    viewportStateCreateInfo.scissorCount  = 1;
-    viewportStateCreateInfo.pScissors     = &scissor;
-
-    // Create Rasterizer
-    VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = {};
-    rasterizerCreateInfo.sType                   = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizerCreateInfo.depthClampEnable        = VK_FALSE;
-    rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;
-    rasterizerCreateInfo.polygonMode             = VK_POLYGON_MODE_FILL;
-    rasterizerCreateInfo.lineWidth               = 1.0f;
-    rasterizerCreateInfo.cullMode                = VK_CULL_MODE_BACK_BIT;
-    rasterizerCreateInfo.frontFace               = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-    rasterizerCreateInfo.depthBiasEnable         = VK_FALSE;
-    rasterizerCreateInfo.depthBiasConstantFactor = 0.0f;
-    rasterizerCreateInfo.depthBiasClamp          = 0.0f;
-    rasterizerCreateInfo.depthBiasSlopeFactor    = 0.0f;
-
-    // Create Depth Testing
-    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
-    depthStencil.sType                 = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencil.depthTestEnable       = VK_TRUE;
-    depthStencil.depthWriteEnable      = VK_TRUE;
-    depthStencil.depthCompareOp        = VK_COMPARE_OP_LESS;
-    depthStencil.depthBoundsTestEnable = VK_FALSE;
-    depthStencil.minDepthBounds        = 0.0f;
-    depthStencil.maxDepthBounds        = 1.0f;
-    depthStencil.stencilTestEnable     = VK_FALSE;
-    depthStencil.front                 = {};
-    depthStencil.back                  = {};
-
-    // Create Multisampling
-    VkPipelineMultisampleStateCreateInfo multisamplingCreateInfo = {};
-    multisamplingCreateInfo.sType                 = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisamplingCreateInfo.sampleShadingEnable   = VK_FALSE;
-    multisamplingCreateInfo.rasterizationSamples  = VK_SAMPLE_COUNT_1_BIT;
-    multisamplingCreateInfo.minSampleShading      = 1.0f;
-    multisamplingCreateInfo.pSampleMask           = nullptr;
-    multisamplingCreateInfo.alphaToCoverageEnable = VK_FALSE;
-    multisamplingCreateInfo.alphaToOneEnable      = VK_FALSE;
-
-    // Configure Color Blending
-    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask      = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable         = VK_FALSE;
-    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-    colorBlendAttachment.colorBlendOp        = VK_BLEND_OP_ADD;
-    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-    colorBlendAttachment.alphaBlendOp        = VK_BLEND_OP_ADD;
-
-    // Create Color Blending for all framebuffers
-    VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo = {};
-    colorBlendCreateInfo.sType             = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlendCreateInfo.logicOpEnable     = VK_FALSE;
-    colorBlendCreateInfo.logicOp           = VK_LOGIC_OP_COPY;
-    colorBlendCreateInfo.attachmentCount   = 1;
-    colorBlendCreateInfo.pAttachments      = &colorBlendAttachment;
-    colorBlendCreateInfo.blendConstants[0] = 0.0f;
-    colorBlendCreateInfo.blendConstants[1] = 0.0f;
-    colorBlendCreateInfo.blendConstants[2] = 0.0f;
-    colorBlendCreateInfo.blendConstants[3] = 0.0f;
-
-    // Create Pipeline Layout
-    VkDescriptorSetLayout setLayouts[] = { this->descriptorSetLayout };
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
-    pipelineLayoutCreateInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCreateInfo.setLayoutCount         = 1;
-    pipelineLayoutCreateInfo.pSetLayouts            = setLayouts;
-    pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-    pipelineLayoutCreateInfo.pPushConstantRanges    = 0;
-
-    if (vkCreatePipelineLayout( this->device, &pipelineLayoutCreateInfo, nullptr,
-                                &this->pipelineLayout ) != VK_SUCCESS )
-    {
-      throw std::runtime_error( "Failed to create pipeline layout!" );
-    }
-
-    // Create Graphics Pipeline
-    VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
-    pipelineCreateInfo.sType               = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineCreateInfo.stageCount          = 2;
-    pipelineCreateInfo.pStages             = shaderStages;
-    pipelineCreateInfo.pVertexInputState   = &vertexInputCreateInfo;
-    pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
-    pipelineCreateInfo.pViewportState      = &viewportStateCreateInfo;
-    pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
-    pipelineCreateInfo.pMultisampleState   = &multisamplingCreateInfo;
-    pipelineCreateInfo.pDepthStencilState  = &depthStencil;
-    pipelineCreateInfo.pColorBlendState    = &colorBlendCreateInfo;
-    pipelineCreateInfo.pDynamicState       = nullptr;
-    pipelineCreateInfo.layout              = this->pipelineLayout;
-    pipelineCreateInfo.renderPass          = this->renderPass;
-    pipelineCreateInfo.subpass             = 0;
-    pipelineCreateInfo.basePipelineHandle  = VK_NULL_HANDLE;
-    pipelineCreateInfo.basePipelineIndex   = -1;
-
-    if ( vkCreateGraphicsPipelines( this->device,
-                                    VK_NULL_HANDLE,
-                                    1,
-                                    &pipelineCreateInfo,
-                                    nullptr,
-                                    &this->graphicsPipeline ) != VK_SUCCESS )
-    {
-      throw std::runtime_error( "Failed to create graphics pipeline!" );
+    layoutInfo.bindingCount = impostorBindings.size();
+    layoutInfo.pBindings    = impostorBindings.data();
+
+    if ( vkCreateDescriptorSetLayout( this->device,
+                                      &layoutInfo,
+                                      nullptr,
+                                      &this->impostorDescriptorSetLayout ) != VK_SUCCESS )
+    {
+      throw std::runtime_error( "Failed to create impostor descriptor set layout!" );
     }
   }
 
+  void createGraphicsPipeline(  )
+  {
+    createMeshPipelines( this->device,
+                         this->renderPass,
+                         this->swapchainExtent,
+                         this->descriptorSetLayout,
+                         this->textureFeedbackEnabled ? "feedback-frag.spv" : "frag.spv",
+                         this->pipelineLayout,
+                         this->graphicsPipeline,
+                         this->stripPipeline );
+
+    createImpostorPipeline( this->device,
+                            this->renderPass,
+                            this->swapchainExtent,
+                            this->impostorDescriptorSetLayout,
+                            this->impostorPipelineLayout,
+                            this->impostorPipeline );
+  }
+
   void createCommandPool(  )
   {
     VkCommandPoolCreateInfo poolCreateInfo = {};
     poolCreateInfo.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolCreateInfo.queueFamilyIndex = this->graphicsQueueIdx; 
-    poolCreateInfo.flags            = 0;
+    poolCreateInfo.flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Frame commands are re-recorded one image at a time
 
     if ( vkCreateCommandPool( this->device, &poolCreateInfo,
                               nullptr, &this->commandPool ) != VK_SUCCESS )
@@ -789,22 +1237,27 @@ private:
                  this->device,
                  this->swapchainExtent.width,
                  this->swapchainExtent.height,
+                 1,
+                 1,
                  depthFormat,
                  VK_IMAGE_TILING_OPTIMAL,
                  VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 MEMORY_USAGE_GPU_ONLY,
                  this->depthImage,
                  this->depthImageMemory );
     createImageView( this->device,
                      this->depthImage,
+                     VK_IMAGE_VIEW_TYPE_2D,
                      depthFormat,
                      VK_IMAGE_ASPECT_DEPTH_BIT,
+                     0,
+                     1,
+                     1,
                      this->depthImageView );
     // Transition depth image to a suitable layout
-    transitionImageLayout( this->device,
-                           this->graphicsQueue,
-                           this->commandPool,
+    transitionImageLayout( this->upload,
                            this->depthImage,
+                           1,
                            VK_IMAGE_LAYOUT_UNDEFINED,
                            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL );
     
@@ -845,109 +1298,702 @@ private:
 
   void createTextureImage(  )
   {
-    // Load image from file
-    int texWidth, texHeight, texChannels;
-    stbi_uc* pixels        = stbi_load( TEXTURE_PATH.c_str(),
-                                        &texWidth, &texHeight,
-                                        &texChannels, STBI_rgb_alpha );
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    if ( this->materialTextures.size() > 1 )
+    {
+      this->createMaterialTextureArray();
+      return;
+    }
+
+    const VkFormatFeatureFlags sampledFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+                                                 VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    // Prefer a previously cooked texture if it matches the source and the
+    // device can still sample its format
+    std::vector<char> file = readFile( TEXTURE_PATH );
+    CookedTexture     cooked;
+    if ( !JPEG_GPU_VALIDATE &&
+         readCookedTextureHeader( COOKED_TEXTURE_PATH, file.size(), cooked ) &&
+         findSupportedFormat( this->physical,
+                              { cooked.format, VK_FORMAT_R8G8B8A8_UNORM },
+                              VK_IMAGE_TILING_OPTIMAL,
+                              sampledFeatures ) == cooked.format )
+    {
+      TextureBudgetRequest request;
+      request.importance = 1.0f;
+      for ( const auto& level : cooked.levels )
+      {
+        request.levelSizes.push_back( level.size );
+      }
+      uint32_t baseLevel = this->planTextureResidency( { request } ).baseLevels[0];
+      this->trackTextureResidency( request.levelSizes, baseLevel, file.size() );
+      skipCookedLevels( cooked, baseLevel );
+
+      this->textureFormat    = cooked.format;
+      this->textureMipLevels = cooked.levels.size();
+      uint32_t residentLevel = this->streamCookedTexture( cooked,
+                                                          this->upload,
+                                                          this->textureImage,
+                                                          this->textureImageMemory );
+      this->textureStreamer.start( this->physical,
+                                   this->hostImporter,
+                                   COOKED_TEXTURE_PATH,
+                                   cooked,
+                                   this->textureImage,
+                                   residentLevel );
+      return;
+    }
 
-    if ( !pixels )
+    // Baseline JPEGs go through the multithreaded decoder, anything else
+    // through stb_image. Sources without alpha stay RGB.
+    JpegImage jpeg;
+    stbi_uc*  stbPixels   = nullptr;
+    int       stbChannels = 0;
+    int       texWidth, texHeight, texChannels;
+    if ( readJpegHeader( file, jpeg ) )
+    {
+      texWidth  = jpeg.width;
+      texHeight = jpeg.height;
+    }
+    else
     {
+      if ( stbi_info_from_memory( (const stbi_uc*)file.data(), file.size(),
+                                  &texWidth, &texHeight, &texChannels ) )
+      {
+        stbChannels = ( texChannels == 2 || texChannels == 4 ) ? STBI_rgb_alpha : STBI_rgb;
+        stbPixels   = stbi_load_from_memory( (const stbi_uc*)file.data(), file.size(),
+                                             &texWidth, &texHeight,
+                                             &texChannels, stbChannels );
+      }
+      if ( !stbPixels )
+      {
         throw std::runtime_error( "Failed to load texture image!" );
+      }
     }
 
-    // Copy image into staging buffer
-    VDeleter<VkImage>        stagingImage       { this->device, vkDestroyImage };
-    VDeleter<VkDeviceMemory> stagingImageMemory { this->device, vkFreeMemory };
-    createImage( this->physical,
-                 this->device,
-                 texWidth,
-                 texHeight,
-                 VK_FORMAT_R8G8B8A8_UNORM,
-                 VK_IMAGE_TILING_LINEAR,
-                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingImage,
-                 stagingImageMemory );
+    // Write the image as 3 or 4 channel rows
+    auto writePixels = [&]( uint8_t* dst, size_t rowPitch, uint32_t channels )
+    {
+      auto start = std::chrono::high_resolution_clock::now();
+      if ( stbPixels )
+      {
+        copyPixelRows( stbPixels, stbChannels, texWidth, texHeight, dst, rowPitch, channels );
+      }
+      else
+      {
+        decodeJpeg( jpeg, dst, rowPitch, channels, std::thread::hardware_concurrency() );
+        std::cout << "Texture: decoded " << TEXTURE_PATH << " in "
+                  << std::chrono::duration<float, std::milli>(
+                       std::chrono::high_resolution_clock::now() - start ).count()
+                  << " ms" << std::endl;
+      }
+    };
 
-    void* data;
-    vkMapMemory( this->device, stagingImageMemory, 0, imageSize, 0, &data );
-    std::memcpy( data, pixels, (size_t) imageSize );
-    vkUnmapMemory( this->device, stagingImageMemory );
+    // JPEGs never carry alpha
+    bool usesAlpha = stbChannels == STBI_rgb_alpha && imageUsesAlpha( stbPixels, texWidth, texHeight );
 
-    stbi_image_free( pixels );  // Free file data
+    VkFormat format = findSupportedFormat( this->physical,
+                                           cookedFormatCandidates( usesAlpha, TEXTURE_COOK_QUALITY ),
+                                           VK_IMAGE_TILING_OPTIMAL,
+                                           sampledFeatures );
 
-    // Create final texture, then optimize layout of both images and
-    // copy staging image into texture image
-    createImage( this->physical,
-                 this->device,
-                 texWidth,
-                 texHeight,
-                 VK_FORMAT_R8G8B8A8_UNORM,
-                 VK_IMAGE_TILING_OPTIMAL,
-                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                 this->textureImage,
-                 this->textureImageMemory );
-    transitionImageLayout( this->device,
-                           this->graphicsQueue,
-                           this->commandPool,
-                           stagingImage,
-                           VK_IMAGE_LAYOUT_PREINITIALIZED,
-                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL );
-    transitionImageLayout( this->device,
-                           this->graphicsQueue,
-                           this->commandPool,
-                           this->textureImage,
-                           VK_IMAGE_LAYOUT_PREINITIALIZED,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
-    copyImage( this->device,
-               this->graphicsQueue,
-               this->commandPool,
-               stagingImage,
-               this->textureImage,
-               texWidth,
-               texHeight );
-  }
+    // Without block compression support upload the raw pixels instead
+    if ( format == VK_FORMAT_R8G8B8A8_UNORM )
+    {
+      TextureBudgetRequest request;
+      request.levelSizes = textureLevelSizes( texWidth, texHeight, 4 );
+      request.importance = 1.0f;
+      uint32_t baseLevel = this->planTextureResidency( { request } ).baseLevels[0];
+      this->trackTextureResidency( request.levelSizes, baseLevel, 0 );
+      if ( baseLevel == 0 && !stbPixels && JPEG_GPU_RECONSTRUCT )
+      {
+        this->uploadJpegTexture( jpeg );
+        return;
+      }
+      if ( baseLevel == 0 )
+      {
+        this->uploadDecodedTexture( texWidth, texHeight, usesAlpha, writePixels );
+        stbi_image_free( stbPixels );
+        return;
+      }
 
-  void createTextureImageView(  )
-  {
-    createImageView( this->device,
-                     this->textureImage,
-                     VK_FORMAT_R8G8B8A8_UNORM,
-                     VK_IMAGE_ASPECT_COLOR_BIT,
-                     this->textureImageView );
-  }
+      // Decode in full and downsample to the planned level first
+      std::vector<uint8_t> pixels( (size_t)texWidth * texHeight * 4 );
+      writePixels( pixels.data(), texWidth * 4, 4 );
+      stbi_image_free( stbPixels );
 
-  void createTextureSampler(  )
-  {
-    VkSamplerCreateInfo samplerInfo = {};
-    samplerInfo.sType                   = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerInfo.magFilter               = VK_FILTER_LINEAR;
-    samplerInfo.minFilter               = VK_FILTER_LINEAR;
-    samplerInfo.addressModeU            = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV            = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW            = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable        = VK_TRUE;
-    samplerInfo.maxAnisotropy           = 16;
-    samplerInfo.borderColor             = VK_BORDER_COLOR_INT_OPAQUE_BLACK ;
-    samplerInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerInfo.compareEnable           = VK_FALSE;
-    samplerInfo.compareOp               = VK_COMPARE_OP_ALWAYS;
-    samplerInfo.mipmapMode              = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    samplerInfo.mipLodBias              = 0.0f;
-    samplerInfo.minLod                  = 0.0f;
-    samplerInfo.maxLod                  = 0.0f;
-    
-    if ( vkCreateSampler( this->device, &samplerInfo,
-                          nullptr, &this->textureSampler ) != VK_SUCCESS )
-    {
-      throw std::runtime_error( "Failed to create texture sampler!" );
+      uint32_t width  = texWidth;
+      uint32_t height = texHeight;
+      for ( uint32_t level = 0; level < baseLevel; level++ )
+      {
+        pixels = downsampleRGBA( pixels, width, height );
+        width  = std::max( width / 2, 1u );
+        height = std::max( height / 2, 1u );
+      }
+
+      this->uploadDecodedTexture( width, height, usesAlpha,
+                                  [&]( uint8_t* dst, size_t rowPitch, uint32_t channels )
+      {
+        copyPixelRows( pixels.data(), 4, width, height, dst, rowPitch, channels );
+      } );
+      return;
     }
-  }
 
-  void loadModel(  )
+    std::vector<uint8_t> pixels( (size_t)texWidth * texHeight * 4 );
+    if ( !stbPixels && JPEG_GPU_RECONSTRUCT )
+    {
+      this->decodeJpegTextureOnDevice( jpeg, pixels.data() );
+    }
+    else
+    {
+      writePixels( pixels.data(), texWidth * 4, 4 );
+    }
+    stbi_image_free( stbPixels );  // Free file data
+
+    cooked = cookTexture( pixels.data(), texWidth, texHeight, format, TEXTURE_COOK_QUALITY, file.size() );
+
+    writeCookedTexture( COOKED_TEXTURE_PATH, cooked );
+    std::cout << "Texture: cooked " << TEXTURE_PATH << " into " << COOKED_TEXTURE_PATH
+              << " (" << cooked.data.size() << " bytes, "
+              << cooked.levels.size() << " levels)" << std::endl;
+
+    TextureBudgetRequest request;
+    request.importance = 1.0f;
+    for ( const auto& level : cooked.levels )
+    {
+      request.levelSizes.push_back( level.size );
+    }
+    uint32_t baseLevel = this->planTextureResidency( { request } ).baseLevels[0];
+    this->trackTextureResidency( request.levelSizes, baseLevel, file.size() );
+    skipCookedLevels( cooked, baseLevel );
+
+    this->uploadCookedTexture( cooked );
+  }
+
+  // Compose every material texture into its slot of the packed layers
+  void createMaterialTextureArray(  )
+  {
+    const TextureArrayPacking& packing = this->materialTexturePacking;
+
+    this->textureFormat      = VK_FORMAT_R8G8B8A8_UNORM;
+    this->textureArrayLayers = packing.layers;
+    createTextureArray( this->physical,
+                        this->device,
+                        this->upload,
+                        packing.size,
+                        packing.layers,
+                        this->textureImage,
+                        this->textureImageMemory,
+                        this->textureMipLevels );
+
+    // Decode on worker threads, the biggest slots first, straight into
+    // mapped staging memory, and copy each texture into its slot from there
+    // as soon as it is ready
+    uint64_t stagingSize = DECODE_STAGING_SIZE;
+    for ( const auto& extent : this->materialTextureExtents )
+    {
+      stagingSize = std::max( stagingSize, (uint64_t)extent.width * extent.height * 4 );
+    }
+    VDeleter<VkBuffer> stagingBuffer { this->device, vkDestroyBuffer };
+    MemoryAllocation   stagingMemory { this->allocator, MEMORY_CATEGORY_STAGING, "decode staging" };
+    createBuffer( this->device,
+                  this->physical,
+                  stagingSize,
+                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                  MEMORY_USAGE_UPLOAD,
+                  stagingBuffer,
+                  stagingMemory );
+
+    DecodeStagingPool stagingPool( (uint8_t*)stagingMemory.map(), stagingSize );
+    DecodeService     decoder( std::thread::hardware_concurrency(), stagingPool );
+
+    std::map<DecodeJob*, size_t> jobSlots;
+    for ( size_t i = 0; i < this->materialTextures.size(); i++ )
+    {
+      const TextureArraySlot& slot = packing.slots[i];
+      auto job = decoder.submit( this->materialTextures[i], (float)slot.width * slot.height );
+      jobSlots[ job.get() ] = i;
+    }
+
+    // A job keeps its staging range until the copies reading it have run.
+    // They are submitted whenever no other decode is ready to record, which
+    // hands the ranges back before the workers could be left waiting.
+    std::vector<std::shared_ptr<DecodeJob>> copied;
+    while ( true )
+    {
+      auto job = copied.empty() ? decoder.next() : decoder.tryNext();
+      if ( !job )
+      {
+        if ( copied.empty() )
+        {
+          break;
+        }
+
+        VkCommandPool commandPool = this->upload.commandPool;
+        this->upload.flush( this->graphicsQueue );
+        this->upload.begin( commandPool );
+        for ( auto& done : copied )
+        {
+          decoder.release( done );
+        }
+        copied.clear();
+        continue;
+      }
+
+      if ( job->state != DECODE_STATE_DONE )
+      {
+        throw std::runtime_error( "Failed to load material texture " + job->path + ": " + job->error );
+      }
+
+      const TextureArraySlot& slot = packing.slots[ jobSlots[ job.get() ] ];
+      fitTextureArraySlot( slot, job->pixels, job->width, job->height );
+      recordTextureArraySlotCopy( this->upload.commandBuffer,
+                                  stagingBuffer,
+                                  job->stagingOffset,
+                                  slot,
+                                  packing.size,
+                                  MATERIAL_TEXTURE_GUTTER,
+                                  this->textureImage );
+      this->upload.stagedBytes += (VkDeviceSize)slot.width * slot.height * 4;
+      copied.push_back( job );
+    }
+
+    DecodeMetrics metrics = decoder.metrics();
+    std::cout << "Texture: decoded " << metrics.completed << " material textures, "
+              << metrics.averageDecodeMs << " ms average decode, "
+              << metrics.maxLatencyMs << " ms worst latency, "
+              << metrics.stagingPeak / 1024 << " KiB peak staging" << std::endl;
+
+    // Box filtered blits never mix aligned cells while they are a texel wide
+    generateMipmaps( this->physical,
+                     this->upload,
+                     this->textureImage,
+                     VK_FORMAT_R8G8B8A8_UNORM,
+                     packing.size,
+                     packing.size,
+                     this->textureMipLevels,
+                     packing.layers );
+
+    std::cout << "Texture: packed " << this->materialTextures.size() << " material textures into "
+              << packing.layers << " layers of " << packing.size << "x" << packing.size << std::endl;
+
+    // Already planned at packing time
+    this->trackTextureResidency( textureLevelSizes( packing.size, packing.size, 4 * packing.layers ), 0, 0 );
+  }
+
+  // Copy every level of a cooked texture through the staging ring
+  void uploadCookedTexture( const CookedTexture& cooked )
+  {
+    this->textureFormat    = cooked.format;
+    this->textureMipLevels = cooked.levels.size();
+
+    // Only the levels left after budget planning are staged
+    uint64_t offset, size;
+    cookedLevelRange( cooked, 0, cooked.levels.size(), offset, size );
+
+    createImage( this->physical,
+                 this->device,
+                 cooked.width,
+                 cooked.height,
+                 this->textureMipLevels,
+                 1,
+                 this->textureFormat,
+                 VK_IMAGE_TILING_OPTIMAL,
+                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                 MEMORY_USAGE_GPU_ONLY,
+                 this->textureImage,
+                 this->textureImageMemory );
+
+    std::vector<VkBufferImageCopy> regions( cooked.levels.size() );
+    std::vector<VkDeviceSize>      sizes( cooked.levels.size() );
+    for ( uint32_t i = 0; i < regions.size(); i++ )
+    {
+      sizes[i]   = cooked.levels[i].size;
+      regions[i] = {};
+      regions[i].bufferOffset                    = cooked.levels[i].offset - offset;
+      regions[i].bufferRowLength                 = 0; // Tightly packed
+      regions[i].bufferImageHeight               = 0;
+      regions[i].imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+      regions[i].imageSubresource.mipLevel       = i;
+      regions[i].imageSubresource.baseArrayLayer = 0;
+      regions[i].imageSubresource.layerCount     = 1;
+      regions[i].imageOffset                     = { 0, 0, 0 };
+      regions[i].imageExtent                     = { cooked.levels[i].width,
+                                                     cooked.levels[i].height,
+                                                     1 };
+    }
+
+    copyHostToImage( this->upload,
+                     this->physical,
+                     cooked.data.data() + offset,
+                     regions,
+                     sizes,
+                     compressedBlockSize( cooked.format ) ? 4 : 1,
+                     this->textureImage,
+                     0,
+                     this->textureMipLevels,
+                     1,
+                     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL );
+  }
+
+  // Record loading only the coarse levels of a cooked texture into a new
+  // image; returns the finest of them. The finer levels are left for the
+  // texture streamer to read from disk once rendering has started.
+  uint32_t streamCookedTexture( const CookedTexture& cooked,
+                                UploadContext&       upload,
+                                VDeleter<VkImage>&   image,
+                                MemoryAllocation&    imageMemory )
+  {
+    uint32_t mipLevels     = cooked.levels.size();
+    uint32_t residentLevel = 0;
+    while ( residentLevel + 1 < mipLevels &&
+            std::max( cooked.levels[residentLevel].width,
+                      cooked.levels[residentLevel].height ) > TEXTURE_STREAM_RESIDENT_SIZE )
+    {
+      residentLevel++;
+    }
+
+    uint64_t offset, size;
+    cookedLevelRange( cooked, residentLevel, mipLevels - residentLevel, offset, size );
+
+    // Copy straight from the file where it can be imported
+    VkBuffer     stagingBuffer;
+    VkDeviceSize stagingOffset = 0;
+    std::shared_ptr<HostImportedRange> imported =
+      this->hostImporter.import( COOKED_TEXTURE_PATH, cooked.dataOffset + offset, size );
+    if ( imported )
+    {
+      upload.owned.push_back( imported );
+      upload.stats.importedBytes += size;
+      stagingBuffer = imported->buffer;
+      stagingOffset = imported->offset;
+    }
+    else
+    {
+      StagingRange staging = upload.createStagingBuffer( this->physical, size );
+      stagingBuffer = staging.buffer;
+      stagingOffset = staging.offset;
+      if ( !readCookedLevels( COOKED_TEXTURE_PATH, cooked, residentLevel,
+                              mipLevels - residentLevel, (char*)staging.data ) )
+      {
+        throw std::runtime_error( "Failed to read cooked texture!" );
+      }
+    }
+
+    createImage( this->physical,
+                 this->device,
+                 cooked.width,
+                 cooked.height,
+                 mipLevels,
+                 1,
+                 cooked.format,
+                 VK_IMAGE_TILING_OPTIMAL,
+                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                 MEMORY_USAGE_GPU_ONLY,
+                 image,
+                 imageMemory );
+
+    std::vector<VkBufferImageCopy> regions( mipLevels - residentLevel );
+    for ( uint32_t i = 0; i < regions.size(); i++ )
+    {
+      const CookedMipLevel& level = cooked.levels[ residentLevel + i ];
+
+      regions[i] = {};
+      regions[i].bufferOffset                    = stagingOffset + level.offset - offset;
+      regions[i].bufferRowLength                 = 0; // Tightly packed
+      regions[i].bufferImageHeight               = 0;
+      regions[i].imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+      regions[i].imageSubresource.mipLevel       = residentLevel + i;
+      regions[i].imageSubresource.baseArrayLayer = 0;
+      regions[i].imageSubresource.layerCount     = 1;
+      regions[i].imageOffset                     = { 0, 0, 0 };
+      regions[i].imageExtent                     = { level.width, level.height, 1 };
+    }
+
+    // Every level goes to SHADER_READ_ONLY_OPTIMAL, the missing ones are
+    // left out of the texture view until they arrive
+    copyBufferToImage( upload,
+                       stagingBuffer,
+                       image,
+                       0,
+                       mipLevels,
+                       1,
+                       regions,
+                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL );
+
+    std::cout << "Texture: " << mipLevels - residentLevel << " of "
+              << mipLevels << " levels resident, streaming the rest" << std::endl;
+    return residentLevel;
+  }
+
+  // Upload level 0 as RGBA8 and downsample the rest of the chain on the GPU.
+  // Opaque images are staged as RGB8 and widened on the device.
+  void uploadDecodedTexture( uint32_t                                                texWidth,
+                             uint32_t                                                texHeight,
+                             bool                                                    usesAlpha,
+                             const std::function<void(uint8_t*, size_t, uint32_t)>& writePixels )
+  {
+    this->textureFormat    = VK_FORMAT_R8G8B8A8_UNORM;
+    this->textureMipLevels = calculateMipLevels( texWidth, texHeight );
+
+    // Create final texture with a full mip chain
+    createImage( this->physical,
+                 this->device,
+                 texWidth,
+                 texHeight,
+                 this->textureMipLevels,
+                 1,
+                 VK_FORMAT_R8G8B8A8_UNORM,
+                 VK_IMAGE_TILING_OPTIMAL,
+                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                   ( usesAlpha ? 0 : VK_IMAGE_USAGE_STORAGE_BIT ) |
+                   mipmapImageUsage( this->physical, VK_FORMAT_R8G8B8A8_UNORM ),
+                 MEMORY_USAGE_GPU_ONLY,
+                 this->textureImage,
+                 this->textureImageMemory );
+
+    // Decode straight into staging memory and fill level 0 from it;
+    // generateMipmaps expects every level in TRANSFER_DST_OPTIMAL
+    if ( !usesAlpha )
+    {
+      void*    data;
+      VkBuffer stagingBuffer = createRGBStagingBuffer( this->physical, this->upload,
+                                                       texWidth, texHeight, &data );
+      writePixels( (uint8_t*)data, rgbRowPitch( texWidth ), 3 );
+
+      expandRGBToRGBA( this->upload,
+                       stagingBuffer,
+                       this->textureImage,
+                       texWidth,
+                       texHeight,
+                       this->textureMipLevels );
+    }
+    else
+    {
+      VkDeviceSize imageSize = (VkDeviceSize)texWidth * texHeight * 4;
+      StagingRange staging   = this->upload.createStagingBuffer( this->physical, imageSize );
+      writePixels( (uint8_t*)staging.data, texWidth * 4, 4 );
+
+      VkBufferImageCopy region = {};
+      region.bufferOffset                    = staging.offset;
+      region.bufferRowLength                 = 0; // Tightly packed
+      region.bufferImageHeight               = 0;
+      region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.mipLevel       = 0;
+      region.imageSubresource.baseArrayLayer = 0;
+      region.imageSubresource.layerCount     = 1;
+      region.imageOffset                     = { 0, 0, 0 };
+      region.imageExtent                     = { texWidth, texHeight, 1 };
+
+      copyBufferToImage( this->upload,
+                         staging.buffer,
+                         this->textureImage,
+                         0,
+                         this->textureMipLevels,
+                         1,
+                         { region },
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+    }
+
+    // Downsample level 0 into the rest of the chain
+    generateMipmaps( this->physical,
+                     this->upload,
+                     this->textureImage,
+                     VK_FORMAT_R8G8B8A8_UNORM,
+                     texWidth,
+                     texHeight,
+                     this->textureMipLevels );
+  }
+
+  // Entropy decode on the CPU, reconstruct level 0 on the device and
+  // downsample the rest of the chain
+  void uploadJpegTexture( const JpegImage& jpeg )
+  {
+    this->textureFormat    = VK_FORMAT_R8G8B8A8_UNORM;
+    this->textureMipLevels = calculateMipLevels( jpeg.width, jpeg.height );
+
+    createImage( this->physical,
+                 this->device,
+                 jpeg.width,
+                 jpeg.height,
+                 this->textureMipLevels,
+                 1,
+                 VK_FORMAT_R8G8B8A8_UNORM,
+                 VK_IMAGE_TILING_OPTIMAL,
+                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                   VK_IMAGE_USAGE_STORAGE_BIT |
+                   ( JPEG_GPU_VALIDATE ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0 ) |
+                   mipmapImageUsage( this->physical, VK_FORMAT_R8G8B8A8_UNORM ),
+                 MEMORY_USAGE_GPU_ONLY,
+                 this->textureImage,
+                 this->textureImageMemory );
+
+    auto start = std::chrono::high_resolution_clock::now();
+    JpegCoefficients coefficients;
+    decodeJpegCoefficients( jpeg, coefficients, std::thread::hardware_concurrency() );
+    VkBuffer buffer = createJpegCoefficientBuffer( this->physical, this->upload, jpeg, coefficients );
+
+    std::cout << "Texture: entropy decoded " << TEXTURE_PATH << " in "
+              << std::chrono::duration<float, std::milli>(
+                   std::chrono::high_resolution_clock::now() - start ).count()
+              << " ms, " << jpegGpuWordCount( coefficients ) * 4 << " coefficient bytes instead of "
+              << (VkDeviceSize)jpeg.width * jpeg.height * 4 << " texel bytes" << std::endl;
+
+    reconstructJpeg( this->upload, buffer, this->textureImage, jpeg, this->textureMipLevels );
+    generateMipmaps( this->physical,
+                     this->upload,
+                     this->textureImage,
+                     VK_FORMAT_R8G8B8A8_UNORM,
+                     jpeg.width,
+                     jpeg.height,
+                     this->textureMipLevels );
+    this->textureReconstructedOnGpu = true;
+  }
+
+  // Reconstruct on the device as above, but read the pixels back for the
+  // cook, which is where a block compressed texture comes from
+  void decodeJpegTextureOnDevice( const JpegImage& jpeg, uint8_t* pixels )
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    JpegCoefficients coefficients;
+    decodeJpegCoefficients( jpeg, coefficients, std::thread::hardware_concurrency() );
+    decodeJpegOnDevice( this->physical, this->device, this->allocator, this->graphicsQueue,
+                        this->commandPool, jpeg, coefficients, pixels );
+
+    std::cout << "Texture: decoded " << TEXTURE_PATH << " on the device in "
+              << std::chrono::duration<float, std::milli>(
+                   std::chrono::high_resolution_clock::now() - start ).count()
+              << " ms" << std::endl;
+
+    if ( JPEG_GPU_VALIDATE )
+    {
+      this->compareWithStb( pixels );
+    }
+  }
+
+  // Read level 0 back and compare it with stb_image's decode of the source
+  void validateJpegTexture(  )
+  {
+    int width, height, channels;
+    if ( !stbi_info( TEXTURE_PATH.c_str(), &width, &height, &channels ) )
+    {
+      throw std::runtime_error( "Failed to load texture image!" );
+    }
+
+    VkDeviceSize             size = (VkDeviceSize)width * height * 4;
+    VDeleter<VkBuffer>       readbackBuffer       { this->device, vkDestroyBuffer };
+    MemoryAllocation         readbackBufferMemory { this->allocator, MEMORY_CATEGORY_READBACK, "JPEG validation readback" };
+    createBuffer( this->device,
+                  this->physical,
+                  size,
+                  VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  MEMORY_USAGE_READBACK,
+                  readbackBuffer,
+                  readbackBufferMemory );
+
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands( this->device, this->commandPool );
+
+    auto toSrc = mipBarrier( this->textureImage, 0, 1,
+                             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             VK_ACCESS_SHADER_READ_BIT,
+                             VK_ACCESS_TRANSFER_READ_BIT );
+    vkCmdPipelineBarrier( commandBuffer,
+                          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          0, 0, nullptr, 0, nullptr, 1, &toSrc );
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel       = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount     = 1;
+    region.imageExtent                     = { (uint32_t)width, (uint32_t)height, 1 };
+    vkCmdCopyImageToBuffer( commandBuffer, this->textureImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                            readbackBuffer, 1, &region );
+
+    auto toShader = mipBarrier( this->textureImage, 0, 1,
+                                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                VK_ACCESS_TRANSFER_READ_BIT,
+                                VK_ACCESS_SHADER_READ_BIT );
+    vkCmdPipelineBarrier( commandBuffer,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                          0, 0, nullptr, 0, nullptr, 1, &toShader );
+
+    endSingleTimeCommands( this->device, this->graphicsQueue, this->commandPool, commandBuffer );
+
+    this->compareWithStb( (const uint8_t*)readbackBufferMemory.map() );
+  }
+
+  // Hold RGBA8 pixels decoded from the source to stb_image's decode of it
+  void compareWithStb( const uint8_t* actual )
+  {
+    int      width, height, channels;
+    stbi_uc* expected = stbi_load( TEXTURE_PATH.c_str(), &width, &height, &channels, STBI_rgb_alpha );
+    if ( !expected )
+    {
+      throw std::runtime_error( "Failed to load texture image!" );
+    }
+
+    VkDeviceSize size     = (VkDeviceSize)width * height * 4;
+    int          maxError = 0;
+    double       sumError = 0.0;
+    for ( VkDeviceSize i = 0; i < size; i++ )
+    {
+      int error = std::abs( (int)actual[i] - (int)expected[i] );
+      maxError  = std::max( maxError, error );
+      sumError += error;
+    }
+    stbi_image_free( expected );
+
+    float meanError = (float)( sumError / size );
+    std::cout << "Texture: GPU JPEG decode against stb_image, mean error " << meanError
+              << ", max error " << maxError << std::endl;
+    if ( meanError > JPEG_GPU_VALIDATE_MEAN_ERROR )
+    {
+      throw std::runtime_error( "GPU JPEG decode does not match stb_image!" );
+    }
+  }
+
+  void createTextureImageView(  )
+  {
+    createImageView( this->device,
+                     this->textureImage,
+                     VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+                     this->textureFormat,
+                     VK_IMAGE_ASPECT_COLOR_BIT,
+                     this->textureStreamer.residentLevel,
+                     this->textureMipLevels - this->textureStreamer.residentLevel,
+                     this->textureArrayLayers,
+                     this->textureImageView );
+  }
+
+  // Independent of the texture; the image view limits the mip range
+  VkSamplerCreateInfo textureSamplerInfo(  )
+  {
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType                   = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter               = VK_FILTER_LINEAR;
+    samplerInfo.minFilter               = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU            = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV            = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW            = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.anisotropyEnable        = VK_TRUE;
+    samplerInfo.maxAnisotropy           = 16;
+    samplerInfo.borderColor             = VK_BORDER_COLOR_INT_OPAQUE_BLACK ;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable           = VK_FALSE;
+    samplerInfo.compareOp               = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.mipmapMode              = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.mipLodBias              = 0.0f;
+    samplerInfo.minLod                  = 0.0f;
+    samplerInfo.maxLod                  = 1000.0f; // No clamp
+
+    return samplerInfo;
+  }
+
+  void loadModel(  )
   {
     tinyobj::attrib_t                attrib;
     std::vector<tinyobj::shape_t>    shapes;
@@ -961,23 +2007,39 @@ private:
       throw std::runtime_error( err );
     }
 
+    std::vector<TextureArraySlot> materialSlots = this->packMaterialTextures( materials, shapes );
+
     for ( const auto& shape : shapes )
     {
-      for ( const auto& index : shape.mesh.indices )
+      for ( size_t i = 0; i < shape.mesh.indices.size(); i++ )
       {
-        Vertex vertex = {};
+        const auto& index  = shape.mesh.indices[i];
+        Vertex      vertex = {};
+
+        size_t vertexIndex   = (size_t)index.vertex_index;
+        size_t texcoordIndex = (size_t)index.texcoord_index;
 
         vertex.pos = {
-          attrib.vertices[ 3 * index.vertex_index + 0 ],
-          attrib.vertices[ 3 * index.vertex_index + 1 ],
-          attrib.vertices[ 3 * index.vertex_index + 2 ]
+          attrib.vertices[ 3 * vertexIndex + 0 ],
+          attrib.vertices[ 3 * vertexIndex + 1 ],
+          attrib.vertices[ 3 * vertexIndex + 2 ]
         };
 
         vertex.texCoord = {
-          attrib.texcoords[ 2 * index.texcoord_index + 0 ],
-          1.0f - attrib.texcoords[ 2 * index.texcoord_index + 1 ]
+          attrib.texcoords[ 2 * texcoordIndex + 0 ],
+          1.0f - attrib.texcoords[ 2 * texcoordIndex + 1 ]
         };
 
+        // Remap into the material's slot of the texture array
+        if ( !materialSlots.empty() )
+        {
+          int material = shape.mesh.material_ids[ i / 3 ];
+
+          const TextureArraySlot& slot = materialSlots[ std::max( material, 0 ) ];
+          vertex.texCoord     = slot.uvOffset + vertex.texCoord * slot.uvScale;
+          vertex.textureLayer = (float)slot.layer;
+        }
+
         if ( this->uniqueVertices.count( vertex ) == 0 )
         {
           this->uniqueVertices[ vertex ] = this->vertices.size();
@@ -987,112 +2049,221 @@ private:
         this->indices.push_back( this->uniqueVertices[vertex] );
       }
     }
+
+    // Split into chunks addressable with 32 bit indices that fit in a page
+    this->geometryLimits = queryGeometryLimits( this->physical, GEOMETRY_PAGE_SIZE );
+    this->meshChunks     = splitMesh( this->vertices,
+                                      this->indices,
+                                      this->geometryLimits.maxChunkVertices,
+                                      this->geometryLimits.maxChunkIndices );
+
+    // Use restart-joined strips per chunk if they need fewer indices than the list
+    for ( auto& chunk : this->meshChunks )
+    {
+      auto encoded   = encodeIndices( chunk.indices );
+      chunk.encoding = encoded.encoding;
+      chunk.indices  = std::move( encoded.indices );
+    }
   }
 
-  void createVertexBuffer(  )
+  // Pack the distinct diffuse textures of the materials into one texture
+  // array and return each material's slot in it. Models with fewer than two
+  // material textures use the main texture and get no slots.
+  std::vector<TextureArraySlot> packMaterialTextures( const std::vector<tinyobj::material_t>& materials,
+                                                     const std::vector<tinyobj::shape_t>&    shapes )
   {
-    VkDeviceSize bufferSize = sizeof( vertices[0] ) * vertices.size();
+    std::vector<uint32_t> materialTexture( materials.size(), 0 );
+    for ( size_t m = 0; m < materials.size(); m++ )
+    {
+      const std::string& path = materials[m].diffuse_texname;
+      if ( path.empty() )
+      {
+        continue; // Falls back to the first texture
+      }
 
-    // Create Staging Buffer
-    VDeleter<VkBuffer>       stagingBuffer        { this->device, vkDestroyBuffer };
-    VDeleter<VkDeviceMemory> stagingBufferMemory { this->device, vkFreeMemory };
-    createBuffer( this->device,
-                  this->physical,
-                  bufferSize,
-                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                  stagingBuffer,
-                  stagingBufferMemory );
-    
-    // Memory map Staging Buffer
-    void* data;
-    vkMapMemory( this->device, stagingBufferMemory, 0, bufferSize, 0, &data );
-    std::memcpy( data, vertices.data(), (size_t)bufferSize );
-    vkUnmapMemory( this->device, stagingBufferMemory );
+      auto found = std::find( this->materialTextures.begin(), this->materialTextures.end(), path );
+      materialTexture[m] = found - this->materialTextures.begin();
+      if ( found == this->materialTextures.end() )
+      {
+        this->materialTextures.push_back( path );
+      }
+    }
 
-    // Copy contents of Staging Buffer into Vertex Buffer
-    createBuffer( this->device,
-                  this->physical,
-                  bufferSize,
-                  VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                  this->vertexBuffer,
-                  this->vertexBufferMemory );
-    copyBuffer( this->device,
-                this->graphicsQueue,
-                this->commandPool,
-                stagingBuffer,
-                this->vertexBuffer, bufferSize );
+    if ( this->materialTextures.size() < 2 )
+    {
+      this->materialTextures.clear();
+      return {};
+    }
+
+    std::vector<VkExtent2D>& extents = this->materialTextureExtents;
+    extents.resize( this->materialTextures.size() );
+    for ( size_t i = 0; i < extents.size(); i++ )
+    {
+      int texWidth, texHeight, texChannels;
+      if ( !stbi_info( this->materialTextures[i].c_str(), &texWidth, &texHeight, &texChannels ) )
+      {
+        throw std::runtime_error( "Failed to load material texture!" );
+      }
+      extents[i] = { (uint32_t)texWidth, (uint32_t)texHeight };
+    }
+
+    // Textures used by more faces keep their detail longer
+    std::vector<TextureBudgetRequest> requests( extents.size() );
+    for ( size_t i = 0; i < extents.size(); i++ )
+    {
+      requests[i].levelSizes = textureLevelSizes( extents[i].width, extents[i].height, 4 );
+      requests[i].importance = 1.0f;
+    }
+    for ( const auto& shape : shapes )
+    {
+      for ( int material : shape.mesh.material_ids )
+      {
+        requests[ materialTexture[ std::max( material, 0 ) ] ].importance += 1.0f;
+      }
+    }
+
+    // Pack the textures at their planned resolution
+    TextureBudgetPlan       plan           = this->planTextureResidency( requests );
+    std::vector<VkExtent2D> plannedExtents = extents;
+    for ( size_t i = 0; i < extents.size(); i++ )
+    {
+      plannedExtents[i].width  = std::max( extents[i].width >> plan.baseLevels[i], 1u );
+      plannedExtents[i].height = std::max( extents[i].height >> plan.baseLevels[i], 1u );
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties( this->physical, &properties );
+
+    this->materialTexturePacking = packTextureArray( plannedExtents,
+                                                     properties.limits.maxImageDimension2D,
+                                                     properties.limits.maxImageArrayLayers,
+                                                     MATERIAL_TEXTURE_GUTTER );
+
+    std::vector<TextureArraySlot> slots( materials.size() );
+    for ( size_t m = 0; m < materials.size(); m++ )
+    {
+      slots[m] = this->materialTexturePacking.slots[ materialTexture[m] ];
+    }
+    return slots;
   }
 
-  void createIndexBuffer( )
+  // Fit the requested textures into TEXTURE_BUDGET_SHARE of the device
+  // local memory that is currently available. Can be run again with the
+  // same requests whenever the budget changes.
+  TextureBudgetPlan planTextureResidency( const std::vector<TextureBudgetRequest>& requests )
   {
-    VkDeviceSize bufferSize = sizeof( indices[0] ) * indices.size(  );
+    VkDeviceSize available = queryDeviceLocalBudget( this->instance,
+                                                     this->physical,
+                                                     this->memoryBudgetSupported );
+    VkDeviceSize budget    = (VkDeviceSize)( available * TEXTURE_BUDGET_SHARE );
 
-    VDeleter<VkBuffer>       stagingBuffer        {device, vkDestroyBuffer};
-    VDeleter<VkDeviceMemory> stagingBufferMemory {device, vkFreeMemory};
-    createBuffer( this->device,
-                  this->physical,
-                  bufferSize,
-                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                  stagingBuffer,
-                  stagingBufferMemory );
+    TextureBudgetPlan plan = planTextureBudget( requests, budget );
+    this->textureBudget    = budget;
+
+    uint32_t reduced = 0;
+    for ( uint32_t base : plan.baseLevels )
+    {
+      reduced += base > 0;
+    }
+    std::cout << "Texture budget: " << plan.requestedBytes << " bytes requested, "
+              << plan.plannedBytes << " planned of " << budget << " ("
+              << ( this->memoryBudgetSupported ? "VK_EXT_memory_budget" : "heap size" ) << "), "
+              << reduced << " of " << requests.size() << " textures reduced" << std::endl;
+    if ( !plan.fits )
+    {
+      std::cout << "Texture budget: textures do not fit even at their coarsest levels" << std::endl;
+    }
 
-    void* data;
-    vkMapMemory( device, stagingBufferMemory, 0, bufferSize, 0, &data );
-    std::memcpy( data, indices.data(  ), ( size_t ) bufferSize );
-    vkUnmapMemory( device, stagingBufferMemory );
+    return plan;
+  }
 
-    createBuffer( this->device,
-                  this->physical,
-                  bufferSize,
-                  VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                  this->indexBuffer,
-                  this->indexBufferMemory );
+  void createGeometryBuffers(  )
+  {
+    createGeometryPages( this->physical,
+                         this->device,
+                         this->upload,
+                         this->meshChunks,
+                         this->geometryLimits.pageSize,
+                         this->geometryPages,
+                         this->geometryDraws );
+
+    // Chunk data now lives on the GPU
+    this->meshChunks.clear();
+    this->meshChunks.shrink_to_fit();
+  }
 
-    copyBuffer( this->device,
-                this->graphicsQueue,
-                this->commandPool,
-                stagingBuffer,
-                this->indexBuffer,
-                bufferSize );
+  // Instance data itself is written to the frame ring every frame
+  void createInstances(  )
+  {
+    for ( uint32_t y = 0; y < INSTANCE_GRID_SIZE; y++ )
+    {
+      for ( uint32_t x = 0; x < INSTANCE_GRID_SIZE; x++ )
+      {
+        float half = 0.5f * ( INSTANCE_GRID_SIZE - 1 );
+        this->instances.push_back( glm::vec4( ( x - half ) * INSTANCE_SPACING,
+                                              ( y - half ) * INSTANCE_SPACING,
+                                              0.0f,
+                                              1.0f ) );
+      }
+    }
   }
 
-  void createUniformBuffer(  )
+  // Room for every instance as both a mesh and an impostor
+  VkDeviceSize instanceDataSize(  ) const
   {
-    VkDeviceSize bufferSize = sizeof( UniformBufferObject );
+    return 2 * INSTANCE_COUNT * sizeof( InstanceData );
+  }
 
-    createBuffer( this->device,
-                  this->physical,
-                  bufferSize,
-                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                  this->uniformStagingBuffer,
-                  this->uniformStagingBufferMemory);
-    createBuffer( this->device,
-                  this->physical,
-                  bufferSize,
-                  VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                  this->uniformBuffer,
-                  this->uniformBufferMemory );
+  // One indexed draw per geometry chunk followed by the impostor draw
+  VkDeviceSize indirectDataSize(  ) const
+  {
+    return this->geometryDraws.size() * sizeof( VkDrawIndexedIndirectCommand ) +
+           sizeof( VkDrawIndirectCommand );
   }
 
+  // Offsets within an image's ring region of the allocations writeFrameData
+  // makes after the uniforms
+  VkDeviceSize frameInstanceOffset(  ) const
+  {
+    return this->frameRing.allocationSize( sizeof( UniformBufferObject ) );
+  }
+
+  VkDeviceSize frameIndirectOffset(  ) const
+  {
+    return this->frameInstanceOffset() + this->frameRing.allocationSize( this->instanceDataSize() );
+  }
+
+  // Uniforms, instances and indirect draws come from one ring region per
+  // swapchain image. Each allocation is padded by at most the largest
+  // alignment a device may require.
+  void createUniformBuffer(  )
+  {
+    VkDeviceSize frameData = sizeof( UniformBufferObject ) + this->instanceDataSize() +
+                             this->indirectDataSize() + 3 * 256;
+    this->frameRing.create( this->physical,
+                            std::max<VkDeviceSize>( FRAME_RING_REGION_SIZE, frameData ),
+                            this->swapchainImages.size() );
+  }
+
+  // Every swapchain image has its own sets, so an image's sets can be
+  // rewritten while frames drawing to other images are in flight
   void createDescriptorPool(  )
   {
-    std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-    poolSizes[0].type            = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = 1;
+    uint32_t images = this->swapchainImages.size();
+
+    std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+    poolSizes[0].type            = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = 2 * images;
     poolSizes[1].type            = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = 1;
+    poolSizes[1].descriptorCount = 3 * images;
+    poolSizes[2].type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    poolSizes[2].descriptorCount = images;
 
     VkDescriptorPoolCreateInfo poolInfo = {};
     poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = poolSizes.size();
     poolInfo.pPoolSizes    = poolSizes.data();
-    poolInfo.maxSets       = 1;
+    poolInfo.maxSets       = 2 * images;
     
     if ( vkCreateDescriptorPool( this->device, &poolInfo,
                                  nullptr, &this->descriptorPool ) != VK_SUCCESS )
@@ -1101,61 +2272,181 @@ private:
     }
   }
 
-  void createDescriptorSet(  )
+  // The impostor sets are filled once the atlas exists, when each image is
+  // first recorded; the mesh sets are also used to bake the atlas
+  void createDescriptorSets(  )
   {
-    // Create initial descriptors
-    VkDescriptorSetLayout layouts[] = { this->descriptorSetLayout };
+    uint32_t images = this->swapchainImages.size();
+    this->descriptorSets.resize( images );
+    this->impostorDescriptorSets.resize( images );
+
+    std::vector<VkDescriptorSetLayout> layouts( images, this->descriptorSetLayout );
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool     = this->descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts        = layouts;
+    allocInfo.descriptorSetCount = images;
+    allocInfo.pSetLayouts        = layouts.data();
 
     if ( vkAllocateDescriptorSets( this->device,
                                    &allocInfo,
-                                   &this->descriptorSet ) != VK_SUCCESS )
+                                   this->descriptorSets.data() ) != VK_SUCCESS )
     {
       throw std::runtime_error( "Failed to allocate descriptor set!" );
     }
 
-    // Now create buffer to hold uniform data
+    std::vector<VkDescriptorSetLayout> impostorLayouts( images, this->impostorDescriptorSetLayout );
+    allocInfo.pSetLayouts = impostorLayouts.data();
+
+    if ( vkAllocateDescriptorSets( this->device,
+                                   &allocInfo,
+                                   this->impostorDescriptorSets.data() ) != VK_SUCCESS )
+    {
+      throw std::runtime_error( "Failed to allocate impostor descriptor set!" );
+    }
+
+    for ( uint32_t i = 0; i < images; i++ )
+    {
+      this->updateUniformDescriptors( i );
+      this->updateTextureDescriptor( i );
+      this->updateFeedbackDescriptor( i );
+    }
+  }
+
+  // Point image's sets at the current resources. The previous frame drawn
+  // to image must have completed, and its command buffer is re-recorded
+  // afterwards.
+  void updateDescriptorSets( uint32_t image )
+  {
+    this->updateUniformDescriptors( image );
+    this->updateTextureDescriptor( image );
+    this->updateFeedbackDescriptor( image );
+    this->updateImpostorDescriptor( image );
+  }
+
+  void createTextureFeedback(  )
+  {
+    if ( this->textureFeedbackEnabled )
+    {
+      this->textureFeedback.create( this->physical,
+                                    this->swapchainExtent,
+                                    TEXTURE_FEEDBACK_TILE,
+                                    this->swapchainImages.size() );
+    }
+  }
+
+  void updateUniformDescriptors( uint32_t image )
+  {
     VkDescriptorBufferInfo bufferInfo = {};
-    bufferInfo.buffer = this->uniformBuffer;
+    bufferInfo.buffer = this->frameRing.buffer;
     bufferInfo.offset = 0;
     bufferInfo.range  = sizeof(UniformBufferObject);
 
-    // Create image to hold texture data
+    std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+    VkDescriptorSet sets[] = { this->descriptorSets[image], this->impostorDescriptorSets[image] };
+    for ( uint32_t i = 0; i < descriptorWrites.size(); i++ )
+    {
+      descriptorWrites[i].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[i].dstSet          = sets[i];
+      descriptorWrites[i].dstBinding      = 0;
+      descriptorWrites[i].dstArrayElement = 0;
+      descriptorWrites[i].descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+      descriptorWrites[i].descriptorCount = 1;
+      descriptorWrites[i].pBufferInfo     = &bufferInfo;
+    }
+
+    vkUpdateDescriptorSets( this->device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr );
+  }
+
+  void updateFeedbackDescriptor( uint32_t image )
+  {
+    if ( !this->textureFeedbackEnabled )
+    {
+      return;
+    }
+
+    VkDescriptorBufferInfo bufferInfo = {};
+    bufferInfo.buffer = this->textureFeedback.buffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range  = this->textureFeedback.range();
+
+    VkWriteDescriptorSet descriptorWrite = {};
+    descriptorWrite.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet          = this->descriptorSets[image];
+    descriptorWrite.dstBinding      = 2;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pBufferInfo     = &bufferInfo;
+
+    vkUpdateDescriptorSets( this->device, 1, &descriptorWrite, 0, nullptr );
+  }
+
+  void updateTextureDescriptor( uint32_t image )
+  {
     VkDescriptorImageInfo imageInfo = {};
     imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     imageInfo.imageView   = this->textureImageView;
     imageInfo.sampler     = this->textureSampler;
 
-    // Update descriptors
+    VkWriteDescriptorSet descriptorWrite = {};
+    descriptorWrite.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet          = this->descriptorSets[image];
+    descriptorWrite.dstBinding      = 1;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo      = &imageInfo;
+
+    vkUpdateDescriptorSets( this->device, 1, &descriptorWrite, 0, nullptr );
+  }
+
+  void createImpostorAtlas(  )
+  {
+    bakeImpostorAtlas( this->physical,
+                       this->device,
+                       this->upload,
+                       this->descriptorSetLayout,
+                       this->descriptorSets[0],
+                       this->vertices,
+                       this->geometryPages,
+                       this->geometryDraws,
+                       IMPOSTOR_VIEWS_PER_SIDE,
+                       IMPOSTOR_TILE_SIZE,
+                       this->impostorAtlas );
+  }
+
+  // Atlas views change when the defragmenter moves the atlas
+  void updateImpostorDescriptor( uint32_t image )
+  {
+    std::array<VkDescriptorImageInfo, 2> imageInfos = {};
+    imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfos[0].imageView   = this->impostorAtlas.colorImageView;
+    imageInfos[0].sampler     = this->impostorAtlas.sampler;
+    imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfos[1].imageView   = this->impostorAtlas.normalDepthImageView;
+    imageInfos[1].sampler     = this->impostorAtlas.sampler;
+
     std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
-    
-    descriptorWrites[0].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstSet          = this->descriptorSet;
-    descriptorWrites[0].dstBinding      = 0;
-    descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrites[0].descriptorCount = 1;
-    descriptorWrites[0].pBufferInfo     = &bufferInfo;
-    
-    descriptorWrites[1].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[1].dstSet          = this->descriptorSet;
-    descriptorWrites[1].dstBinding      = 1;
-    descriptorWrites[1].dstArrayElement = 0;
-    descriptorWrites[1].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    descriptorWrites[1].descriptorCount = 1;
-    descriptorWrites[1].pImageInfo      = &imageInfo;
-
-    vkUpdateDescriptorSets( device,
+    for ( uint32_t i = 0; i < imageInfos.size(); i++ )
+    {
+      descriptorWrites[i].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[i].dstSet          = this->impostorDescriptorSets[image];
+      descriptorWrites[i].dstBinding      = i + 1;
+      descriptorWrites[i].dstArrayElement = 0;
+      descriptorWrites[i].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      descriptorWrites[i].descriptorCount = 1;
+      descriptorWrites[i].pImageInfo      = &imageInfos[i];
+    }
+
+    vkUpdateDescriptorSets( this->device,
                             descriptorWrites.size(),
                             descriptorWrites.data(),
                             0,
                             nullptr );
   }
 
+  // One command buffer per swapchain image, recorded by drawFrame when the
+  // image is next drawn
   void createCommandBuffers(  )
   {
     // Free old command buffers (if called from recreateSwapChain())
@@ -1180,82 +2471,127 @@ private:
       throw std::runtime_error( "Failed to allocate command buffers!" );
     }
 
-    for ( size_t i = 0; i < this->commandBuffers.size(  ); i++ )
-    {
-      VkCommandBufferBeginInfo beginInfo = {};
-      beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-      beginInfo.pInheritanceInfo = nullptr;
-
-      vkBeginCommandBuffer( this->commandBuffers[i], &beginInfo );
-      
-      // Start Render Pass
-      std::array<VkClearValue, 2> clearValues = {};
-      clearValues[0].color        = { 0.0f, 0.0f, 0.0f, 1.0f };
-      clearValues[1].depthStencil = { 1.0f, 0 };
-      
-      VkRenderPassBeginInfo renderPassCreateInfo = {};
-      renderPassCreateInfo.sType             = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-      renderPassCreateInfo.renderPass        = this->renderPass;
-      renderPassCreateInfo.framebuffer       = this->swapchainFramebuffers[i];
-      renderPassCreateInfo.renderArea.offset = {0, 0};
-      renderPassCreateInfo.renderArea.extent = this->swapchainExtent;
-      renderPassCreateInfo.clearValueCount   = clearValues.size();
-      renderPassCreateInfo.pClearValues      = clearValues.data();
-
-      vkCmdBeginRenderPass( this->commandBuffers[i],
-                            &renderPassCreateInfo,
-                            VK_SUBPASS_CONTENTS_INLINE );
+    this->recordedVersions.assign( this->commandBuffers.size(), 0 );
+  }
+
+  // Record image's frame commands against its descriptor sets and the
+  // current geometry. Beginning the command buffer resets it; the previous
+  // frame drawn to image must have completed.
+  void recordCommandBuffer( uint32_t i )
+  {
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0;
+    beginInfo.pInheritanceInfo = nullptr;
+
+    vkBeginCommandBuffer( this->commandBuffers[i], &beginInfo );
+
+    if ( this->textureFeedbackEnabled )
+    {
+      this->textureFeedback.recordClear( this->commandBuffers[i], i );
+    }
+    
+    // Start Render Pass
+    std::array<VkClearValue, 2> clearValues = {};
+    clearValues[0].color        = { 0.0f, 0.0f, 0.0f, 1.0f };
+    clearValues[1].depthStencil = { 1.0f, 0 };
+    
+    VkRenderPassBeginInfo renderPassCreateInfo = {};
+    renderPassCreateInfo.sType             = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassCreateInfo.renderPass        = this->renderPass;
+    renderPassCreateInfo.framebuffer       = this->swapchainFramebuffers[i];
+    renderPassCreateInfo.renderArea.offset = {0, 0};
+    renderPassCreateInfo.renderArea.extent = this->swapchainExtent;
+    renderPassCreateInfo.clearValueCount   = clearValues.size();
+    renderPassCreateInfo.pClearValues      = clearValues.data();
+
+    vkCmdBeginRenderPass( this->commandBuffers[i],
+                          &renderPassCreateInfo,
+                          VK_SUBPASS_CONTENTS_INLINE );
+
+    // Bind this image's uniforms and feedback slot
+    uint32_t dynamicOffsets[] = { (uint32_t)this->frameRing.regionOffset( i ),
+                                  this->textureFeedback.dynamicOffset( i ) };
+    vkCmdBindDescriptorSets( this->commandBuffers[i],
+                             VK_PIPELINE_BIND_POINT_GRAPHICS,
+                             this->pipelineLayout,
+                             0,
+                             1,
+                             &this->descriptorSets[i],
+                             this->textureFeedbackEnabled ? 2 : 1,
+                             dynamicOffsets );
+
+    // Draw each chunk from its page. Instance counts are written
+    // each frame by writeFrameData()
+    for ( size_t d = 0; d < this->geometryDraws.size(); d++ )
+    {
+      const GeometryDraw& draw = this->geometryDraws[d];
+      const GeometryPage& page = this->geometryPages[draw.page];
 
       vkCmdBindPipeline( this->commandBuffers[i],
                          VK_PIPELINE_BIND_POINT_GRAPHICS,
-                         this->graphicsPipeline );
-
-      // Bind vertex buffer
-      VkBuffer vertexBuffers[] = { this->vertexBuffer };
-      VkDeviceSize offsets[]    = { 0 };
-      vkCmdBindVertexBuffers( this->commandBuffers[i], 0, 1,
+                         draw.encoding == INDEX_ENCODING_TRIANGLE_STRIP ?
+                           this->stripPipeline : this->graphicsPipeline );
+
+      // Bind vertex and instance buffers
+      VkBuffer vertexBuffers[] = { page.vertexBuffer, this->frameRing.buffer };
+      VkDeviceSize offsets[]    = { 0, this->frameRing.regionOffset( i ) +
+                                         this->frameInstanceOffset() };
+      vkCmdBindVertexBuffers( this->commandBuffers[i], 0, 2,
                               vertexBuffers, offsets );
 
       // Bind index buffer
-      vkCmdBindIndexBuffer( this->commandBuffers[i], this->indexBuffer,
+      vkCmdBindIndexBuffer( this->commandBuffers[i], page.indexBuffer,
                             0, VK_INDEX_TYPE_UINT32 );
 
-      // Bind uniform buffer(s)
-      vkCmdBindDescriptorSets( this->commandBuffers[i],
-                               VK_PIPELINE_BIND_POINT_GRAPHICS,
-                               this->pipelineLayout,
-                               0,
-                               1,
-                               &this->descriptorSet,
-                               0,
-                               nullptr );
-      
-      vkCmdDrawIndexed( this->commandBuffers[i],
-                        indices.size(),
-                        1, 0, 0, 0 );
-
-      vkCmdEndRenderPass(this->commandBuffers[i]);
-
-      if ( vkEndCommandBuffer( this->commandBuffers[i] ) != VK_SUCCESS )
-      {
-        throw std::runtime_error("failed to record command buffer!");
-      }
+      vkCmdDrawIndexedIndirect( this->commandBuffers[i],
+                                this->frameRing.buffer,
+                                this->frameRing.regionOffset( i ) + this->frameIndirectOffset() +
+                                  d * sizeof( VkDrawIndexedIndirectCommand ),
+                                1, 0 );
     }
 
-  }
-
-  void createSemaphores(  )
-  {
-    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-
-    if ( vkCreateSemaphore( this->device, &semaphoreCreateInfo,
-                            nullptr, &this->imageAvailableSemaphore ) != VK_SUCCESS ||
-         vkCreateSemaphore( this->device, &semaphoreCreateInfo,
-                            nullptr, &this->renderFinishSemaphore ) != VK_SUCCESS )
+    // Draw distant instances as impostors
+    ImpostorConstants impostorConstants;
+    impostorConstants.centerRadius = glm::vec4( this->impostorAtlas.center,
+                                                this->impostorAtlas.radius );
+    impostorConstants.grid         = glm::vec4( (float)this->impostorAtlas.viewsPerSide,
+                                                0.0f, 0.0f, 0.0f );
+
+    VkBuffer     impostorBuffers[] = { this->frameRing.buffer };
+    VkDeviceSize impostorOffsets[] = { this->frameRing.regionOffset( i ) + this->frameInstanceOffset() +
+                                         INSTANCE_COUNT * sizeof( InstanceData ) };
+
+    vkCmdBindPipeline( this->commandBuffers[i],
+                       VK_PIPELINE_BIND_POINT_GRAPHICS,
+                       this->impostorPipeline );
+    vkCmdBindVertexBuffers( this->commandBuffers[i], 0, 1,
+                            impostorBuffers, impostorOffsets );
+    vkCmdBindDescriptorSets( this->commandBuffers[i],
+                             VK_PIPELINE_BIND_POINT_GRAPHICS,
+                             this->impostorPipelineLayout,
+                             0,
+                             1,
+                             &this->impostorDescriptorSets[i],
+                             1,
+                             dynamicOffsets );
+    vkCmdPushConstants( this->commandBuffers[i],
+                        this->impostorPipelineLayout,
+                        VK_SHADER_STAGE_VERTEX_BIT,
+                        0,
+                        sizeof( impostorConstants ),
+                        &impostorConstants );
+    vkCmdDrawIndirect( this->commandBuffers[i],
+                       this->frameRing.buffer,
+                       this->frameRing.regionOffset( i ) + this->frameIndirectOffset() +
+                         this->geometryDraws.size() * sizeof( VkDrawIndexedIndirectCommand ),
+                       1, 0 );
+
+    vkCmdEndRenderPass(this->commandBuffers[i]);
+
+    if ( vkEndCommandBuffer( this->commandBuffers[i] ) != VK_SUCCESS )
     {
-      throw std::runtime_error( "Failed to create semaphore!" );
+      throw std::runtime_error("failed to record command buffer!");
     }
   }
 
@@ -1306,6 +2642,25 @@ private:
       extensions.push_back( VK_EXT_DEBUG_REPORT_EXTENSION_NAME );
     }
 
+    // Needed to query VK_EXT_memory_budget
+    this->properties2Supported =
+      instanceExtensionSupported( VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME );
+    if ( this->properties2Supported )
+    {
+      extensions.push_back( VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME );
+    }
+
+    // Needed by VK_EXT_external_memory_host
+#ifdef VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME
+    this->externalMemorySupported =
+      HOST_IMPORT && this->properties2Supported &&
+      instanceExtensionSupported( VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME );
+    if ( this->externalMemorySupported )
+    {
+      extensions.push_back( VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME );
+    }
+#endif
+
     return extensions;
   }
 
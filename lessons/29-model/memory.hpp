@@ -1,25 +1,196 @@
 #ifndef __MEMORY_HPP__
 #define __MEMORY_HPP__
 
+#include <algorithm>
 #include "base-includes.hpp"
 
+bool findMemoryTypeIndex( VkPhysicalDevice      physical,
+                          uint32_t              typeFilter,
+                          VkMemoryPropertyFlags props,
+                          uint32_t&             typeIndex )
+{
+  VkPhysicalDeviceMemoryProperties memprops;
+  vkGetPhysicalDeviceMemoryProperties( physical, &memprops );
+
+  for ( uint32_t i = 0; i < memprops.memoryTypeCount; i++ )
+  {
+    if ( ( typeFilter & ( 1 << i ) ) &&
+         ( memprops.memoryTypes[i].propertyFlags & props ) == props )
+    {
+      typeIndex = i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
 uint32_t findMemoryType( VkPhysicalDevice      physical,
                          uint32_t              typeFilter,
                          VkMemoryPropertyFlags props )
+{
+  uint32_t typeIndex;
+  if ( !findMemoryTypeIndex( physical, typeFilter, props, typeIndex ) )
+  {
+    throw std::runtime_error( "Failed to find suitable memory type!" );
+  }
+
+  return typeIndex;
+}
+
+// Device local memory the host can write, as exposed by resizable BAR and
+// by integrated GPUs
+const VkMemoryPropertyFlags DIRECT_WRITE_MEMORY_PROPERTIES = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                                                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+// Size of the largest heap backing a direct write memory type, or 0 when
+// the host can only reach device local memory through copies
+VkDeviceSize directWriteHeapSize( VkPhysicalDevice physical )
 {
   VkPhysicalDeviceMemoryProperties memprops;
   vkGetPhysicalDeviceMemoryProperties( physical, &memprops );
 
+  VkDeviceSize size = 0;
   for ( uint32_t i = 0; i < memprops.memoryTypeCount; i++ )
   {
-    if ( ( typeFilter & ( 1 << i ) ) &&
-         ( memprops.memoryTypes[i].propertyFlags & props ) == props )
+    const VkMemoryType& type = memprops.memoryTypes[i];
+    if ( ( type.propertyFlags & DIRECT_WRITE_MEMORY_PROPERTIES ) == DIRECT_WRITE_MEMORY_PROPERTIES )
+    {
+      size = std::max( size, memprops.memoryHeaps[ type.heapIndex ].size );
+    }
+  }
+
+  return size;
+}
+
+// What the host and the device do with a resource, which decides the memory
+// type it is placed in
+enum MemoryUsage
+{
+  MEMORY_USAGE_GPU_ONLY,    // Only the device reads and writes it
+  MEMORY_USAGE_UPLOAD,      // Written once by the host and read once by the device, e.g. staging
+  MEMORY_USAGE_READBACK,    // Written by the device and read by the host
+  MEMORY_USAGE_DYNAMIC,     // Rewritten by the host every frame
+  MEMORY_USAGE_DIRECT_WRITE // Written once by the host instead of staged; must be device local
+};
+
+// Flags a memory type must have, and the ones that make it better or worse
+// for a usage
+struct MemoryPolicy
+{
+  VkMemoryPropertyFlags required;
+  VkMemoryPropertyFlags preferred;
+  VkMemoryPropertyFlags avoided;
+};
+
+MemoryPolicy memoryPolicy( MemoryUsage usage )
+{
+  const VkMemoryPropertyFlags hostCoherent = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  MemoryPolicy policy = { 0, 0, 0 };
+  switch ( usage )
+  {
+  case MEMORY_USAGE_GPU_ONLY:
+    // Leave host visible device local memory to the usages that write it
+    policy.required  = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    policy.avoided   = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    break;
+  case MEMORY_USAGE_UPLOAD:
+    policy.required  = hostCoherent;
+    policy.avoided   = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    break;
+  case MEMORY_USAGE_READBACK:
+    policy.required  = hostCoherent;
+    policy.preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    break;
+  case MEMORY_USAGE_DYNAMIC:
+    policy.required  = hostCoherent;
+    policy.preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    policy.avoided   = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    break;
+  case MEMORY_USAGE_DIRECT_WRITE:
+    policy.required  = DIRECT_WRITE_MEMORY_PROPERTIES;
+    policy.avoided   = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    break;
+  }
+  return policy;
+}
+
+uint32_t countFlags( VkMemoryPropertyFlags flags )
+{
+  uint32_t count = 0;
+  for ( ; flags != 0; flags &= flags - 1 )
+  {
+    count++;
+  }
+  return count;
+}
+
+// Memory types in typeFilter with the policy's required flags, best first:
+// most preferred flags, then fewest avoided ones. Ties keep the driver's
+// order, which lists faster types first.
+std::vector<uint32_t> rankMemoryTypes( const VkPhysicalDeviceMemoryProperties& memprops,
+                                       uint32_t                                typeFilter,
+                                       const MemoryPolicy&                     policy )
+{
+  std::vector<uint32_t> ranked;
+  std::vector<int>      scores( memprops.memoryTypeCount, 0 );
+  for ( uint32_t i = 0; i < memprops.memoryTypeCount; i++ )
+  {
+    VkMemoryPropertyFlags flags = memprops.memoryTypes[i].propertyFlags;
+    if ( ( typeFilter & ( 1 << i ) ) && ( flags & policy.required ) == policy.required )
     {
-      return i;
+      scores[i] = countFlags( flags & policy.preferred ) * 32 - countFlags( flags & policy.avoided );
+      ranked.push_back( i );
     }
   }
 
-  throw std::runtime_error( "Failed to find suitable memory type!" );
+  std::stable_sort( ranked.begin(), ranked.end(), [&]( uint32_t a, uint32_t b )
+  {
+    return scores[a] > scores[b];
+  } );
+  return ranked;
+}
+
+// Budget and current usage of every heap. Without VK_EXT_memory_budget the
+// budget is the heap size and usage is unknown, so it is reported as 0.
+void queryHeapBudgets( VkInstance       instance,
+                       VkPhysicalDevice physical,
+                       bool             memoryBudgetSupported,
+                       VkDeviceSize     heapBudget[ VK_MAX_MEMORY_HEAPS ],
+                       VkDeviceSize     heapUsage[ VK_MAX_MEMORY_HEAPS ] )
+{
+  VkPhysicalDeviceMemoryProperties memprops;
+  vkGetPhysicalDeviceMemoryProperties( physical, &memprops );
+
+  for ( uint32_t i = 0; i < memprops.memoryHeapCount; i++ )
+  {
+    heapBudget[i] = memprops.memoryHeaps[i].size;
+    heapUsage[i]  = 0;
+  }
+
+#ifdef VK_EXT_MEMORY_BUDGET_EXTENSION_NAME
+  auto getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)
+    vkGetInstanceProcAddr( instance, "vkGetPhysicalDeviceMemoryProperties2KHR" );
+
+  if ( memoryBudgetSupported && getMemoryProperties2 != nullptr )
+  {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2KHR memprops2 = {};
+    memprops2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+    memprops2.pNext = &budget;
+    getMemoryProperties2( physical, &memprops2 );
+
+    for ( uint32_t i = 0; i < memprops.memoryHeapCount; i++ )
+    {
+      heapBudget[i] = budget.heapBudget[i];
+      heapUsage[i]  = budget.heapUsage[i];
+    }
+  }
+#endif
 }
 
 #endif
@@ -0,0 +1,221 @@
+#ifndef __MESHPIPELINE_HPP__
+#define __MESHPIPELINE_HPP__
+
+#include <array>
+#include <string>
+#include "base-includes.hpp"
+#include "shader.hpp"
+#include "vertex.hpp"
+#include "impostor.hpp"
+
+// Pipelines drawing mesh pages with shader.vert and the given fragment
+// shader, per-vertex data at binding 0 and InstanceData at binding 1. Both
+// share one layout; the strip pipeline draws restart-joined triangle strips.
+void createMeshPipelines( const VDeleter<VkDevice>&   device,
+                          VkRenderPass                renderPass,
+                          VkExtent2D                  extent,
+                          VkDescriptorSetLayout       descriptorSetLayout,
+                          const std::string&          fragmentShaderFile,
+                          VDeleter<VkPipelineLayout>& pipelineLayout,
+                          VDeleter<VkPipeline>&       listPipeline,
+                          VDeleter<VkPipeline>&       stripPipeline )
+{
+  auto vertexShaderCode   = readFile( "vert.spv" );
+  auto fragmentShaderCode = readFile( fragmentShaderFile );
+
+  // Create shader modules
+  VDeleter<VkShaderModule> vertexShader{device, vkDestroyShaderModule};
+  VDeleter<VkShaderModule> fragmentShader{device, vkDestroyShaderModule};
+  createShaderModule( device, vertexShaderCode, vertexShader );
+  createShaderModule( device, fragmentShaderCode, fragmentShader );
+
+  // Add to graphics pipeline
+  VkPipelineShaderStageCreateInfo vertexShaderStageInfo = {};
+  vertexShaderStageInfo.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  vertexShaderStageInfo.stage  = VK_SHADER_STAGE_VERTEX_BIT;
+  vertexShaderStageInfo.module = vertexShader;
+  vertexShaderStageInfo.pName  = "main";
+  VkPipelineShaderStageCreateInfo fragmentShaderStageInfo = {};
+  fragmentShaderStageInfo.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  fragmentShaderStageInfo.stage  = VK_SHADER_STAGE_FRAGMENT_BIT;
+  fragmentShaderStageInfo.module = fragmentShader;
+  fragmentShaderStageInfo.pName  = "main";
+
+  VkPipelineShaderStageCreateInfo shaderStages[] = {
+    vertexShaderStageInfo,
+    fragmentShaderStageInfo
+  };
+
+  // Describe the format of the input vertex and instance data
+  auto vertexAttributes   = Vertex::getAttributeDescriptions();
+  auto instanceAttributes = InstanceData::getAttributeDescriptions( 1, vertexAttributes.size() );
+
+  std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = {
+    Vertex::getBindingDescription(),
+    InstanceData::getBindingDescription( 1 )
+  };
+  std::vector<VkVertexInputAttributeDescription> attributeDescriptions( vertexAttributes.begin(),
+                                                                        vertexAttributes.end() );
+  attributeDescriptions.insert( attributeDescriptions.end(),
+                                instanceAttributes.begin(),
+                                instanceAttributes.end() );
+  
+  VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
+  vertexInputCreateInfo.sType                           = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInputCreateInfo.vertexBindingDescriptionCount   = bindingDescriptions.size();
+  vertexInputCreateInfo.pVertexBindingDescriptions      = bindingDescriptions.data();
+  vertexInputCreateInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+  vertexInputCreateInfo.pVertexAttributeDescriptions    = attributeDescriptions.data();
+
+  // Specify topology of input vertices
+  VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo = {};
+  inputAssemblyCreateInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssemblyCreateInfo.topology               = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  inputAssemblyCreateInfo.primitiveRestartEnable = VK_FALSE;
+
+  // Strip variant for meshes encoded as restart-joined triangle strips
+  VkPipelineInputAssemblyStateCreateInfo stripAssemblyCreateInfo = {};
+  stripAssemblyCreateInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  stripAssemblyCreateInfo.topology               = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+  stripAssemblyCreateInfo.primitiveRestartEnable = VK_TRUE;
+
+  // Create Viewport
+  VkViewport viewport = {};
+  viewport.x        = 0.0f;
+  viewport.y        = 0.0f;
+  viewport.width    = (float) extent.width;
+  viewport.height   = (float) extent.height;
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+
+  // Create Scissor Rectangle
+  VkRect2D scissor = {};
+  scissor.offset = {0, 0};
+  scissor.extent = extent;
+
+  // Combine Viewport and Scissor Rectangle into Viewport State
+  VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
+  viewportStateCreateInfo.sType         = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewportStateCreateInfo.viewportCount = 1;
+  viewportStateCreateInfo.pViewports    = &viewport;
+  viewportStateCreateInfo.scissorCount  = 1;
+  viewportStateCreateInfo.pScissors     = &scissor;
+
+  // Create Rasterizer
+  VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = {};
+  rasterizerCreateInfo.sType                   = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizerCreateInfo.depthClampEnable        = VK_FALSE;
+  rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;
+  rasterizerCreateInfo.polygonMode             = VK_POLYGON_MODE_FILL;
+  rasterizerCreateInfo.lineWidth               = 1.0f;
+  rasterizerCreateInfo.cullMode                = VK_CULL_MODE_BACK_BIT;
+  rasterizerCreateInfo.frontFace               = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  rasterizerCreateInfo.depthBiasEnable         = VK_FALSE;
+  rasterizerCreateInfo.depthBiasConstantFactor = 0.0f;
+  rasterizerCreateInfo.depthBiasClamp          = 0.0f;
+  rasterizerCreateInfo.depthBiasSlopeFactor    = 0.0f;
+
+  // Create Depth Testing
+  VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+  depthStencil.sType                 = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencil.depthTestEnable       = VK_TRUE;
+  depthStencil.depthWriteEnable      = VK_TRUE;
+  depthStencil.depthCompareOp        = VK_COMPARE_OP_LESS;
+  depthStencil.depthBoundsTestEnable = VK_FALSE;
+  depthStencil.minDepthBounds        = 0.0f;
+  depthStencil.maxDepthBounds        = 1.0f;
+  depthStencil.stencilTestEnable     = VK_FALSE;
+  depthStencil.front                 = {};
+  depthStencil.back                  = {};
+
+  // Create Multisampling
+  VkPipelineMultisampleStateCreateInfo multisamplingCreateInfo = {};
+  multisamplingCreateInfo.sType                 = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisamplingCreateInfo.sampleShadingEnable   = VK_FALSE;
+  multisamplingCreateInfo.rasterizationSamples  = VK_SAMPLE_COUNT_1_BIT;
+  multisamplingCreateInfo.minSampleShading      = 1.0f;
+  multisamplingCreateInfo.pSampleMask           = nullptr;
+  multisamplingCreateInfo.alphaToCoverageEnable = VK_FALSE;
+  multisamplingCreateInfo.alphaToOneEnable      = VK_FALSE;
+
+  // Configure Color Blending
+  VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+  colorBlendAttachment.colorWriteMask      = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  colorBlendAttachment.blendEnable         = VK_FALSE;
+  colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+  colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+  colorBlendAttachment.colorBlendOp        = VK_BLEND_OP_ADD;
+  colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+  colorBlendAttachment.alphaBlendOp        = VK_BLEND_OP_ADD;
+
+  // Create Color Blending for all framebuffers
+  VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo = {};
+  colorBlendCreateInfo.sType             = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlendCreateInfo.logicOpEnable     = VK_FALSE;
+  colorBlendCreateInfo.logicOp           = VK_LOGIC_OP_COPY;
+  colorBlendCreateInfo.attachmentCount   = 1;
+  colorBlendCreateInfo.pAttachments      = &colorBlendAttachment;
+  colorBlendCreateInfo.blendConstants[0] = 0.0f;
+  colorBlendCreateInfo.blendConstants[1] = 0.0f;
+  colorBlendCreateInfo.blendConstants[2] = 0.0f;
+  colorBlendCreateInfo.blendConstants[3] = 0.0f;
+
+  // Create Pipeline Layout
+  VkDescriptorSetLayout setLayouts[] = { descriptorSetLayout };
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+  pipelineLayoutCreateInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutCreateInfo.setLayoutCount         = 1;
+  pipelineLayoutCreateInfo.pSetLayouts            = setLayouts;
+  pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
+  pipelineLayoutCreateInfo.pPushConstantRanges    = 0;
+
+  if (vkCreatePipelineLayout( device, &pipelineLayoutCreateInfo, nullptr,
+                              &pipelineLayout ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create pipeline layout!" );
+  }
+
+  // Create Graphics Pipeline
+  VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
+  pipelineCreateInfo.sType               = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineCreateInfo.stageCount          = 2;
+  pipelineCreateInfo.pStages             = shaderStages;
+  pipelineCreateInfo.pVertexInputState   = &vertexInputCreateInfo;
+  pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
+  pipelineCreateInfo.pViewportState      = &viewportStateCreateInfo;
+  pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
+  pipelineCreateInfo.pMultisampleState   = &multisamplingCreateInfo;
+  pipelineCreateInfo.pDepthStencilState  = &depthStencil;
+  pipelineCreateInfo.pColorBlendState    = &colorBlendCreateInfo;
+  pipelineCreateInfo.pDynamicState       = nullptr;
+  pipelineCreateInfo.layout              = pipelineLayout;
+  pipelineCreateInfo.renderPass          = renderPass;
+  pipelineCreateInfo.subpass             = 0;
+  pipelineCreateInfo.basePipelineHandle  = VK_NULL_HANDLE;
+  pipelineCreateInfo.basePipelineIndex   = -1;
+
+  if ( vkCreateGraphicsPipelines( device,
+                                  VK_NULL_HANDLE,
+                                  1,
+                                  &pipelineCreateInfo,
+                                  nullptr,
+                                  &listPipeline ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create graphics pipeline!" );
+  }
+
+  pipelineCreateInfo.pInputAssemblyState = &stripAssemblyCreateInfo;
+
+  if ( vkCreateGraphicsPipelines( device,
+                                  VK_NULL_HANDLE,
+                                  1,
+                                  &pipelineCreateInfo,
+                                  nullptr,
+                                  &stripPipeline ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create strip graphics pipeline!" );
+  }
+}
+
+#endif
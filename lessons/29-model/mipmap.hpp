@@ -0,0 +1,359 @@
+#ifndef __MIPMAP_HPP__
+#define __MIPMAP_HPP__
+
+#include <cmath>
+#include "base-includes.hpp"
+#include "buffer.hpp"
+#include "upload.hpp"
+#include "shader.hpp"
+
+uint32_t calculateMipLevels( uint32_t width, uint32_t height )
+{
+  return (uint32_t)std::floor( std::log2( std::max( width, height ) ) ) + 1;
+}
+
+// Blitting needs linear filtering plus blit source and destination support
+bool supportsLinearBlit( VkPhysicalDevice physical, VkFormat format )
+{
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties( physical, format, &props );
+
+  VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                  VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                  VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+  return ( props.optimalTilingFeatures & required ) == required;
+}
+
+// Usage flags the texture needs so generateMipmaps can fill its levels
+VkImageUsageFlags mipmapImageUsage( VkPhysicalDevice physical, VkFormat format )
+{
+  return supportsLinearBlit( physical, format ) ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT :
+                                                  VK_IMAGE_USAGE_STORAGE_BIT;
+}
+
+static VkImageMemoryBarrier mipBarrier( VkImage       image,
+                                        uint32_t      baseLevel,
+                                        uint32_t      levelCount,
+                                        VkImageLayout oldLayout,
+                                        VkImageLayout newLayout,
+                                        VkAccessFlags srcAccess,
+                                        VkAccessFlags dstAccess,
+                                        uint32_t      layerCount = 1 )
+{
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout                       = oldLayout;
+  barrier.newLayout                       = newLayout;
+  barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image                           = image;
+  barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel   = baseLevel;
+  barrier.subresourceRange.levelCount     = levelCount;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount     = layerCount;
+  barrier.srcAccessMask                   = srcAccess;
+  barrier.dstAccessMask                   = dstAccess;
+
+  return barrier;
+}
+
+static void recordBlitMipmaps( VkCommandBuffer commandBuffer,
+                               VkImage         image,
+                               int32_t         width,
+                               int32_t         height,
+                               uint32_t        mipLevels,
+                               uint32_t        layers )
+{
+  for ( uint32_t i = 1; i < mipLevels; i++ )
+  {
+    // Previous level becomes the blit source
+    auto toSrc = mipBarrier( image, i - 1, 1,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             VK_ACCESS_TRANSFER_WRITE_BIT,
+                             VK_ACCESS_TRANSFER_READ_BIT,
+                             layers );
+    vkCmdPipelineBarrier( commandBuffer,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          0, 0, nullptr, 0, nullptr, 1, &toSrc );
+
+    int32_t nextWidth  = std::max( width / 2, 1 );
+    int32_t nextHeight = std::max( height / 2, 1 );
+
+    VkImageBlit blit = {};
+    blit.srcSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.mipLevel       = i - 1;
+    blit.srcSubresource.baseArrayLayer = 0;
+    blit.srcSubresource.layerCount     = layers;
+    blit.srcOffsets[0]                 = { 0, 0, 0 };
+    blit.srcOffsets[1]                 = { width, height, 1 };
+    blit.dstSubresource                = blit.srcSubresource;
+    blit.dstSubresource.mipLevel       = i;
+    blit.dstOffsets[0]                 = { 0, 0, 0 };
+    blit.dstOffsets[1]                 = { nextWidth, nextHeight, 1 };
+
+    vkCmdBlitImage( commandBuffer,
+                    image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    1, &blit,
+                    VK_FILTER_LINEAR );
+
+    // Previous level is final
+    auto toRead = mipBarrier( image, i - 1, 1,
+                              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                              VK_ACCESS_TRANSFER_READ_BIT,
+                              VK_ACCESS_SHADER_READ_BIT,
+                              layers );
+    vkCmdPipelineBarrier( commandBuffer,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                          0, 0, nullptr, 0, nullptr, 1, &toRead );
+
+    width  = nextWidth;
+    height = nextHeight;
+  }
+
+  // Last level was only ever written
+  auto last = mipBarrier( image, mipLevels - 1, 1,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                          VK_ACCESS_TRANSFER_WRITE_BIT,
+                          VK_ACCESS_SHADER_READ_BIT,
+                          layers );
+  vkCmdPipelineBarrier( commandBuffer,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        0, 0, nullptr, 0, nullptr, 1, &last );
+}
+
+// Compute fallback for formats without linear blit support. Each level is
+// a 2x2 box filter of the previous one, run by mipgen.comp.
+static void generateComputeMipmaps( UploadContext& upload,
+                                    VkImage        image,
+                                    VkFormat       format,
+                                    int32_t        width,
+                                    int32_t        height,
+                                    uint32_t       mipLevels,
+                                    uint32_t       layers )
+{
+  const VDeleter<VkDevice>& device = upload.device;
+
+  // Everything the recorded dispatches use is owned by the upload context
+
+  // Descriptor layout: previous level in, next level out
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+  for ( uint32_t b = 0; b < bindings.size(); b++ )
+  {
+    bindings[b].binding         = b;
+    bindings[b].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[b].descriptorCount = 1;
+    bindings[b].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = bindings.size();
+  layoutInfo.pBindings    = bindings.data();
+
+  VDeleter<VkDescriptorSetLayout>& setLayout = upload.own<VkDescriptorSetLayout>( vkDestroyDescriptorSetLayout );
+  if ( vkCreateDescriptorSetLayout( device, &layoutInfo, nullptr, &setLayout ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create mipmap descriptor set layout!" );
+  }
+
+  VkDescriptorSetLayout setLayouts[] = { setLayout };
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+  pipelineLayoutInfo.sType          = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts    = setLayouts;
+
+  VDeleter<VkPipelineLayout>& pipelineLayout = upload.own<VkPipelineLayout>( vkDestroyPipelineLayout );
+  if ( vkCreatePipelineLayout( device, &pipelineLayoutInfo, nullptr, &pipelineLayout ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create mipmap pipeline layout!" );
+  }
+
+  auto shaderCode = readFile( "mipgen-comp.spv" );
+  VDeleter<VkShaderModule> shader { device, vkDestroyShaderModule };
+  createShaderModule( device, shaderCode, shader );
+
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType        = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shader;
+  pipelineInfo.stage.pName  = "main";
+  pipelineInfo.layout       = pipelineLayout;
+
+  VDeleter<VkPipeline>& pipeline = upload.own<VkPipeline>( vkDestroyPipeline );
+  if ( vkCreateComputePipelines( device, VK_NULL_HANDLE, 1,
+                                 &pipelineInfo, nullptr, &pipeline ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create mipmap pipeline!" );
+  }
+
+  // One view per level of each layer and one set per downsample step
+  const uint32_t steps = ( mipLevels - 1 ) * layers;
+
+  VkDescriptorPoolSize poolSize = {};
+  poolSize.type            = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSize.descriptorCount = 2 * steps;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes    = &poolSize;
+  poolInfo.maxSets       = steps;
+
+  VDeleter<VkDescriptorPool>& descriptorPool = upload.own<VkDescriptorPool>( vkDestroyDescriptorPool );
+  if ( vkCreateDescriptorPool( device, &poolInfo, nullptr, &descriptorPool ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create mipmap descriptor pool!" );
+  }
+
+  std::vector<VkImageView> levelViews( mipLevels * layers );
+  for ( uint32_t v = 0; v < levelViews.size(); v++ )
+  {
+    VDeleter<VkImageView>& levelView = upload.own<VkImageView>( vkDestroyImageView );
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image                           = image;
+    viewInfo.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format                          = format;
+    viewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel   = v % mipLevels;
+    viewInfo.subresourceRange.levelCount     = 1;
+    viewInfo.subresourceRange.baseArrayLayer = v / mipLevels;
+    viewInfo.subresourceRange.layerCount     = 1;
+
+    if ( vkCreateImageView( device, &viewInfo, nullptr, &levelView ) != VK_SUCCESS )
+    {
+      throw std::runtime_error( "Failed to create mipmap level view!" );
+    }
+    levelViews[v] = levelView;
+  }
+
+  std::vector<VkDescriptorSetLayout> stepLayouts( steps, setLayout );
+  std::vector<VkDescriptorSet>       sets( steps );
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool     = descriptorPool;
+  allocInfo.descriptorSetCount = sets.size();
+  allocInfo.pSetLayouts        = stepLayouts.data();
+
+  if ( vkAllocateDescriptorSets( device, &allocInfo, sets.data() ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to allocate mipmap descriptor sets!" );
+  }
+
+  // Step i - 1 of a layer reads level i - 1 and writes level i
+  for ( uint32_t s = 0; s < steps; s++ )
+  {
+    uint32_t layer = s / ( mipLevels - 1 );
+    uint32_t i     = s % ( mipLevels - 1 ) + 1;
+
+    std::array<VkDescriptorImageInfo, 2> imageInfos = {};
+    imageInfos[0].imageView   = levelViews[ layer * mipLevels + i - 1 ];
+    imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfos[1].imageView   = levelViews[ layer * mipLevels + i ];
+    imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    std::array<VkWriteDescriptorSet, 2> writes = {};
+    for ( uint32_t b = 0; b < writes.size(); b++ )
+    {
+      writes[b].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[b].dstSet          = sets[s];
+      writes[b].dstBinding      = b;
+      writes[b].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      writes[b].descriptorCount = 1;
+      writes[b].pImageInfo      = &imageInfos[b];
+    }
+
+    vkUpdateDescriptorSets( device, writes.size(), writes.data(), 0, nullptr );
+  }
+
+  VkCommandBuffer commandBuffer = upload.commandBuffer;
+
+  // All levels go to GENERAL; level 0 holds the uploaded image
+  auto toGeneral = mipBarrier( image, 0, mipLevels,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               VK_IMAGE_LAYOUT_GENERAL,
+                               VK_ACCESS_TRANSFER_WRITE_BIT,
+                               VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                               layers );
+  vkCmdPipelineBarrier( commandBuffer,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        0, 0, nullptr, 0, nullptr, 1, &toGeneral );
+
+  vkCmdBindPipeline( commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline );
+
+  for ( uint32_t i = 1; i < mipLevels; i++ )
+  {
+    width  = std::max( width / 2, 1 );
+    height = std::max( height / 2, 1 );
+
+    for ( uint32_t layer = 0; layer < layers; layer++ )
+    {
+      vkCmdBindDescriptorSets( commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                               pipelineLayout, 0, 1, &sets[ layer * ( mipLevels - 1 ) + i - 1 ], 0, nullptr );
+      vkCmdDispatch( commandBuffer, ( width + 7 ) / 8, ( height + 7 ) / 8, 1 );
+    }
+
+    // Level i is read by the next step
+    auto written = mipBarrier( image, i, 1,
+                               VK_IMAGE_LAYOUT_GENERAL,
+                               VK_IMAGE_LAYOUT_GENERAL,
+                               VK_ACCESS_SHADER_WRITE_BIT,
+                               VK_ACCESS_SHADER_READ_BIT,
+                               layers );
+    vkCmdPipelineBarrier( commandBuffer,
+                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                          0, 0, nullptr, 0, nullptr, 1, &written );
+  }
+
+  auto toRead = mipBarrier( image, 0, mipLevels,
+                            VK_IMAGE_LAYOUT_GENERAL,
+                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                            VK_ACCESS_SHADER_WRITE_BIT,
+                            VK_ACCESS_SHADER_READ_BIT,
+                            layers );
+  vkCmdPipelineBarrier( commandBuffer,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        0, 0, nullptr, 0, nullptr, 1, &toRead );
+}
+
+// Record filling levels 1..mipLevels-1 of every one of layers array layers
+// from its level 0, which must be in TRANSFER_DST_OPTIMAL along with every
+// other level. Leaves the whole chain in SHADER_READ_ONLY_OPTIMAL. Uses vkCmdBlitImage when the format
+// supports linear blits and falls back to a compute downsample otherwise.
+void generateMipmaps( VkPhysicalDevice physical,
+                      UploadContext&   upload,
+                      VkImage          image,
+                      VkFormat         format,
+                      int32_t          width,
+                      int32_t          height,
+                      uint32_t         mipLevels,
+                      uint32_t         layers = 1 )
+{
+  if ( !supportsLinearBlit( physical, format ) )
+  {
+    if ( mipLevels > 1 )
+    {
+      generateComputeMipmaps( upload, image, format, width, height, mipLevels, layers );
+      return;
+    }
+  }
+
+  recordBlitMipmaps( upload.commandBuffer, image, width, height, mipLevels, layers );
+}
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef __RESIDENCY_HPP__
+#define __RESIDENCY_HPP__
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include "base-includes.hpp"
+
+struct ResidencyMetrics
+{
+  VkDeviceSize residentBytes = 0;
+  uint32_t     downgrades    = 0; // Finest level dropped under pressure
+  uint32_t     evictions     = 0; // Dropped to the coarsest level
+  uint32_t     reuploads     = 0; // Restored after a downgrade or eviction
+  uint32_t     trims         = 0; // Dropped levels no pixel asked for
+};
+
+// Keeps textures within a byte budget by least recently used order.
+// Textures report which frames draw with them; under pressure the ones
+// used longest ago lose their finest level, and textures unused for
+// evictAfterFrames keep only their coarsest level. A texture that is drawn
+// again is brought back to its full level when it fits. With demand from
+// mip feedback, levels finer than any pixel needs are dropped as well and
+// a texture only comes back as far as its demand. Changes are applied
+// through each texture's setBaseLevel callback, which is responsible for
+// retiring the replaced objects safely.
+class TextureResidency
+{
+public:
+  uint64_t evictAfterFrames = 600;
+
+  // levelSizes is the full chain; fullLevel is the finest level it should
+  // normally keep, e.g. from planTextureBudget. Textures without a
+  // callback are pinned at fullLevel.
+  uint32_t add( const std::string&                   name,
+                const std::vector<VkDeviceSize>&     levelSizes,
+                uint32_t                             fullLevel,
+                std::function<void( uint32_t )>      setBaseLevel )
+  {
+    Entry entry;
+    entry.name         = name;
+    entry.levelSizes   = levelSizes;
+    entry.fullLevel    = fullLevel;
+    entry.baseLevel    = fullLevel;
+    entry.setBaseLevel = setBaseLevel;
+    this->entries.push_back( entry );
+    return this->entries.size() - 1;
+  }
+
+  // Recorded draws in frame sample the texture
+  void use( uint32_t texture, uint64_t frame )
+  {
+    this->entries[texture].lastUsed = frame;
+  }
+
+  // Finest level the texture's pixels asked for, e.g. from TextureFeedback
+  void demand( uint32_t texture, uint32_t level )
+  {
+    Entry& entry = this->entries[texture];
+    entry.demandLevel = std::min<uint32_t>( level, entry.levelSizes.size() - 1 );
+  }
+
+  VkDeviceSize residentBytes() const
+  {
+    VkDeviceSize bytes = 0;
+    for ( const auto& entry : this->entries )
+    {
+      bytes += this->bytesFrom( entry, entry.baseLevel );
+    }
+    return bytes;
+  }
+
+  ResidencyMetrics metrics() const
+  {
+    ResidencyMetrics metrics = this->counters;
+    metrics.residentBytes = this->residentBytes();
+    return metrics;
+  }
+
+  // Apply one round of residency changes for frame within budget bytes.
+  // Every texture whose level changed gets a single setBaseLevel call.
+  // Returns true if any did.
+  bool update( uint64_t frame, VkDeviceSize budget )
+  {
+    for ( auto& entry : this->entries )
+    {
+      entry.targetLevel = entry.baseLevel;
+    }
+
+    // Long unused textures give up everything but their coarsest level
+    for ( auto& entry : this->entries )
+    {
+      uint32_t coarsest = entry.levelSizes.size() - 1;
+      if ( entry.setBaseLevel && entry.targetLevel < coarsest &&
+           frame > entry.lastUsed + this->evictAfterFrames )
+      {
+        entry.targetLevel = coarsest;
+        this->counters.evictions++;
+      }
+    }
+
+    // Nothing samples levels finer than the demand
+    for ( auto& entry : this->entries )
+    {
+      if ( entry.setBaseLevel && entry.targetLevel < this->wantedLevel( entry ) )
+      {
+        entry.targetLevel = this->wantedLevel( entry );
+        this->counters.trims++;
+      }
+    }
+
+    // Textures drawn again come back if there is room, freeing it from the
+    // least recently used ones when needed
+    for ( auto& entry : this->entries )
+    {
+      if ( !entry.setBaseLevel || entry.targetLevel <= this->wantedLevel( entry ) || entry.lastUsed != frame )
+      {
+        continue;
+      }
+
+      std::vector<uint32_t> targets;
+      for ( const auto& other : this->entries )
+      {
+        targets.push_back( other.targetLevel );
+      }
+      uint32_t downgrades = this->counters.downgrades;
+
+      VkDeviceSize extra = this->bytesFrom( entry, this->wantedLevel( entry ) ) -
+                           this->bytesFrom( entry, entry.targetLevel );
+      if ( this->makeRoom( frame, budget, extra ) )
+      {
+        entry.targetLevel = this->wantedLevel( entry );
+        this->counters.reuploads++;
+        continue;
+      }
+
+      // Does not fit; leave everything else as it was
+      for ( size_t i = 0; i < targets.size(); i++ )
+      {
+        this->entries[i].targetLevel = targets[i];
+      }
+      this->counters.downgrades = downgrades;
+    }
+
+    // Stay within the budget even if nothing wants to come back
+    this->makeRoom( frame, budget, 0 );
+
+    bool changed = false;
+    for ( auto& entry : this->entries )
+    {
+      if ( entry.targetLevel != entry.baseLevel )
+      {
+        entry.baseLevel = entry.targetLevel;
+        entry.setBaseLevel( entry.baseLevel );
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+private:
+  struct Entry
+  {
+    std::string                     name;
+    std::vector<VkDeviceSize>       levelSizes;
+    uint32_t                        fullLevel;
+    uint32_t                        baseLevel;
+    uint32_t                        targetLevel;
+    uint64_t                        lastUsed    = 0;
+    uint32_t                        demandLevel = 0;
+    std::function<void( uint32_t )> setBaseLevel;
+  };
+
+  std::vector<Entry> entries;
+  ResidencyMetrics   counters;
+
+  // Finest level worth keeping
+  uint32_t wantedLevel( const Entry& entry ) const
+  {
+    return std::max( entry.fullLevel, entry.demandLevel );
+  }
+
+  VkDeviceSize bytesFrom( const Entry& entry, uint32_t level ) const
+  {
+    VkDeviceSize bytes = 0;
+    for ( size_t i = level; i < entry.levelSizes.size(); i++ )
+    {
+      bytes += entry.levelSizes[i];
+    }
+    return bytes;
+  }
+
+  VkDeviceSize targetBytes() const
+  {
+    VkDeviceSize bytes = 0;
+    for ( const auto& entry : this->entries )
+    {
+      bytes += this->bytesFrom( entry, entry.targetLevel );
+    }
+    return bytes;
+  }
+
+  // Lower the target of textures not drawn in frame, least recently used
+  // first, until extra more bytes fit. Returns false if that is impossible.
+  bool makeRoom( uint64_t frame, VkDeviceSize budget, VkDeviceSize extra )
+  {
+    while ( this->targetBytes() + extra > budget )
+    {
+      Entry* victim = nullptr;
+      for ( auto& entry : this->entries )
+      {
+        if ( entry.setBaseLevel && entry.lastUsed != frame &&
+             entry.targetLevel + 1 < entry.levelSizes.size() &&
+             ( !victim || entry.lastUsed < victim->lastUsed ) )
+        {
+          victim = &entry;
+        }
+      }
+
+      if ( !victim )
+      {
+        return false;
+      }
+
+      victim->targetLevel++;
+      this->counters.downgrades++;
+    }
+
+    return true;
+  }
+};
+
+#endif
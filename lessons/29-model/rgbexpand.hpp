@@ -0,0 +1,58 @@
+#ifndef __RGBEXPAND_HPP__
+#define __RGBEXPAND_HPP__
+
+#include "base-includes.hpp"
+#include "buffer.hpp"
+#include "computefill.hpp"
+#include "upload.hpp"
+
+// Opaque textures are staged as RGB8 and widened to RGBA8 by rgbexpand.comp
+// on the device, so the padding byte never crosses host memory or the bus.
+
+// Rows start on a word boundary; the shader handles any width
+uint32_t rgbRowPitch( uint32_t width )
+{
+  return ( width * 3 + 3 ) & ~3u;
+}
+
+// Host visible buffer the expand shader can read as a storage buffer
+VkBuffer createRGBStagingBuffer( VkPhysicalDevice physical,
+                                 UploadContext&   upload,
+                                 uint32_t         width,
+                                 uint32_t         height,
+                                 void**           data )
+{
+  VkDeviceSize size = (VkDeviceSize)rgbRowPitch( width ) * height;
+
+  VDeleter<VkBuffer>& buffer = upload.own<VkBuffer>( vkDestroyBuffer );
+  MemoryAllocation&   memory = upload.ownMemory( MEMORY_CATEGORY_STAGING, "RGB expansion source" );
+  createBuffer( upload.device,
+                physical,
+                size,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                MEMORY_USAGE_UPLOAD,
+                buffer,
+                memory );
+  *data = memory.map();
+
+  upload.stagedBytes += size;
+  return buffer;
+}
+
+// Record writing the RGB8 rows in buffer to level 0 of image, which needs
+// STORAGE usage. Leaves all mipLevels levels in TRANSFER_DST_OPTIMAL, the
+// same as copyBufferToImage, so generateMipmaps can follow.
+void expandRGBToRGBA( UploadContext& upload,
+                      VkBuffer       buffer,
+                      VkImage        image,
+                      uint32_t       width,
+                      uint32_t       height,
+                      uint32_t       mipLevels )
+{
+  uint32_t rowPitch = rgbRowPitch( width );
+  fillLevelZeroCompute( upload, "rgbexpand-comp.spv", buffer, image,
+                        &rowPitch, sizeof( rowPitch ),
+                        ( width + 7 ) / 8, ( height + 7 ) / 8, mipLevels );
+}
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef __SAMPLER_HPP__
+#define __SAMPLER_HPP__
+
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+#include "base-includes.hpp"
+#include "deleter.hpp"
+
+class SamplerCache;
+
+// Shared reference to a cached sampler. Copies add a reference and the
+// sampler is destroyed once the last one goes away.
+class SamplerHandle
+{
+public:
+  SamplerHandle() {}
+  SamplerHandle( SamplerCache* cache, VkSampler sampler );
+  SamplerHandle( const SamplerHandle& other );
+  SamplerHandle& operator=( const SamplerHandle& other );
+  ~SamplerHandle();
+
+  operator VkSampler() const
+  {
+    return this->sampler;
+  }
+
+  // For VkDescriptorSetLayoutBinding::pImmutableSamplers
+  const VkSampler* get() const
+  {
+    return &this->sampler;
+  }
+
+private:
+  SamplerCache* cache   = nullptr;
+  VkSampler     sampler = VK_NULL_HANDLE;
+};
+
+struct SamplerKey
+{
+  VkSamplerCreateInfo info;
+
+  bool operator==( const SamplerKey& other ) const
+  {
+    const VkSamplerCreateInfo& a = this->info;
+    const VkSamplerCreateInfo& b = other.info;
+    return a.flags                   == b.flags &&
+           a.magFilter               == b.magFilter &&
+           a.minFilter               == b.minFilter &&
+           a.mipmapMode              == b.mipmapMode &&
+           a.addressModeU            == b.addressModeU &&
+           a.addressModeV            == b.addressModeV &&
+           a.addressModeW            == b.addressModeW &&
+           a.mipLodBias              == b.mipLodBias &&
+           a.anisotropyEnable        == b.anisotropyEnable &&
+           a.maxAnisotropy           == b.maxAnisotropy &&
+           a.compareEnable           == b.compareEnable &&
+           a.compareOp               == b.compareOp &&
+           a.minLod                  == b.minLod &&
+           a.maxLod                  == b.maxLod &&
+           a.borderColor             == b.borderColor &&
+           a.unnormalizedCoordinates == b.unnormalizedCoordinates;
+  }
+};
+
+struct SamplerKeyHash
+{
+  size_t operator()( const SamplerKey& key ) const
+  {
+    const VkSamplerCreateInfo& info = key.info;
+
+    size_t hash = 0;
+    auto combine = [&hash]( uint32_t value )
+    {
+      hash ^= std::hash<uint32_t>()( value ) + 0x9e3779b9 + ( hash << 6 ) + ( hash >> 2 );
+    };
+    auto combineFloat = [&combine]( float value )
+    {
+      uint32_t bits;
+      std::memcpy( &bits, &value, sizeof( bits ) );
+      combine( value == 0.0f ? 0 : bits ); // -0.0 == 0.0
+    };
+
+    combine( info.flags );
+    combine( info.magFilter );
+    combine( info.minFilter );
+    combine( info.mipmapMode );
+    combine( info.addressModeU );
+    combine( info.addressModeV );
+    combine( info.addressModeW );
+    combineFloat( info.mipLodBias );
+    combine( info.anisotropyEnable );
+    combineFloat( info.maxAnisotropy );
+    combine( info.compareEnable );
+    combine( info.compareOp );
+    combineFloat( info.minLod );
+    combineFloat( info.maxLod );
+    combine( info.borderColor );
+    combine( info.unnormalizedCoordinates );
+    return hash;
+  }
+};
+
+// Samplers deduplicated by their create info. Materials only use a handful
+// of distinct configurations while drivers cap the number of live samplers
+// at maxSamplerAllocationCount.
+class SamplerCache
+{
+public:
+  SamplerCache( const VDeleter<VkDevice>& device )
+    : device { device }
+  {
+  }
+
+  ~SamplerCache()
+  {
+    for ( const auto& entry : this->samplers )
+    {
+      vkDestroySampler( this->device, entry.second.sampler, nullptr );
+    }
+  }
+
+  // Set from VkPhysicalDeviceLimits::maxSamplerAllocationCount
+  uint32_t maxSamplers = std::numeric_limits<uint32_t>::max();
+
+  SamplerHandle get( const VkSamplerCreateInfo& info )
+  {
+    if ( info.pNext != nullptr )
+    {
+      throw std::invalid_argument( "Sampler cache does not support extension structures!" );
+    }
+
+    SamplerKey key;
+    key.info = info;
+
+    auto found = this->samplers.find( key );
+    if ( found != this->samplers.end() )
+    {
+      return SamplerHandle( this, found->second.sampler );
+    }
+
+    if ( this->samplers.size() >= this->maxSamplers )
+    {
+      throw std::runtime_error( "Too many distinct samplers!" );
+    }
+
+    Entry entry;
+    if ( vkCreateSampler( this->device, &info, nullptr, &entry.sampler ) != VK_SUCCESS )
+    {
+      throw std::runtime_error( "Failed to create texture sampler!" );
+    }
+
+    this->samplers[key]       = entry;
+    this->keys[entry.sampler] = key;
+    return SamplerHandle( this, entry.sampler );
+  }
+
+  size_t size() const
+  {
+    return this->samplers.size();
+  }
+
+private:
+  friend class SamplerHandle;
+
+  struct Entry
+  {
+    VkSampler sampler    = VK_NULL_HANDLE;
+    uint32_t  references = 0;
+  };
+
+  const VDeleter<VkDevice>&                             device;
+  std::unordered_map<SamplerKey, Entry, SamplerKeyHash> samplers;
+  std::unordered_map<VkSampler, SamplerKey>             keys;
+
+  void addReference( VkSampler sampler )
+  {
+    this->samplers[ this->keys.at( sampler ) ].references++;
+  }
+
+  void release( VkSampler sampler )
+  {
+    auto key   = this->keys.find( sampler );
+    auto found = this->samplers.find( key->second );
+    if ( --found->second.references == 0 )
+    {
+      vkDestroySampler( this->device, sampler, nullptr );
+      this->samplers.erase( found );
+      this->keys.erase( key );
+    }
+  }
+};
+
+inline SamplerHandle::SamplerHandle( SamplerCache* cache, VkSampler sampler )
+  : cache { cache },
+    sampler { sampler }
+{
+  this->cache->addReference( sampler );
+}
+
+inline SamplerHandle::SamplerHandle( const SamplerHandle& other )
+  : cache { other.cache },
+    sampler { other.sampler }
+{
+  if ( this->cache )
+  {
+    this->cache->addReference( this->sampler );
+  }
+}
+
+inline SamplerHandle& SamplerHandle::operator=( const SamplerHandle& other )
+{
+  if ( other.cache )
+  {
+    other.cache->addReference( other.sampler );
+  }
+  if ( this->cache )
+  {
+    this->cache->release( this->sampler );
+  }
+
+  this->cache   = other.cache;
+  this->sampler = other.sampler;
+  return *this;
+}
+
+inline SamplerHandle::~SamplerHandle()
+{
+  if ( this->cache )
+  {
+    this->cache->release( this->sampler );
+  }
+}
+
+#endif
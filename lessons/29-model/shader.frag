@@ -1,14 +1,52 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
 
-layout(binding = 1) uniform sampler2D texSampler;
+// Compiled as frag.spv, and with TEXTURE_FEEDBACK defined as
+// feedback-frag.spv, which also writes texture mip feedback
+
+layout(binding = 1) uniform sampler2DArray texSampler;
+
+#ifdef TEXTURE_FEEDBACK
+// Mip feedback, see feedback.hpp. params holds the sample pixel within each
+// tile, the tile column count and the tile size.
+layout(binding = 2) buffer Feedback
+{
+  uvec4 params;
+  uint  tiles[];
+} feedback;
+#endif
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in float fragVisibility;
+layout(location = 3) flat in float fragTextureLayer;
 
 layout(location = 0) out vec4 outColor;
 
+#include "dither.glsl"
+
 void main() {
   //outColor = vec4(fragColor, 1.0);
-  outColor = texture(texSampler, fragTexCoord);
+  outColor = texture(texSampler, vec3(fragTexCoord, fragTextureLayer));
+#ifdef TEXTURE_FEEDBACK
+  float lod = textureQueryLod(texSampler, fragTexCoord).y;
+#endif
+
+  // Cross-fade towards the impostor, after sampling
+  if (fragVisibility < ditherThreshold(gl_FragCoord.xy))
+  {
+    discard;
+  }
+
+#ifdef TEXTURE_FEEDBACK
+  // Occluded fragments write too, so demand errs on the fine side
+  uvec2 p = uvec2(gl_FragCoord.xy);
+  if (all(equal(p % feedback.params.w, feedback.params.xy)))
+  {
+    uint level = uint(clamp(lod, 0.0, 254.0)) + 1u;
+    feedback.tiles[(p.y / feedback.params.w) * feedback.params.z + p.x / feedback.params.w] =
+      (uint(fragTextureLayer) << 8) | level;
+  }
+#endif
 }
@@ -16,13 +16,23 @@ layout(binding = 0) uniform UniformBufferObject
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in float inTextureLayer;
+layout(location = 4) in vec4 instOffsetScale;
+layout(location = 5) in vec4 instParams;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out float fragVisibility;
+layout(location = 3) flat out float fragTextureLayer;
 
 void main()
 {
-  gl_Position  = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-  fragColor    = inColor;
-  fragTexCoord = inTexCoord;
+  vec4 worldPos = ubo.model * vec4(inPosition * instOffsetScale.w, 1.0) +
+                  vec4(instOffsetScale.xyz, 0.0);
+
+  gl_Position      = ubo.proj * ubo.view * worldPos;
+  fragColor        = inColor;
+  fragTexCoord     = inTexCoord;
+  fragVisibility   = instParams.x;
+  fragTextureLayer = inTextureLayer;
 }
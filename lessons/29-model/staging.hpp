@@ -0,0 +1,170 @@
+#ifndef __STAGING_HPP__
+#define __STAGING_HPP__
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include "base-includes.hpp"
+#include "deleter.hpp"
+#include "buffer.hpp"
+
+// Range of the staging ring the host writes and one submission copies from
+struct StagingRange
+{
+  VkBuffer     buffer = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size   = 0;
+  void*        data   = nullptr;
+};
+
+// One persistently mapped host visible buffer that every staged upload
+// takes its source ranges from, so staging never allocates Vulkan memory.
+// Ranges are handed out in order around the ring and released once the
+// submission that read them has retired; space is reclaimed from the
+// oldest range on, so releasing out of order only delays reuse. Safe to
+// use from several threads.
+class StagingRing
+{
+public:
+  StagingRing( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : buffer { device, vkDestroyBuffer },
+      memory { allocator, MEMORY_CATEGORY_STAGING, "staging ring" },
+      device { device }
+  {
+  }
+
+  VDeleter<VkBuffer> buffer;
+  MemoryAllocation   memory;
+
+  void create( VkPhysicalDevice physical, VkDeviceSize size )
+  {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties( physical, &properties );
+
+    // Enough for buffer copies and for image copies of any texel block
+    this->alignment = std::max<VkDeviceSize>( properties.limits.optimalBufferCopyOffsetAlignment, 16 );
+    this->size      = size / this->alignment * this->alignment;
+
+    createBuffer( this->device,
+                  physical,
+                  this->size,
+                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                  MEMORY_USAGE_UPLOAD,
+                  this->buffer,
+                  this->memory );
+    this->data = (uint8_t*)this->memory.map();
+  }
+
+  VkDeviceSize capacity() const
+  {
+    return this->size;
+  }
+
+  // A range of exactly size bytes. Returns false if the ring has no room
+  // for it until earlier ranges are released.
+  bool allocate( VkDeviceSize size, StagingRange& range )
+  {
+    return this->allocateUpTo( size, size, range );
+  }
+
+  // The largest range the ring has room for, of at most size bytes and a
+  // multiple of granularity unless it is size itself. Returns false if not
+  // even granularity bytes fit.
+  bool allocateUpTo( VkDeviceSize size, VkDeviceSize granularity, StagingRange& range )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+
+    if ( this->entries.empty() )
+    {
+      this->head = 0;
+    }
+
+    // Free space is [head, end) and [0, tail), or [head, tail) once the
+    // newest ranges have wrapped around to the start
+    VkDeviceSize tail    = this->entries.empty() ? 0 : this->entries.front().start;
+    bool         wrapped = !this->entries.empty() && this->head <= tail;
+    VkDeviceSize start   = this->head;
+    VkDeviceSize room    = wrapped ? tail - start : this->size - start;
+    if ( room < granularity && !wrapped && tail > room )
+    {
+      start = 0;
+      room  = tail;
+    }
+
+    VkDeviceSize taken = room >= size ? size : room / granularity * granularity;
+    if ( taken == 0 )
+    {
+      return false;
+    }
+
+    range.buffer = this->buffer;
+    range.offset = start;
+    range.size   = taken;
+    range.data   = this->data + start;
+
+    this->head = this->align( start + taken );
+    this->entries.push_back( Entry { start, false } );
+    this->peak = std::max( this->peak, this->usedBytes() );
+    return true;
+  }
+
+  void release( const StagingRange& range )
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+
+    for ( auto& entry : this->entries )
+    {
+      if ( entry.start == range.offset && !entry.released )
+      {
+        entry.released = true;
+        break;
+      }
+    }
+    while ( !this->entries.empty() && this->entries.front().released )
+    {
+      this->entries.pop_front();
+    }
+  }
+
+  // Most bytes held at once
+  VkDeviceSize peakBytes()
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    return this->peak;
+  }
+
+private:
+  struct Entry
+  {
+    VkDeviceSize start;
+    bool         released;
+  };
+
+  const VDeleter<VkDevice>& device;
+  std::mutex                mutex;
+  uint8_t*                  data      = nullptr;
+  VkDeviceSize              size      = 0;
+  VkDeviceSize              alignment = 16;
+  VkDeviceSize              head      = 0; // Where the next range starts
+  std::deque<Entry>         entries;       // Live ranges, oldest first
+  VkDeviceSize              peak      = 0;
+
+  VkDeviceSize align( VkDeviceSize offset ) const
+  {
+    return std::min( ( offset + this->alignment - 1 ) / this->alignment * this->alignment, this->size );
+  }
+
+  // From the oldest live range to head, around the end if need be
+  VkDeviceSize usedBytes() const
+  {
+    if ( this->entries.empty() )
+    {
+      return 0;
+    }
+    VkDeviceSize tail = this->entries.front().start;
+    return this->head > tail ? this->head - tail : this->size - tail + this->head;
+  }
+};
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef __STREAMING_HPP__
+#define __STREAMING_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "base-includes.hpp"
+#include "deleter.hpp"
+#include "buffer.hpp"
+#include "texture.hpp"
+#include "texcook.hpp"
+#include "hostimport.hpp"
+#include "staging.hpp"
+#include "upload.hpp"
+
+// One mip level read from disk into a range of the staging ring or its own
+// staging buffer, or imported from a mapping of the file
+struct StreamedLevel
+{
+  uint32_t                                  level;
+  StagingRange                              staged;
+  std::shared_ptr<void>                     stagedHold; // Returns staged to the ring
+  std::shared_ptr<VDeleter<VkBuffer>>       buffer;
+  std::shared_ptr<MemoryAllocation>         memory;
+  std::shared_ptr<HostImportedRange>        imported;
+};
+
+// Streams the finer mip levels of a cooked texture in after the coarse tail
+// is already resident. A background thread reads one level at a time from
+// disk, finest last, straight into mapped staging memory. The render thread
+// records and submits the copy, and residentLevel drops once its fence has
+// signalled, so only levels that are fully uploaded are ever sampled.
+struct TextureStreamer
+{
+  TextureStreamer( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : device { device },
+      upload { device, allocator }
+  {
+  }
+
+  ~TextureStreamer()
+  {
+    this->stop();
+  }
+
+  // Finest mip level with valid contents; texture views start at it
+  uint32_t residentLevel = 0;
+
+  // Read levels that fit into ring instead of staging buffers of their own
+  void useStagingRing( StagingRing& ring )
+  {
+    this->ring = &ring;
+    this->upload.useStagingRing( ring, VK_NULL_HANDLE );
+  }
+
+  // Stream levels [0, residentLevel) of the cooked file at path into image,
+  // importing them through importer when it can. Every level of image must
+  // already be in SHADER_READ_ONLY_OPTIMAL.
+  void start( VkPhysicalDevice     physical,
+              const HostImporter&  importer,
+              const std::string&   path,
+              const CookedTexture& cooked,
+              VkImage              image,
+              uint32_t             residentLevel )
+  {
+    this->stop();
+
+    this->image         = image;
+    this->cooked        = cooked;
+    this->residentLevel = residentLevel;
+    this->stopping      = false;
+    this->error         = nullptr;
+
+    if ( residentLevel == 0 )
+    {
+      return;
+    }
+
+    this->finished = false;
+    this->thread   = std::thread( [this, physical, &importer, path, residentLevel]()
+    {
+      struct Finish
+      {
+        std::atomic<bool>& finished;
+        ~Finish() { this->finished = true; }
+      } finish { this->finished };
+
+      try
+      {
+        for ( uint32_t level = residentLevel; level-- > 0; )
+        {
+          std::unique_ptr<StreamedLevel> streamed( new StreamedLevel );
+          streamed->level    = level;
+          streamed->imported = importer.import( path,
+                                                this->cooked.dataOffset + this->cooked.levels[level].offset,
+                                                this->cooked.levels[level].size );
+          VkDeviceSize size = this->cooked.levels[level].size;
+          if ( !streamed->imported && this->stageFromRing( size, *streamed ) )
+          {
+            if ( !readCookedLevels( path, this->cooked, level, 1, (char*)streamed->staged.data ) )
+            {
+              throw std::runtime_error( "Failed to stream cooked texture level!" );
+            }
+          }
+          else if ( !streamed->imported )
+          {
+            streamed->buffer = std::make_shared<VDeleter<VkBuffer>>( this->device, vkDestroyBuffer );
+            streamed->memory = std::make_shared<MemoryAllocation>( this->upload.allocator,
+                                                                  MEMORY_CATEGORY_STAGING,
+                                                                  "streamed texture level" );
+
+            createBuffer( this->device,
+                          physical,
+                          size,
+                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          MEMORY_USAGE_UPLOAD,
+                          *streamed->buffer,
+                          *streamed->memory );
+
+            void* data = streamed->memory->map();
+            if ( !readCookedLevels( path, this->cooked, level, 1, (char*)data ) )
+            {
+              throw std::runtime_error( "Failed to stream cooked texture level!" );
+            }
+          }
+
+          // Stay at most one level ahead of the render thread
+          std::unique_lock<std::mutex> lock( this->mutex );
+          this->condition.wait( lock, [this]() { return !this->ready || this->stopping; } );
+          if ( this->stopping )
+          {
+            return;
+          }
+          this->ready = std::move( streamed );
+        }
+      }
+      catch ( ... )
+      {
+        std::lock_guard<std::mutex> lock( this->mutex );
+        this->error = std::current_exception();
+      }
+    } );
+  }
+
+  // Called once per frame on the render thread. Submits the copy for the
+  // next level read from disk and returns true when a level has become
+  // resident, in which case residentLevel has been lowered.
+  bool update( VkQueue queue, VkCommandPool commandPool )
+  {
+    if ( this->upload.pending )
+    {
+      if ( !this->upload.poll() )
+      {
+        return false;
+      }
+
+      this->residentLevel = this->uploadingLevel;
+      return true;
+    }
+
+    std::unique_ptr<StreamedLevel> streamed;
+    {
+      std::lock_guard<std::mutex> lock( this->mutex );
+      if ( this->error )
+      {
+        std::rethrow_exception( this->error );
+      }
+      if ( this->stopping )
+      {
+        return false;
+      }
+      streamed = std::move( this->ready );
+    }
+
+    if ( !streamed )
+    {
+      return false;
+    }
+    this->condition.notify_one();
+
+    const CookedMipLevel& level = this->cooked.levels[ streamed->level ];
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset                    = streamed->imported ? streamed->imported->offset : streamed->staged.offset;
+    region.bufferRowLength                 = 0; // Tightly packed
+    region.bufferImageHeight               = 0;
+    region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel       = streamed->level;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount     = 1;
+    region.imageOffset                     = { 0, 0, 0 };
+    region.imageExtent                     = { level.width, level.height, 1 };
+
+    // The level is outside the texture view, so frames in flight never
+    // read it while it is being replaced
+    this->upload.begin( commandPool );
+    VkBuffer source = streamed->imported   ? (VkBuffer)streamed->imported->buffer
+                    : streamed->stagedHold ? streamed->staged.buffer
+                                           : (VkBuffer)*streamed->buffer;
+    copyBufferToImage( this->upload,
+                       source,
+                       this->image,
+                       streamed->level,
+                       1,
+                       1,
+                       { region },
+                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL );
+    if ( streamed->imported )
+    {
+      this->upload.owned.push_back( streamed->imported );
+      this->upload.stats.importedBytes += level.size;
+    }
+    else
+    {
+      this->upload.owned.push_back( streamed->stagedHold );
+      this->upload.owned.push_back( streamed->buffer );
+      this->upload.owned.push_back( streamed->memory );
+      this->upload.stagedBytes += level.size;
+    }
+    this->upload.submit( queue );
+
+    this->uploadingLevel = streamed->level;
+    return false;
+  }
+
+  // Totals of every level streamed so far
+  const UploadStats& uploadStats() const
+  {
+    return this->upload.stats;
+  }
+
+  // Ask the worker to stop without waiting for it. Levels already uploaded
+  // stay resident; no further copies are submitted.
+  void cancel()
+  {
+    {
+      std::lock_guard<std::mutex> lock( this->mutex );
+      this->stopping = true;
+    }
+    this->condition.notify_one();
+  }
+
+  // True once the worker has exited and the last copy has finished, after
+  // which the image may be replaced without stop() blocking. Polls the copy
+  // like update() but leaves residentLevel alone.
+  bool idle()
+  {
+    if ( this->thread.joinable() && !this->finished )
+    {
+      return false;
+    }
+    if ( !this->upload.poll() )
+    {
+      return false;
+    }
+
+    this->stop();
+    return true;
+  }
+
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock( this->mutex );
+      this->stopping = true;
+    }
+    this->condition.notify_one();
+
+    if ( this->thread.joinable() )
+    {
+      this->thread.join();
+    }
+
+    this->upload.wait();
+    this->ready.reset();
+  }
+
+private:
+  const VDeleter<VkDevice>&      device;
+  UploadContext                  upload;
+  StagingRing*                   ring           = nullptr;
+  CookedTexture                  cooked;
+  VkImage                        image          = VK_NULL_HANDLE;
+  uint32_t                       uploadingLevel = 0;
+
+  std::thread                    thread;
+  std::mutex                     mutex;
+  std::condition_variable        condition;
+  bool                           stopping       = false;
+  std::atomic<bool>              finished       { true }; // Set by the worker as it exits
+  std::unique_ptr<StreamedLevel> ready;
+  std::exception_ptr             error;
+
+  // Take a range of the ring for a level on the worker thread, waiting for
+  // earlier uploads to retire when it is full. Returns false when there is
+  // no ring, the level exceeds it or streaming stops.
+  bool stageFromRing( VkDeviceSize size, StreamedLevel& streamed )
+  {
+    if ( !this->ring || size > this->ring->capacity() )
+    {
+      return false;
+    }
+
+    std::unique_lock<std::mutex> lock( this->mutex );
+    while ( !this->ring->allocate( size, streamed.staged ) )
+    {
+      this->condition.wait_for( lock, std::chrono::milliseconds( 1 ) );
+      if ( this->stopping )
+      {
+        return false;
+      }
+    }
+
+    StagingRing*  ring  = this->ring;
+    StagingRange  range = streamed.staged;
+    streamed.stagedHold = std::shared_ptr<void>( nullptr, [ring, range]( void* ) { ring->release( range ); } );
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef __STRIP_HPP__
+#define __STRIP_HPP__
+
+#include <iostream>
+#include "base-includes.hpp"
+
+// Index value that ends the current strip when primitive restart is enabled
+const uint32_t PRIMITIVE_RESTART_INDEX = 0xFFFFFFFF;
+
+enum IndexEncoding
+{
+  INDEX_ENCODING_TRIANGLE_LIST,
+  INDEX_ENCODING_TRIANGLE_STRIP
+};
+
+struct EncodedIndices
+{
+  IndexEncoding         encoding;
+  std::vector<uint32_t> indices;
+};
+
+static uint64_t stripEdgeKey( uint32_t from, uint32_t to )
+{
+  return ( (uint64_t)from << 32 ) | to;
+}
+
+// Find an unused triangle containing the directed edge from -> to
+static bool findStripTriangle( const std::unordered_map<uint64_t, std::vector<uint32_t>>& edges,
+                               const std::vector<bool>&                                   used,
+                               uint32_t                                                   from,
+                               uint32_t                                                   to,
+                               uint32_t&                                                  tri )
+{
+  auto it = edges.find( stripEdgeKey( from, to ) );
+  if ( it == edges.end() )
+  {
+    return false;
+  }
+
+  for ( uint32_t candidate : it->second )
+  {
+    if ( !used[ candidate ] )
+    {
+      tri = candidate;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Third vertex of a triangle, given two of its corners
+static uint32_t stripThirdVertex( const std::vector<uint32_t>& triangles,
+                                  uint32_t                     tri,
+                                  uint32_t                     a,
+                                  uint32_t                     b )
+{
+  for ( uint32_t i = 0; i < 3; i++ )
+  {
+    uint32_t v = triangles[ 3 * tri + i ];
+    if ( v != a && v != b )
+    {
+      return v;
+    }
+  }
+
+  return triangles[ 3 * tri ];
+}
+
+// Grow a strip from the given start triangle rotation. Triangle k of a strip
+// uses vertices (k, k+1, k+2) when k is even and (k, k+2, k+1) when k is odd,
+// so the edge searched for flips direction every step to preserve winding.
+// If markUsed is false the strip is only measured, not committed.
+static size_t growStrip( const std::vector<uint32_t>&                               triangles,
+                         const std::unordered_map<uint64_t, std::vector<uint32_t>>& edges,
+                         std::vector<bool>&                                         used,
+                         uint32_t                                                   start,
+                         uint32_t                                                   rotation,
+                         bool                                                       markUsed,
+                         std::vector<uint32_t>*                                     strip )
+{
+  uint32_t a = triangles[ 3 * start + ( rotation + 0 ) % 3 ];
+  uint32_t b = triangles[ 3 * start + ( rotation + 1 ) % 3 ];
+  uint32_t c = triangles[ 3 * start + ( rotation + 2 ) % 3 ];
+
+  std::vector<uint32_t> visited = { start };
+  used[ start ] = true;
+  if ( strip )
+  {
+    strip->push_back( a );
+    strip->push_back( b );
+    strip->push_back( c );
+  }
+
+  uint32_t p = b;
+  uint32_t q = c;
+  size_t   k = 1;
+  uint32_t tri;
+
+  while ( findStripTriangle( edges, used,
+                             ( k % 2 == 0 ) ? p : q,
+                             ( k % 2 == 0 ) ? q : p,
+                             tri ) )
+  {
+    uint32_t r = stripThirdVertex( triangles, tri, p, q );
+
+    used[ tri ] = true;
+    visited.push_back( tri );
+    if ( strip )
+    {
+      strip->push_back( r );
+    }
+
+    p = q;
+    q = r;
+    k++;
+  }
+
+  if ( !markUsed )
+  {
+    for ( uint32_t v : visited )
+    {
+      used[ v ] = false;
+    }
+  }
+
+  return visited.size();
+}
+
+// Stitch a triangle list into strips separated by PRIMITIVE_RESTART_INDEX
+std::vector<uint32_t> stripifyTriangles( const std::vector<uint32_t>& triangles )
+{
+  uint32_t triCount = triangles.size() / 3;
+
+  // Map each directed edge to the triangles that contain it in winding order
+  std::unordered_map<uint64_t, std::vector<uint32_t>> edges;
+  for ( uint32_t t = 0; t < triCount; t++ )
+  {
+    for ( uint32_t i = 0; i < 3; i++ )
+    {
+      uint32_t from = triangles[ 3 * t + i ];
+      uint32_t to   = triangles[ 3 * t + ( i + 1 ) % 3 ];
+      edges[ stripEdgeKey( from, to ) ].push_back( t );
+    }
+  }
+
+  std::vector<bool>     used( triCount, false );
+  std::vector<uint32_t> strips;
+  strips.reserve( triangles.size() );
+
+  for ( uint32_t t = 0; t < triCount; t++ )
+  {
+    if ( used[ t ] )
+    {
+      continue;
+    }
+
+    // Pick the starting rotation that yields the longest strip
+    uint32_t bestRotation = 0;
+    size_t   bestLength   = 0;
+    for ( uint32_t rotation = 0; rotation < 3; rotation++ )
+    {
+      size_t length = growStrip( triangles, edges, used, t, rotation, false, nullptr );
+      if ( length > bestLength )
+      {
+        bestLength   = length;
+        bestRotation = rotation;
+      }
+    }
+
+    if ( !strips.empty() )
+    {
+      strips.push_back( PRIMITIVE_RESTART_INDEX );
+    }
+    growStrip( triangles, edges, used, t, bestRotation, true, &strips );
+  }
+
+  return strips;
+}
+
+// Encode a triangle list as either a list or restart-joined strips,
+// whichever needs fewer indices
+EncodedIndices encodeIndices( const std::vector<uint32_t>& triangles )
+{
+  EncodedIndices encoded;
+  encoded.indices = stripifyTriangles( triangles );
+
+  std::cout << "Index encoding: " << triangles.size() << " list indices, "
+            << encoded.indices.size() << " strip indices";
+
+  if ( encoded.indices.size() < triangles.size() )
+  {
+    encoded.encoding = INDEX_ENCODING_TRIANGLE_STRIP;
+    std::cout << " (strip saves "
+              << 100.0 * ( triangles.size() - encoded.indices.size() ) / triangles.size()
+              << "%)" << std::endl;
+  }
+  else
+  {
+    encoded.encoding = INDEX_ENCODING_TRIANGLE_LIST;
+    encoded.indices  = triangles;
+    std::cout << " (keeping list)" << std::endl;
+  }
+
+  return encoded;
+}
+
+#endif
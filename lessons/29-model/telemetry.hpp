@@ -0,0 +1,251 @@
+#ifndef __TELEMETRY_HPP__
+#define __TELEMETRY_HPP__
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include "base-includes.hpp"
+
+// Accounting of device memory by heap, memory type and category, kept by
+// DeviceMemoryAllocator. Every resource carries a category and a debug name
+// so snapshots and the leak report at shutdown can say what the memory is.
+
+enum MemoryCategory
+{
+  MEMORY_CATEGORY_GEOMETRY,   // Vertex, index, instance and indirect buffers
+  MEMORY_CATEGORY_TEXTURE,
+  MEMORY_CATEGORY_UNIFORM,
+  MEMORY_CATEGORY_STAGING,
+  MEMORY_CATEGORY_ATTACHMENT, // Depth buffers and render targets
+  MEMORY_CATEGORY_READBACK,
+  MEMORY_CATEGORY_COUNT
+};
+
+const char* memoryCategoryName( MemoryCategory category )
+{
+  static const char* names[ MEMORY_CATEGORY_COUNT ] = {
+    "geometry", "texture", "uniform", "staging", "attachment", "readback"
+  };
+  return names[ category ];
+}
+
+struct MemoryTotals
+{
+  VkDeviceSize bytes     = 0;
+  uint32_t     count     = 0;
+  VkDeviceSize peakBytes = 0;
+  uint32_t     peakCount = 0;
+  uint64_t     total     = 0; // Allocations made over the whole run
+
+  void add( VkDeviceSize size )
+  {
+    this->bytes    += size;
+    this->count    += 1;
+    this->total    += 1;
+    this->peakBytes = std::max( this->peakBytes, this->bytes );
+    this->peakCount = std::max( this->peakCount, this->count );
+  }
+
+  void remove( VkDeviceSize size )
+  {
+    this->bytes -= size;
+    this->count -= 1;
+  }
+};
+
+// State of one vkAllocateMemory block for snapshots
+struct MemoryBlockInfo
+{
+  const void*  block            = nullptr; // Compares equal to MemoryAllocation::block()
+  uint32_t     typeIndex        = 0;
+  bool         linear           = false;
+  bool         dedicated        = false;
+  VkDeviceSize size             = 0;
+  VkDeviceSize usedBytes        = 0;
+  uint32_t     allocations      = 0;
+  uint32_t     freeRanges       = 0;
+  VkDeviceSize largestFreeRange = 0;
+};
+
+class MemoryTelemetry
+{
+public:
+  // Totals of the memory held by vkAllocateMemory blocks and of the part
+  // placed resources use, per heap and per memory type
+  MemoryTotals heapReserved[ VK_MAX_MEMORY_HEAPS ];
+  MemoryTotals heapUsed[ VK_MAX_MEMORY_HEAPS ];
+  MemoryTotals typeReserved[ VK_MAX_MEMORY_TYPES ];
+  MemoryTotals typeUsed[ VK_MAX_MEMORY_TYPES ];
+  MemoryTotals categories[ MEMORY_CATEGORY_COUNT ];
+
+  void init( const VkPhysicalDeviceMemoryProperties& memprops )
+  {
+    this->memprops = memprops;
+  }
+
+  void blockAllocated( uint32_t typeIndex, VkDeviceSize size )
+  {
+    this->typeReserved[ typeIndex ].add( size );
+    this->heapReserved[ this->heapOf( typeIndex ) ].add( size );
+  }
+
+  void blockFreed( uint32_t typeIndex, VkDeviceSize size )
+  {
+    this->typeReserved[ typeIndex ].remove( size );
+    this->heapReserved[ this->heapOf( typeIndex ) ].remove( size );
+  }
+
+  // Returns the id to pass to freed
+  uint64_t allocated( uint32_t typeIndex, VkDeviceSize size, MemoryCategory category, const std::string& name )
+  {
+    this->typeUsed[ typeIndex ].add( size );
+    this->heapUsed[ this->heapOf( typeIndex ) ].add( size );
+    this->categories[ category ].add( size );
+
+    Live live;
+    live.typeIndex = typeIndex;
+    live.size      = size;
+    live.category  = category;
+    live.name      = name;
+    this->live[ this->nextId ] = live;
+    return this->nextId++;
+  }
+
+  void freed( uint64_t id )
+  {
+    auto found = this->live.find( id );
+    if ( found == this->live.end() )
+    {
+      return;
+    }
+
+    const Live& live = found->second;
+    this->typeUsed[ live.typeIndex ].remove( live.size );
+    this->heapUsed[ this->heapOf( live.typeIndex ) ].remove( live.size );
+    this->categories[ live.category ].remove( live.size );
+    this->live.erase( found );
+  }
+
+  // List every resource still placed, e.g. when the allocator is destroyed.
+  // Returns how many there are.
+  size_t reportLeaks( std::ostream& out ) const
+  {
+    for ( const auto& entry : this->live )
+    {
+      const Live& live = entry.second;
+      out << "Device memory leak: " << live.name << " (" << memoryCategoryName( live.category )
+          << ", " << live.size << " bytes in memory type " << live.typeIndex << ")" << std::endl;
+    }
+    return this->live.size();
+  }
+
+  // Everything above as one JSON object, with the budget of every heap and
+  // the state of every block
+  void writeJson( std::ostream&                       out,
+                  const VkDeviceSize*                 heapBudget,
+                  const std::vector<MemoryBlockInfo>& blocks ) const
+  {
+    out << "{\n  \"heaps\": [";
+    for ( uint32_t i = 0; i < this->memprops.memoryHeapCount; i++ )
+    {
+      out << ( i > 0 ? "," : "" ) << "\n    { \"index\": " << i
+          << ", \"size\": " << this->memprops.memoryHeaps[i].size
+          << ", \"deviceLocal\": "
+          << ( this->memprops.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ? "true" : "false" )
+          << ", \"budget\": " << heapBudget[i]
+          << ", \"reserved\": " << totalsJson( this->heapReserved[i] )
+          << ", \"used\": " << totalsJson( this->heapUsed[i] ) << " }";
+    }
+
+    out << "\n  ],\n  \"types\": [";
+    for ( uint32_t i = 0; i < this->memprops.memoryTypeCount; i++ )
+    {
+      out << ( i > 0 ? "," : "" ) << "\n    { \"index\": " << i
+          << ", \"heap\": " << this->memprops.memoryTypes[i].heapIndex
+          << ", \"flags\": " << this->memprops.memoryTypes[i].propertyFlags
+          << ", \"reserved\": " << totalsJson( this->typeReserved[i] )
+          << ", \"used\": " << totalsJson( this->typeUsed[i] ) << " }";
+    }
+
+    out << "\n  ],\n  \"categories\": {";
+    for ( uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++ )
+    {
+      out << ( i > 0 ? "," : "" ) << "\n    \"" << memoryCategoryName( (MemoryCategory)i )
+          << "\": " << totalsJson( this->categories[i] );
+    }
+
+    out << "\n  },\n  \"blocks\": [";
+    for ( size_t i = 0; i < blocks.size(); i++ )
+    {
+      const MemoryBlockInfo& block = blocks[i];
+      VkDeviceSize freeBytes = block.size - block.usedBytes;
+      out << ( i > 0 ? "," : "" ) << "\n    { \"type\": " << block.typeIndex
+          << ", \"linear\": " << ( block.linear ? "true" : "false" )
+          << ", \"dedicated\": " << ( block.dedicated ? "true" : "false" )
+          << ", \"size\": " << block.size
+          << ", \"used\": " << block.usedBytes
+          << ", \"allocations\": " << block.allocations
+          << ", \"freeRanges\": " << block.freeRanges
+          << ", \"largestFreeRange\": " << block.largestFreeRange
+          << ", \"fragmentation\": "
+          << ( freeBytes > 0 ? 1.0f - (float)block.largestFreeRange / freeBytes : 0.0f ) << " }";
+    }
+
+    out << "\n  ],\n  \"allocations\": [";
+    bool first = true;
+    for ( const auto& entry : this->live )
+    {
+      const Live& live = entry.second;
+      out << ( first ? "" : "," ) << "\n    { \"name\": \"" << jsonEscape( live.name )
+          << "\", \"category\": \"" << memoryCategoryName( live.category )
+          << "\", \"type\": " << live.typeIndex
+          << ", \"size\": " << live.size << " }";
+      first = false;
+    }
+    out << "\n  ]\n}\n";
+  }
+
+private:
+  struct Live
+  {
+    uint32_t       typeIndex;
+    VkDeviceSize   size;
+    MemoryCategory category;
+    std::string    name;
+  };
+
+  VkPhysicalDeviceMemoryProperties   memprops = {};
+  std::unordered_map<uint64_t, Live> live;
+  uint64_t                           nextId   = 1;
+
+  uint32_t heapOf( uint32_t typeIndex ) const
+  {
+    return this->memprops.memoryTypes[ typeIndex ].heapIndex;
+  }
+
+  static std::string totalsJson( const MemoryTotals& totals )
+  {
+    return "{ \"bytes\": " + std::to_string( totals.bytes ) +
+           ", \"count\": " + std::to_string( totals.count ) +
+           ", \"peakBytes\": " + std::to_string( totals.peakBytes ) +
+           ", \"peakCount\": " + std::to_string( totals.peakCount ) +
+           ", \"total\": " + std::to_string( totals.total ) + " }";
+  }
+
+  static std::string jsonEscape( const std::string& text )
+  {
+    std::string escaped;
+    for ( char c : text )
+    {
+      if ( c == '"' || c == '\\' )
+      {
+        escaped += '\\';
+      }
+      escaped += ( (unsigned char)c < 0x20 ) ? ' ' : c;
+    }
+    return escaped;
+  }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include <random>
+#include "allocator.hpp"
+#include "check.hpp"
+
+// Randomized allocation and release against one block, checking that no
+// two live ranges overlap, that every range is aligned and that freeing
+// everything merges the block back into a single range. Prints the
+// fragmentation seen at the busiest point.
+static void stressTestSuballocator( VkDeviceSize blockSize, uint32_t operations, uint32_t seed )
+{
+  struct Live
+  {
+    uint32_t     range;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+  };
+
+  TlsfSuballocator                        ranges( blockSize );
+  std::vector<Live>                       live;
+  std::mt19937                            random( seed );
+  std::uniform_int_distribution<uint32_t> sizeBits( 4, 20 );
+  std::uniform_int_distribution<uint32_t> alignmentBits( 0, 12 );
+
+  uint32_t     failures = 0;
+  VkDeviceSize peakUsed = 0;
+  VkDeviceSize peakFree = 0, peakLargest = 0;
+  uint32_t     peakRanges = 0;
+
+  for ( uint32_t op = 0; op < operations; op++ )
+  {
+    // Mostly allocate while the block is empty, mostly free once it is full
+    bool allocate = live.empty() || random() % blockSize >= ranges.usedBytes();
+    if ( allocate )
+    {
+      VkDeviceSize size      = ( random() % ( 1u << sizeBits( random ) ) ) + 1;
+      VkDeviceSize alignment = (VkDeviceSize)1 << alignmentBits( random );
+      Live         entry;
+      entry.size  = size;
+      entry.range = ranges.allocate( size, alignment, entry.offset );
+      if ( entry.range == TlsfSuballocator::INVALID )
+      {
+        failures++;
+        continue;
+      }
+      CHECK( entry.offset % alignment == 0 && entry.offset + size <= blockSize );
+      for ( const auto& other : live )
+      {
+        CHECK( entry.offset >= other.offset + other.size || other.offset >= entry.offset + size );
+      }
+      live.push_back( entry );
+    }
+    else
+    {
+      size_t victim = random() % live.size();
+      ranges.free( live[victim].range );
+      live[victim] = live.back();
+      live.pop_back();
+    }
+
+    if ( ranges.usedBytes() > peakUsed )
+    {
+      peakUsed = ranges.usedBytes();
+      ranges.freeStats( peakFree, peakLargest, peakRanges );
+    }
+  }
+
+  for ( const auto& entry : live )
+  {
+    ranges.free( entry.range );
+  }
+
+  VkDeviceSize freeBytes, largest;
+  uint32_t     freeRanges;
+  ranges.freeStats( freeBytes, largest, freeRanges );
+  CHECK( freeRanges == 1 && largest == blockSize && ranges.allocationCount() == 0 );
+
+  std::cout << "Seed " << seed << ": " << operations << " operations, "
+            << failures << " allocations did not fit, peak " << peakUsed << " of "
+            << blockSize << " bytes used with " << peakRanges << " free ranges, "
+            << "fragmentation " << ( peakFree > 0 ? 1.0f - (float)peakLargest / peakFree : 0.0f )
+            << std::endl;
+}
+
+// Random allocations and frees in one block with several seeds
+int main()
+{
+  return runTest( []()
+  {
+    for ( uint32_t seed = 1; seed <= 4; seed++ )
+    {
+      stressTestSuballocator( ALLOCATOR_BLOCK_SIZE, 20000, seed );
+    }
+  } );
+}
@@ -0,0 +1,39 @@
+#ifndef __CHECK_HPP__
+#define __CHECK_HPP__
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+
+// A failed check prints where it failed and exits non-zero
+#define CHECK( condition )                                                   \
+  do                                                                         \
+  {                                                                          \
+    if ( !( condition ) )                                                    \
+    {                                                                        \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: "         \
+                << #condition << std::endl;                                  \
+      std::exit( 1 );                                                        \
+    }                                                                        \
+  } while ( 0 )
+
+// Exit code CTest reports as skipped
+const int TEST_SKIPPED = 77;
+
+// Run a test body, turning an escaped exception into a failure
+template < typename F >
+int runTest( F body )
+{
+  try
+  {
+    body();
+  }
+  catch ( const std::exception& e )
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,223 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <cstdlib>
+#include <fstream>
+#include "decode.hpp"
+#include "check.hpp"
+#include "jpegenc.hpp"
+
+const std::string IMAGE_DIRECTORY = "decode-images";
+
+struct TestImage
+{
+  std::string       name;
+  uint32_t          width;
+  uint32_t          height;
+  JpegEncodeOptions options;
+};
+
+static void writeTestFile( const std::string& name, const std::vector<char>& bytes )
+{
+  std::ofstream file( IMAGE_DIRECTORY + "/" + name, std::ios::binary | std::ios::trunc );
+  file.write( bytes.data(), bytes.size() );
+  CHECK( file.good() );
+}
+
+// Image files in the directory, in no particular order
+static std::vector<std::string> listImages( const std::string& directory )
+{
+  std::vector<std::string> paths;
+  DIR* dir = opendir( directory.c_str() );
+  CHECK( dir != nullptr );
+  while ( dirent* entry = readdir( dir ) )
+  {
+    std::string name = entry->d_name;
+    if ( name.size() > 4 && name.compare( name.size() - 4, 4, ".jpg" ) == 0 )
+    {
+      paths.push_back( directory + "/" + name );
+    }
+  }
+  closedir( dir );
+  return paths;
+}
+
+// Compare a decode with stb_image's decode of the same file. 4:4:4 images
+// only differ by IDCT rounding; stb_image interpolates subsampled chroma
+// where the decoder replicates it, so those differ more along hard edges.
+static void checkAgainstReference( const DecodeJob& job, bool subsampled )
+{
+  std::vector<char> file = readFile( job.path );
+  int      width, height, channels;
+  stbi_uc* reference = stbi_load_from_memory( (const stbi_uc*)file.data(), file.size(),
+                                              &width, &height, &channels, STBI_rgb_alpha );
+  CHECK( reference != nullptr );
+  CHECK( job.width == (uint32_t)width && job.height == (uint32_t)height );
+
+  size_t   count    = (size_t)width * height * 4;
+  uint64_t total    = 0;
+  int      maxError = 0;
+  for ( size_t i = 0; i < count; i++ )
+  {
+    int error = std::abs( (int)job.pixels[i] - (int)reference[i] );
+    total    += error;
+    maxError  = std::max( maxError, error );
+  }
+  stbi_image_free( reference );
+
+  float meanError = (float)total / count;
+  std::cout << job.path << ": mean error " << meanError << ", max error " << maxError << std::endl;
+  CHECK( meanError <= ( subsampled ? 2.0f : 0.25f ) );
+  CHECK( subsampled || maxError <= 4 );
+}
+
+// Decode a directory of generated JPEGs, with and without chroma subsampling
+// and restart intervals, through a staging pool that holds about one and a
+// half of the largest image. Every decode must match stb_image, the pool
+// must never be exceeded and must drain back to empty, and files that are
+// too large, missing or not images must fail instead of blocking.
+int main()
+{
+  return runTest( []()
+  {
+    std::vector<TestImage> images = {
+      { "gradient.jpg",        640,  480, { 85, true,  0  } },
+      { "restart-444.jpg",     333,  217, { 90, false, 3  } },
+      { "restart-420.jpg",     1024, 512, { 75, true,  16 } },
+      { "small.jpg",           96,   64,  { 95, false, 1  } },
+      { "wide.jpg",            1500, 300, { 85, true,  7  } },
+    };
+    const TestImage oversized = { "oversized.jpg", 1600, 1200, { 85, true, 0 } };
+
+    mkdir( IMAGE_DIRECTORY.c_str(), 0755 );
+    uint64_t largest = 0;
+    for ( uint32_t i = 0; i <= images.size(); i++ )
+    {
+      const TestImage& image = i < images.size() ? images[i] : oversized;
+      auto rgb = makeJpegTestImage( image.width, image.height, i + 1 );
+      writeTestFile( image.name, encodeJpeg( rgb.data(), image.width, image.height, image.options ) );
+      if ( i < images.size() )
+      {
+        largest = std::max( largest, (uint64_t)image.width * image.height * 4 );
+      }
+    }
+
+    std::vector<char> noise( 4096 );
+    for ( size_t i = 0; i < noise.size(); i++ )
+    {
+      noise[i] = (char)( i * 2654435761u >> 13 );
+    }
+    writeTestFile( "noise.jpg", noise );
+    writeTestFile( "notes.txt", { 'n', 'o', 't', ' ', 'a', 'n', ' ', 'i', 'm', 'a', 'g', 'e' } );
+
+    auto paths = listImages( IMAGE_DIRECTORY );
+    CHECK( paths.size() == images.size() + 2 );
+    paths.push_back( IMAGE_DIRECTORY + "/missing.jpg" );
+
+    std::vector<uint8_t> memory( largest + largest / 2 );
+    DecodeStagingPool    pool( memory.data(), memory.size() );
+
+    {
+      DecodeService service( 4, pool );
+
+      // Every file twice, so the pool is contended; then reorder and drop a few
+      std::vector<std::shared_ptr<DecodeJob>> jobs;
+      for ( uint32_t round = 0; round < 2; round++ )
+      {
+        for ( size_t i = 0; i < paths.size(); i++ )
+        {
+          jobs.push_back( service.submit( paths[i], (float)i ) );
+        }
+      }
+      service.reprioritize( jobs.back(), 100.0f );
+      service.cancel( jobs[1] );
+      service.cancel( jobs[paths.size() + 2] );
+
+      size_t decoded = 0, failed = 0;
+      while ( auto job = service.next() )
+      {
+        CHECK( !job->cancelled );
+
+        std::string name = job->path.substr( IMAGE_DIRECTORY.size() + 1 );
+        if ( name == oversized.name )
+        {
+          CHECK( job->state == DECODE_STATE_FAILED );
+          CHECK( job->error == "Image is larger than the staging pool" );
+          failed++;
+          continue;
+        }
+        if ( name == "noise.jpg" || name == "missing.jpg" )
+        {
+          CHECK( job->state == DECODE_STATE_FAILED );
+          failed++;
+          continue;
+        }
+
+        CHECK( job->state == DECODE_STATE_DONE );
+        auto image = std::find_if( images.begin(), images.end(),
+                                   [&name]( const TestImage& image ) { return image.name == name; } );
+        CHECK( image != images.end() );
+        checkAgainstReference( *job, image->options.subsampleChroma );
+        service.release( job );
+        decoded++;
+      }
+
+      DecodeMetrics metrics = service.metrics();
+      std::cout << decoded << " decoded, " << failed << " failed, staging peak "
+                << metrics.stagingPeak << " of " << pool.capacity() << " bytes" << std::endl;
+
+      CHECK( decoded + failed + 2 == jobs.size() );
+      CHECK( metrics.completed == decoded );
+      CHECK( metrics.failed == failed );
+      CHECK( metrics.cancelled == 2 );
+      CHECK( metrics.queued == 0 && metrics.decoding == 0 );
+      CHECK( metrics.stagingPeak <= pool.capacity() );
+      CHECK( metrics.stagingUsed == 0 );
+    }
+
+    // Holding finished jobs until none is ready, as uploads copying straight
+    // out of the pool do, must still get through every job
+    {
+      DecodeService service( 2, pool );
+      for ( uint32_t i = 0; i < 16; i++ )
+      {
+        service.submit( paths[i % images.size()], 1.0f );
+      }
+
+      std::vector<std::shared_ptr<DecodeJob>> held;
+      size_t                                  finished = 0;
+      while ( true )
+      {
+        auto job = held.empty() ? service.next() : service.tryNext();
+        if ( !job )
+        {
+          if ( held.empty() )
+          {
+            break;
+          }
+          for ( auto& done : held )
+          {
+            service.release( done );
+          }
+          held.clear();
+          continue;
+        }
+        held.push_back( job );
+        finished++;
+      }
+
+      CHECK( finished == 16 );
+      CHECK( service.metrics().stagingUsed == 0 );
+    }
+
+    // Shutting down with jobs queued and workers waiting for staging memory
+    // held by a decode nobody releases must not hang
+    {
+      DecodeService service( 2, pool );
+      for ( uint32_t i = 0; i < 16; i++ )
+      {
+        service.submit( paths[i % images.size()], 1.0f );
+      }
+      service.next();
+    }
+  } );
+}
@@ -0,0 +1,161 @@
+#include <random>
+#include "defrag.hpp"
+#include "check.hpp"
+#include "headless.hpp"
+
+struct TestBuffer
+{
+  TestBuffer( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : buffer { device, vkDestroyBuffer },
+      memory { allocator, MEMORY_CATEGORY_GEOMETRY, "defragmentation test buffer" }
+  {
+  }
+
+  VDeleter<VkBuffer> buffer;
+  MemoryAllocation   memory;
+  VkDeviceSize       size    = 0;
+  uint32_t           pattern = 0;
+};
+
+// Fragment the allocator with random buffers, free most of them and let a
+// Defragmenter compact the rest, printing how blocks and fragmentation
+// shrink on the way. Fails if no block is released or a buffer lost its
+// contents in a move.
+static DefragmentStats stressTestDefragmentation( const HeadlessDevice&  headless,
+                                                  DeviceMemoryAllocator& allocator,
+                                                  uint32_t               bufferCount,
+                                                  VkDeviceSize           stepBytes,
+                                                  uint32_t               seed )
+{
+  const VDeleter<VkDevice>& device      = headless.device;
+  VkCommandPool             commandPool = headless.commandPool;
+  VkQueue                   queue       = headless.queue;
+
+  std::mt19937                            random( seed );
+  std::uniform_int_distribution<uint32_t> sizeKiB( 64, 2048 );
+  const VkBufferUsageFlags                usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                                  VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+  std::vector<std::unique_ptr<TestBuffer>> buffers;
+  for ( uint32_t i = 0; i < bufferCount; i++ )
+  {
+    std::unique_ptr<TestBuffer> buffer( new TestBuffer( device, allocator ) );
+    buffer->size    = (VkDeviceSize)sizeKiB( random ) * 1024;
+    buffer->pattern = random();
+    createBuffer( device, headless.physical, buffer->size, usage, MEMORY_USAGE_GPU_ONLY,
+                  buffer->buffer, buffer->memory );
+    buffers.push_back( std::move( buffer ) );
+  }
+
+  // Give every buffer contents of its own to check after the moves
+  VkCommandBuffer fill = beginSingleTimeCommands( device, commandPool );
+  for ( auto& buffer : buffers )
+  {
+    vkCmdFillBuffer( fill, buffer->buffer, 0, VK_WHOLE_SIZE, buffer->pattern );
+  }
+  endSingleTimeCommands( device, queue, commandPool, fill );
+
+  // Leave holes all over every block
+  for ( size_t i = 0; i < buffers.size(); )
+  {
+    if ( random() % 5 < 3 )
+    {
+      buffers[i] = std::move( buffers.back() );
+      buffers.pop_back();
+    }
+    else
+    {
+      i++;
+    }
+  }
+
+  // Test buffers are the only movables, so only blocks holding nothing
+  // else are compacted
+  std::unique_ptr<Defragmenter> defragmenter( new Defragmenter( device, allocator ) );
+  for ( auto& buffer : buffers )
+  {
+    defragmenter->addBuffer( buffer->buffer, buffer->memory, buffer->size, usage );
+  }
+
+  // Each step stands for a frame with nothing in flight
+  for ( uint64_t frame = 1; frame < 10000; frame++ )
+  {
+    if ( frame % 10 == 1 )
+    {
+      AllocatorStats stats = allocator.stats();
+      std::cout << "Frame " << frame << ": " << stats.blocks << " blocks, "
+                << stats.usedBytes << " of " << stats.reservedBytes << " bytes used, fragmentation "
+                << stats.fragmentation << std::endl;
+    }
+
+    uint32_t released = defragmenter->statistics().blocksReleased;
+    bool     swapped  = defragmenter->update( queue, commandPool, frame, frame - 1, stepBytes );
+    bool     started  = defragmenter->busy();
+    defragmenter->finish();
+
+    // Settled once an update neither moves nor releases anything
+    if ( !swapped && !started && defragmenter->statistics().blocksReleased == released )
+    {
+      break;
+    }
+  }
+
+  DefragmentStats result    = defragmenter->statistics();
+  AllocatorStats  allocated = allocator.stats();
+  std::cout << "Seed " << seed << ": " << result.moves << " moves, " << result.bytesMoved
+            << " bytes moved, " << result.blocksReleased << " blocks released, "
+            << allocated.blocks << " blocks left, fragmentation " << allocated.fragmentation << std::endl;
+
+  defragmenter.reset();
+  CHECK( result.blocksReleased > 0 );
+
+  for ( auto& buffer : buffers )
+  {
+    VDeleter<VkBuffer> readback { device, vkDestroyBuffer };
+    MemoryAllocation   readbackMemory { allocator, MEMORY_CATEGORY_STAGING, "defragmentation test readback" };
+    createBuffer( device, headless.physical, buffer->size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  MEMORY_USAGE_READBACK, readback, readbackMemory );
+    copyBuffer( device, queue, commandPool, buffer->buffer, readback, buffer->size );
+
+    const uint32_t* words = (const uint32_t*)readbackMemory.map();
+    for ( VkDeviceSize i = 0; i < buffer->size / 4; i++ )
+    {
+      if ( words[i] != buffer->pattern )
+      {
+        CHECK( !"buffer lost its contents in a move" );
+      }
+    }
+  }
+
+  buffers.clear();
+  return result;
+}
+
+// Fragment device memory with random buffers on a headless device and let
+// the Defragmenter compact it. Every moved buffer must keep its contents.
+// Skipped without a Vulkan device.
+int main()
+{
+  HeadlessDevice headless;
+  if ( !headless.create( "lesson29-test-defrag" ) )
+  {
+    std::cout << "No Vulkan device, skipping" << std::endl;
+    return TEST_SKIPPED;
+  }
+
+  return runTest( [&headless]()
+  {
+    DeviceMemoryAllocator allocator( headless.device );
+    allocator.init( headless.physical, ALLOCATOR_BLOCK_SIZE );
+
+    for ( uint32_t seed = 1; seed <= 2; seed++ )
+    {
+      DefragmentStats stats = stressTestDefragmentation( headless, allocator, 256,
+                                                         DEFRAGMENT_BYTES_PER_FRAME, seed );
+      CHECK( stats.moves > 0 );
+      CHECK( allocator.stats().allocations == 0 );
+    }
+    allocator.releaseEmptyBlocks();
+  } );
+}
@@ -0,0 +1,126 @@
+#include "geometry.hpp"
+#include "check.hpp"
+
+// Triangles of a long strip-like list whose vertex indices start past 2^32.
+// Triangle t uses vertices FIRST_VERTEX + t, + t + 1 and + t + 2, every other
+// one wound the other way, so consecutive triangles share an edge and each
+// one after the first adds a single vertex.
+const uint64_t FIRST_VERTEX = ( 1ull << 32 ) + 12345;
+
+static uint64_t streamIndex( uint64_t i )
+{
+  uint64_t t = i / 3, k = i % 3;
+  if ( t % 2 == 1 && k > 0 )
+  {
+    k = 3 - k;
+  }
+  return FIRST_VERTEX + t + k;
+}
+
+// The vertex carries its own 64 bit index, split into parts a float holds exactly
+static Vertex streamVertex( uint64_t index )
+{
+  Vertex vertex = {};
+  vertex.pos = glm::vec3( (float)( index & 0xFFFF ),
+                          (float)( ( index >> 16 ) & 0xFFFF ),
+                          (float)( index >> 32 ) );
+  return vertex;
+}
+
+static uint64_t vertexIndex( const Vertex& vertex )
+{
+  return (uint64_t)vertex.pos.x | ( (uint64_t)vertex.pos.y << 16 ) | ( (uint64_t)vertex.pos.z << 32 );
+}
+
+struct SplitTotals
+{
+  uint64_t chunks   = 0;
+  uint64_t indices  = 0;
+  uint64_t vertices = 0;
+};
+
+// Split indexCount indices of the stream, checking every chunk as it is
+// emitted: within the limits, indices rebased to the chunk's own vertices,
+// the stream reproduced in order, and the vertices of the edge shared with
+// the previous chunk duplicated into this one
+static SplitTotals splitStream( uint64_t indexCount, uint64_t maxVertices, uint64_t maxIndices )
+{
+  SplitTotals totals;
+  uint64_t    position = 0;
+  uint64_t    previousLast[2] = { 0, 0 };
+
+  splitMeshStream( indexCount, streamIndex, streamVertex, maxVertices, maxIndices,
+                   [&]( MeshChunk&& chunk )
+  {
+    CHECK( chunk.vertices.size() <= maxVertices );
+    CHECK( chunk.indices.size() <= maxIndices );
+    CHECK( chunk.indices.size() % 3 == 0 );
+    CHECK( !chunk.indices.empty() || indexCount < 3 );
+
+    for ( size_t i = 0; i < chunk.indices.size(); i++ )
+    {
+      CHECK( chunk.indices[i] < chunk.vertices.size() );
+      if ( vertexIndex( chunk.vertices[ chunk.indices[i] ] ) != streamIndex( position + i ) )
+      {
+        CHECK( !"chunk index does not rebase to the stream's vertex" );
+      }
+    }
+
+    if ( totals.chunks > 0 )
+    {
+      uint32_t shared = 0;
+      for ( uint32_t k = 0; k < 3; k++ )
+      {
+        uint64_t index = vertexIndex( chunk.vertices[ chunk.indices[k] ] );
+        shared += index == previousLast[0] || index == previousLast[1];
+      }
+      CHECK( shared == 2 );
+    }
+    if ( !chunk.indices.empty() )
+    {
+      uint64_t t = ( position + chunk.indices.size() ) / 3 - 1;
+      previousLast[0] = FIRST_VERTEX + t + 1;
+      previousLast[1] = FIRST_VERTEX + t + 2;
+    }
+
+    position        += chunk.indices.size();
+    totals.chunks   += 1;
+    totals.indices  += chunk.indices.size();
+    totals.vertices += chunk.vertices.size();
+  } );
+
+  CHECK( position == indexCount / 3 * 3 );
+  return totals;
+}
+
+int main()
+{
+  return runTest( []()
+  {
+    // More indices than fit in 4 GiB as 64 bit values, streamed and never
+    // stored, with the vertex limit reached first
+    const uint64_t triangles   = ( 1ull << 32 ) / sizeof( uint64_t ) / 3 + 1000;
+    const uint64_t maxVertices = 1u << 16;
+    SplitTotals    large       = splitStream( triangles * 3, maxVertices, 1u << 20 );
+
+    std::cout << triangles * 3 * sizeof( uint64_t ) << " bytes of indices: " << large.chunks
+              << " chunks, " << large.vertices << " vertices" << std::endl;
+    CHECK( triangles * 3 * sizeof( uint64_t ) > ( 1ull << 32 ) );
+
+    // Full chunks hold maxVertices vertices, the first two duplicated from
+    // the previous chunk
+    uint64_t perChunk = maxVertices - 2;
+    CHECK( large.chunks == ( triangles + perChunk - 1 ) / perChunk );
+    CHECK( large.indices == triangles * 3 );
+    CHECK( large.vertices == ( triangles + 2 ) + 2 * ( large.chunks - 1 ) );
+
+    // The index limit reached first
+    SplitTotals small = splitStream( 3 * 1000, 1000, 3 * 64 );
+    CHECK( small.chunks == ( 1000 + 63 ) / 64 );
+    CHECK( small.vertices == ( 1000 + 2 ) + 2 * ( small.chunks - 1 ) );
+
+    // A stream without a whole triangle still gives one empty chunk
+    SplitTotals empty = splitStream( 2, 3, 3 );
+    CHECK( empty.chunks == 1 && empty.vertices == 0 );
+  } );
+}
@@ -0,0 +1,99 @@
+#ifndef __HEADLESS_HPP__
+#define __HEADLESS_HPP__
+
+#include "base-includes.hpp"
+#include "deleter.hpp"
+
+// Instance, device and queue without a window or surface, for checks that
+// need a GPU. Runs on any implementation, including lavapipe.
+struct HeadlessDevice
+{
+  VDeleter<VkInstance>    instance    { vkDestroyInstance };
+  VkPhysicalDevice        physical    = VK_NULL_HANDLE;
+  VDeleter<VkDevice>      device      { vkDestroyDevice };
+  uint32_t                queueFamily = 0;
+  VkQueue                 queue       = VK_NULL_HANDLE;
+  VDeleter<VkCommandPool> commandPool { this->device, vkDestroyCommandPool };
+
+  // Returns false when there is no Vulkan implementation or no device with
+  // a graphics queue, in which case the check should be skipped
+  bool create( const char* name )
+  {
+    VkApplicationInfo appInfo = {};
+    appInfo.sType            = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = name;
+    appInfo.apiVersion       = VK_API_VERSION_1_0;
+
+    VkInstanceCreateInfo instanceInfo = {};
+    instanceInfo.sType            = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceInfo.pApplicationInfo = &appInfo;
+    if ( vkCreateInstance( &instanceInfo, nullptr, &this->instance ) != VK_SUCCESS )
+    {
+      return false;
+    }
+
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices( this->instance, &deviceCount, nullptr );
+    std::vector<VkPhysicalDevice> devices( deviceCount );
+    vkEnumeratePhysicalDevices( this->instance, &deviceCount, devices.data() );
+
+    for ( VkPhysicalDevice candidate : devices )
+    {
+      uint32_t familyCount = 0;
+      vkGetPhysicalDeviceQueueFamilyProperties( candidate, &familyCount, nullptr );
+      std::vector<VkQueueFamilyProperties> families( familyCount );
+      vkGetPhysicalDeviceQueueFamilyProperties( candidate, &familyCount, families.data() );
+
+      for ( uint32_t i = 0; i < familyCount; i++ )
+      {
+        if ( families[i].queueCount > 0 && ( families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT ) )
+        {
+          this->physical    = candidate;
+          this->queueFamily = i;
+          break;
+        }
+      }
+      if ( this->physical )
+      {
+        break;
+      }
+    }
+    if ( !this->physical )
+    {
+      return false;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties( this->physical, &properties );
+    std::cout << "Device: " << properties.deviceName << std::endl;
+
+    float                   queuePriority = 1.0f;
+    VkDeviceQueueCreateInfo queueInfo     = {};
+    queueInfo.sType            = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfo.queueFamilyIndex = this->queueFamily;
+    queueInfo.queueCount       = 1;
+    queueInfo.pQueuePriorities = &queuePriority;
+
+    VkDeviceCreateInfo deviceInfo = {};
+    deviceInfo.sType                = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.queueCreateInfoCount = 1;
+    deviceInfo.pQueueCreateInfos    = &queueInfo;
+    if ( vkCreateDevice( this->physical, &deviceInfo, nullptr, &this->device ) != VK_SUCCESS )
+    {
+      throw std::runtime_error( "Failed to create logical device!" );
+    }
+    vkGetDeviceQueue( this->device, this->queueFamily, 0, &this->queue );
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = this->queueFamily;
+    if ( vkCreateCommandPool( this->device, &poolInfo, nullptr, &this->commandPool ) != VK_SUCCESS )
+    {
+      throw std::runtime_error( "Failed to create command pool!" );
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "impostor.hpp"
+#include "check.hpp"
+
+// Directions spread evenly over the sphere, plus the axes and the points
+// where the octahedral mapping folds
+static std::vector<glm::vec3> sphereDirections( uint32_t count )
+{
+  std::vector<glm::vec3> directions = {
+    glm::vec3(  1.0f,  0.0f,  0.0f ), glm::vec3( -1.0f,  0.0f,  0.0f ),
+    glm::vec3(  0.0f,  1.0f,  0.0f ), glm::vec3(  0.0f, -1.0f,  0.0f ),
+    glm::vec3(  0.0f,  0.0f,  1.0f ), glm::vec3(  0.0f,  0.0f, -1.0f ),
+    glm::normalize( glm::vec3(  1.0f,  1.0f,  0.0f ) ),
+    glm::normalize( glm::vec3( -1.0f,  1.0f, -1.0f ) ),
+    glm::normalize( glm::vec3(  1.0f, -1.0f, -1.0f ) )
+  };
+
+  const float golden = 3.14159265f * ( 3.0f - std::sqrt( 5.0f ) );
+  for ( uint32_t i = 0; i < count; i++ )
+  {
+    float z = 1.0f - 2.0f * ( i + 0.5f ) / count;
+    float r = std::sqrt( 1.0f - z * z );
+    directions.push_back( glm::vec3( r * std::cos( golden * i ), r * std::sin( golden * i ), z ) );
+  }
+  return directions;
+}
+
+static float angleBetween( glm::vec3 a, glm::vec3 b )
+{
+  return std::acos( glm::clamp( glm::dot( a, b ), -1.0f, 1.0f ) );
+}
+
+// The octahedral mapping round-trips, the draw picks back the tile each view
+// was baked into, and the view it picks for any direction is never further
+// away than the corners of that tile
+static void checkViewSelection( uint32_t viewsPerSide )
+{
+  for ( const glm::vec3& direction : sphereDirections( 5000 ) )
+  {
+    glm::vec2 e = impostorOctEncode( direction );
+    CHECK( std::fabs( e.x ) <= 1.0f && std::fabs( e.y ) <= 1.0f );
+    CHECK( glm::length( impostorOctDecode( e ) - direction ) < 1e-5f );
+  }
+
+  float largestTileRadius = 0.0f;
+  for ( uint32_t ty = 0; ty < viewsPerSide; ty++ )
+  {
+    for ( uint32_t tx = 0; tx < viewsPerSide; tx++ )
+    {
+      glm::vec3  direction = impostorTileDirection( tx, ty, viewsPerSide );
+      glm::uvec2 tile      = impostorViewTile( direction, viewsPerSide );
+      CHECK( tile.x == tx && tile.y == ty );
+
+      for ( uint32_t corner = 0; corner < 4; corner++ )
+      {
+        glm::vec2 e( (float)( tx + ( corner & 1 ) ) / viewsPerSide * 2.0f - 1.0f,
+                     (float)( ty + ( corner >> 1 ) ) / viewsPerSide * 2.0f - 1.0f );
+        largestTileRadius = std::max( largestTileRadius, angleBetween( direction, impostorOctDecode( e ) ) );
+      }
+    }
+  }
+
+  for ( const glm::vec3& direction : sphereDirections( 20000 ) )
+  {
+    glm::uvec2 tile = impostorViewTile( direction * 3.0f, viewsPerSide );
+    CHECK( tile.x < viewsPerSide && tile.y < viewsPerSide );
+    glm::vec3 view = impostorTileDirection( tile.x, tile.y, viewsPerSide );
+    CHECK( angleBetween( direction, view ) <= largestTileRadius + 1e-4f );
+  }
+}
+
+// Instances straight ahead of the camera at increasing distances switch from
+// mesh to impostor as their projected radius crosses the threshold, through a
+// band where both are drawn with the same visibility
+static void checkInstanceSelection()
+{
+  VDeleter<VkDevice>    device { vkDestroyDevice };
+  DeviceMemoryAllocator allocator( device );
+  ImpostorAtlas         atlas( device, allocator );
+  atlas.center = glm::vec3( 0.0f, 0.0f, 0.5f );
+  atlas.radius = 1.0f;
+
+  const float fovY = glm::radians( 45.0f ), height = 600.0f, threshold = 48.0f, band = 0.25f;
+
+  UniformBufferObject ubo;
+  ubo.model = glm::mat4( 1.0f );
+  ubo.view  = glm::lookAt( glm::vec3( 0.0f, 0.0f, 5.0f ), glm::vec3( 0.0f, 0.0f, 0.0f ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
+  ubo.proj  = glm::perspective( fovY, 4.0f / 3.0f, 0.1f, 1000.0f );
+  ubo.proj[1][1] *= -1;
+
+  // Instance i sits at distance 0.25 * i from the eye; the last one twice as
+  // far with twice the scale, which must look the same as the one before
+  std::vector<glm::vec4> instances;
+  for ( uint32_t i = 0; i < 200; i++ )
+  {
+    instances.push_back( glm::vec4( 0.0f, 0.0f, 5.0f - 0.25f * i - 0.5f, 1.0f ) );
+  }
+  instances.push_back( glm::vec4( 0.0f, 0.0f, 5.0f - 2.0f * 0.25f * 199 - 1.0f, 2.0f ) );
+
+  std::vector<InstanceData> meshes, impostors;
+  selectImpostorInstances( instances, atlas, ubo, height, threshold, band, meshes, impostors );
+
+  // Both lists keep the instance order, so walk them alongside
+  float  focal = height * 0.5f / std::tan( fovY * 0.5f );
+  float  last  = 1.0f;
+  size_t m = 0, n = 0;
+  bool   faded = false;
+  for ( uint32_t i = 0; i < instances.size(); i++ )
+  {
+    float distance = 0.25f * ( i < 200 ? i : 2 * 199 );
+    float expected = 1.0f;
+    if ( distance > instances[i].w )
+    {
+      float screenRadius = instances[i].w * focal / distance;
+      expected = glm::clamp( ( screenRadius - threshold ) / ( threshold * band ), 0.0f, 1.0f );
+    }
+
+    bool inMeshes    = m < meshes.size() && meshes[m].offsetScale == instances[i];
+    bool inImpostors = n < impostors.size() && impostors[n].offsetScale == instances[i];
+    CHECK( inMeshes == ( expected > 0.0f ) );
+    CHECK( inImpostors == ( expected < 1.0f ) );
+
+    float visibility = inMeshes ? meshes[m].params.x : impostors[n].params.x;
+    CHECK( std::fabs( visibility - expected ) < 1e-4f );
+    if ( inMeshes && inImpostors )
+    {
+      CHECK( meshes[m].params.x == impostors[n].params.x );
+      faded = true;
+    }
+    if ( i < 200 )
+    {
+      CHECK( visibility <= last );
+      last = visibility;
+    }
+
+    m += inMeshes;
+    n += inImpostors;
+  }
+  CHECK( m == meshes.size() && n == impostors.size() );
+  CHECK( faded );
+  CHECK( meshes.front().params.x == 1.0f && impostors.back().params.x == 0.0f );
+  CHECK( meshes.size() + impostors.size() > instances.size() );
+}
+
+int main()
+{
+  return runTest( []()
+  {
+    checkViewSelection( IMPOSTOR_VIEWS_PER_SIDE );
+    checkViewSelection( 3 );
+    checkViewSelection( 16 );
+    checkInstanceSelection();
+  } );
+}
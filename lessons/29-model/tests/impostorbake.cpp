@@ -0,0 +1,274 @@
+#include "impostor.hpp"
+#include "check.hpp"
+#include "headless.hpp"
+#include "offscreen.hpp"
+
+const uint32_t BAKE_VIEWS_PER_SIDE = 8;
+const uint32_t BAKE_TILE_SIZE      = 128;
+
+// Unit cube around the origin, every face wound counter-clockwise seen
+// from outside and textured with the middle of the texture
+static void makeCube( std::vector<Vertex>& vertices, std::vector<uint64_t>& indices )
+{
+  const float corners[4][2] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f } };
+
+  for ( uint32_t axis = 0; axis < 3; axis++ )
+  {
+    for ( float side = -1.0f; side <= 1.0f; side += 2.0f )
+    {
+      glm::vec3 normal( 0.0f );
+      glm::vec3 u( 0.0f );
+      normal[axis]          = side;
+      u[ ( axis + 1 ) % 3 ] = 1.0f;
+      glm::vec3 v = glm::cross( normal, u ); // u x v = normal
+
+      uint64_t first = vertices.size();
+      for ( const auto& corner : corners )
+      {
+        Vertex vertex = {};
+        vertex.pos          = 0.5f * ( normal + corner[0] * u + corner[1] * v );
+        vertex.color        = glm::vec3( 1.0f );
+        vertex.texCoord     = glm::vec2( 0.5f );
+        vertex.textureLayer = 0.0f;
+        vertices.push_back( vertex );
+      }
+      for ( uint64_t i : { 0, 1, 2, 0, 2, 3 } )
+      {
+        indices.push_back( first + i );
+      }
+    }
+  }
+}
+
+// Where a ray from origin + s * direction, s in [0, 1], first enters the
+// unit cube: the face normal, and s, which is the depth for an orthographic
+// ray unprojected from the near to the far plane
+static bool castCube( glm::vec3 origin, glm::vec3 direction, glm::vec3& normal, float& s )
+{
+  float enter = -1e30f, leave = 1e30f;
+  for ( uint32_t axis = 0; axis < 3; axis++ )
+  {
+    if ( std::fabs( direction[axis] ) < 1e-9f )
+    {
+      if ( std::fabs( origin[axis] ) > 0.5f )
+      {
+        return false;
+      }
+      continue;
+    }
+
+    float a = ( -0.5f - origin[axis] ) / direction[axis];
+    float b = (  0.5f - origin[axis] ) / direction[axis];
+    if ( std::min( a, b ) > enter )
+    {
+      enter        = std::min( a, b );
+      normal       = glm::vec3( 0.0f );
+      normal[axis] = direction[axis] > 0.0f ? -1.0f : 1.0f;
+    }
+    leave = std::min( leave, std::max( a, b ) );
+  }
+
+  s = enter;
+  return enter <= leave && enter >= 0.0f && enter <= 1.0f;
+}
+
+// Check one tile against the cube seen from its direction, ray casting the
+// center of every pixel through the tile's own camera. Pixels whose four
+// neighbours disagree about the face they see lie within a pixel of an edge
+// and are left out. Returns the covered fraction of the tile.
+static float checkTile( const ImpostorAtlas& atlas, const uint8_t* color, const uint8_t* normalDepth,
+                        uint32_t tx, uint32_t ty )
+{
+  const uint32_t        size      = atlas.tileSize;
+  const uint32_t        rowPixels = atlas.viewsPerSide * size;
+  ImpostorBakeConstants constants = impostorTileConstants( atlas, tx, ty );
+  glm::mat4             unproject = glm::inverse( constants.proj * constants.view );
+
+  // Face seen through pixel (x, y) of the tile, zero for none
+  auto cast = [&]( int32_t x, int32_t y, float& depth ) -> glm::vec3
+  {
+    glm::vec2 ndc( ( x + 0.5f ) / size * 2.0f - 1.0f, ( y + 0.5f ) / size * 2.0f - 1.0f );
+    glm::vec4 near = unproject * glm::vec4( ndc, 0.0f, 1.0f );
+    glm::vec4 far  = unproject * glm::vec4( ndc, 1.0f, 1.0f );
+    glm::vec3 origin( near / near.w );
+
+    glm::vec3 normal( 0.0f );
+    if ( !castCube( origin, glm::vec3( far / far.w ) - origin, normal, depth ) )
+    {
+      return glm::vec3( 0.0f );
+    }
+    return normal;
+  };
+
+  uint32_t covered = 0;
+  for ( int32_t y = 0; y < (int32_t)size; y++ )
+  {
+    for ( int32_t x = 0; x < (int32_t)size; x++ )
+    {
+      size_t         texel = ( (size_t)( ty * size + y ) * rowPixels + tx * size + x ) * 4;
+      const uint8_t* c     = color + texel;
+      const uint8_t* n     = normalDepth + texel;
+      covered += c[3] > 127 ? 1 : 0;
+
+      float     depth, unused;
+      glm::vec3 face = cast( x, y, depth );
+      if ( face != cast( x - 1, y, unused ) || face != cast( x + 1, y, unused ) ||
+           face != cast( x, y - 1, unused ) || face != cast( x, y + 1, unused ) )
+      {
+        continue;
+      }
+
+      if ( face == glm::vec3( 0.0f ) )
+      {
+        // Left as cleared
+        CHECK( c[3] == 0 );
+        CHECK( n[0] == 128 && n[1] == 128 && n[2] == 255 && n[3] == 255 );
+        continue;
+      }
+
+      // White texture, view space normal facing the eye, and window depth
+      CHECK( c[0] == 255 && c[1] == 255 && c[2] == 255 && c[3] == 255 );
+
+      glm::vec3 expected = glm::mat3( constants.view ) * face;
+      glm::vec3 baked    = glm::vec3( n[0], n[1], n[2] ) / 255.0f * 2.0f - 1.0f;
+      CHECK( expected.z > 0.0f );
+      CHECK( glm::dot( glm::normalize( baked ), expected ) > 0.98f );
+      CHECK( std::fabs( n[3] / 255.0f - depth ) <= 2.0f / 255.0f );
+    }
+  }
+
+  return (float)covered / ( size * size );
+}
+
+// Bake a cube into an impostor atlas on a headless device and read both
+// atlas images back. Every tile must show the cube from the direction
+// impostorTileDirection gives it: covering as much of the tile as the cube's
+// projection along that direction, with the normals and depths a ray cast
+// through the same camera finds. Skipped without a Vulkan device.
+int main()
+{
+  HeadlessDevice headless;
+  if ( !headless.create( "lesson29-test-impostorbake" ) )
+  {
+    std::cout << "No Vulkan device, skipping" << std::endl;
+    return TEST_SKIPPED;
+  }
+
+  return runTest( [&headless]()
+  {
+    const VDeleter<VkDevice>& device = headless.device;
+
+    DeviceMemoryAllocator allocator( device );
+    allocator.init( headless.physical, ALLOCATOR_BLOCK_SIZE );
+
+    {
+      UploadContext upload( device, allocator );
+      upload.begin( headless.commandPool );
+
+      TestTexture texture( device, allocator );
+      createTestTexture( headless.physical, device, upload, 1, 1, { 255, 255, 255, 255 }, texture );
+
+      std::vector<Vertex>       vertices;
+      std::vector<uint64_t>     indices;
+      std::vector<GeometryPage> pages;
+      std::vector<GeometryDraw> draws;
+      makeCube( vertices, indices );
+
+      GeometryLimits limits = queryGeometryLimits( headless.physical, GEOMETRY_PAGE_SIZE );
+      createGeometryPages( headless.physical, device, upload,
+                           splitMesh( vertices, indices, limits.maxChunkVertices, limits.maxChunkIndices ),
+                           limits.pageSize, pages, draws );
+
+      // The bake samples the mesh texture at binding 1
+      VkSampler                    sampler        = texture.sampler;
+      VkDescriptorSetLayoutBinding samplerBinding = {};
+      samplerBinding.binding            = 1;
+      samplerBinding.descriptorCount    = 1;
+      samplerBinding.descriptorType     = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      samplerBinding.pImmutableSamplers = &sampler;
+      samplerBinding.stageFlags         = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+      VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+      layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+      layoutInfo.bindingCount = 1;
+      layoutInfo.pBindings    = &samplerBinding;
+
+      VDeleter<VkDescriptorSetLayout> setLayout { device, vkDestroyDescriptorSetLayout };
+      CHECK( vkCreateDescriptorSetLayout( device, &layoutInfo, nullptr, &setLayout ) == VK_SUCCESS );
+
+      VkDescriptorPoolSize poolSize = {};
+      poolSize.type            = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      poolSize.descriptorCount = 1;
+
+      VkDescriptorPoolCreateInfo poolInfo = {};
+      poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+      poolInfo.poolSizeCount = 1;
+      poolInfo.pPoolSizes    = &poolSize;
+      poolInfo.maxSets       = 1;
+
+      VDeleter<VkDescriptorPool> descriptorPool { device, vkDestroyDescriptorPool };
+      CHECK( vkCreateDescriptorPool( device, &poolInfo, nullptr, &descriptorPool ) == VK_SUCCESS );
+
+      VkDescriptorSetLayout       setLayouts[] = { setLayout };
+      VkDescriptorSetAllocateInfo allocInfo    = {};
+      allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      allocInfo.descriptorPool     = descriptorPool;
+      allocInfo.descriptorSetCount = 1;
+      allocInfo.pSetLayouts        = setLayouts;
+
+      VkDescriptorSet descriptorSet;
+      CHECK( vkAllocateDescriptorSets( device, &allocInfo, &descriptorSet ) == VK_SUCCESS );
+
+      VkDescriptorImageInfo imageInfo = {};
+      imageInfo.imageView   = texture.view;
+      imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+      VkWriteDescriptorSet write = {};
+      write.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet          = descriptorSet;
+      write.dstBinding      = 1;
+      write.descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      write.descriptorCount = 1;
+      write.pImageInfo      = &imageInfo;
+      vkUpdateDescriptorSets( device, 1, &write, 0, nullptr );
+
+      ImpostorAtlas atlas( device, allocator );
+      bakeImpostorAtlas( headless.physical, device, upload, setLayout, descriptorSet,
+                         vertices, pages, draws, BAKE_VIEWS_PER_SIDE, BAKE_TILE_SIZE, atlas );
+      CHECK( atlas.center == glm::vec3( 0.0f ) );
+      CHECK( std::fabs( atlas.radius - std::sqrt( 0.75f ) ) < 1e-5f );
+
+      uint32_t           atlasSize = BAKE_VIEWS_PER_SIDE * BAKE_TILE_SIZE;
+      VDeleter<VkBuffer> colorReadback { device, vkDestroyBuffer };
+      MemoryAllocation   colorReadbackMemory { allocator, MEMORY_CATEGORY_READBACK, "atlas color readback" };
+      VDeleter<VkBuffer> normalDepthReadback { device, vkDestroyBuffer };
+      MemoryAllocation   normalDepthReadbackMemory { allocator, MEMORY_CATEGORY_READBACK, "atlas normal depth readback" };
+      recordTestImageReadback( headless.physical, upload, atlas.colorImage, atlasSize, atlasSize,
+                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, colorReadback, colorReadbackMemory );
+      recordTestImageReadback( headless.physical, upload, atlas.normalDepthImage, atlasSize, atlasSize,
+                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, normalDepthReadback, normalDepthReadbackMemory );
+      upload.flush( headless.queue );
+
+      const uint8_t* color       = (const uint8_t*)colorReadbackMemory.map();
+      const uint8_t* normalDepth = (const uint8_t*)normalDepthReadbackMemory.map();
+      float          worstError  = 0.0f;
+      for ( uint32_t ty = 0; ty < BAKE_VIEWS_PER_SIDE; ty++ )
+      {
+        for ( uint32_t tx = 0; tx < BAKE_VIEWS_PER_SIDE; tx++ )
+        {
+          // A unit cube projects to |x| + |y| + |z| along a unit direction,
+          // out of the (2 * radius)^2 = 3 the tile spans, give or take the
+          // pixels along its outline
+          glm::vec3 d        = impostorTileDirection( tx, ty, BAKE_VIEWS_PER_SIDE );
+          float     expected = ( std::fabs( d.x ) + std::fabs( d.y ) + std::fabs( d.z ) ) / 3.0f;
+          float     coverage = checkTile( atlas, color, normalDepth, tx, ty );
+          worstError = std::max( worstError, std::fabs( coverage - expected ) );
+        }
+      }
+
+      std::cout << "Worst tile coverage error " << worstError << std::endl;
+      CHECK( worstError < 0.01f );
+    }
+    allocator.releaseEmptyBlocks();
+  } );
+}
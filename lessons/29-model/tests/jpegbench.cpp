@@ -0,0 +1,136 @@
+#include <chrono>
+#include <cstdlib>
+#include "jpeg.hpp"
+#include "check.hpp"
+#include "jpegenc.hpp"
+
+// Decoder benchmark over the same generated images on every run, with and
+// without chroma subsampling and restart intervals. Reports the median of
+// several RGBA decodes with one thread and with every hardware thread, and
+// of IDCT and color conversion alone over coefficients decoded beforehand.
+// lesson29-jpegbench-scalar is the same benchmark built without SIMD, and
+// both must print the same checksums.
+// Usage: lesson29-jpegbench [repetitions]
+
+struct BenchImage
+{
+  uint32_t          width;
+  uint32_t          height;
+  JpegEncodeOptions options;
+};
+
+template < typename F >
+static float medianMilliseconds( uint32_t repetitions, F run )
+{
+  std::vector<float> times;
+  for ( uint32_t i = 0; i < repetitions; i++ )
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    run();
+    times.push_back( std::chrono::duration<float, std::milli>(
+                       std::chrono::high_resolution_clock::now() - start ).count() );
+  }
+  std::sort( times.begin(), times.end() );
+  return times[ times.size() / 2 ];
+}
+
+// Entropy decode every MCU up front, with the AC masks reconstructJpegMcu takes
+static void decodeAllMcus( const JpegImage& jpeg, std::vector<int16_t>& coefficients, std::vector<uint32_t>& acMasks )
+{
+  const uint32_t totalMcus      = jpeg.mcusX * jpeg.mcusY;
+  const uint32_t mcusPerSegment = jpeg.restartInterval > 0 ? jpeg.restartInterval : totalMcus;
+
+  coefficients.assign( (size_t)totalMcus * jpeg.blocksPerMcu * 64, 0 );
+  acMasks.assign( totalMcus, 0 );
+
+  auto segments = findJpegRestartSegments( jpeg );
+  for ( uint32_t s = 0; s < segments.size() && s * mcusPerSegment < totalMcus; s++ )
+  {
+    JpegBitReader reader( segments[s].first, segments[s].second );
+    int32_t       dcPred[3] = { 0, 0, 0 };
+    uint32_t      last      = std::min( ( s + 1 ) * mcusPerSegment, totalMcus );
+    for ( uint32_t m = s * mcusPerSegment; m < last; m++ )
+    {
+      acMasks[m] = decodeJpegMcu( jpeg, reader, dcPred, &coefficients[ (size_t)m * jpeg.blocksPerMcu * 64 ] );
+    }
+  }
+}
+
+// FNV-1a of the decoded pixels
+static uint64_t checksum( const std::vector<uint8_t>& pixels )
+{
+  uint64_t hash = 14695981039346656037ull;
+  for ( uint8_t value : pixels )
+  {
+    hash = ( hash ^ value ) * 1099511628211ull;
+  }
+  return hash;
+}
+
+int main( int argc, char** argv )
+{
+  return runTest( [argc, argv]()
+  {
+    const uint32_t repetitions = argc > 1 ? std::max( std::atoi( argv[1] ), 1 ) : 7;
+    const uint32_t threads     = std::max( std::thread::hardware_concurrency(), 1u );
+
+    std::vector<BenchImage> images = {
+      { 2048, 2048, { 85, true,  0  } },
+      { 2048, 2048, { 85, true,  32 } },
+      { 1920, 1080, { 90, false, 8  } },
+      { 4096, 1024, { 75, true,  1  } },
+      { 1000, 1000, { 95, false, 0  } },
+    };
+
+#if JPEG_SSE2
+    std::cout << "SSE2, ";
+#else
+    std::cout << "scalar, ";
+#endif
+    std::cout << repetitions << " repetitions, " << threads << " threads" << std::endl;
+
+    for ( uint32_t i = 0; i < images.size(); i++ )
+    {
+      const BenchImage& image = images[i];
+      auto              rgb   = makeJpegTestImage( image.width, image.height, i + 1 );
+      std::vector<char> file  = encodeJpeg( rgb.data(), image.width, image.height, image.options );
+
+      JpegImage jpeg;
+      CHECK( readJpegHeader( file, jpeg ) );
+
+      std::vector<uint8_t> pixels( (size_t)image.width * image.height * 4 );
+      float single = medianMilliseconds( repetitions, [&]()
+      {
+        decodeJpeg( jpeg, pixels.data(), image.width * 4, 4, 1 );
+      } );
+      uint64_t hash = checksum( pixels );
+
+      float parallel = medianMilliseconds( repetitions, [&]()
+      {
+        decodeJpeg( jpeg, pixels.data(), image.width * 4, 4, threads );
+      } );
+      CHECK( checksum( pixels ) == hash );
+
+      std::vector<int16_t>  coefficients;
+      std::vector<uint32_t> acMasks;
+      decodeAllMcus( jpeg, coefficients, acMasks );
+      float reconstruct = medianMilliseconds( repetitions, [&]()
+      {
+        for ( uint32_t m = 0; m < acMasks.size(); m++ )
+        {
+          reconstructJpegMcu( jpeg, &coefficients[ (size_t)m * jpeg.blocksPerMcu * 64 ], acMasks[m],
+                              m % jpeg.mcusX, m / jpeg.mcusX, pixels.data(), image.width * 4, 4 );
+        }
+      } );
+      CHECK( checksum( pixels ) == hash );
+
+      float megapixels = image.width * image.height / 1e6f;
+      std::cout << image.width << "x" << image.height
+                << ( image.options.subsampleChroma ? " 4:2:0" : " 4:4:4" )
+                << " restart " << image.options.restartInterval << ": "
+                << single << " ms (" << megapixels * 1000.0f / single << " MP/s) on 1 thread, "
+                << parallel << " ms on " << threads << ", IDCT and color " << reconstruct << " ms ("
+                << megapixels * 1000.0f / reconstruct << " MP/s), checksum " << std::hex << hash << std::dec << std::endl;
+    }
+  } );
+}
@@ -0,0 +1,456 @@
+#ifndef __JPEGENC_HPP__
+#define __JPEGENC_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Baseline JPEG encoder for generating test images: YCbCr with optional
+// 4:2:0 chroma, the example tables of ITU T.81 Annex K scaled by quality,
+// and an optional restart interval. Slow and simple on purpose; it only
+// has to produce valid files with the features the decoder handles.
+struct JpegEncodeOptions
+{
+  int      quality;
+  bool     subsampleChroma;
+  uint32_t restartInterval; // MCUs per interval, 0 for none
+
+  JpegEncodeOptions( int quality = 85, bool subsampleChroma = true, uint32_t restartInterval = 0 )
+    : quality { quality },
+      subsampleChroma { subsampleChroma },
+      restartInterval { restartInterval }
+  {
+  }
+};
+
+static const uint8_t jpegEncodeZigzag[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static const uint8_t jpegEncodeLumaQuant[64] = {
+  16, 11, 10, 16,  24,  40,  51,  61,
+  12, 12, 14, 19,  26,  58,  60,  55,
+  14, 13, 16, 24,  40,  57,  69,  56,
+  14, 17, 22, 29,  51,  87,  80,  62,
+  18, 22, 37, 56,  68, 109, 103,  77,
+  24, 35, 55, 64,  81, 104, 113,  92,
+  49, 64, 78, 87, 103, 121, 120, 101,
+  72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static const uint8_t jpegEncodeChromaQuant[64] = {
+  17, 18, 24, 47, 99, 99, 99, 99,
+  18, 21, 26, 66, 99, 99, 99, 99,
+  24, 26, 56, 99, 99, 99, 99, 99,
+  47, 66, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99
+};
+
+static const uint8_t jpegEncodeDcCounts[2][16] = {
+  { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+  { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 }
+};
+
+static const uint8_t jpegEncodeDcValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t jpegEncodeAcCounts[2][16] = {
+  { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+  { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 }
+};
+
+static const uint8_t jpegEncodeAcValues[2][162] = {
+  {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+  },
+  {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+  }
+};
+
+struct JpegEncodeTable
+{
+  uint16_t code[256];
+  uint8_t  size[256];
+
+  JpegEncodeTable( const uint8_t counts[16], const uint8_t* values )
+  {
+    std::memset( this->size, 0, sizeof( this->size ) );
+    uint32_t code = 0, k = 0;
+    for ( uint32_t length = 1; length <= 16; length++ )
+    {
+      for ( uint32_t i = 0; i < counts[length - 1]; i++, k++ )
+      {
+        this->code[ values[k] ] = code++;
+        this->size[ values[k] ] = length;
+      }
+      code <<= 1;
+    }
+  }
+};
+
+struct JpegBitWriter
+{
+  std::vector<char>& out;
+  uint32_t           bits  = 0;
+  uint32_t           count = 0;
+
+  JpegBitWriter( std::vector<char>& out ) : out( out ) {}
+
+  void put( uint32_t value, uint32_t length )
+  {
+    for ( uint32_t i = length; i-- > 0; )
+    {
+      this->bits = ( this->bits << 1 ) | ( ( value >> i ) & 1 );
+      if ( ++this->count == 8 )
+      {
+        this->out.push_back( (char)this->bits );
+        if ( this->bits == 0xFF )
+        {
+          this->out.push_back( 0 );
+        }
+        this->bits  = 0;
+        this->count = 0;
+      }
+    }
+  }
+
+  // Pad the last byte with ones
+  void flush()
+  {
+    if ( this->count > 0 )
+    {
+      this->put( 0x7F, 8 - this->count );
+    }
+  }
+};
+
+static void putJpegEncodeU16( std::vector<char>& out, uint32_t value )
+{
+  out.push_back( (char)( value >> 8 ) );
+  out.push_back( (char)value );
+}
+
+// Magnitude category and the bits that follow it
+static void jpegEncodeMagnitude( int value, uint32_t& category, uint32_t& bits )
+{
+  int magnitude = value < 0 ? -value : value;
+  category = 0;
+  while ( magnitude >> category )
+  {
+    category++;
+  }
+  bits = value < 0 ? (uint32_t)( value - 1 ) & ( ( 1u << category ) - 1 ) : (uint32_t)value;
+}
+
+static void encodeJpegBlock( const float           samples[64],
+                             const float           quant[64],
+                             int&                  dc,
+                             const JpegEncodeTable& dcTable,
+                             const JpegEncodeTable& acTable,
+                             JpegBitWriter&        writer )
+{
+  // Separable forward DCT with scaled basis functions; rows, then columns
+  struct Basis
+  {
+    float value[8][8];
+
+    Basis()
+    {
+      for ( int u = 0; u < 8; u++ )
+      {
+        for ( int x = 0; x < 8; x++ )
+        {
+          this->value[u][x] = 0.5f * ( u == 0 ? 0.70710678f : 1.0f ) *
+                              std::cos( ( 2 * x + 1 ) * u * 3.14159265f / 16 );
+        }
+      }
+    }
+  };
+  static const Basis basisTable;
+  const float ( &basis )[8][8] = basisTable.value;
+
+  float rows[64], coefficients[64];
+  for ( int y = 0; y < 8; y++ )
+  {
+    for ( int u = 0; u < 8; u++ )
+    {
+      float sum = 0.0f;
+      for ( int x = 0; x < 8; x++ )
+      {
+        sum += samples[y * 8 + x] * basis[u][x];
+      }
+      rows[y * 8 + u] = sum;
+    }
+  }
+  for ( int v = 0; v < 8; v++ )
+  {
+    for ( int u = 0; u < 8; u++ )
+    {
+      float sum = 0.0f;
+      for ( int y = 0; y < 8; y++ )
+      {
+        sum += rows[y * 8 + u] * basis[v][y];
+      }
+      coefficients[v * 8 + u] = sum;
+    }
+  }
+
+  int zigzagged[64];
+  for ( int k = 0; k < 64; k++ )
+  {
+    int n = jpegEncodeZigzag[k];
+    zigzagged[k] = (int)std::lround( coefficients[n] / quant[n] );
+  }
+
+  uint32_t category, bits;
+  jpegEncodeMagnitude( zigzagged[0] - dc, category, bits );
+  dc = zigzagged[0];
+  writer.put( dcTable.code[category], dcTable.size[category] );
+  writer.put( bits, category );
+
+  int run = 0;
+  for ( int k = 1; k < 64; k++ )
+  {
+    if ( zigzagged[k] == 0 )
+    {
+      run++;
+      continue;
+    }
+    while ( run > 15 )
+    {
+      writer.put( acTable.code[0xF0], acTable.size[0xF0] );
+      run -= 16;
+    }
+    jpegEncodeMagnitude( zigzagged[k], category, bits );
+    uint32_t symbol = ( run << 4 ) | category;
+    writer.put( acTable.code[symbol], acTable.size[symbol] );
+    writer.put( bits, category );
+    run = 0;
+  }
+  if ( run > 0 )
+  {
+    writer.put( acTable.code[0x00], acTable.size[0x00] );
+  }
+}
+
+// Encode width * height RGB8 texels
+std::vector<char> encodeJpeg( const uint8_t*           rgb,
+                              uint32_t                 width,
+                              uint32_t                 height,
+                              const JpegEncodeOptions& options )
+{
+  int   quality = options.quality < 1 ? 1 : options.quality > 100 ? 100 : options.quality;
+  int   scale   = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+  float quant[2][64];
+  uint8_t quantBytes[2][64];
+  for ( int t = 0; t < 2; t++ )
+  {
+    const uint8_t* base = t == 0 ? jpegEncodeLumaQuant : jpegEncodeChromaQuant;
+    for ( int n = 0; n < 64; n++ )
+    {
+      int q = ( base[n] * scale + 50 ) / 100;
+      q = q < 1 ? 1 : q > 255 ? 255 : q;
+      quantBytes[t][n] = (uint8_t)q;
+      quant[t][n]      = (float)q;
+    }
+  }
+
+  uint32_t lumaFactor = options.subsampleChroma ? 2 : 1;
+  uint32_t mcuSize    = 8 * lumaFactor;
+  uint32_t mcusX      = ( width + mcuSize - 1 ) / mcuSize;
+  uint32_t mcusY      = ( height + mcuSize - 1 ) / mcuSize;
+
+  std::vector<char> out;
+  out.push_back( (char)0xFF ); out.push_back( (char)0xD8 );
+
+  // Quantization tables, zigzagged
+  for ( int t = 0; t < 2; t++ )
+  {
+    out.push_back( (char)0xFF ); out.push_back( (char)0xDB );
+    putJpegEncodeU16( out, 67 );
+    out.push_back( (char)t );
+    for ( int k = 0; k < 64; k++ )
+    {
+      out.push_back( (char)quantBytes[t][ jpegEncodeZigzag[k] ] );
+    }
+  }
+
+  out.push_back( (char)0xFF ); out.push_back( (char)0xC0 );
+  putJpegEncodeU16( out, 17 );
+  out.push_back( 8 );
+  putJpegEncodeU16( out, height );
+  putJpegEncodeU16( out, width );
+  out.push_back( 3 );
+  for ( int c = 0; c < 3; c++ )
+  {
+    out.push_back( (char)( c + 1 ) );
+    out.push_back( (char)( c == 0 ? ( lumaFactor << 4 ) | lumaFactor : 0x11 ) );
+    out.push_back( (char)( c == 0 ? 0 : 1 ) );
+  }
+
+  for ( int t = 0; t < 2; t++ )
+  {
+    uint32_t acCount = 0;
+    for ( int i = 0; i < 16; i++ )
+    {
+      acCount += jpegEncodeAcCounts[t][i];
+    }
+
+    out.push_back( (char)0xFF ); out.push_back( (char)0xC4 );
+    putJpegEncodeU16( out, 2 + 17 + 12 + 17 + acCount );
+    out.push_back( (char)t );
+    out.insert( out.end(), jpegEncodeDcCounts[t], jpegEncodeDcCounts[t] + 16 );
+    out.insert( out.end(), jpegEncodeDcValues, jpegEncodeDcValues + 12 );
+    out.push_back( (char)( 0x10 | t ) );
+    out.insert( out.end(), jpegEncodeAcCounts[t], jpegEncodeAcCounts[t] + 16 );
+    out.insert( out.end(), jpegEncodeAcValues[t], jpegEncodeAcValues[t] + acCount );
+  }
+
+  if ( options.restartInterval > 0 )
+  {
+    out.push_back( (char)0xFF ); out.push_back( (char)0xDD );
+    putJpegEncodeU16( out, 4 );
+    putJpegEncodeU16( out, options.restartInterval );
+  }
+
+  out.push_back( (char)0xFF ); out.push_back( (char)0xDA );
+  putJpegEncodeU16( out, 12 );
+  out.push_back( 3 );
+  for ( int c = 0; c < 3; c++ )
+  {
+    out.push_back( (char)( c + 1 ) );
+    out.push_back( (char)( c == 0 ? 0x00 : 0x11 ) );
+  }
+  out.push_back( 0 ); out.push_back( 63 ); out.push_back( 0 );
+
+  JpegEncodeTable dcTables[2] = { JpegEncodeTable( jpegEncodeDcCounts[0], jpegEncodeDcValues ),
+                                  JpegEncodeTable( jpegEncodeDcCounts[1], jpegEncodeDcValues ) };
+  JpegEncodeTable acTables[2] = { JpegEncodeTable( jpegEncodeAcCounts[0], jpegEncodeAcValues[0] ),
+                                  JpegEncodeTable( jpegEncodeAcCounts[1], jpegEncodeAcValues[1] ) };
+
+  // Full resolution planes of the MCU, edge texels repeated
+  std::vector<float> planes[3];
+  for ( auto& plane : planes )
+  {
+    plane.resize( mcuSize * mcuSize );
+  }
+
+  JpegBitWriter writer( out );
+  int           dc[3]    = { 0, 0, 0 };
+  uint32_t      mcuCount = mcusX * mcusY;
+  for ( uint32_t mcu = 0; mcu < mcuCount; mcu++ )
+  {
+    if ( options.restartInterval > 0 && mcu > 0 && mcu % options.restartInterval == 0 )
+    {
+      writer.flush();
+      out.push_back( (char)0xFF );
+      out.push_back( (char)( 0xD0 + ( mcu / options.restartInterval - 1 ) % 8 ) );
+      dc[0] = dc[1] = dc[2] = 0;
+    }
+
+    uint32_t mx = mcu % mcusX, my = mcu / mcusX;
+    for ( uint32_t y = 0; y < mcuSize; y++ )
+    {
+      for ( uint32_t x = 0; x < mcuSize; x++ )
+      {
+        uint32_t       sx = std::min( mx * mcuSize + x, width - 1 );
+        uint32_t       sy = std::min( my * mcuSize + y, height - 1 );
+        const uint8_t* p  = rgb + ( (size_t)sy * width + sx ) * 3;
+        float          r  = p[0], g = p[1], b = p[2];
+        planes[0][y * mcuSize + x] =  0.299f    * r + 0.587f    * g + 0.114f    * b - 128.0f;
+        planes[1][y * mcuSize + x] = -0.168736f * r - 0.331264f * g + 0.5f      * b;
+        planes[2][y * mcuSize + x] =  0.5f      * r - 0.418688f * g - 0.081312f * b;
+      }
+    }
+
+    float block[64];
+    for ( uint32_t by = 0; by < lumaFactor; by++ )
+    {
+      for ( uint32_t bx = 0; bx < lumaFactor; bx++ )
+      {
+        for ( int i = 0; i < 64; i++ )
+        {
+          block[i] = planes[0][( by * 8 + i / 8 ) * mcuSize + bx * 8 + i % 8];
+        }
+        encodeJpegBlock( block, quant[0], dc[0], dcTables[0], acTables[0], writer );
+      }
+    }
+
+    // Chroma averaged over lumaFactor squared texels
+    for ( int c = 1; c < 3; c++ )
+    {
+      for ( int i = 0; i < 64; i++ )
+      {
+        float sum = 0.0f;
+        for ( uint32_t dy = 0; dy < lumaFactor; dy++ )
+        {
+          for ( uint32_t dx = 0; dx < lumaFactor; dx++ )
+          {
+            sum += planes[c][( ( i / 8 ) * lumaFactor + dy ) * mcuSize + ( i % 8 ) * lumaFactor + dx];
+          }
+        }
+        block[i] = sum / ( lumaFactor * lumaFactor );
+      }
+      encodeJpegBlock( block, quant[1], dc[c], dcTables[1], acTables[1], writer );
+    }
+  }
+
+  writer.flush();
+  out.push_back( (char)0xFF ); out.push_back( (char)0xD9 );
+  return out;
+}
+
+// Smooth gradients with a few hard edges and some noise, so every
+// coefficient range and both Huffman table kinds get exercised
+std::vector<uint8_t> makeJpegTestImage( uint32_t width, uint32_t height, uint32_t seed )
+{
+  std::vector<uint8_t> rgb( (size_t)width * height * 3 );
+  uint32_t state = seed * 2654435761u + 1;
+  for ( uint32_t y = 0; y < height; y++ )
+  {
+    for ( uint32_t x = 0; x < width; x++ )
+    {
+      state = state * 1664525u + 1013904223u;
+      int      noise = (int)( state >> 28 ) - 8;
+      bool     edge  = ( ( x / 37 ) + ( y / 23 ) + seed ) % 5 == 0;
+      uint8_t* p     = &rgb[( (size_t)y * width + x ) * 3];
+      int      r     = (int)( 255 * x / std::max( width - 1, 1u ) );
+      int      g     = (int)( 255 * y / std::max( height - 1, 1u ) );
+      int      b     = edge ? 230 : (int)( 128 + 100 * std::sin( ( x + y + seed ) * 0.05f ) );
+      p[0] = (uint8_t)std::min( std::max( r + noise, 0 ), 255 );
+      p[1] = (uint8_t)std::min( std::max( g + noise, 0 ), 255 );
+      p[2] = (uint8_t)std::min( std::max( b + noise, 0 ), 255 );
+    }
+  }
+  return rgb;
+}
+
+#endif
@@ -0,0 +1,109 @@
+#include "jpeggpu.hpp"
+#include "check.hpp"
+#include "headless.hpp"
+#include "jpegenc.hpp"
+
+struct TestImage
+{
+  uint32_t          width;
+  uint32_t          height;
+  JpegEncodeOptions options;
+};
+
+struct PixelErrors
+{
+  float meanError = 0.0f;
+  int   maxError  = 0;
+};
+
+static PixelErrors comparePixels( const uint8_t* actual, const uint8_t* expected, size_t count )
+{
+  PixelErrors errors;
+  uint64_t    total = 0;
+  for ( size_t i = 0; i < count; i++ )
+  {
+    int error = std::abs( (int)actual[i] - (int)expected[i] );
+    total           += error;
+    errors.maxError  = std::max( errors.maxError, error );
+  }
+  errors.meanError = (float)total / count;
+  return errors;
+}
+
+// Reconstruct a generated JPEG with jpegidct.comp and compare it with the
+// CPU decoder, which runs the same arithmetic and may only differ where
+// float rounding lands on the other side of a level, and with stb_image,
+// which interpolates subsampled chroma where both replicate it
+static void checkImage( const HeadlessDevice& headless, DeviceMemoryAllocator& allocator,
+                        const TestImage& image, uint32_t seed )
+{
+  auto              rgb  = makeJpegTestImage( image.width, image.height, seed );
+  std::vector<char> file = encodeJpeg( rgb.data(), image.width, image.height, image.options );
+
+  JpegImage jpeg;
+  CHECK( readJpegHeader( file, jpeg ) );
+  CHECK( jpeg.width == image.width && jpeg.height == image.height );
+
+  size_t               count = (size_t)image.width * image.height * 4;
+  std::vector<uint8_t> device( count ), cpu( count );
+
+  JpegCoefficients coefficients;
+  decodeJpegCoefficients( jpeg, coefficients, 4 );
+  decodeJpegOnDevice( headless.physical, headless.device, allocator, headless.queue,
+                      headless.commandPool, jpeg, coefficients, device.data() );
+  decodeJpeg( jpeg, cpu.data(), image.width * 4, 4, 4 );
+
+  int      width, height, channels;
+  stbi_uc* reference = stbi_load_from_memory( (const stbi_uc*)file.data(), file.size(),
+                                              &width, &height, &channels, STBI_rgb_alpha );
+  CHECK( reference != nullptr );
+  PixelErrors stb = comparePixels( device.data(), reference, count );
+  stbi_image_free( reference );
+
+  PixelErrors decoder = comparePixels( device.data(), cpu.data(), count );
+  std::cout << image.width << "x" << image.height
+            << ( image.options.subsampleChroma ? " 4:2:0" : " 4:4:4" )
+            << " restart " << image.options.restartInterval
+            << ": against the CPU decoder mean error " << decoder.meanError << ", max error " << decoder.maxError
+            << "; against stb_image mean error " << stb.meanError << ", max error " << stb.maxError << std::endl;
+
+  CHECK( decoder.maxError <= 2 && decoder.meanError <= 0.05f );
+  CHECK( stb.meanError <= ( image.options.subsampleChroma ? 2.0f : JPEG_GPU_VALIDATE_MEAN_ERROR ) );
+  for ( size_t i = 3; i < count; i += 4 )
+  {
+    CHECK( device[i] == 255 );
+  }
+}
+
+// Compile jpegidct.comp, reconstruct JPEGs of every layout the decoder
+// takes on a headless device and read them back. Skipped without a Vulkan
+// device.
+int main()
+{
+  HeadlessDevice headless;
+  if ( !headless.create( "lesson29-test-jpeggpu" ) )
+  {
+    std::cout << "No Vulkan device, skipping" << std::endl;
+    return TEST_SKIPPED;
+  }
+
+  return runTest( [&headless]()
+  {
+    DeviceMemoryAllocator allocator( headless.device );
+    allocator.init( headless.physical, ALLOCATOR_BLOCK_SIZE );
+
+    std::vector<TestImage> images = {
+      { 640,  480, { 85, true,  0  } },
+      { 333,  217, { 90, false, 3  } },
+      { 1024, 512, { 75, true,  16 } },
+      { 17,   9,   { 95, false, 1  } },
+      { 96,   64,  { 95, false, 0  } },
+      { 1500, 300, { 50, true,  7  } },
+    };
+    for ( uint32_t i = 0; i < images.size(); i++ )
+    {
+      checkImage( headless, allocator, images[i], i + 1 );
+    }
+    allocator.releaseEmptyBlocks();
+  } );
+}
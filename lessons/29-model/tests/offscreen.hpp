@@ -0,0 +1,127 @@
+#ifndef __OFFSCREEN_HPP__
+#define __OFFSCREEN_HPP__
+
+#include "base-includes.hpp"
+#include "buffer.hpp"
+#include "texture.hpp"
+#include "imgview.hpp"
+#include "mipmap.hpp"
+#include "upload.hpp"
+
+// Pieces shared by checks that render offscreen on a HeadlessDevice: a
+// small texture for the shaders to sample and readback of what they drew
+
+// Single layer RGBA8 texture array, sampled with nearest filtering so
+// every texel reads back exactly
+struct TestTexture
+{
+  TestTexture( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : image   { device, vkDestroyImage },
+      memory  { allocator, MEMORY_CATEGORY_TEXTURE, "test texture" },
+      view    { device, vkDestroyImageView },
+      sampler { device, vkDestroySampler }
+  {
+  }
+
+  VDeleter<VkImage>     image;
+  MemoryAllocation      memory;
+  VDeleter<VkImageView> view;
+  VDeleter<VkSampler>   sampler;
+};
+
+// Record uploading width x height texels, which repeat across UV space
+void createTestTexture( VkPhysicalDevice            physical,
+                        const VDeleter<VkDevice>&   device,
+                        UploadContext&              upload,
+                        uint32_t                    width,
+                        uint32_t                    height,
+                        const std::vector<uint8_t>& rgba,
+                        TestTexture&                texture )
+{
+  createImage( physical, device, width, height, 1, 1,
+               VK_FORMAT_R8G8B8A8_UNORM,
+               VK_IMAGE_TILING_OPTIMAL,
+               VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+               MEMORY_USAGE_GPU_ONLY,
+               texture.image,
+               texture.memory );
+
+  StagingRange staging = upload.createStagingBuffer( physical, rgba.size() );
+  std::memcpy( staging.data, rgba.data(), rgba.size() );
+
+  VkBufferImageCopy region = {};
+  region.bufferOffset                    = staging.offset;
+  region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel       = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount     = 1;
+  region.imageExtent                     = { width, height, 1 };
+  copyBufferToImage( upload, staging.buffer, texture.image, 0, 1, 1, { region },
+                     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL );
+
+  createImageView( device, texture.image, VK_IMAGE_VIEW_TYPE_2D_ARRAY, VK_FORMAT_R8G8B8A8_UNORM,
+                   VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 1, texture.view );
+
+  VkSamplerCreateInfo samplerInfo = {};
+  samplerInfo.sType         = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter     = VK_FILTER_NEAREST;
+  samplerInfo.minFilter     = VK_FILTER_NEAREST;
+  samplerInfo.addressModeU  = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeV  = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeW  = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.maxAnisotropy = 1.0f;
+  samplerInfo.mipmapMode    = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.minLod        = 0.0f;
+  samplerInfo.maxLod        = 0.0f;
+
+  if ( vkCreateSampler( device, &samplerInfo, nullptr, &texture.sampler ) != VK_SUCCESS )
+  {
+    throw std::runtime_error( "Failed to create test texture sampler!" );
+  }
+}
+
+// Record copying a width x height RGBA8 image in layout, after whatever
+// wrote it last, into a host readable buffer. Map memory once the upload
+// has been flushed. Leaves the image in TRANSFER_SRC_OPTIMAL.
+void recordTestImageReadback( VkPhysicalDevice    physical,
+                              UploadContext&      upload,
+                              VkImage             image,
+                              uint32_t            width,
+                              uint32_t            height,
+                              VkImageLayout       layout,
+                              VDeleter<VkBuffer>& buffer,
+                              MemoryAllocation&   memory )
+{
+  createBuffer( upload.device, physical, (VkDeviceSize)width * height * 4,
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT, MEMORY_USAGE_READBACK, buffer, memory );
+
+  auto toSrc = mipBarrier( image, 0, 1,
+                           layout,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           VK_ACCESS_MEMORY_WRITE_BIT,
+                           VK_ACCESS_TRANSFER_READ_BIT );
+  vkCmdPipelineBarrier( upload.commandBuffer,
+                        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        0, 0, nullptr, 0, nullptr, 1, &toSrc );
+
+  VkBufferImageCopy region = {};
+  region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel       = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount     = 1;
+  region.imageExtent                     = { width, height, 1 };
+  vkCmdCopyImageToBuffer( upload.commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                          buffer, 1, &region );
+
+  VkMemoryBarrier toHost = {};
+  toHost.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier( upload.commandBuffer,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_HOST_BIT,
+                        0, 1, &toHost, 0, nullptr, 0, nullptr );
+}
+
+#endif
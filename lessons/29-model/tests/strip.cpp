@@ -0,0 +1,157 @@
+#include <array>
+#include <set>
+#include <random>
+#include "strip.hpp"
+#include "check.hpp"
+
+typedef std::array<uint32_t, 3> Triangle;
+
+// Rotate so the smallest index comes first; rotations keep the winding
+static Triangle canonical( uint32_t a, uint32_t b, uint32_t c )
+{
+  if ( b < a && b <= c )
+  {
+    return Triangle { { b, c, a } };
+  }
+  if ( c < a && c < b )
+  {
+    return Triangle { { c, a, b } };
+  }
+  return Triangle { { a, b, c } };
+}
+
+static std::multiset<Triangle> listTriangles( const std::vector<uint32_t>& list )
+{
+  std::multiset<Triangle> triangles;
+  for ( size_t i = 0; i + 2 < list.size(); i += 3 )
+  {
+    triangles.insert( canonical( list[i], list[i + 1], list[i + 2] ) );
+  }
+  return triangles;
+}
+
+// Triangles a restart-joined strip draws, as the GPU assembles them: odd
+// triangles of each strip swap their last two vertices, and triangles with
+// a repeated vertex are dropped as they cover no area
+static std::multiset<Triangle> stripTriangles( const std::vector<uint32_t>& strip )
+{
+  std::multiset<Triangle> triangles;
+  size_t                  start = 0;
+  for ( size_t i = 0; i <= strip.size(); i++ )
+  {
+    if ( i < strip.size() && strip[i] != PRIMITIVE_RESTART_INDEX )
+    {
+      continue;
+    }
+    for ( size_t k = start; k + 2 < i; k++ )
+    {
+      uint32_t a = strip[k], b = strip[k + 1], c = strip[k + 2];
+      if ( ( k - start ) % 2 == 1 )
+      {
+        std::swap( b, c );
+      }
+      if ( a != b && b != c && a != c )
+      {
+        triangles.insert( canonical( a, b, c ) );
+      }
+    }
+    start = i + 1;
+  }
+  return triangles;
+}
+
+// Encode the list and check the encoding draws exactly the same triangles
+// with the same winding. Returns the encoding chosen.
+static IndexEncoding checkRoundTrip( const std::vector<uint32_t>& list )
+{
+  std::vector<uint32_t> strip = stripifyTriangles( list );
+  CHECK( stripTriangles( strip ) == listTriangles( list ) );
+
+  EncodedIndices encoded = encodeIndices( list );
+  CHECK( encoded.indices.size() <= list.size() );
+  if ( encoded.encoding == INDEX_ENCODING_TRIANGLE_STRIP )
+  {
+    CHECK( stripTriangles( encoded.indices ) == listTriangles( list ) );
+  }
+  else
+  {
+    CHECK( encoded.indices == list );
+  }
+  return encoded.encoding;
+}
+
+// Two triangles per cell of a size by size grid, in shuffled order
+static std::vector<uint32_t> gridTriangles( uint32_t size, std::mt19937& random )
+{
+  std::vector<Triangle> cells;
+  for ( uint32_t y = 0; y < size; y++ )
+  {
+    for ( uint32_t x = 0; x < size; x++ )
+    {
+      uint32_t i = y * ( size + 1 ) + x;
+      cells.push_back( Triangle { { i, i + 1, i + size + 1 } } );
+      cells.push_back( Triangle { { i + 1, i + size + 2, i + size + 1 } } );
+    }
+  }
+  std::shuffle( cells.begin(), cells.end(), random );
+
+  std::vector<uint32_t> list;
+  for ( const Triangle& triangle : cells )
+  {
+    list.insert( list.end(), triangle.begin(), triangle.end() );
+  }
+  return list;
+}
+
+// Strips must reproduce every triangle of the list exactly once with its
+// winding, whether the mesh strips well, badly or mixes both windings
+int main()
+{
+  return runTest( []()
+  {
+    std::mt19937 random( 1 );
+
+    // A grid strips well
+    CHECK( checkRoundTrip( gridTriangles( 64, random ) ) == INDEX_ENCODING_TRIANGLE_STRIP );
+
+    // Some triangles flipped, so shared edges often run the same direction
+    std::vector<uint32_t> flipped = gridTriangles( 32, random );
+    for ( size_t i = 0; i < flipped.size(); i += 3 )
+    {
+      if ( random() % 4 == 0 )
+      {
+        std::swap( flipped[i + 1], flipped[i + 2] );
+      }
+    }
+    checkRoundTrip( flipped );
+
+    // The same triangle twice, once per winding, and a repeated triangle
+    std::vector<uint32_t> doubled = gridTriangles( 8, random );
+    doubled.insert( doubled.end(), { 0, 1, 9, 0, 9, 1, 0, 1, 9 } );
+    checkRoundTrip( doubled );
+
+    // Disjoint triangles share no edges and stay a list
+    std::vector<uint32_t> disjoint;
+    for ( uint32_t i = 0; i < 300; i++ )
+    {
+      disjoint.push_back( random() % 1000 * 3 );
+      disjoint.push_back( random() % 1000 * 3 + 1 );
+      disjoint.push_back( random() % 1000 * 3 + 2 );
+    }
+    CHECK( checkRoundTrip( disjoint ) == INDEX_ENCODING_TRIANGLE_LIST );
+
+    // Random triangles over few vertices share many edges in both directions
+    std::vector<uint32_t> dense;
+    while ( dense.size() < 3 * 2000 )
+    {
+      uint32_t a = random() % 40, b = random() % 40, c = random() % 40;
+      if ( a != b && b != c && a != c )
+      {
+        dense.insert( dense.end(), { a, b, c } );
+      }
+    }
+    checkRoundTrip( dense );
+
+    checkRoundTrip( std::vector<uint32_t>() );
+  } );
+}
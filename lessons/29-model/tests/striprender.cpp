@@ -0,0 +1,405 @@
+#include <algorithm>
+#include <cmath>
+#include "meshpipeline.hpp"
+#include "strip.hpp"
+#include "ubo.hpp"
+#include "check.hpp"
+#include "headless.hpp"
+#include "offscreen.hpp"
+
+const uint32_t RENDER_SIZE    = 256;
+const uint32_t GRID_QUADS     = 32;
+const uint32_t TEXTURE_TEXELS = 4;
+
+// Colour and depth image rendered into, left in TRANSFER_SRC_OPTIMAL
+struct RenderTarget
+{
+  RenderTarget( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : colorImage       { device, vkDestroyImage },
+      colorImageMemory { allocator, MEMORY_CATEGORY_ATTACHMENT, "strip test color" },
+      colorImageView   { device, vkDestroyImageView },
+      depthImage       { device, vkDestroyImage },
+      depthImageMemory { allocator, MEMORY_CATEGORY_ATTACHMENT, "strip test depth" },
+      depthImageView   { device, vkDestroyImageView },
+      framebuffer      { device, vkDestroyFramebuffer }
+  {
+  }
+
+  VDeleter<VkImage>       colorImage;
+  MemoryAllocation        colorImageMemory;
+  VDeleter<VkImageView>   colorImageView;
+  VDeleter<VkImage>       depthImage;
+  MemoryAllocation        depthImageMemory;
+  VDeleter<VkImageView>   depthImageView;
+  VDeleter<VkFramebuffer> framebuffer;
+};
+
+// Wavy height field facing +z, wound counter-clockwise seen from above,
+// with texture coordinates repeating the test texture across it
+static void makeHeightField( std::vector<Vertex>& vertices, std::vector<uint32_t>& triangles )
+{
+  for ( uint32_t y = 0; y <= GRID_QUADS; y++ )
+  {
+    for ( uint32_t x = 0; x <= GRID_QUADS; x++ )
+    {
+      float u = (float)x / GRID_QUADS;
+      float v = (float)y / GRID_QUADS;
+
+      Vertex vertex = {};
+      vertex.pos          = glm::vec3( u * 2.0f - 1.0f, v * 2.0f - 1.0f,
+                                       0.2f * std::sin( u * 9.0f ) * std::cos( v * 7.0f ) );
+      vertex.color        = glm::vec3( 1.0f );
+      vertex.texCoord     = glm::vec2( u, v ) * 3.0f;
+      vertex.textureLayer = 0.0f;
+      vertices.push_back( vertex );
+    }
+  }
+
+  const uint32_t row = GRID_QUADS + 1;
+  for ( uint32_t y = 0; y < GRID_QUADS; y++ )
+  {
+    for ( uint32_t x = 0; x < GRID_QUADS; x++ )
+    {
+      uint32_t i = y * row + x;
+      for ( uint32_t index : { i, i + 1, i + row + 1, i, i + row + 1, i + row } )
+      {
+        triangles.push_back( index );
+      }
+    }
+  }
+}
+
+// Record writing data into a new device local buffer
+static void uploadTestBuffer( VkPhysicalDevice    physical,
+                              UploadContext&      upload,
+                              const char*         name,
+                              const void*         data,
+                              VkDeviceSize        size,
+                              VkBufferUsageFlags  usage,
+                              VDeleter<VkBuffer>& buffer,
+                              MemoryAllocation&   memory )
+{
+  BufferWrite write = upload.beginBufferWrite( physical, name, size, usage, buffer, memory );
+  std::memcpy( write.data, data, size );
+  upload.finishBufferWrite( physical, write );
+}
+
+// Single subpass pass like the main one, but keeping colour for readback
+static void createTestRenderPass( VkPhysicalDevice physical, VkDevice device, VDeleter<VkRenderPass>& renderPass )
+{
+  std::array<VkAttachmentDescription, 2> attachments = {};
+  attachments[0].format         = VK_FORMAT_R8G8B8A8_UNORM;
+  attachments[0].samples        = VK_SAMPLE_COUNT_1_BIT;
+  attachments[0].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[0].storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
+  attachments[0].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[0].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachments[0].finalLayout    = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+  attachments[1].format         = findDepthFormat( physical );
+  attachments[1].samples        = VK_SAMPLE_COUNT_1_BIT;
+  attachments[1].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[1].storeOp        = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[1].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[1].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachments[1].finalLayout    = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference colorAttachmentRef = {};
+  colorAttachmentRef.attachment = 0;
+  colorAttachmentRef.layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference depthAttachmentRef = {};
+  depthAttachmentRef.attachment = 1;
+  depthAttachmentRef.layout     = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpassDesc = {};
+  subpassDesc.pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpassDesc.colorAttachmentCount    = 1;
+  subpassDesc.pColorAttachments       = &colorAttachmentRef;
+  subpassDesc.pDepthStencilAttachment = &depthAttachmentRef;
+
+  VkRenderPassCreateInfo renderPassCreateInfo = {};
+  renderPassCreateInfo.sType           = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassCreateInfo.attachmentCount = attachments.size();
+  renderPassCreateInfo.pAttachments    = attachments.data();
+  renderPassCreateInfo.subpassCount    = 1;
+  renderPassCreateInfo.pSubpasses      = &subpassDesc;
+
+  CHECK( vkCreateRenderPass( device, &renderPassCreateInfo, nullptr, &renderPass ) == VK_SUCCESS );
+}
+
+static void createRenderTarget( VkPhysicalDevice          physical,
+                                const VDeleter<VkDevice>& device,
+                                VkRenderPass              renderPass,
+                                RenderTarget&             target )
+{
+  VkFormat depthFormat = findDepthFormat( physical );
+
+  createImage( physical, device, RENDER_SIZE, RENDER_SIZE, 1, 1,
+               VK_FORMAT_R8G8B8A8_UNORM,
+               VK_IMAGE_TILING_OPTIMAL,
+               VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+               MEMORY_USAGE_GPU_ONLY,
+               target.colorImage,
+               target.colorImageMemory );
+  createImage( physical, device, RENDER_SIZE, RENDER_SIZE, 1, 1,
+               depthFormat,
+               VK_IMAGE_TILING_OPTIMAL,
+               VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+               MEMORY_USAGE_GPU_ONLY,
+               target.depthImage,
+               target.depthImageMemory );
+
+  createImageView( device, target.colorImage, VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM,
+                   VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 1, target.colorImageView );
+  createImageView( device, target.depthImage, VK_IMAGE_VIEW_TYPE_2D, depthFormat,
+                   VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 1, target.depthImageView );
+
+  std::array<VkImageView, 2> attachments = { target.colorImageView, target.depthImageView };
+
+  VkFramebufferCreateInfo framebufferCreateInfo = {};
+  framebufferCreateInfo.sType           = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferCreateInfo.renderPass      = renderPass;
+  framebufferCreateInfo.attachmentCount = attachments.size();
+  framebufferCreateInfo.pAttachments    = attachments.data();
+  framebufferCreateInfo.width           = RENDER_SIZE;
+  framebufferCreateInfo.height          = RENDER_SIZE;
+  framebufferCreateInfo.layers          = 1;
+
+  CHECK( vkCreateFramebuffer( device, &framebufferCreateInfo, nullptr, &target.framebuffer ) == VK_SUCCESS );
+}
+
+// Render a textured height field offscreen twice with the pipelines the
+// lesson draws mesh pages with: once as a triangle list through the list
+// pipeline, once stripified into restart-joined strips through the strip
+// pipeline. Both images must match pixel for pixel. Skipped without a
+// Vulkan device.
+int main()
+{
+  HeadlessDevice headless;
+  if ( !headless.create( "lesson29-test-striprender" ) )
+  {
+    std::cout << "No Vulkan device, skipping" << std::endl;
+    return TEST_SKIPPED;
+  }
+
+  return runTest( [&headless]()
+  {
+    const VDeleter<VkDevice>& device   = headless.device;
+    VkPhysicalDevice          physical = headless.physical;
+
+    DeviceMemoryAllocator allocator( device );
+    allocator.init( physical, ALLOCATOR_BLOCK_SIZE );
+
+    {
+      UploadContext upload( device, allocator );
+      upload.begin( headless.commandPool );
+
+      // Distinct texels, so a triangle drawn with other texture
+      // coordinates shows
+      std::vector<uint8_t> texels;
+      for ( uint32_t i = 0; i < TEXTURE_TEXELS * TEXTURE_TEXELS; i++ )
+      {
+        texels.insert( texels.end(), { (uint8_t)( 40 + i * 13 ), (uint8_t)( 255 - i * 11 ), (uint8_t)( i * 16 ), 255 } );
+      }
+      TestTexture texture( device, allocator );
+      createTestTexture( physical, device, upload, TEXTURE_TEXELS, TEXTURE_TEXELS, texels, texture );
+
+      std::vector<Vertex>   vertices;
+      std::vector<uint32_t> listIndices;
+      makeHeightField( vertices, listIndices );
+      std::vector<uint32_t> stripIndices = stripifyTriangles( listIndices );
+      CHECK( stripIndices.size() < listIndices.size() );
+      CHECK( std::find( stripIndices.begin(), stripIndices.end(), PRIMITIVE_RESTART_INDEX ) != stripIndices.end() );
+
+      InstanceData instance = {};
+      instance.offsetScale = glm::vec4( 0.0f, 0.0f, 0.0f, 1.0f );
+      instance.params      = glm::vec4( 1.0f, 0.0f, 0.0f, 0.0f ); // Fully visible, never dithered away
+
+      VDeleter<VkBuffer> vertexBuffer       { device, vkDestroyBuffer };
+      MemoryAllocation   vertexBufferMemory { allocator, MEMORY_CATEGORY_GEOMETRY, "strip test vertices" };
+      VDeleter<VkBuffer> instanceBuffer       { device, vkDestroyBuffer };
+      MemoryAllocation   instanceBufferMemory { allocator, MEMORY_CATEGORY_GEOMETRY, "strip test instance" };
+      VDeleter<VkBuffer> listBuffer       { device, vkDestroyBuffer };
+      MemoryAllocation   listBufferMemory { allocator, MEMORY_CATEGORY_GEOMETRY, "strip test list indices" };
+      VDeleter<VkBuffer> stripBuffer       { device, vkDestroyBuffer };
+      MemoryAllocation   stripBufferMemory { allocator, MEMORY_CATEGORY_GEOMETRY, "strip test strip indices" };
+      uploadTestBuffer( physical, upload, "strip test vertices", vertices.data(),
+                        vertices.size() * sizeof( Vertex ), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                        vertexBuffer, vertexBufferMemory );
+      uploadTestBuffer( physical, upload, "strip test instance", &instance,
+                        sizeof( instance ), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                        instanceBuffer, instanceBufferMemory );
+      uploadTestBuffer( physical, upload, "strip test list indices", listIndices.data(),
+                        listIndices.size() * sizeof( uint32_t ), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                        listBuffer, listBufferMemory );
+      uploadTestBuffer( physical, upload, "strip test strip indices", stripIndices.data(),
+                        stripIndices.size() * sizeof( uint32_t ), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                        stripBuffer, stripBufferMemory );
+
+      VkMemoryBarrier barrier = {};
+      barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+      vkCmdPipelineBarrier( upload.commandBuffer,
+                            VK_PIPELINE_STAGE_TRANSFER_BIT,
+                            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                            0, 1, &barrier, 0, nullptr, 0, nullptr );
+
+      // Oblique camera over the height field, set up like the main one
+      UniformBufferObject ubo = {};
+      ubo.model = glm::mat4( 1.0f );
+      ubo.view  = glm::lookAt( glm::vec3( 0.0f, -2.2f, 1.8f ), glm::vec3( 0.0f ), glm::vec3( 0.0f, 0.0f, 1.0f ) );
+      ubo.proj  = glm::perspective( glm::radians( 45.0f ), 1.0f, 0.1f, 10.0f );
+      ubo.proj[1][1] *= -1;
+
+      VDeleter<VkBuffer> uniformBuffer       { device, vkDestroyBuffer };
+      MemoryAllocation   uniformBufferMemory { allocator, MEMORY_CATEGORY_UNIFORM, "strip test uniforms" };
+      createBuffer( device, physical, sizeof( ubo ), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                    MEMORY_USAGE_DYNAMIC, uniformBuffer, uniformBufferMemory );
+      std::memcpy( uniformBufferMemory.map(), &ubo, sizeof( ubo ) );
+
+      // Same bindings the lesson's mesh pipelines are laid out for
+      VkSampler                                   sampler  = texture.sampler;
+      std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+      bindings[0].binding            = 0;
+      bindings[0].descriptorCount    = 1;
+      bindings[0].descriptorType     = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+      bindings[0].stageFlags         = VK_SHADER_STAGE_VERTEX_BIT;
+      bindings[1].binding            = 1;
+      bindings[1].descriptorCount    = 1;
+      bindings[1].descriptorType     = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      bindings[1].pImmutableSamplers = &sampler;
+      bindings[1].stageFlags         = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+      VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+      layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+      layoutInfo.bindingCount = bindings.size();
+      layoutInfo.pBindings    = bindings.data();
+
+      VDeleter<VkDescriptorSetLayout> setLayout { device, vkDestroyDescriptorSetLayout };
+      CHECK( vkCreateDescriptorSetLayout( device, &layoutInfo, nullptr, &setLayout ) == VK_SUCCESS );
+
+      std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+      poolSizes[0].type            = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+      poolSizes[0].descriptorCount = 1;
+      poolSizes[1].type            = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      poolSizes[1].descriptorCount = 1;
+
+      VkDescriptorPoolCreateInfo poolInfo = {};
+      poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+      poolInfo.poolSizeCount = poolSizes.size();
+      poolInfo.pPoolSizes    = poolSizes.data();
+      poolInfo.maxSets       = 1;
+
+      VDeleter<VkDescriptorPool> descriptorPool { device, vkDestroyDescriptorPool };
+      CHECK( vkCreateDescriptorPool( device, &poolInfo, nullptr, &descriptorPool ) == VK_SUCCESS );
+
+      VkDescriptorSetLayout       setLayouts[] = { setLayout };
+      VkDescriptorSetAllocateInfo allocInfo    = {};
+      allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      allocInfo.descriptorPool     = descriptorPool;
+      allocInfo.descriptorSetCount = 1;
+      allocInfo.pSetLayouts        = setLayouts;
+
+      VkDescriptorSet descriptorSet;
+      CHECK( vkAllocateDescriptorSets( device, &allocInfo, &descriptorSet ) == VK_SUCCESS );
+
+      VkDescriptorBufferInfo bufferInfo = {};
+      bufferInfo.buffer = uniformBuffer;
+      bufferInfo.offset = 0;
+      bufferInfo.range  = sizeof( ubo );
+
+      VkDescriptorImageInfo imageInfo = {};
+      imageInfo.imageView   = texture.view;
+      imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+      std::array<VkWriteDescriptorSet, 2> writes = {};
+      writes[0].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[0].dstSet          = descriptorSet;
+      writes[0].dstBinding      = 0;
+      writes[0].descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+      writes[0].descriptorCount = 1;
+      writes[0].pBufferInfo     = &bufferInfo;
+      writes[1].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[1].dstSet          = descriptorSet;
+      writes[1].dstBinding      = 1;
+      writes[1].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      writes[1].descriptorCount = 1;
+      writes[1].pImageInfo      = &imageInfo;
+      vkUpdateDescriptorSets( device, writes.size(), writes.data(), 0, nullptr );
+
+      VDeleter<VkRenderPass>     renderPass     { device, vkDestroyRenderPass };
+      VDeleter<VkPipelineLayout> pipelineLayout { device, vkDestroyPipelineLayout };
+      VDeleter<VkPipeline>       listPipeline   { device, vkDestroyPipeline };
+      VDeleter<VkPipeline>       stripPipeline  { device, vkDestroyPipeline };
+      createTestRenderPass( physical, device, renderPass );
+      createMeshPipelines( device, renderPass, { RENDER_SIZE, RENDER_SIZE }, setLayout, "frag.spv",
+                           pipelineLayout, listPipeline, stripPipeline );
+
+      RenderTarget listTarget( device, allocator );
+      RenderTarget stripTarget( device, allocator );
+      createRenderTarget( physical, device, renderPass, listTarget );
+      createRenderTarget( physical, device, renderPass, stripTarget );
+
+      auto recordDraw = [&]( RenderTarget& target, VkPipeline pipeline, VkBuffer indexBuffer, uint32_t indexCount )
+      {
+        std::array<VkClearValue, 2> clearValues = {};
+        clearValues[0].color        = { 0.0f, 0.0f, 0.0f, 0.0f };
+        clearValues[1].depthStencil = { 1.0f, 0 };
+
+        VkRenderPassBeginInfo renderPassBeginInfo = {};
+        renderPassBeginInfo.sType             = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassBeginInfo.renderPass        = renderPass;
+        renderPassBeginInfo.framebuffer       = target.framebuffer;
+        renderPassBeginInfo.renderArea.offset = { 0, 0 };
+        renderPassBeginInfo.renderArea.extent = { RENDER_SIZE, RENDER_SIZE };
+        renderPassBeginInfo.clearValueCount   = clearValues.size();
+        renderPassBeginInfo.pClearValues      = clearValues.data();
+
+        VkCommandBuffer commandBuffer = upload.commandBuffer;
+        VkBuffer        buffers[]     = { vertexBuffer, instanceBuffer };
+        VkDeviceSize    offsets[]     = { 0, 0 };
+        uint32_t        dynamicOffset = 0;
+
+        vkCmdBeginRenderPass( commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE );
+        vkCmdBindPipeline( commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline );
+        vkCmdBindDescriptorSets( commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                 pipelineLayout, 0, 1, &descriptorSet, 1, &dynamicOffset );
+        vkCmdBindVertexBuffers( commandBuffer, 0, 2, buffers, offsets );
+        vkCmdBindIndexBuffer( commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32 );
+        vkCmdDrawIndexed( commandBuffer, indexCount, 1, 0, 0, 0 );
+        vkCmdEndRenderPass( commandBuffer );
+      };
+      recordDraw( listTarget, listPipeline, listBuffer, listIndices.size() );
+      recordDraw( stripTarget, stripPipeline, stripBuffer, stripIndices.size() );
+
+      VDeleter<VkBuffer> listReadback        { device, vkDestroyBuffer };
+      MemoryAllocation   listReadbackMemory  { allocator, MEMORY_CATEGORY_READBACK, "list render readback" };
+      VDeleter<VkBuffer> stripReadback       { device, vkDestroyBuffer };
+      MemoryAllocation   stripReadbackMemory { allocator, MEMORY_CATEGORY_READBACK, "strip render readback" };
+      recordTestImageReadback( physical, upload, listTarget.colorImage, RENDER_SIZE, RENDER_SIZE,
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, listReadback, listReadbackMemory );
+      recordTestImageReadback( physical, upload, stripTarget.colorImage, RENDER_SIZE, RENDER_SIZE,
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, stripReadback, stripReadbackMemory );
+      upload.flush( headless.queue );
+
+      const uint8_t* list    = (const uint8_t*)listReadbackMemory.map();
+      const uint8_t* strip   = (const uint8_t*)stripReadbackMemory.map();
+      uint32_t       covered = 0, different = 0;
+      for ( uint32_t i = 0; i < RENDER_SIZE * RENDER_SIZE; i++ )
+      {
+        covered   += list[i * 4 + 3] == 255 ? 1 : 0;
+        different += std::memcmp( list + i * 4, strip + i * 4, 4 ) != 0 ? 1 : 0;
+      }
+
+      std::cout << listIndices.size() << " list indices, " << stripIndices.size() << " strip indices, "
+                << covered << " pixels covered, " << different << " differ" << std::endl;
+      CHECK( covered > RENDER_SIZE * RENDER_SIZE / 4 );
+      CHECK( different == 0 );
+    }
+    allocator.releaseEmptyBlocks();
+  } );
+}
@@ -0,0 +1,274 @@
+#ifndef __TEXARRAY_HPP__
+#define __TEXARRAY_HPP__
+
+#include "base-includes.hpp"
+#include "texture.hpp"
+#include "mipmap.hpp"
+#include "texcook.hpp"
+#include "upload.hpp"
+
+// Packs many material textures into the square layers of one RGBA8 2D
+// array so they can all be sampled through a single descriptor.
+// Textures that fill a whole layer keep repeat wrapping. Smaller ones are
+// placed in power-of-two cells aligned to their own size, surrounded by a
+// gutter of replicated edge texels. Box filtered mips of an aligned cell
+// never mix with a neighbouring cell, so the gutter keeps bilinear taps
+// inside the texture at every level where the cell is still a texel wide.
+// UVs of packed textures must stay within [0, 1].
+
+struct TextureArraySlot
+{
+  uint32_t  layer;
+  uint32_t  x;      // Texel offset of the texture in level 0
+  uint32_t  y;
+  uint32_t  width;  // After any downsampling to fit a layer
+  uint32_t  height;
+  glm::vec2 uvOffset;
+  glm::vec2 uvScale;
+};
+
+struct TextureArrayPacking
+{
+  uint32_t                      size   = 0; // Width and height of every layer
+  uint32_t                      layers = 0;
+  std::vector<TextureArraySlot> slots;      // In the order of the input extents
+};
+
+static uint32_t nextPowerOfTwo( uint32_t value )
+{
+  uint32_t result = 1;
+  while ( result < value )
+  {
+    result <<= 1;
+  }
+  return result;
+}
+
+// Inverse of interleaving x into the even and y into the odd bits
+static void mortonDecode( uint64_t code, uint32_t& x, uint32_t& y )
+{
+  x = 0;
+  y = 0;
+  for ( uint32_t bit = 0; bit < 32; bit++ )
+  {
+    x |= (uint32_t)( ( code >> ( 2 * bit ) ) & 1 ) << bit;
+    y |= (uint32_t)( ( code >> ( 2 * bit + 1 ) ) & 1 ) << bit;
+  }
+}
+
+TextureArrayPacking packTextureArray( const std::vector<VkExtent2D>& extents,
+                                      uint32_t                       maxSize,
+                                      uint32_t                       maxLayers,
+                                      uint32_t                       gutter )
+{
+  TextureArrayPacking packing;
+  packing.slots.resize( extents.size() );
+
+  uint32_t largest = 1;
+  for ( const auto& extent : extents )
+  {
+    largest = std::max( largest, std::max( extent.width, extent.height ) );
+  }
+  // Layers are at least big enough for the smallest texture plus gutter
+  packing.size = std::min( std::max( nextPowerOfTwo( largest ), nextPowerOfTwo( 1 + 2 * gutter ) ),
+                           maxSize );
+
+  // Shrink each texture until it fills a layer exactly or fits in a cell
+  std::vector<uint32_t> cells( extents.size() );
+  for ( size_t i = 0; i < extents.size(); i++ )
+  {
+    TextureArraySlot& slot = packing.slots[i];
+    slot.width  = extents[i].width;
+    slot.height = extents[i].height;
+
+    while ( !( slot.width == packing.size && slot.height == packing.size ) &&
+            ( slot.width > 1 || slot.height > 1 ) &&
+            nextPowerOfTwo( std::max( slot.width, slot.height ) + 2 * gutter ) > packing.size )
+    {
+      slot.width  = std::max( slot.width / 2, 1u );
+      slot.height = std::max( slot.height / 2, 1u );
+    }
+
+    bool fullLayer = slot.width == packing.size && slot.height == packing.size;
+    cells[i] = fullLayer ? packing.size :
+                           std::min( nextPowerOfTwo( std::max( slot.width, slot.height ) + 2 * gutter ),
+                                     packing.size );
+  }
+
+  // Placing cells largest first along a Z-order curve keeps every cell
+  // aligned to its own size without any free list
+  std::vector<size_t> order( extents.size() );
+  for ( size_t i = 0; i < order.size(); i++ )
+  {
+    order[i] = i;
+  }
+  std::stable_sort( order.begin(), order.end(),
+                    [&cells]( size_t a, size_t b ) { return cells[a] > cells[b]; } );
+
+  uint64_t layerArea = (uint64_t)packing.size * packing.size;
+  uint64_t cursor    = layerArea;
+  for ( size_t i : order )
+  {
+    TextureArraySlot& slot = packing.slots[i];
+    uint64_t          area = (uint64_t)cells[i] * cells[i];
+
+    if ( cursor + area > layerArea )
+    {
+      packing.layers++;
+      cursor = 0;
+    }
+
+    uint32_t cellX, cellY;
+    mortonDecode( cursor, cellX, cellY );
+    cursor += area;
+
+    bool     fullLayer = slot.width == packing.size && slot.height == packing.size;
+    uint32_t border    = fullLayer ? 0 : gutter;
+    slot.layer    = packing.layers - 1;
+    slot.x        = cellX + border;
+    slot.y        = cellY + border;
+    slot.uvOffset = glm::vec2( slot.x, slot.y ) / (float)packing.size;
+    slot.uvScale  = glm::vec2( slot.width, slot.height ) / (float)packing.size;
+  }
+
+  if ( packing.layers > maxLayers )
+  {
+    throw std::runtime_error( "Material textures do not fit in one texture array!" );
+  }
+
+  return packing;
+}
+
+// Downsample an RGBA8 image in place until it matches its slot
+void fitTextureArraySlot( const TextureArraySlot& slot,
+                          uint8_t*                rgba,
+                          uint32_t                width,
+                          uint32_t                height )
+{
+  if ( width == slot.width && height == slot.height )
+  {
+    return;
+  }
+
+  std::vector<uint8_t> pixels( rgba, rgba + (size_t)width * height * 4 );
+  while ( width != slot.width || height != slot.height )
+  {
+    pixels = downsampleRGBA( pixels, width, height );
+    width  = std::max( width / 2, 1u );
+    height = std::max( height / 2, 1u );
+  }
+  std::memcpy( rgba, pixels.data(), pixels.size() );
+}
+
+// Create the array image and record clearing level 0 of every layer, so
+// texels outside any slot are transparent black. Every level is left in
+// TRANSFER_DST_OPTIMAL for the slot copies and generateMipmaps.
+void createTextureArray( VkPhysicalDevice   physical,
+                         VkDevice           device,
+                         UploadContext&     upload,
+                         uint32_t           size,
+                         uint32_t           layers,
+                         VDeleter<VkImage>& image,
+                         MemoryAllocation&  imageMemory,
+                         uint32_t&          mipLevels )
+{
+  mipLevels = calculateMipLevels( size, size );
+
+  createImage( physical,
+               device,
+               size,
+               size,
+               mipLevels,
+               layers,
+               VK_FORMAT_R8G8B8A8_UNORM,
+               VK_IMAGE_TILING_OPTIMAL,
+               VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                 mipmapImageUsage( physical, VK_FORMAT_R8G8B8A8_UNORM ),
+               MEMORY_USAGE_GPU_ONLY,
+               image,
+               imageMemory );
+
+  recordImageCopyBarrier( upload.commandBuffer, image, 0, mipLevels, layers,
+                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+
+  VkClearColorValue       black = {};
+  VkImageSubresourceRange range = {};
+  range.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+  range.baseMipLevel   = 0;
+  range.levelCount     = 1;
+  range.baseArrayLayer = 0;
+  range.layerCount     = layers;
+  vkCmdClearColorImage( upload.commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &black, 1, &range );
+
+  // The slot copies land on the cleared texels
+  auto cleared = mipBarrier( image, 0, 1,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             VK_ACCESS_TRANSFER_WRITE_BIT,
+                             VK_ACCESS_TRANSFER_WRITE_BIT,
+                             layers );
+  vkCmdPipelineBarrier( upload.commandBuffer,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        0, 0, nullptr, 0, nullptr, 1, &cleared );
+}
+
+// Record copying a tightly packed RGBA8 image of exactly the slot size at
+// offset in buffer into its slot of level 0, replicating its edges into
+// the surrounding gutter. The gutter is filled by further copies of the
+// edge rows, columns and corner texels, so the image is read straight from
+// the buffer without being composed in host memory first.
+void recordTextureArraySlotCopy( VkCommandBuffer         commandBuffer,
+                                 VkBuffer                buffer,
+                                 VkDeviceSize            offset,
+                                 const TextureArraySlot& slot,
+                                 uint32_t                size,
+                                 uint32_t                gutter,
+                                 VkImage                 image )
+{
+  std::vector<VkBufferImageCopy> regions;
+  auto copy = [&]( uint32_t srcX, uint32_t srcY, int32_t x, int32_t y, uint32_t width, uint32_t height )
+  {
+    VkBufferImageCopy region = {};
+    region.bufferOffset                    = offset + ( (VkDeviceSize)srcY * slot.width + srcX ) * 4;
+    region.bufferRowLength                 = slot.width;
+    region.bufferImageHeight               = 0;
+    region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel       = 0;
+    region.imageSubresource.baseArrayLayer = slot.layer;
+    region.imageSubresource.layerCount     = 1;
+    region.imageOffset                     = { (int32_t)slot.x + x, (int32_t)slot.y + y, 0 };
+    region.imageExtent                     = { width, height, 1 };
+    regions.push_back( region );
+  };
+
+  copy( 0, 0, 0, 0, slot.width, slot.height );
+
+  int32_t  border = ( slot.width == size && slot.height == size ) ? 0 : (int32_t)gutter;
+  uint32_t right  = slot.width - 1;
+  uint32_t bottom = slot.height - 1;
+  for ( int32_t i = 1; i <= border; i++ )
+  {
+    copy( 0,     0,      0,                  -i,                  slot.width, 1 );
+    copy( 0,     bottom, 0,                  (int32_t)bottom + i, slot.width, 1 );
+    copy( 0,     0,      -i,                 0,                   1,          slot.height );
+    copy( right, 0,      (int32_t)right + i, 0,                   1,          slot.height );
+
+    for ( int32_t j = 1; j <= border; j++ )
+    {
+      copy( 0,     0,      -i,                 -j,                  1, 1 );
+      copy( right, 0,      (int32_t)right + i, -j,                  1, 1 );
+      copy( 0,     bottom, -i,                 (int32_t)bottom + j, 1, 1 );
+      copy( right, bottom, (int32_t)right + i, (int32_t)bottom + j, 1, 1 );
+    }
+  }
+
+  vkCmdCopyBufferToImage( commandBuffer,
+                          buffer,
+                          image,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          regions.size(),
+                          regions.data() );
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef __TEXBUDGET_HPP__
+#define __TEXBUDGET_HPP__
+
+#include <algorithm>
+#include "base-includes.hpp"
+#include "memory.hpp"
+
+// Chooses how many of the finest mip levels each texture leaves out so the
+// whole set fits a device local memory budget. Planning is a pure function
+// of the requests and the budget, so it can simply be run again whenever
+// the budget changes.
+
+struct TextureBudgetRequest
+{
+  std::vector<VkDeviceSize> levelSizes; // Full chain, finest level first
+  float                     importance; // Larger keeps detail longer
+};
+
+struct TextureBudgetPlan
+{
+  std::vector<uint32_t> baseLevels;     // Finest level kept, per request
+  VkDeviceSize          requestedBytes = 0;
+  VkDeviceSize          plannedBytes   = 0;
+  bool                  fits           = true;
+};
+
+// Level sizes of an uncompressed chain down to 1x1
+std::vector<VkDeviceSize> textureLevelSizes( uint32_t width, uint32_t height, uint32_t bytesPerTexel )
+{
+  std::vector<VkDeviceSize> sizes;
+  while ( true )
+  {
+    sizes.push_back( (VkDeviceSize)width * height * bytesPerTexel );
+    if ( width == 1 && height == 1 )
+    {
+      return sizes;
+    }
+    width  = std::max( width / 2, 1u );
+    height = std::max( height / 2, 1u );
+  }
+}
+
+// Drop the finest remaining level of whichever texture loses the least
+// importance per byte saved until the set fits. Every texture keeps at
+// least its coarsest level.
+TextureBudgetPlan planTextureBudget( const std::vector<TextureBudgetRequest>& requests,
+                                     VkDeviceSize                             budget )
+{
+  TextureBudgetPlan plan;
+  plan.baseLevels.assign( requests.size(), 0 );
+
+  for ( const auto& request : requests )
+  {
+    for ( VkDeviceSize size : request.levelSizes )
+    {
+      plan.requestedBytes += size;
+    }
+  }
+  plan.plannedBytes = plan.requestedBytes;
+
+  while ( plan.plannedBytes > budget )
+  {
+    size_t best      = requests.size();
+    float  bestScore = 0.0f;
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+      const TextureBudgetRequest& request = requests[i];
+      uint32_t                    base    = plan.baseLevels[i];
+      if ( base + 1 >= request.levelSizes.size() )
+      {
+        continue;
+      }
+
+      // Coarser levels save a quarter as much, so drops spread out
+      float score = request.importance /
+                    (float)std::max<VkDeviceSize>( request.levelSizes[base], 1 );
+      if ( best == requests.size() || score < bestScore )
+      {
+        best      = i;
+        bestScore = score;
+      }
+    }
+
+    if ( best == requests.size() )
+    {
+      plan.fits = false;
+      break;
+    }
+
+    plan.plannedBytes -= requests[best].levelSizes[ plan.baseLevels[best] ];
+    plan.baseLevels[best]++;
+  }
+
+  return plan;
+}
+
+// Device local memory the application may still claim: the
+// VK_EXT_memory_budget budget minus current usage when available, the
+// size of the largest device local heap otherwise
+VkDeviceSize queryDeviceLocalBudget( VkInstance       instance,
+                                     VkPhysicalDevice physical,
+                                     bool             memoryBudgetSupported )
+{
+  VkPhysicalDeviceMemoryProperties memprops;
+  vkGetPhysicalDeviceMemoryProperties( physical, &memprops );
+
+  VkDeviceSize heapBudget[ VK_MAX_MEMORY_HEAPS ];
+  VkDeviceSize heapUsage[ VK_MAX_MEMORY_HEAPS ];
+  queryHeapBudgets( instance, physical, memoryBudgetSupported, heapBudget, heapUsage );
+
+  VkDeviceSize available = 0;
+  for ( uint32_t i = 0; i < memprops.memoryHeapCount; i++ )
+  {
+    if ( memprops.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT )
+    {
+      available = std::max( available, heapBudget[i] > heapUsage[i] ?
+                                       heapBudget[i] - heapUsage[i] : 0 );
+    }
+  }
+
+  return available;
+}
+
+#endif
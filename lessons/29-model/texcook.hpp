@@ -0,0 +1,835 @@
+#ifndef __TEXCOOK_HPP__
+#define __TEXCOOK_HPP__
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include "base-includes.hpp"
+#include "common.hpp"
+
+// First-load texture cooking into block compressed formats. Cooked
+// textures are stored with their whole mip chain in a small container so
+// that loading is a file read and a memcpy into staging memory.
+
+struct CookedMipLevel
+{
+  uint32_t width;
+  uint32_t height;
+  uint64_t offset; // From the start of the level data
+  uint64_t size;
+};
+
+struct CookedTexture
+{
+  VkFormat                    format;
+  uint32_t                    width;
+  uint32_t                    height;
+  uint64_t                    sourceSize;
+  std::vector<CookedMipLevel> levels;
+  std::vector<char>           data;       // Empty when only the header was read
+  uint64_t                    dataOffset; // Of the level data within the file
+};
+
+// "VTEX" container layout, little endian:
+//   CookedTextureHeader
+//   CookedMipLevel[mipLevels]
+//   padding to COOKED_DATA_ALIGNMENT
+//   level data, each level aligned to COOKED_DATA_ALIGNMENT
+//   padding to COOKED_FILE_ALIGNMENT, so the last level can be imported
+//   from a file mapping (hostimport.hpp)
+struct CookedTextureHeader
+{
+  char     magic[4];
+  uint32_t version;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t mipLevels;
+  uint64_t sourceSize;
+  uint64_t dataSize;
+};
+
+const uint32_t COOKED_TEXTURE_VERSION = 1;
+const uint64_t COOKED_DATA_ALIGNMENT  = 16;
+const uint64_t COOKED_FILE_ALIGNMENT  = 64 * 1024;
+
+static uint64_t alignCooked( uint64_t value )
+{
+  return ( value + COOKED_DATA_ALIGNMENT - 1 ) & ~( COOKED_DATA_ALIGNMENT - 1 );
+}
+
+uint32_t compressedBlockSize( VkFormat format )
+{
+  switch ( format )
+  {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+      return 8;
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+bool imageUsesAlpha( const uint8_t* rgba, uint32_t width, uint32_t height )
+{
+  for ( uint64_t i = 0; i < (uint64_t)width * height; i++ )
+  {
+    if ( rgba[4 * i + 3] != 255 )
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Preferred formats for a texture, best first. RGBA8 is always last so
+// findSupportedFormat has a guaranteed match. Only BC7 mode 6 is encoded,
+// which fits one line through RGBA, so BC3 with its separate alpha block
+// stays the first choice for textures that use alpha.
+std::vector<VkFormat> cookedFormatCandidates( bool usesAlpha, TextureQuality quality )
+{
+  if ( usesAlpha )
+  {
+    return { VK_FORMAT_BC3_UNORM_BLOCK, VK_FORMAT_BC7_UNORM_BLOCK, VK_FORMAT_R8G8B8A8_UNORM };
+  }
+
+  if ( quality == TEXTURE_QUALITY_HIGH )
+  {
+    return { VK_FORMAT_BC7_UNORM_BLOCK, VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_R8G8B8A8_UNORM };
+  }
+
+  return { VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC7_UNORM_BLOCK, VK_FORMAT_R8G8B8A8_UNORM };
+}
+
+// Copy tightly packed RGB or RGBA texels into rows rowPitch bytes apart,
+// adding opaque alpha or dropping alpha as needed
+void copyPixelRows( const uint8_t* src,
+                    uint32_t       srcChannels,
+                    uint32_t       width,
+                    uint32_t       height,
+                    uint8_t*       dst,
+                    size_t         rowPitch,
+                    uint32_t       dstChannels )
+{
+  for ( uint32_t y = 0; y < height; y++ )
+  {
+    const uint8_t* in  = src + (size_t)y * width * srcChannels;
+    uint8_t*       out = dst + y * rowPitch;
+    if ( srcChannels == dstChannels )
+    {
+      std::memcpy( out, in, (size_t)width * dstChannels );
+      continue;
+    }
+
+    for ( uint32_t x = 0; x < width; x++ )
+    {
+      std::memcpy( out + x * dstChannels, in + x * srcChannels, 3 );
+      if ( dstChannels == 4 )
+      {
+        out[ x * 4 + 3 ] = 255;
+      }
+    }
+  }
+}
+
+// 2x2 box filter; odd dimensions reuse the edge texel
+std::vector<uint8_t> downsampleRGBA( const std::vector<uint8_t>& src,
+                                     uint32_t                    width,
+                                     uint32_t                    height )
+{
+  uint32_t dstWidth  = std::max( width / 2, 1u );
+  uint32_t dstHeight = std::max( height / 2, 1u );
+
+  std::vector<uint8_t> dst( (size_t)dstWidth * dstHeight * 4 );
+  for ( uint32_t y = 0; y < dstHeight; y++ )
+  {
+    uint32_t y0 = std::min( 2 * y, height - 1 );
+    uint32_t y1 = std::min( 2 * y + 1, height - 1 );
+    for ( uint32_t x = 0; x < dstWidth; x++ )
+    {
+      uint32_t x0 = std::min( 2 * x, width - 1 );
+      uint32_t x1 = std::min( 2 * x + 1, width - 1 );
+      for ( uint32_t c = 0; c < 4; c++ )
+      {
+        uint32_t sum = src[ ( (size_t)y0 * width + x0 ) * 4 + c ] +
+                       src[ ( (size_t)y0 * width + x1 ) * 4 + c ] +
+                       src[ ( (size_t)y1 * width + x0 ) * 4 + c ] +
+                       src[ ( (size_t)y1 * width + x1 ) * 4 + c ];
+        dst[ ( (size_t)y * dstWidth + x ) * 4 + c ] = (uint8_t)( ( sum + 2 ) / 4 );
+      }
+    }
+  }
+
+  return dst;
+}
+
+// Principal axis of a block's colors through power iteration
+static void blockPrincipalAxis( const float pixels[16][4],
+                                uint32_t    channels,
+                                float       mean[4],
+                                float       axis[4] )
+{
+  float cov[4][4] = {};
+
+  for ( uint32_t c = 0; c < 4; c++ )
+  {
+    mean[c] = 0.0f;
+    for ( uint32_t i = 0; i < 16; i++ )
+    {
+      mean[c] += pixels[i][c] / 16.0f;
+    }
+  }
+
+  for ( uint32_t i = 0; i < 16; i++ )
+  {
+    for ( uint32_t a = 0; a < channels; a++ )
+    {
+      for ( uint32_t b = 0; b < channels; b++ )
+      {
+        cov[a][b] += ( pixels[i][a] - mean[a] ) * ( pixels[i][b] - mean[b] );
+      }
+    }
+  }
+
+  for ( uint32_t c = 0; c < 4; c++ )
+  {
+    axis[c] = c < channels ? 1.0f : 0.0f;
+  }
+
+  for ( uint32_t iter = 0; iter < 8; iter++ )
+  {
+    float next[4] = {};
+    float length  = 0.0f;
+    for ( uint32_t a = 0; a < channels; a++ )
+    {
+      for ( uint32_t b = 0; b < channels; b++ )
+      {
+        next[a] += cov[a][b] * axis[b];
+      }
+      length += next[a] * next[a];
+    }
+
+    if ( length < 1e-12f )
+    {
+      break;
+    }
+
+    length = std::sqrt( length );
+    for ( uint32_t a = 0; a < channels; a++ )
+    {
+      axis[a] = next[a] / length;
+    }
+  }
+}
+
+// Endpoints at the extremes of the block's projection onto its principal axis
+static void blockEndpoints( const float pixels[16][4],
+                            uint32_t    channels,
+                            float       lo[4],
+                            float       hi[4] )
+{
+  float mean[4], axis[4];
+  blockPrincipalAxis( pixels, channels, mean, axis );
+
+  float minProj = 1e30f, maxProj = -1e30f;
+  for ( uint32_t i = 0; i < 16; i++ )
+  {
+    float proj = 0.0f;
+    for ( uint32_t c = 0; c < channels; c++ )
+    {
+      proj += ( pixels[i][c] - mean[c] ) * axis[c];
+    }
+    minProj = std::min( minProj, proj );
+    maxProj = std::max( maxProj, proj );
+  }
+
+  for ( uint32_t c = 0; c < 4; c++ )
+  {
+    lo[c] = glm::clamp( mean[c] + minProj * axis[c], 0.0f, 255.0f );
+    hi[c] = glm::clamp( mean[c] + maxProj * axis[c], 0.0f, 255.0f );
+  }
+}
+
+static void fetchBlock( const uint8_t* rgba,
+                        uint32_t       width,
+                        uint32_t       height,
+                        uint32_t       bx,
+                        uint32_t       by,
+                        float          pixels[16][4] )
+{
+  for ( uint32_t y = 0; y < 4; y++ )
+  {
+    for ( uint32_t x = 0; x < 4; x++ )
+    {
+      uint32_t sx = std::min( bx * 4 + x, width - 1 );
+      uint32_t sy = std::min( by * 4 + y, height - 1 );
+      for ( uint32_t c = 0; c < 4; c++ )
+      {
+        pixels[y * 4 + x][c] = rgba[ ( (size_t)sy * width + sx ) * 4 + c ];
+      }
+    }
+  }
+}
+
+static uint16_t packRGB565( const float color[4] )
+{
+  uint32_t r = (uint32_t)( color[0] * 31.0f / 255.0f + 0.5f );
+  uint32_t g = (uint32_t)( color[1] * 63.0f / 255.0f + 0.5f );
+  uint32_t b = (uint32_t)( color[2] * 31.0f / 255.0f + 0.5f );
+  return (uint16_t)( ( r << 11 ) | ( g << 5 ) | b );
+}
+
+static void unpackRGB565( uint16_t packed, float color[3] )
+{
+  uint32_t r = ( packed >> 11 ) & 31;
+  uint32_t g = ( packed >> 5 ) & 63;
+  uint32_t b = packed & 31;
+  color[0] = (float)( ( r << 3 ) | ( r >> 2 ) );
+  color[1] = (float)( ( g << 2 ) | ( g >> 4 ) );
+  color[2] = (float)( ( b << 3 ) | ( b >> 2 ) );
+}
+
+// BC1 color block in 4 color mode
+static void encodeBC1Block( const float pixels[16][4], uint8_t* out )
+{
+  float lo[4], hi[4];
+  blockEndpoints( pixels, 3, lo, hi );
+
+  uint16_t c0 = packRGB565( hi );
+  uint16_t c1 = packRGB565( lo );
+  if ( c0 < c1 )
+  {
+    std::swap( c0, c1 );
+  }
+
+  float palette[4][3];
+  unpackRGB565( c0, palette[0] );
+  unpackRGB565( c1, palette[1] );
+  for ( uint32_t c = 0; c < 3; c++ )
+  {
+    palette[2][c] = ( 2.0f * palette[0][c] + palette[1][c] ) / 3.0f;
+    palette[3][c] = ( palette[0][c] + 2.0f * palette[1][c] ) / 3.0f;
+  }
+
+  uint32_t indices = 0;
+  if ( c0 != c1 )
+  {
+    for ( uint32_t i = 0; i < 16; i++ )
+    {
+      uint32_t best     = 0;
+      float    bestDist = 1e30f;
+      for ( uint32_t p = 0; p < 4; p++ )
+      {
+        float dist = 0.0f;
+        for ( uint32_t c = 0; c < 3; c++ )
+        {
+          float d = pixels[i][c] - palette[p][c];
+          dist += d * d;
+        }
+        if ( dist < bestDist )
+        {
+          bestDist = dist;
+          best     = p;
+        }
+      }
+      indices |= best << ( 2 * i );
+    }
+  }
+
+  out[0] = c0 & 0xFF;
+  out[1] = c0 >> 8;
+  out[2] = c1 & 0xFF;
+  out[3] = c1 >> 8;
+  for ( uint32_t b = 0; b < 4; b++ )
+  {
+    out[4 + b] = ( indices >> ( 8 * b ) ) & 0xFF;
+  }
+}
+
+// BC3 alpha block in 8 value mode
+static void encodeBC3AlphaBlock( const float pixels[16][4], uint8_t* out )
+{
+  float minA = 255.0f, maxA = 0.0f;
+  for ( uint32_t i = 0; i < 16; i++ )
+  {
+    minA = std::min( minA, pixels[i][3] );
+    maxA = std::max( maxA, pixels[i][3] );
+  }
+
+  uint8_t a0 = (uint8_t)( maxA + 0.5f );
+  uint8_t a1 = (uint8_t)( minA + 0.5f );
+
+  float palette[8];
+  palette[0] = a0;
+  palette[1] = a1;
+  for ( uint32_t p = 1; p < 7; p++ )
+  {
+    palette[p + 1] = ( ( 7 - p ) * a0 + p * a1 ) / 7.0f;
+  }
+
+  uint64_t indices = 0;
+  if ( a0 != a1 )
+  {
+    for ( uint32_t i = 0; i < 16; i++ )
+    {
+      uint64_t best     = 0;
+      float    bestDist = 1e30f;
+      for ( uint32_t p = 0; p < 8; p++ )
+      {
+        float dist = std::fabs( pixels[i][3] - palette[p] );
+        if ( dist < bestDist )
+        {
+          bestDist = dist;
+          best     = p;
+        }
+      }
+      indices |= best << ( 3 * i );
+    }
+  }
+
+  out[0] = a0;
+  out[1] = a1;
+  for ( uint32_t b = 0; b < 6; b++ )
+  {
+    out[2 + b] = ( indices >> ( 8 * b ) ) & 0xFF;
+  }
+}
+
+static const uint32_t bc7Weights4[16] = {
+  0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+};
+
+// Quantize an RGBA endpoint to 7 bits per channel plus a shared p-bit
+static void quantizeBC7Endpoint( const float color[4], uint32_t quantized[4], uint32_t& pbit )
+{
+  float bestError = 1e30f;
+  for ( uint32_t p = 0; p < 2; p++ )
+  {
+    uint32_t candidate[4];
+    float    error = 0.0f;
+    for ( uint32_t c = 0; c < 4; c++ )
+    {
+      float q = std::floor( ( color[c] - p ) / 2.0f + 0.5f );
+      candidate[c] = (uint32_t)glm::clamp( q, 0.0f, 127.0f );
+      float d = (float)( ( candidate[c] << 1 ) | p ) - color[c];
+      error += d * d;
+    }
+
+    if ( error < bestError )
+    {
+      bestError = error;
+      pbit      = p;
+      std::memcpy( quantized, candidate, sizeof( candidate ) );
+    }
+  }
+}
+
+static float assignBC7Indices( const float    pixels[16][4],
+                               const uint32_t e0[4],
+                               const uint32_t e1[4],
+                               uint32_t       indices[16] )
+{
+  float palette[16][4];
+  for ( uint32_t p = 0; p < 16; p++ )
+  {
+    for ( uint32_t c = 0; c < 4; c++ )
+    {
+      palette[p][c] = (float)( ( ( 64 - bc7Weights4[p] ) * e0[c] + bc7Weights4[p] * e1[c] + 32 ) >> 6 );
+    }
+  }
+
+  float total = 0.0f;
+  for ( uint32_t i = 0; i < 16; i++ )
+  {
+    float bestDist = 1e30f;
+    for ( uint32_t p = 0; p < 16; p++ )
+    {
+      float dist = 0.0f;
+      for ( uint32_t c = 0; c < 4; c++ )
+      {
+        float d = pixels[i][c] - palette[p][c];
+        dist += d * d;
+      }
+      if ( dist < bestDist )
+      {
+        bestDist   = dist;
+        indices[i] = p;
+      }
+    }
+    total += bestDist;
+  }
+
+  return total;
+}
+
+// Least squares endpoints for a fixed index assignment
+static bool refineBC7Endpoints( const float    pixels[16][4],
+                                const uint32_t indices[16],
+                                float          lo[4],
+                                float          hi[4] )
+{
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+  float ax[4] = {}, bx[4] = {};
+  for ( uint32_t i = 0; i < 16; i++ )
+  {
+    float w = bc7Weights4[ indices[i] ] / 64.0f;
+    float a = 1.0f - w;
+    aa += a * a;
+    ab += a * w;
+    bb += w * w;
+    for ( uint32_t c = 0; c < 4; c++ )
+    {
+      ax[c] += a * pixels[i][c];
+      bx[c] += w * pixels[i][c];
+    }
+  }
+
+  float det = aa * bb - ab * ab;
+  if ( std::fabs( det ) < 1e-6f )
+  {
+    return false;
+  }
+
+  for ( uint32_t c = 0; c < 4; c++ )
+  {
+    lo[c] = glm::clamp( ( ax[c] * bb - bx[c] * ab ) / det, 0.0f, 255.0f );
+    hi[c] = glm::clamp( ( bx[c] * aa - ax[c] * ab ) / det, 0.0f, 255.0f );
+  }
+
+  return true;
+}
+
+static void writeBits( uint8_t* out, uint32_t& bitPos, uint32_t value, uint32_t count )
+{
+  for ( uint32_t i = 0; i < count; i++, bitPos++ )
+  {
+    if ( value & ( 1u << i ) )
+    {
+      out[ bitPos / 8 ] |= (uint8_t)( 1u << ( bitPos % 8 ) );
+    }
+  }
+}
+
+// BC7 mode 6: one subset, RGBA 7.7.7.7 endpoints with unique p-bits,
+// 4 bit indices
+static void encodeBC7Block( const float pixels[16][4], TextureQuality quality, uint8_t* out )
+{
+  float lo[4], hi[4];
+  blockEndpoints( pixels, 4, lo, hi );
+
+  uint32_t e0[4], e1[4], p0 = 0, p1 = 0;
+  uint32_t indices[16];
+  uint32_t full0[4], full1[4];
+
+  quantizeBC7Endpoint( lo, e0, p0 );
+  quantizeBC7Endpoint( hi, e1, p1 );
+  for ( uint32_t c = 0; c < 4; c++ )
+  {
+    full0[c] = ( e0[c] << 1 ) | p0;
+    full1[c] = ( e1[c] << 1 ) | p1;
+  }
+  float error = assignBC7Indices( pixels, full0, full1, indices );
+
+  // The high quality preset refines endpoints while it keeps helping
+  uint32_t refinements = quality == TEXTURE_QUALITY_HIGH ? 4 : 1;
+  for ( uint32_t r = 0; r < refinements; r++ )
+  {
+    float    newLo[4], newHi[4];
+    uint32_t n0[4], n1[4], np0 = 0, np1 = 0, nf0[4], nf1[4], nIndices[16];
+
+    if ( !refineBC7Endpoints( pixels, indices, newLo, newHi ) )
+    {
+      break;
+    }
+
+    quantizeBC7Endpoint( newLo, n0, np0 );
+    quantizeBC7Endpoint( newHi, n1, np1 );
+    for ( uint32_t c = 0; c < 4; c++ )
+    {
+      nf0[c] = ( n0[c] << 1 ) | np0;
+      nf1[c] = ( n1[c] << 1 ) | np1;
+    }
+
+    float newError = assignBC7Indices( pixels, nf0, nf1, nIndices );
+    if ( newError >= error )
+    {
+      break;
+    }
+
+    error = newError;
+    std::memcpy( e0, n0, sizeof( e0 ) );
+    std::memcpy( e1, n1, sizeof( e1 ) );
+    std::memcpy( indices, nIndices, sizeof( indices ) );
+    p0 = np0;
+    p1 = np1;
+  }
+
+  // The anchor index's top bit is implicit zero, so swap endpoints if needed
+  if ( indices[0] & 8 )
+  {
+    for ( uint32_t c = 0; c < 4; c++ )
+    {
+      std::swap( e0[c], e1[c] );
+    }
+    std::swap( p0, p1 );
+    for ( uint32_t i = 0; i < 16; i++ )
+    {
+      indices[i] = 15 - indices[i];
+    }
+  }
+
+  std::memset( out, 0, 16 );
+  uint32_t bitPos = 0;
+  writeBits( out, bitPos, 1u << 6, 7 ); // Mode 6
+  for ( uint32_t c = 0; c < 4; c++ )
+  {
+    writeBits( out, bitPos, e0[c], 7 );
+    writeBits( out, bitPos, e1[c], 7 );
+  }
+  writeBits( out, bitPos, p0, 1 );
+  writeBits( out, bitPos, p1, 1 );
+  writeBits( out, bitPos, indices[0], 3 );
+  for ( uint32_t i = 1; i < 16; i++ )
+  {
+    writeBits( out, bitPos, indices[i], 4 );
+  }
+}
+
+// Encode one RGBA8 level into the given format
+std::vector<char> encodeTextureLevel( const std::vector<uint8_t>& rgba,
+                                      uint32_t                    width,
+                                      uint32_t                    height,
+                                      VkFormat                    format,
+                                      TextureQuality              quality )
+{
+  if ( format == VK_FORMAT_R8G8B8A8_UNORM )
+  {
+    return std::vector<char>( rgba.begin(), rgba.end() );
+  }
+
+  uint32_t blockSize = compressedBlockSize( format );
+  uint32_t blocksX   = ( width + 3 ) / 4;
+  uint32_t blocksY   = ( height + 3 ) / 4;
+
+  std::vector<char> encoded( (size_t)blocksX * blocksY * blockSize );
+  float             pixels[16][4];
+
+  for ( uint32_t by = 0; by < blocksY; by++ )
+  {
+    for ( uint32_t bx = 0; bx < blocksX; bx++ )
+    {
+      uint8_t* out = (uint8_t*)&encoded[ ( (size_t)by * blocksX + bx ) * blockSize ];
+      fetchBlock( rgba.data(), width, height, bx, by, pixels );
+
+      switch ( format )
+      {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+          encodeBC1Block( pixels, out );
+          break;
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+          encodeBC3AlphaBlock( pixels, out );
+          encodeBC1Block( pixels, out + 8 );
+          break;
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+          encodeBC7Block( pixels, quality, out );
+          break;
+        default:
+          throw std::runtime_error( "Unsupported texture cooking format!" );
+      }
+    }
+  }
+
+  return encoded;
+}
+
+// Build the mip chain on the CPU and encode every level
+CookedTexture cookTexture( const uint8_t* rgba,
+                           uint32_t       width,
+                           uint32_t       height,
+                           VkFormat       format,
+                           TextureQuality quality,
+                           uint64_t       sourceSize )
+{
+  CookedTexture cooked;
+  cooked.format     = format;
+  cooked.width      = width;
+  cooked.height     = height;
+  cooked.sourceSize = sourceSize;
+  cooked.dataOffset = 0;
+
+  std::vector<uint8_t> level( rgba, rgba + (size_t)width * height * 4 );
+  uint32_t levelWidth  = width;
+  uint32_t levelHeight = height;
+
+  while ( true )
+  {
+    std::vector<char> encoded = encodeTextureLevel( level, levelWidth, levelHeight,
+                                                    format, quality );
+
+    CookedMipLevel mip;
+    mip.width  = levelWidth;
+    mip.height = levelHeight;
+    mip.offset = alignCooked( cooked.data.size() );
+    mip.size   = encoded.size();
+    cooked.levels.push_back( mip );
+
+    cooked.data.resize( mip.offset );
+    cooked.data.insert( cooked.data.end(), encoded.begin(), encoded.end() );
+
+    if ( levelWidth == 1 && levelHeight == 1 )
+    {
+      break;
+    }
+
+    level       = downsampleRGBA( level, levelWidth, levelHeight );
+    levelWidth  = std::max( levelWidth / 2, 1u );
+    levelHeight = std::max( levelHeight / 2, 1u );
+  }
+
+  return cooked;
+}
+
+void writeCookedTexture( const std::string& path, const CookedTexture& cooked )
+{
+  std::ofstream file( path, std::ios::binary | std::ios::trunc );
+  if ( !file.is_open() )
+  {
+    throw std::runtime_error( "Failed to write cooked texture!" );
+  }
+
+  CookedTextureHeader header = {};
+  std::memcpy( header.magic, "VTEX", 4 );
+  header.version    = COOKED_TEXTURE_VERSION;
+  header.format     = cooked.format;
+  header.width      = cooked.width;
+  header.height     = cooked.height;
+  header.mipLevels  = cooked.levels.size();
+  header.sourceSize = cooked.sourceSize;
+  header.dataSize   = cooked.data.size();
+
+  uint64_t tableEnd = sizeof( header ) + cooked.levels.size() * sizeof( CookedMipLevel );
+  std::vector<char> padding( alignCooked( tableEnd ) - tableEnd, 0 );
+
+  file.write( (const char*)&header, sizeof( header ) );
+  file.write( (const char*)cooked.levels.data(), cooked.levels.size() * sizeof( CookedMipLevel ) );
+  file.write( padding.data(), padding.size() );
+  file.write( cooked.data.data(), cooked.data.size() );
+
+  uint64_t fileEnd = alignCooked( tableEnd ) + cooked.data.size();
+  std::vector<char> tail( ( COOKED_FILE_ALIGNMENT - fileEnd % COOKED_FILE_ALIGNMENT ) % COOKED_FILE_ALIGNMENT, 0 );
+  file.write( tail.data(), tail.size() );
+}
+
+// Reads the header and level table only, leaving the level data on disk.
+// Returns false if the file is missing, stale, truncated or malformed.
+bool readCookedTextureHeader( const std::string& path, uint64_t sourceSize, CookedTexture& cooked )
+{
+  std::ifstream file( path, std::ios::binary | std::ios::ate );
+  if ( !file.is_open() )
+  {
+    return false;
+  }
+
+  uint64_t fileSize = (uint64_t)file.tellg();
+  file.seekg( 0 );
+
+  CookedTextureHeader header;
+  if ( !file.read( (char*)&header, sizeof( header ) ) ||
+       std::memcmp( header.magic, "VTEX", 4 ) != 0 ||
+       header.version != COOKED_TEXTURE_VERSION ||
+       header.sourceSize != sourceSize ||
+       header.mipLevels == 0 )
+  {
+    return false;
+  }
+
+  cooked.format     = (VkFormat)header.format;
+  cooked.width      = header.width;
+  cooked.height     = header.height;
+  cooked.sourceSize = header.sourceSize;
+  cooked.data.clear();
+  cooked.levels.resize( header.mipLevels );
+  if ( !file.read( (char*)cooked.levels.data(), header.mipLevels * sizeof( CookedMipLevel ) ) )
+  {
+    return false;
+  }
+
+  uint64_t tableEnd = sizeof( header ) + header.mipLevels * sizeof( CookedMipLevel );
+  cooked.dataOffset = alignCooked( tableEnd );
+  if ( cooked.dataOffset + header.dataSize > fileSize )
+  {
+    return false;
+  }
+
+  for ( const auto& level : cooked.levels )
+  {
+    if ( level.offset + level.size > header.dataSize )
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Levels are stored largest first, so any run of levels is one
+// contiguous byte range of the level data
+void cookedLevelRange( const CookedTexture& cooked,
+                       uint32_t             firstLevel,
+                       uint32_t             levelCount,
+                       uint64_t&            offset,
+                       uint64_t&            size )
+{
+  const CookedMipLevel& last = cooked.levels[ firstLevel + levelCount - 1 ];
+
+  offset = cooked.levels[ firstLevel ].offset;
+  size   = last.offset + last.size - offset;
+}
+
+// Read levels [firstLevel, firstLevel + levelCount) straight into dst
+bool readCookedLevels( const std::string&   path,
+                       const CookedTexture& cooked,
+                       uint32_t             firstLevel,
+                       uint32_t             levelCount,
+                       char*                dst )
+{
+  std::ifstream file( path, std::ios::binary );
+  if ( !file.is_open() )
+  {
+    return false;
+  }
+
+  uint64_t offset, size;
+  cookedLevelRange( cooked, firstLevel, levelCount, offset, size );
+
+  file.seekg( cooked.dataOffset + offset );
+  return (bool)file.read( dst, size );
+}
+
+// Leave out the count finest levels; the level offsets stay valid
+void skipCookedLevels( CookedTexture& cooked, uint32_t count )
+{
+  cooked.levels.erase( cooked.levels.begin(), cooked.levels.begin() + count );
+  cooked.width  = cooked.levels[0].width;
+  cooked.height = cooked.levels[0].height;
+}
+
+// Returns false if the file is missing, stale or malformed
+bool readCookedTexture( const std::string& path, uint64_t sourceSize, CookedTexture& cooked )
+{
+  if ( !readCookedTextureHeader( path, sourceSize, cooked ) )
+  {
+    return false;
+  }
+
+  uint64_t offset, size;
+  cookedLevelRange( cooked, 0, cooked.levels.size(), offset, size );
+
+  cooked.data.resize( offset + size );
+  return readCookedLevels( path, cooked, 0, cooked.levels.size(), cooked.data.data() + offset );
+}
+
+#endif
@@ -1,20 +1,25 @@
 #ifndef __TEXTURE_HPP__
 #define __TEXTURE_HPP__
 
+#include <algorithm>
+#include <cstring>
 #include "base-includes.hpp"
 #include "memory.hpp"
 #include "buffer.hpp"
+#include "upload.hpp"
 
 void createImage( VkPhysicalDevice          physical,
                   VkDevice                  device,
                   uint32_t                  width,
                   uint32_t                  height,
+                  uint32_t                  mipLevels,
+                  uint32_t                  arrayLayers,
                   VkFormat                  format,
                   VkImageTiling             tiling,
                   VkImageUsageFlags         usage,
-                  VkMemoryPropertyFlags     properties,
+                  MemoryUsage               memoryUsage,
                   VDeleter<VkImage>&        image,
-                  VDeleter<VkDeviceMemory>& imageMemory )
+                  MemoryAllocation&         imageMemory )
 {
   VkImageCreateInfo imageInfo = {};
   imageInfo.sType         = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -22,8 +27,8 @@ void createImage( VkPhysicalDevice          physical,
   imageInfo.extent.width  = width;
   imageInfo.extent.height = height;
   imageInfo.extent.depth  = 1;
-  imageInfo.mipLevels     = 1;
-  imageInfo.arrayLayers   = 1;
+  imageInfo.mipLevels     = mipLevels;
+  imageInfo.arrayLayers   = arrayLayers;
   imageInfo.format        = format;
   imageInfo.tiling        = tiling;
   imageInfo.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
@@ -39,31 +44,21 @@ void createImage( VkPhysicalDevice          physical,
   VkMemoryRequirements memRequirements;
   vkGetImageMemoryRequirements( device, image, &memRequirements );
 
-  VkMemoryAllocateInfo allocInfo = {};
-  allocInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize  = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType( physical,
-                                              memRequirements.memoryTypeBits,
-                                              properties );
-
-  if ( vkAllocateMemory( device, &allocInfo,
-                         nullptr, &imageMemory ) != VK_SUCCESS )
+  // Linear images may share blocks with buffers, optimal ones may not
+  if ( !imageMemory.allocate( memRequirements, memoryUsage, tiling == VK_IMAGE_TILING_LINEAR ) )
   {
     throw std::runtime_error( "Failed to allocate image memory!" );
   }
 
-  vkBindImageMemory( device, image, imageMemory, 0 );
+  vkBindImageMemory( device, image, imageMemory.memory(), imageMemory.offset() );
 }
 
-void transitionImageLayout( VkDevice      device,
-                            VkQueue       queue,
-                            VkCommandPool commandPool,
-                            VkImage       image,
-                            VkImageLayout oldLayout,
-                            VkImageLayout newLayout )
+void transitionImageLayout( UploadContext& upload,
+                            VkImage        image,
+                            uint32_t       mipLevels,
+                            VkImageLayout  oldLayout,
+                            VkImageLayout  newLayout )
 {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands( device, commandPool );
-
   // Create memory barrier
   VkImageMemoryBarrier barrier = {};
   barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -74,7 +69,7 @@ void transitionImageLayout( VkDevice      device,
   barrier.image                           = image;
   barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
   barrier.subresourceRange.baseMipLevel   = 0;
-  barrier.subresourceRange.levelCount     = 1;
+  barrier.subresourceRange.levelCount     = mipLevels;
   barrier.subresourceRange.baseArrayLayer = 0;
   barrier.subresourceRange.layerCount     = 1;
   barrier.srcAccessMask                   = 0; // TODO
@@ -112,7 +107,7 @@ void transitionImageLayout( VkDevice      device,
     throw std::invalid_argument("unsupported layout transition!");
   }
 
-  vkCmdPipelineBarrier( commandBuffer,
+  vkCmdPipelineBarrier( upload.commandBuffer,
                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
                         0,
@@ -122,45 +117,130 @@ void transitionImageLayout( VkDevice      device,
                         nullptr,
                         1,
                         &barrier );
+}
+
+// Move mip levels [baseMipLevel, baseMipLevel + mipLevels) of every layer
+// from oldLayout to newLayout around the copies into them
+void recordImageCopyBarrier( VkCommandBuffer commandBuffer,
+                             VkImage         image,
+                             uint32_t        baseMipLevel,
+                             uint32_t        mipLevels,
+                             uint32_t        arrayLayers,
+                             VkImageLayout   oldLayout,
+                             VkImageLayout   newLayout )
+{
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout                       = oldLayout;
+  barrier.newLayout                       = newLayout;
+  barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image                           = image;
+  barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel   = baseMipLevel;
+  barrier.subresourceRange.levelCount     = mipLevels;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount     = arrayLayers;
 
-  endSingleTimeCommands( device, queue, commandPool, commandBuffer );
+  bool toTransfer = newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcAccessMask = toTransfer ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = toTransfer ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+
+  vkCmdPipelineBarrier( commandBuffer,
+                        toTransfer ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        toTransfer ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        0,
+                        0, nullptr,
+                        0, nullptr,
+                        1, &barrier );
 }
 
-void copyImage( VkDevice      device,
-                VkQueue       queue,
-                VkCommandPool commandPool,
-                VkImage       srcImage,
-                VkImage       dstImage,
-                uint32_t      width,
-                uint32_t      height )
+// Record an upload of buffer regions into an image: mip levels
+// [baseMipLevel, baseMipLevel + mipLevels) of every layer are moved to
+// TRANSFER_DST_OPTIMAL, discarding their contents, the regions are copied,
+// and those levels are left in finalLayout. Regions may address any mix of
+// levels in that range and array layers, including block compressed ones.
+void copyBufferToImage( UploadContext&                        upload,
+                        VkBuffer                              buffer,
+                        VkImage                               image,
+                        uint32_t                              baseMipLevel,
+                        uint32_t                              mipLevels,
+                        uint32_t                              arrayLayers,
+                        const std::vector<VkBufferImageCopy>& regions,
+                        VkImageLayout                         finalLayout )
 {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands( device, commandPool );
-
-  VkImageSubresourceLayers subResource = {};
-  subResource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
-  subResource.baseArrayLayer = 0;
-  subResource.mipLevel       = 0;
-  subResource.layerCount     = 1;
-
-  VkImageCopy region = {};
-  region.srcSubresource = subResource;
-  region.dstSubresource = subResource;
-  region.srcOffset      = {0, 0, 0};
-  region.dstOffset      = {0, 0, 0};
-  region.extent.width   = width;
-  region.extent.height  = height;
-  region.extent.depth   = 1;
-
-  vkCmdCopyImage( commandBuffer,
-                  srcImage,
-                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                  dstImage,
-                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                  1,
-                  &region );
-
-  endSingleTimeCommands( device, queue, commandPool, commandBuffer );
+  recordImageCopyBarrier( upload.commandBuffer, image, baseMipLevel, mipLevels, arrayLayers,
+                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+
+  vkCmdCopyBufferToImage( upload.commandBuffer,
+                          buffer,
+                          image,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          regions.size(),
+                          regions.data() );
+
+  if ( finalLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL )
+  {
+    recordImageCopyBarrier( upload.commandBuffer, image, baseMipLevel, mipLevels, arrayLayers,
+                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout );
+  }
 }
 
+// As copyBufferToImage, but from host memory through the upload's staging
+// ring, rows of texel blocks at a time when a region does not fit. Each
+// region's bufferOffset is its offset in data, sizes holds its byte size,
+// and it covers a single layer. blockHeight is 4 for block compressed
+// formats and 1 otherwise.
+void copyHostToImage( UploadContext&                        upload,
+                      VkPhysicalDevice                      physical,
+                      const void*                           data,
+                      const std::vector<VkBufferImageCopy>& regions,
+                      const std::vector<VkDeviceSize>&      sizes,
+                      uint32_t                              blockHeight,
+                      VkImage                               image,
+                      uint32_t                              baseMipLevel,
+                      uint32_t                              mipLevels,
+                      uint32_t                              arrayLayers,
+                      VkImageLayout                         finalLayout )
+{
+  recordImageCopyBarrier( upload.commandBuffer, image, baseMipLevel, mipLevels, arrayLayers,
+                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+
+  for ( size_t r = 0; r < regions.size(); r++ )
+  {
+    const VkBufferImageCopy& region   = regions[r];
+    uint32_t                 height   = region.imageExtent.height;
+    uint32_t                 rows     = ( height + blockHeight - 1 ) / blockHeight;
+    VkDeviceSize             rowBytes = sizes[r] / rows;
+
+    for ( uint32_t row = 0; row < rows; )
+    {
+      // A split submission keeps the image in TRANSFER_DST_OPTIMAL
+      StagingRange range = upload.createStagingChunk( physical, ( rows - row ) * rowBytes, rowBytes );
+      uint32_t     count = range.size / rowBytes;
+      std::memcpy( range.data, (const char*)data + region.bufferOffset + row * rowBytes, count * rowBytes );
+
+      VkBufferImageCopy piece  = region;
+      piece.bufferOffset       = range.offset;
+      piece.bufferRowLength    = 0;
+      piece.bufferImageHeight  = 0;
+      piece.imageOffset.y     += row * blockHeight;
+      piece.imageExtent.height = std::min( count * blockHeight, height - row * blockHeight );
+      vkCmdCopyBufferToImage( upload.commandBuffer,
+                              range.buffer,
+                              image,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              1,
+                              &piece );
+      row += count;
+    }
+  }
+
+  if ( finalLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL )
+  {
+    recordImageCopyBarrier( upload.commandBuffer, image, baseMipLevel, mipLevels, arrayLayers,
+                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout );
+  }
+}
 
 #endif
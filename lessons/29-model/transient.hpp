@@ -0,0 +1,134 @@
+#ifndef __TRANSIENT_HPP__
+#define __TRANSIENT_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include "base-includes.hpp"
+#include "deleter.hpp"
+#include "buffer.hpp"
+
+// Range of the ring written by the host and read by one frame's commands
+struct TransientAllocation
+{
+  VkBuffer     buffer = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  void*        data   = nullptr;
+};
+
+// Per frame data such as uniforms, bump allocated from a persistently
+// mapped host visible buffer. The buffer is split into one region per
+// swapchain image; a region is reset in bulk once its image's frame fence
+// has signalled, so allocating is an atomic add and needs no Vulkan calls.
+// Every allocation is aligned to minUniformBufferOffsetAlignment and may be
+// bound as a dynamic uniform buffer, a vertex buffer or indirect draws.
+class TransientRing
+{
+public:
+  TransientRing( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : buffer { device, vkDestroyBuffer },
+      memory { allocator, MEMORY_CATEGORY_UNIFORM, "transient ring" },
+      device { device }
+  {
+  }
+
+  VDeleter<VkBuffer> buffer;
+  MemoryAllocation   memory;
+
+  // regionCount regions of at least regionSize bytes; the device must be
+  // idle
+  void create( VkPhysicalDevice physical, VkDeviceSize regionSize, uint32_t regionCount )
+  {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties( physical, &properties );
+
+    this->alignment   = properties.limits.minUniformBufferOffsetAlignment;
+    this->regionSize  = this->align( regionSize );
+    this->regionCount = regionCount;
+    this->region      = 0;
+    this->head        = 0;
+    this->peak        = 0;
+
+    createBuffer( this->device,
+                  physical,
+                  this->regionSize * regionCount,
+                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                  MEMORY_USAGE_DYNAMIC,
+                  this->buffer,
+                  this->memory );
+    this->data = (uint8_t*)this->memory.map();
+  }
+
+  uint32_t regions() const
+  {
+    return this->regionCount;
+  }
+
+  // Offset of the region's first allocation, for command buffers recorded
+  // ahead of the frames that fill them
+  VkDeviceSize regionOffset( uint32_t region ) const
+  {
+    return region * this->regionSize;
+  }
+
+  // Bytes allocate( size ) takes from a region, so command buffers can be
+  // recorded against where a fixed sequence of allocations will land
+  VkDeviceSize allocationSize( VkDeviceSize size ) const
+  {
+    return this->align( size );
+  }
+
+  // Start filling region; the previous frame that used it must have
+  // completed
+  void begin( uint32_t region )
+  {
+    this->peak   = std::max<VkDeviceSize>( this->peak, this->head.load() );
+    this->region = region;
+    this->head   = 0;
+  }
+
+  // Safe to call from several threads between begin calls
+  TransientAllocation allocate( VkDeviceSize size )
+  {
+    VkDeviceSize start = this->head.fetch_add( this->align( size ) );
+    if ( start + size > this->regionSize )
+    {
+      throw std::runtime_error( "Transient ring region exhausted!" );
+    }
+
+    TransientAllocation allocation;
+    allocation.buffer = this->buffer;
+    allocation.offset = this->regionOffset( this->region ) + start;
+    allocation.data   = this->data + allocation.offset;
+    return allocation;
+  }
+
+  // Most bytes any finished frame allocated
+  VkDeviceSize peakBytes() const
+  {
+    return this->peak;
+  }
+
+  VkDeviceSize capacity() const
+  {
+    return this->regionSize;
+  }
+
+private:
+  const VDeleter<VkDevice>& device;
+  uint8_t*                  data        = nullptr;
+  VkDeviceSize              alignment   = 1;
+  VkDeviceSize              regionSize  = 0;
+  uint32_t                  regionCount = 0;
+  uint32_t                  region      = 0;
+  std::atomic<VkDeviceSize> head { 0 };
+  VkDeviceSize              peak        = 0;
+
+  VkDeviceSize align( VkDeviceSize size ) const
+  {
+    return ( size + this->alignment - 1 ) / this->alignment * this->alignment;
+  }
+};
+
+#endif
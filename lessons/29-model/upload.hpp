@@ -0,0 +1,385 @@
+#ifndef __UPLOAD_HPP__
+#define __UPLOAD_HPP__
+
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "base-includes.hpp"
+#include "deleter.hpp"
+#include "buffer.hpp"
+#include "staging.hpp"
+
+// Running totals across every submission of an upload context
+struct UploadStats
+{
+  VkDeviceSize directBytes   = 0; // Written by the host straight into device local memory
+  VkDeviceSize stagedBytes   = 0; // Staged and copied on the GPU
+  VkDeviceSize importedBytes = 0; // Copied on the GPU straight from imported file mappings
+  uint32_t     submissions   = 0;
+  uint32_t     splits        = 0; // Submissions made early to reclaim staging ring space
+  uint32_t     ringMisses    = 0; // Staging buffers allocated because a range exceeded the ring
+};
+
+// A device local buffer being filled through data. Staged writes are copied
+// into buffer once finishBufferWrite records the copy.
+struct BufferWrite
+{
+  void*                 data          = nullptr;
+  VkBuffer              buffer        = VK_NULL_HANDLE;
+  VkBuffer              staging       = VK_NULL_HANDLE; // Null when written directly or in host memory
+  VkDeviceSize          stagingOffset = 0;
+  VkDeviceSize          size          = 0;
+  std::shared_ptr<void> source;                         // Holds the staging range or host memory
+};
+
+// Collects one-time copies, barriers and setup work from any number of
+// resources into a single command buffer that is submitted once and
+// signals a fence. Objects the recorded commands still reference, such as
+// staging buffers, are owned by the context and released when the
+// submission retires.
+struct UploadContext
+{
+  UploadContext( const VDeleter<VkDevice>& device, DeviceMemoryAllocator& allocator )
+    : device    { device },
+      allocator { allocator },
+      fence     { device, vkDestroyFence }
+  {
+  }
+
+  ~UploadContext()
+  {
+    this->wait();
+    if ( this->commandBuffer != VK_NULL_HANDLE )
+    {
+      vkFreeCommandBuffers( this->device, this->commandPool, 1, &this->commandBuffer );
+    }
+  }
+
+  // Stage through ring from now on. With a queue, a recording that has
+  // filled the ring is submitted and waited for early to make room.
+  void useStagingRing( StagingRing& ring, VkQueue queue )
+  {
+    this->ring      = &ring;
+    this->ringQueue = queue;
+  }
+
+  const VDeleter<VkDevice>&          device;
+  DeviceMemoryAllocator&             allocator;
+  VDeleter<VkFence>                  fence;
+  VkCommandPool                      commandPool   = VK_NULL_HANDLE;
+  VkCommandBuffer                    commandBuffer = VK_NULL_HANDLE;
+  bool                               pending       = false;
+  VkDeviceSize                       stagedBytes   = 0;
+  std::vector<std::shared_ptr<void>> owned;
+  UploadStats                        stats;
+
+  // Bytes of host visible device local memory that may still be written
+  // directly; 0 sends everything through staging
+  VkDeviceSize                       directBudget  = 0;
+
+  void begin( VkCommandPool commandPool )
+  {
+    if ( this->commandBuffer != VK_NULL_HANDLE )
+    {
+      throw std::runtime_error( "Upload context is already recording!" );
+    }
+
+    this->commandPool   = commandPool;
+    this->commandBuffer = beginSingleTimeCommands( this->device, commandPool );
+    this->stagedBytes   = 0;
+  }
+
+  // Create an object that lives until the submission retires
+  template < typename T >
+  VDeleter<T>& own( std::function<void( VkDevice, T, VkAllocationCallbacks* )> deletef )
+  {
+    auto object = std::make_shared<VDeleter<T>>( this->device, deletef );
+    this->owned.push_back( object );
+    return *object;
+  }
+
+  MemoryAllocation& ownMemory( MemoryCategory category, const std::string& name )
+  {
+    auto memory = std::make_shared<MemoryAllocation>( this->allocator, category, name );
+    this->owned.push_back( memory );
+    return *memory;
+  }
+
+  // Host visible, mapped source range for this submission, from the
+  // staging ring when it fits. The copy reading it must be recorded before
+  // anything else is staged, which may split the submission.
+  StagingRange createStagingBuffer( VkPhysicalDevice physical, VkDeviceSize size )
+  {
+    StagingRange range;
+    if ( !this->ring || size > this->ring->capacity() || !this->stageFromRing( size, size, range ) )
+    {
+      this->stats.ringMisses += this->ring ? 1 : 0;
+
+      VDeleter<VkBuffer>& buffer = this->own<VkBuffer>( vkDestroyBuffer );
+      MemoryAllocation&   memory = this->ownMemory( MEMORY_CATEGORY_STAGING, "staging buffer" );
+      createBuffer( this->device,
+                    physical,
+                    size,
+                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                    MEMORY_USAGE_UPLOAD,
+                    buffer,
+                    memory );
+      range.buffer = buffer;
+      range.size   = size;
+      range.data   = memory.map();
+    }
+    else
+    {
+      this->owned.push_back( this->holdRange( range ) );
+    }
+
+    this->stagedBytes += size;
+    return range;
+  }
+
+  // Next piece of an upload too large to stage at once: at most size bytes,
+  // a multiple of granularity unless it is all of size. Like
+  // createStagingBuffer, its copy must be recorded before the next call.
+  StagingRange createStagingChunk( VkPhysicalDevice physical, VkDeviceSize size, VkDeviceSize granularity )
+  {
+    StagingRange range;
+    if ( this->ring && this->stageFromRing( size, granularity, range ) )
+    {
+      this->owned.push_back( this->holdRange( range ) );
+      this->stagedBytes += range.size;
+      return range;
+    }
+    return this->createStagingBuffer( physical, size );
+  }
+
+  // Record copying size bytes of host memory into dst, a piece at a time
+  void stageBuffer( VkPhysicalDevice physical,
+                    const void*      data,
+                    VkDeviceSize     size,
+                    VkBuffer         dst,
+                    VkDeviceSize     dstOffset )
+  {
+    for ( VkDeviceSize done = 0; done < size; )
+    {
+      StagingRange range = this->createStagingChunk( physical, size - done, 1 );
+      std::memcpy( range.data, (const char*)data + done, range.size );
+
+      VkBufferCopy region = {};
+      region.srcOffset = range.offset;
+      region.dstOffset = dstOffset + done;
+      region.size      = range.size;
+      vkCmdCopyBuffer( this->commandBuffer, range.buffer, dst, 1, &region );
+      done += range.size;
+    }
+  }
+
+  // Create a device local buffer that the host writes in place when it fits
+  // in the direct write budget. Returns false, logging why, when the caller
+  // has to stage instead.
+  bool createDirectBuffer( VkPhysicalDevice          physical,
+                           const char*               name,
+                           VkDeviceSize              size,
+                           VkBufferUsageFlags        usage,
+                           VDeleter<VkBuffer>&       buffer,
+                           MemoryAllocation&         memory,
+                           void**                    data )
+  {
+    const char* reason = nullptr;
+    if ( this->directBudget == 0 )
+    {
+      reason = "no host visible device local memory";
+    }
+    else if ( size > this->directBudget )
+    {
+      reason = "direct write budget exhausted";
+    }
+    else if ( !tryCreateBuffer( this->device, physical, size, usage,
+                                MEMORY_USAGE_DIRECT_WRITE, buffer, memory ) )
+    {
+      reason = "allocation failed";
+    }
+
+    if ( reason )
+    {
+      std::cout << "Upload: " << name << " (" << size << " bytes) staged, " << reason << std::endl;
+      return false;
+    }
+
+    *data = memory.map();
+    this->directBudget      -= size;
+    this->stats.directBytes += size;
+    std::cout << "Upload: " << name << " (" << size << " bytes) written directly" << std::endl;
+    return true;
+  }
+
+  // Create a device local buffer for the caller to fill through the
+  // returned write, either in place, in a range of the staging ring or,
+  // when larger than the ring, in host memory staged piece by piece
+  BufferWrite beginBufferWrite( VkPhysicalDevice          physical,
+                                const char*               name,
+                                VkDeviceSize              size,
+                                VkBufferUsageFlags        usage,
+                                VDeleter<VkBuffer>&       buffer,
+                                MemoryAllocation&         memory )
+  {
+    BufferWrite write;
+    write.size = size;
+    if ( !this->createDirectBuffer( physical, name, size, usage, buffer, memory, &write.data ) )
+    {
+      createBuffer( this->device,
+                    physical,
+                    size,
+                    usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    MEMORY_USAGE_GPU_ONLY,
+                    buffer,
+                    memory );
+
+      // The range stays out of owned until its copy is recorded, so other
+      // uploads splitting the submission in the meantime keep it
+      StagingRange range;
+      if ( this->ring && size <= this->ring->capacity() && this->stageFromRing( size, size, range ) )
+      {
+        write.staging       = range.buffer;
+        write.stagingOffset = range.offset;
+        write.data          = range.data;
+        write.source        = this->holdRange( range );
+        this->stagedBytes  += size;
+      }
+      else
+      {
+        auto host    = std::make_shared<std::vector<char>>( size );
+        write.data   = host->data();
+        write.source = host;
+      }
+    }
+    write.buffer = buffer;
+    return write;
+  }
+
+  // Record the copy of a staged write and hand its source over to the
+  // submission. Direct writes become visible to the device when the
+  // submission starts.
+  void finishBufferWrite( VkPhysicalDevice physical, BufferWrite& write )
+  {
+    if ( write.staging != VK_NULL_HANDLE )
+    {
+      VkBufferCopy region = {};
+      region.srcOffset = write.stagingOffset;
+      region.dstOffset = 0;
+      region.size      = write.size;
+      vkCmdCopyBuffer( this->commandBuffer, write.staging, write.buffer, 1, &region );
+      this->owned.push_back( std::move( write.source ) );
+    }
+    else if ( write.source )
+    {
+      this->stageBuffer( physical, write.data, write.size, write.buffer, 0 );
+      write.source.reset();
+    }
+  }
+
+  void submit( VkQueue queue )
+  {
+    vkEndCommandBuffer( this->commandBuffer );
+
+    if ( this->fence == VK_NULL_HANDLE )
+    {
+      VkFenceCreateInfo fenceInfo = {};
+      fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+      if ( vkCreateFence( this->device, &fenceInfo, nullptr, &this->fence ) != VK_SUCCESS )
+      {
+        throw std::runtime_error( "Failed to create upload fence!" );
+      }
+    }
+    else
+    {
+      VkFence fences[] = { this->fence };
+      vkResetFences( this->device, 1, fences );
+    }
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers    = &this->commandBuffer;
+
+    if ( vkQueueSubmit( queue, 1, &submitInfo, this->fence ) != VK_SUCCESS )
+    {
+      throw std::runtime_error( "Failed to submit upload command buffer!" );
+    }
+
+    this->pending = true;
+    this->stats.stagedBytes += this->stagedBytes;
+    this->stats.submissions++;
+  }
+
+  // Returns true once the submission has finished, releasing its resources
+  bool poll()
+  {
+    if ( this->pending && vkGetFenceStatus( this->device, this->fence ) == VK_SUCCESS )
+    {
+      this->retire();
+    }
+
+    return !this->pending;
+  }
+
+  void wait()
+  {
+    if ( this->pending )
+    {
+      VkFence fences[] = { this->fence };
+      vkWaitForFences( this->device, 1, fences, VK_TRUE, std::numeric_limits<uint64_t>::max() );
+      this->retire();
+    }
+  }
+
+  // Submit and wait, for uploads recorded outside initialization
+  void flush( VkQueue queue )
+  {
+    this->submit( queue );
+    this->wait();
+  }
+
+private:
+  StagingRing* ring      = nullptr;
+  VkQueue      ringQueue = VK_NULL_HANDLE;
+
+  // Take a range from the ring, first submitting what is recorded so far
+  // and waiting for it if that is what holds the space
+  bool stageFromRing( VkDeviceSize size, VkDeviceSize granularity, StagingRange& range )
+  {
+    if ( this->ring->allocateUpTo( size, granularity, range ) )
+    {
+      return true;
+    }
+    if ( this->ringQueue == VK_NULL_HANDLE || this->commandBuffer == VK_NULL_HANDLE || this->owned.empty() )
+    {
+      return false;
+    }
+
+    VkCommandPool commandPool = this->commandPool;
+    this->flush( this->ringQueue );
+    this->begin( commandPool );
+    this->stats.splits++;
+    return this->ring->allocateUpTo( size, granularity, range );
+  }
+
+  // Returns the range to the ring when the holder goes
+  std::shared_ptr<void> holdRange( const StagingRange& range )
+  {
+    StagingRing* ring = this->ring;
+    return std::shared_ptr<void>( nullptr, [ring, range]( void* ) { ring->release( range ); } );
+  }
+
+  void retire()
+  {
+    vkFreeCommandBuffers( this->device, this->commandPool, 1, &this->commandBuffer );
+    this->commandBuffer = VK_NULL_HANDLE;
+    this->pending       = false;
+    this->owned.clear();
+  }
+};
+
+#endif
@@ -8,6 +8,7 @@ struct Vertex
   glm::vec3 pos;
   glm::vec3 color;
   glm::vec2 texCoord;
+  float     textureLayer; // Into the texture array
 
   static VkVertexInputBindingDescription getBindingDescription(  )
   {
@@ -19,9 +20,9 @@ struct Vertex
     return bindingDescription;
   }
 
-  static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions(  )
+  static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions(  )
   {
-    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+    std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions = {};
 
     attributeDescriptions[0].binding  = 0;
     attributeDescriptions[0].location = 0;
@@ -38,6 +39,11 @@ struct Vertex
     attributeDescriptions[2].format   = VK_FORMAT_R32G32_SFLOAT;
     attributeDescriptions[2].offset   = offsetof( Vertex, texCoord );
 
+    attributeDescriptions[3].binding  = 0;
+    attributeDescriptions[3].location = 3;
+    attributeDescriptions[3].format   = VK_FORMAT_R32_SFLOAT;
+    attributeDescriptions[3].offset   = offsetof( Vertex, textureLayer );
+
     return attributeDescriptions;
   }
 
@@ -45,7 +51,8 @@ struct Vertex
   {
     return this->pos == other.pos &&
            this->color == other.color &&
-           this->texCoord == other.texCoord;
+           this->texCoord == other.texCoord &&
+           this->textureLayer == other.textureLayer;
   }
 };
 
@@ -57,7 +64,8 @@ namespace std
     {
       return ( ( hash<glm::vec3>()( vertex.pos ) ^
                  ( hash<glm::vec3>()( vertex.color ) << 1 )) >> 1 ) ^
-             ( hash<glm::vec2>()( vertex.texCoord ) << 1 );
+             ( hash<glm::vec2>()( vertex.texCoord ) << 1 ) ^
+             hash<float>()( vertex.textureLayer );
     }
   };
 }
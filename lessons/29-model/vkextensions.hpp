@@ -37,6 +37,42 @@ bool checkDeviceExtensionSupport( VkPhysicalDevice device )
   return true;
 }
 
+bool instanceExtensionSupported( const char* name )
+{
+  uint32_t extensionCount;
+  vkEnumerateInstanceExtensionProperties( nullptr, &extensionCount, nullptr );
+  std::vector<VkExtensionProperties> availableExtensions( extensionCount );
+  vkEnumerateInstanceExtensionProperties( nullptr, &extensionCount, availableExtensions.data() );
+
+  for ( const auto& ext : availableExtensions )
+  {
+    if ( std::strcmp( ext.extensionName, name ) == 0 )
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool deviceExtensionSupported( VkPhysicalDevice device, const char* name )
+{
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties( device, nullptr, &extensionCount, nullptr );
+  std::vector<VkExtensionProperties> availableExtensions( extensionCount );
+  vkEnumerateDeviceExtensionProperties( device, nullptr, &extensionCount, availableExtensions.data() );
+
+  for ( const auto& ext : availableExtensions )
+  {
+    if ( std::strcmp( ext.extensionName, name ) == 0 )
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 VkResult CreateDebugReportCallbackEXT(
   VkInstance                                instance,
   const VkDebugReportCallbackCreateInfoEXT* pCreateInfo,